@@ -47,7 +47,7 @@
 /* This sets FAT/FAT32 label. Exactly 11 characters, all caps. */
 
 
-#define FF_USE_FASTSEEK	0
+#define FF_USE_FASTSEEK	1
 /* This option switches fast seek function. (0:Disable or 1:Enable) */
 
 #define FF_FASTFS 0
@@ -62,7 +62,7 @@
 /* This option switches support for the first GPT partition. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_EXPAND	0
+#define FF_USE_EXPAND	1
 /* This option switches f_expand function. (0:Disable or 1:Enable) */
 
 
@@ -0,0 +1,206 @@
+/*
+ * Cortex-A57 CPU0 as co-processor for the BPMP
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <soc/bpmp.h>
+#include <soc/ccplex.h>
+#include <soc/ccplex_worker.h>
+#include <soc/timer.h>
+
+#define CCPLEX_WORKER_READY      0x4B524F57 // WORK.
+#define CCPLEX_WORKER_BOOT_US    100000
+#define CCPLEX_WORKER_JOB_US     100000     // 64KB take well below 1ms.
+
+#define CCPLEX_WORKER_OP_CRC32   1
+
+#define CCPLEX_WORKER_CODE_WORDS 37
+
+typedef struct _ccplex_worker_mbox_t
+{
+	vu32 state;  // Worker: CCPLEX_WORKER_READY once running.
+	vu32 req;    // BPMP: sequence of the posted job.
+	vu32 ack;    // Worker: sequence of the finished job.
+	vu32 op;
+	vu32 addr;
+	vu32 size;
+	vu32 arg;
+	vu32 res;
+	vu32 status; // 0: OK.
+} ccplex_worker_mbox_t;
+
+/*
+ * Runs at EL3 with the MMU off, so all data accesses are uncached and the
+ * mailbox and buffers need no maintenance on that side. The BPMP cache is write
+ * through, it only has to drop its lines before reading the results.
+ * The mailbox follows the code, the worker finds it PC relative.
+ */
+typedef struct _ccplex_worker_t
+{
+	u32 code[CCPLEX_WORKER_CODE_WORDS];
+	ccplex_worker_mbox_t mbox;
+} ccplex_worker_t;
+
+static ccplex_worker_t worker __attribute__((aligned(64))) = {
+	.code = {
+		0xD53E1000, // 0x00: MRS    X0, SCTLR_EL3
+		0xB2740000, // 0x04: ORR    X0, X0, #0x1000      // I-cache on.
+		0xD51E1000, // 0x08: MSR    SCTLR_EL3, X0
+		0xD5033FDF, // 0x0C: ISB
+		0x10000434, // 0x10: ADR    X20, mbox
+		0x180003E0, // 0x14: LDR    W0, =CCPLEX_WORKER_READY
+		0xB9000280, // 0x18: STR    W0, [X20]            // state.
+		0xB9400680, // 0x1C: LDR    W0, [X20, #4]        // wait: req.
+		0xB9400A81, // 0x20: LDR    W1, [X20, #8]        // ack.
+		0x6B01001F, // 0x24: CMP    W0, W1
+		0x54FFFFA0, // 0x28: B.EQ   wait
+		0xD5033FBF, // 0x2C: DMB    SY
+		0xB9400E82, // 0x30: LDR    W2, [X20, #12]       // op.
+		0xB9401283, // 0x34: LDR    W3, [X20, #16]       // addr.
+		0xB9401684, // 0x38: LDR    W4, [X20, #20]       // size.
+		0xB9401A85, // 0x3C: LDR    W5, [X20, #24]       // arg.
+		0x52800026, // 0x40: MOV    W6, #1
+		0x2A040067, // 0x44: ORR    W7, W3, W4
+		0x72000CFF, // 0x48: TST    W7, #0xF
+		0x540001A1, // 0x4C: B.NE   done
+		0x2A2503E5, // 0x50: MVN    W5, W5
+		0x7100045F, // 0x54: CMP    W2, #CCPLEX_WORKER_OP_CRC32
+		0x54000141, // 0x58: B.NE   done
+		0x340000C4, // 0x5C: CBZ    W4, crc_done         // crc.
+		0xA8C11C66, // 0x60: LDP    X6, X7, [X3], #16
+		0x9AC64CA5, // 0x64: CRC32X W5, W5, X6
+		0x9AC74CA5, // 0x68: CRC32X W5, W5, X7
+		0x71004084, // 0x6C: SUBS   W4, W4, #16
+		0x17FFFFFB, // 0x70: B      crc
+		0x2A2503E5, // 0x74: MVN    W5, W5               // crc_done.
+		0xB9001E85, // 0x78: STR    W5, [X20, #28]       // res.
+		0x52800006, // 0x7C: MOV    W6, #0
+		0xB9002286, // 0x80: STR    W6, [X20, #32]       // done: status.
+		0xD5033FBF, // 0x84: DMB    SY
+		0xB9000A80, // 0x88: STR    W0, [X20, #8]        // ack = req.
+		0x17FFFFE4, // 0x8C: B      wait
+		CCPLEX_WORKER_READY, // 0x90
+	}
+};
+
+static bool worker_running = false;
+static bool worker_failed  = false; // Not retried until stopped.
+static bool worker_busy    = false;
+static u32  worker_seq     = 0;
+
+static void _ccplex_worker_post(u32 op, u32 addr, u32 size, u32 arg)
+{
+	ccplex_worker_mbox_t *mbox = &worker.mbox;
+
+	mbox->op   = op;
+	mbox->addr = addr;
+	mbox->size = size;
+	mbox->arg  = arg;
+	bpmp_mmu_maintenance(BPMP_MMU_MAINT_CLEAN_WAY, false);
+
+	mbox->req = ++worker_seq;
+	bpmp_mmu_maintenance(BPMP_MMU_MAINT_CLEAN_WAY, false);
+
+	worker_busy = true;
+}
+
+bool ccplex_worker_start()
+{
+	if (worker_running)
+		return true;
+
+	if (worker_failed)
+		return false;
+
+	memset(&worker.mbox, 0, sizeof(ccplex_worker_mbox_t));
+	worker_seq  = 0;
+	worker_busy = false;
+	bpmp_mmu_maintenance(BPMP_MMU_MAINT_CLEAN_WAY, false);
+
+	ccplex_boot_cpu0((u32)worker.code, false);
+
+	u32 timeout = get_tmr_us() + CCPLEX_WORKER_BOOT_US;
+	while (true)
+	{
+		bpmp_mmu_maintenance(BPMP_MMU_MAINT_INVALID_WAY, false);
+		if (worker.mbox.state == CCPLEX_WORKER_READY)
+			break;
+
+		if (get_tmr_us() > timeout)
+		{
+			ccplex_powergate_cpu0();
+			worker_failed = true;
+
+			return false;
+		}
+
+		usleep(100);
+	}
+
+	worker_running = true;
+
+	return true;
+}
+
+void ccplex_worker_stop()
+{
+	if (worker_running)
+		ccplex_powergate_cpu0();
+
+	worker_running = false;
+	worker_failed  = false;
+	worker_busy    = false;
+}
+
+bool ccplex_worker_crc32_start(const void *buf, u32 size, u32 crc)
+{
+	if (!worker_running || worker_busy || (((u32)buf | size) & (CCPLEX_WORKER_ALIGN - 1)))
+		return false;
+
+	_ccplex_worker_post(CCPLEX_WORKER_OP_CRC32, (u32)buf, size, crc);
+
+	return true;
+}
+
+bool ccplex_worker_wait(u32 *res)
+{
+	if (!worker_busy)
+		return false;
+
+	u32 timeout = get_tmr_us() + CCPLEX_WORKER_JOB_US;
+	while (true)
+	{
+		bpmp_mmu_maintenance(BPMP_MMU_MAINT_INVALID_WAY, false);
+		if (worker.mbox.ack == worker_seq)
+			break;
+
+		// A hung worker is not used again until the next start.
+		if (get_tmr_us() > timeout)
+		{
+			ccplex_powergate_cpu0();
+			worker_running = false;
+			worker_failed  = true;
+			worker_busy    = false;
+
+			return false;
+		}
+	}
+
+	worker_busy = false;
+	*res = worker.mbox.res;
+
+	return !worker.mbox.status;
+}
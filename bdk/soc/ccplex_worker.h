@@ -0,0 +1,36 @@
+/*
+ * Cortex-A57 CPU0 as co-processor for the BPMP
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CCPLEX_WORKER_H_
+#define _CCPLEX_WORKER_H_
+
+#include <utils/types.h>
+
+#define CCPLEX_WORKER_ALIGN 16 // Buffer address and size of a job.
+
+bool ccplex_worker_start();
+void ccplex_worker_stop();
+
+/*
+ * Split-phase jobs, one at a time. Start returns false if the worker is not up
+ * or the buffer is not aligned, wait returns false if the job failed. The CRC32
+ * is the one of zlib and crc32_calc(), crc is the CRC of the data before.
+ * The buffer must not be written until the job is done.
+ */
+bool ccplex_worker_crc32_start(const void *buf, u32 size, u32 crc);
+bool ccplex_worker_wait(u32 *res);
+
+#endif
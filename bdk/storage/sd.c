@@ -22,12 +22,6 @@
 #include <libs/fatfs/ff.h>
 #include <mem/heap.h>
 
-#ifndef BDK_SDMMC_UHS_DDR200_SUPPORT
-#define SD_DEFAULT_SPEED SD_UHS_SDR104
-#else
-#define SD_DEFAULT_SPEED SD_UHS_DDR208
-#endif
-
 static bool sd_mounted = false;
 static bool sd_init_done = false;
 static bool insertion_event = false;
@@ -177,6 +171,15 @@ bool sd_initialize(bool power_cycle)
 	return false;
 }
 
+// Power cycles the card into the given mode, lower ones are tried like in sd_initialize().
+// Brings a card back up after the retry path stepped it down.
+bool sd_reinit_mode(u32 mode)
+{
+	sd_mode = MIN(mode, SD_DEFAULT_SPEED);
+
+	return sd_initialize(true);
+}
+
 bool sd_mount()
 {
 	if (sd_init_done && sd_mounted)
@@ -198,8 +201,10 @@ bool sd_mount()
 	}
 	else
 	{
+#ifdef BDK_FS_BACKUP_SUPPORT
 		if (!sd_mounted)
-			// res = f_mount(&sd_fs, "0:", 1); // Volume 0 is SD.
+			res = f_mount(&sd_fs, "0:", 1); // Volume 0 is SD.
+#endif
 		if (res == FR_OK)
 		{
 			sd_mounted = true;
@@ -226,10 +231,15 @@ static void _sd_deinit(bool deinit)
 
 	if (sd_init_done)
 	{
+#ifdef BDK_FS_BACKUP_SUPPORT
 		if (sd_mounted)
-			// f_mount(NULL, "0:", 1); // Volume 0 is SD.
+			f_mount(NULL, "0:", 1); // Volume 0 is SD.
 
 		if (deinit)
+#else
+		// Without FatFs the card stays powered unless it was mounted, as it always did.
+		if (sd_mounted && deinit)
+#endif
 		{
 			sdmmc_storage_end(&sd_storage);
 			sd_init_done = false;
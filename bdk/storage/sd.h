@@ -37,6 +37,12 @@ enum
 
 };
 
+#ifndef BDK_SDMMC_UHS_DDR200_SUPPORT
+#define SD_DEFAULT_SPEED SD_UHS_SDR104
+#else
+#define SD_DEFAULT_SPEED SD_UHS_DDR208
+#endif
+
 enum
 {
 	SD_ERROR_INIT_FAIL = 0,
@@ -56,6 +62,7 @@ bool sd_get_card_mounted();
 u32  sd_get_mode();
 int  sd_init_retry(bool power_cycle);
 bool sd_initialize(bool power_cycle);
+bool sd_reinit_mode(u32 mode);
 bool sd_mount();
 void sd_unmount();
 void sd_end();
@@ -373,6 +373,127 @@ int sdmmc_storage_write(sdmmc_storage_t *storage, u32 sector, u32 num_sectors, v
 	// return _sdmmc_storage_readwrite(storage, sector, num_sectors, tmp_buf, 1);
 }
 
+/*
+ * Starts a multi block read or write and returns while the DMA runs, so a
+ * transfer on the other controller can overlap it. Up to 0xFFFF sectors, no
+ * retries: after an error, sdmmc_storage_read/write retry and reinit the card.
+ */
+int sdmmc_storage_xfer_start(sdmmc_storage_t *storage, sdmmc_storage_xfer_t *xfer, u32 sector, u32 num_sectors, void *buf, u32 is_write)
+{
+	u32 tmp = 0;
+
+	// Exit if not initialized or not SDMMC DMA aligned.
+	if (!storage->initialized || !buf || ((u32)buf % 8) || !num_sectors || num_sectors > 0xFFFF)
+		return 0;
+
+	// If SDSC convert block address to byte address.
+	if (!storage->has_sector_access)
+		sector <<= 9;
+
+	sdmmc_init_cmd(&xfer->cmd, is_write ? MMC_WRITE_MULTIPLE_BLOCK : MMC_READ_MULTIPLE_BLOCK, sector, SDMMC_RSP_TYPE_1, 0);
+
+	xfer->req.buf              = buf;
+	xfer->req.num_sectors      = num_sectors;
+	xfer->req.blksize          = SDMMC_DAT_BLOCKSIZE;
+	xfer->req.is_write         = is_write;
+	xfer->req.is_multi_block   = 1;
+	xfer->req.is_auto_stop_trn = 1;
+
+	if (!sdmmc_execute_cmd_start(storage->sdmmc, &xfer->cmd, &xfer->req, NULL))
+	{
+		sdmmc_stop_transmission(storage->sdmmc, &tmp);
+		_sdmmc_storage_get_status(storage, &tmp, 0);
+
+		return 0;
+	}
+
+	return 1;
+}
+
+int sdmmc_storage_xfer_wait(sdmmc_storage_t *storage, sdmmc_storage_xfer_t *xfer)
+{
+	u32 tmp = 0;
+
+	if (!sdmmc_execute_cmd_finish(storage->sdmmc, &xfer->cmd, &xfer->req))
+	{
+		sdmmc_stop_transmission(storage->sdmmc, &tmp);
+		_sdmmc_storage_get_status(storage, &tmp, 0);
+
+		return 0;
+	}
+
+	return 1;
+}
+
+static int _sdmmc_storage_erase_ex(sdmmc_storage_t *storage, u32 sector, u32 num_sectors)
+{
+	u32 resp;
+	bool is_sd = storage->sdmmc->id == SDMMC_1;
+	u32 end = sector + num_sectors - 1;
+
+	// If SDSC convert block address to byte address.
+	if (!storage->has_sector_access)
+	{
+		sector <<= 9;
+		end <<= 9;
+	}
+
+	if (!_sdmmc_storage_execute_cmd_type1(storage, is_sd ? SD_ERASE_WR_BLK_START : MMC_ERASE_GROUP_START, sector, 0, R1_STATE_TRAN))
+		return 0;
+
+	if (!_sdmmc_storage_execute_cmd_type1(storage, is_sd ? SD_ERASE_WR_BLK_END : MMC_ERASE_GROUP_END, end, 0, R1_STATE_TRAN))
+		return 0;
+
+	// Busy can take longer than the driver waits for R1b, so poll the state instead.
+	if (!_sdmmc_storage_execute_cmd_type1_ex(storage, &resp, MMC_ERASE, is_sd ? 0 : MMC_TRIM_ARG, 0, R1_SKIP_STATE_CHECK, 0))
+		return 0;
+
+	u32 timeout = get_tmr_ms() + SDMMC_ERASE_TIMEOUT_MS;
+	while (true)
+	{
+		if (_sdmmc_storage_execute_cmd_type1_ex(storage, &resp, MMC_SEND_STATUS, storage->rca << 16, 0, R1_SKIP_STATE_CHECK, 0) &&
+			R1_CURRENT_STATE(resp) == R1_STATE_TRAN)
+			return 1;
+
+		if (get_tmr_ms() > timeout)
+			return 0;
+
+		msleep(1);
+	}
+}
+
+/*
+ * Erases (SD) or trims (eMMC) sectors, so they read back as zeros.
+ * Returns 0 if the card does not support that, the caller has to write zeros then.
+ */
+int sdmmc_storage_erase(sdmmc_storage_t *storage, u32 sector, u32 num_sectors)
+{
+	// Exit if not initialized.
+	if (!storage->initialized)
+		return 0;
+
+	if (storage->sdmmc->id == SDMMC_1)
+	{
+		if (storage->scr.erase_val)
+			return 0;
+	}
+	else if (storage->ext_csd.erased_mem_cont || !(storage->ext_csd.sec_feature & EXT_CSD_SEC_GB_CL_EN))
+		return 0;
+
+	while (num_sectors)
+	{
+		u32 cnt = MIN(num_sectors, SDMMC_ERASE_MAX_SECTORS);
+
+		if (!_sdmmc_storage_erase_ex(storage, sector, cnt))
+			return 0;
+
+		sector += cnt;
+		num_sectors -= cnt;
+	}
+
+	return 1;
+}
+
 /*
 * MMC specific functions.
 */
@@ -518,6 +639,9 @@ static void _mmc_storage_parse_ext_csd(sdmmc_storage_t *storage, u8 *buf)
 									(buf[EXT_CSD_MAX_ENH_SIZE_MULT + 2] << 16)) *
 									 buf[EXT_CSD_HC_WP_GRP_SIZE] * buf[EXT_CSD_HC_ERASE_GRP_SIZE];
 
+	storage->ext_csd.erased_mem_cont = buf[EXT_CSD_ERASED_MEM_CONT];
+	storage->ext_csd.sec_feature     = buf[EXT_CSD_SEC_FEATURE_SUPPORT];
+
 	storage->sec_cnt = *(u32 *)&buf[EXT_CSD_SEC_CNT];
 }
 
@@ -729,7 +853,7 @@ int sdmmc_storage_init_mmc(sdmmc_storage_t *storage, sdmmc_t *sdmmc, u32 bus_wid
 		return 0;
 	DPRINTF("[MMC] switched buswidth\n");
 
-	if (!mmc_storage_get_ext_csd(storage, (u8 *)SDMMC_UPPER_BUFFER))
+	if (!mmc_storage_get_ext_csd(storage, (u8 *)SDMMC_INIT_BUF_ADDR))
 		return 0;
 	DPRINTF("[MMC] got ext_csd\n");
 
@@ -1052,6 +1176,7 @@ static void _sd_storage_parse_scr(sdmmc_storage_t *storage)
 
 	storage->scr.sda_vsn = unstuff_bits(resp, 56, 4);
 	storage->scr.bus_widths = unstuff_bits(resp, 48, 4);
+	storage->scr.erase_val = unstuff_bits(resp, 55, 1);
 
 	/* If v2.0 is supported, check if Physical Layer Spec v3.0 is supported */
 	if (storage->scr.sda_vsn == SCR_SPEC_VER_2)
@@ -1307,7 +1432,7 @@ static int _sd_storage_set_card_bus_speed(sdmmc_storage_t *storage, u32 hs_type,
 int sd_storage_get_fmodes(sdmmc_storage_t *storage, u8 *buf, sd_func_modes_t *fmodes)
 {
 	if (!buf)
-		buf = (u8 *)SDMMC_UPPER_BUFFER;
+		buf = (u8 *)SDMMC_INIT_BUF_ADDR;
 
 	if (!_sd_storage_switch_get(storage, buf))
 		return 0;
@@ -1652,7 +1777,7 @@ int sdmmc_storage_init_sd(sdmmc_storage_t *storage, sdmmc_t *sdmmc, u32 bus_widt
 {
 	u32  tmp = 0;
 	int  is_sdsc = 0;
-	u8  *buf = (u8 *)SDMMC_UPPER_BUFFER;
+	u8  *buf = (u8 *)SDMMC_INIT_BUF_ADDR;
 	bool bus_uhs_support = _sdmmc_storage_get_bus_uhs_support(bus_width, type);
 
 	DPRINTF("[SD]-[init: bus: %d, type: %d]\n", bus_width, type);
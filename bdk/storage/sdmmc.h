@@ -25,12 +25,16 @@
 #define SDMMC_CMD_BLOCKSIZE 64
 #define SDMMC_DAT_BLOCKSIZE 512
 
+#define SDMMC_ERASE_MAX_SECTORS (SZ_1G / SDMMC_DAT_BLOCKSIZE) // Per erase command.
+#define SDMMC_ERASE_TIMEOUT_MS  60000
+
 extern u32 sd_power_cycle_time_start;
 
 typedef enum _sdmmc_type
 {
-	MMC_SD   = 0,
-	MMC_EMMC = 1,
+	MMC_SD      = 0,
+	MMC_EMMC    = 1,
+	MMC_RAMDISK = 2, // DRAM backed, not an actual SDMMC device.
 
 	EMMC_GPP   = 0,
 	EMMC_BOOT0 = 1,
@@ -155,6 +159,8 @@ typedef struct _mmc_ext_csd
 	u16 dev_version;
 	u32 cache_size;
 	u32 max_enh_mult;
+	u8  erased_mem_cont; /* 181 */
+	u8  sec_feature;     /* 231 */
 } mmc_ext_csd_t;
 
 typedef struct _sd_scr
@@ -163,6 +169,7 @@ typedef struct _sd_scr
 	u8 sda_spec3;
 	u8 bus_widths;
 	u8 cmds;
+	u8 erase_val; /* Data after erase */
 } sd_scr_t;
 
 typedef struct _sd_ssr
@@ -199,6 +206,13 @@ typedef struct _sdmmc_storage_t
 	sd_ssr_t      ssr;
 } sdmmc_storage_t;
 
+/*! Split read/write, see sdmmc_storage_xfer_start. */
+typedef struct _sdmmc_storage_xfer_t
+{
+	sdmmc_cmd_t cmd;
+	sdmmc_req_t req;
+} sdmmc_storage_xfer_t;
+
 typedef struct _sd_func_modes_t
 {
 	u16 access_mode;
@@ -210,6 +224,9 @@ typedef struct _sd_func_modes_t
 int  sdmmc_storage_end(sdmmc_storage_t *storage);
 int  sdmmc_storage_read(sdmmc_storage_t *storage, u32 sector, u32 num_sectors, void *buf);
 int  sdmmc_storage_write(sdmmc_storage_t *storage, u32 sector, u32 num_sectors, void *buf);
+int  sdmmc_storage_erase(sdmmc_storage_t *storage, u32 sector, u32 num_sectors);
+int  sdmmc_storage_xfer_start(sdmmc_storage_t *storage, sdmmc_storage_xfer_t *xfer, u32 sector, u32 num_sectors, void *buf, u32 is_write);
+int  sdmmc_storage_xfer_wait(sdmmc_storage_t *storage, sdmmc_storage_xfer_t *xfer);
 int  sdmmc_storage_init_mmc(sdmmc_storage_t *storage, sdmmc_t *sdmmc, u32 bus_width, u32 type);
 int  sdmmc_storage_set_mmc_partition(sdmmc_storage_t *storage, u32 partition);
 void sdmmc_storage_init_wait_sd();
@@ -1118,17 +1118,17 @@ static int _sdmmc_update_sdma(sdmmc_t *sdmmc)
 	return 0;
 }
 
-static int _sdmmc_execute_cmd_inner(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_t *req, u32 *blkcnt_out)
+// Issues the command. For data commands the transfer is left running, see _sdmmc_execute_cmd_finish.
+static int _sdmmc_execute_cmd_start(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_t *req, u32 *blkcnt_out)
 {
 	int has_req_or_check_busy = req || cmd->check_busy;
 	if (!_sdmmc_wait_cmd_data_inhibit(sdmmc, has_req_or_check_busy))
 		return 0;
 
-	u32 blkcnt = 0;
 	bool is_data_present = false;
 	if (req)
 	{
-		if (!_sdmmc_config_sdma(sdmmc, &blkcnt, req))
+		if (!_sdmmc_config_sdma(sdmmc, blkcnt_out, req))
 		{
 #ifdef ERROR_EXTRA_PRINTING
 			EPRINTFARGS("SDMMC%d: DMA Wrong cfg!", sdmmc->id + 1);
@@ -1159,25 +1159,29 @@ static int _sdmmc_execute_cmd_inner(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_
 #endif
 	DPRINTF("rsp(%d): %08X, %08X, %08X, %08X\n", result,
 		sdmmc->regs->rspreg0, sdmmc->regs->rspreg1, sdmmc->regs->rspreg2, sdmmc->regs->rspreg3);
-	if (result)
+	if (result && cmd->rsp_type)
 	{
-		if (cmd->rsp_type)
-		{
-			sdmmc->expected_rsp_type = cmd->rsp_type;
-			result = _sdmmc_cache_rsp(sdmmc, sdmmc->rsp, 0x10, cmd->rsp_type);
+		sdmmc->expected_rsp_type = cmd->rsp_type;
+		result = _sdmmc_cache_rsp(sdmmc, sdmmc->rsp, 0x10, cmd->rsp_type);
 #ifdef ERROR_EXTRA_PRINTING
-			if (!result)
-				EPRINTFARGS("SDMMC%d: Unknown response type!", sdmmc->id + 1);
+		if (!result)
+			EPRINTFARGS("SDMMC%d: Unknown response type!", sdmmc->id + 1);
 #endif
-		}
-		if (req && result)
-		{
-			result = _sdmmc_update_sdma(sdmmc);
+	}
+
+	return result;
+}
+
+// Waits for the data and busy of a command issued by _sdmmc_execute_cmd_start, result is the one of the start.
+static int _sdmmc_execute_cmd_finish(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_t *req, int result)
+{
+	if (req && result)
+	{
+		result = _sdmmc_update_sdma(sdmmc);
 #ifdef ERROR_EXTRA_PRINTING
-			if (!result)
-				EPRINTFARGS("SDMMC%d: DMA Update failed!", sdmmc->id + 1);
+		if (!result)
+			EPRINTFARGS("SDMMC%d: DMA Update failed!", sdmmc->id + 1);
 #endif
-		}
 	}
 
 	_sdmmc_mask_interrupts(sdmmc);
@@ -1189,9 +1193,6 @@ static int _sdmmc_execute_cmd_inner(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_
 			// Invalidate cache after transfer.
 			bpmp_mmu_maintenance(BPMP_MMU_MAINT_INVALID_WAY, false);
 
-			if (blkcnt_out)
-				*blkcnt_out = blkcnt;
-
 			if (req->is_auto_stop_trn)
 				sdmmc->rsp3 = sdmmc->regs->rspreg3;
 		}
@@ -1210,6 +1211,13 @@ static int _sdmmc_execute_cmd_inner(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_
 	return result;
 }
 
+static int _sdmmc_execute_cmd_inner(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_t *req, u32 *blkcnt_out)
+{
+	int result = _sdmmc_execute_cmd_start(sdmmc, cmd, req, blkcnt_out);
+
+	return _sdmmc_execute_cmd_finish(sdmmc, cmd, req, result);
+}
+
 bool sdmmc_get_sd_inserted()
 {
 	return (!gpio_read(GPIO_PORT_Z, GPIO_PIN_1));
@@ -1501,29 +1509,72 @@ void sdmmc_init_cmd(sdmmc_cmd_t *cmdbuf, u16 cmd, u32 arg, u32 rsp_type, u32 che
 	cmdbuf->check_busy = check_busy;
 }
 
-int sdmmc_execute_cmd(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_t *req, u32 *blkcnt_out)
+// Returns 1 if the card clock was off and has to be stopped again after the command.
+static int _sdmmc_cmd_clock_enable(sdmmc_t *sdmmc)
 {
-	if (!sdmmc->card_clock_enabled)
-		return 0;
-
 	// Recalibrate periodically for SDMMC1.
 	if (sdmmc->manual_cal && sdmmc->powersave_enabled)
 		_sdmmc_autocal_execute(sdmmc, sdmmc_get_io_power(sdmmc));
 
-	int should_disable_sd_clock = 0;
-	if (!(sdmmc->regs->clkcon & SDHCI_CLOCK_CARD_EN))
-	{
-		should_disable_sd_clock = 1;
-		sdmmc->regs->clkcon |= SDHCI_CLOCK_CARD_EN;
-		_sdmmc_commit_changes(sdmmc);
-		usleep((8 * 1000 + sdmmc->card_clock - 1) / sdmmc->card_clock); // Wait 8 cycles.
-	}
+	if (sdmmc->regs->clkcon & SDHCI_CLOCK_CARD_EN)
+		return 0;
 
-	int result = _sdmmc_execute_cmd_inner(sdmmc, cmd, req, blkcnt_out);
+	sdmmc->regs->clkcon |= SDHCI_CLOCK_CARD_EN;
+	_sdmmc_commit_changes(sdmmc);
+	usleep((8 * 1000 + sdmmc->card_clock - 1) / sdmmc->card_clock); // Wait 8 cycles.
+
+	return 1;
+}
+
+static void _sdmmc_cmd_clock_disable(sdmmc_t *sdmmc, int should_disable_sd_clock)
+{
 	usleep((8 * 1000 + sdmmc->card_clock - 1) / sdmmc->card_clock); // Wait 8 cycles.
 
 	if (should_disable_sd_clock)
 		sdmmc->regs->clkcon &= ~SDHCI_CLOCK_CARD_EN;
+}
+
+int sdmmc_execute_cmd(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_t *req, u32 *blkcnt_out)
+{
+	if (!sdmmc->card_clock_enabled)
+		return 0;
+
+	int should_disable_sd_clock = _sdmmc_cmd_clock_enable(sdmmc);
+
+	int result = _sdmmc_execute_cmd_inner(sdmmc, cmd, req, blkcnt_out);
+
+	_sdmmc_cmd_clock_disable(sdmmc, should_disable_sd_clock);
+
+	return result;
+}
+
+/*
+ * Split sdmmc_execute_cmd for data commands. Returns once the card has accepted
+ * the command and the DMA runs, so a transfer can be started on another
+ * controller meanwhile. After success, sdmmc_execute_cmd_finish must be called
+ * with the same cmd and req before anything else is sent to this controller.
+ */
+int sdmmc_execute_cmd_start(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_t *req, u32 *blkcnt_out)
+{
+	if (!sdmmc->card_clock_enabled)
+		return 0;
+
+	sdmmc->xfer_clock_gate = _sdmmc_cmd_clock_enable(sdmmc);
+
+	if (_sdmmc_execute_cmd_start(sdmmc, cmd, req, blkcnt_out))
+		return 1;
+
+	_sdmmc_execute_cmd_finish(sdmmc, cmd, req, 0);
+	_sdmmc_cmd_clock_disable(sdmmc, sdmmc->xfer_clock_gate);
+
+	return 0;
+}
+
+int sdmmc_execute_cmd_finish(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_t *req)
+{
+	int result = _sdmmc_execute_cmd_finish(sdmmc, cmd, req, 1);
+
+	_sdmmc_cmd_clock_disable(sdmmc, sdmmc->xfer_clock_gate);
 
 	return result;
 }
@@ -294,6 +294,7 @@ typedef struct _sdmmc_t
 	u32 rsp[4];
 	u32 rsp3;
 	int t210b01;
+	int xfer_clock_gate; // Card clock to stop after a split command.
 } sdmmc_t;
 
 /*! SDMMC command. */
@@ -331,6 +332,8 @@ int  sdmmc_init(sdmmc_t *sdmmc, u32 id, u32 power, u32 bus_width, u32 type);
 void sdmmc_end(sdmmc_t *sdmmc);
 void sdmmc_init_cmd(sdmmc_cmd_t *cmdbuf, u16 cmd, u32 arg, u32 rsp_type, u32 check_busy);
 int  sdmmc_execute_cmd(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_t *req, u32 *blkcnt_out);
+int  sdmmc_execute_cmd_start(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_t *req, u32 *blkcnt_out);
+int  sdmmc_execute_cmd_finish(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_t *req);
 int  sdmmc_enable_low_voltage(sdmmc_t *sdmmc);
 
 #endif
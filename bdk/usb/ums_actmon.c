@@ -0,0 +1,175 @@
+/*
+ * Bus and memory controller load of the UMS gadget, sampled with actmon
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <mem/mc_t210.h>
+#include <soc/actmon.h>
+#include <soc/t210.h>
+#include <soc/timer.h>
+#include <usb/ums_actmon.h>
+
+static ums_actmon_entry_t samples[UMS_ACTMON_ENTRIES];
+
+static u32 sample_idx = 0;
+static u32 sample_us  = 0; // Time of the last sample.
+static u32 cmds       = 0; // Not reset, counts like the trace sequence.
+
+// Time per combination of busy units since the last sample.
+static u32 busy       = 0;
+static u32 busy_us    = 0; // Start of the current combination.
+static u32 busy_acc[(UMS_ACTMON_SDMMC | UMS_ACTMON_USB) + 1];
+
+void ums_actmon_start()
+{
+	actmon_init();
+	actmon_dev_enable(ACTMON_DEV_AHB);
+	actmon_dev_enable(ACTMON_DEV_APB);
+	actmon_dev_enable(ACTMON_DEV_BPMP);
+	actmon_dev_enable(ACTMON_DEV_MC_ALL);
+
+	memset(busy_acc, 0, sizeof(busy_acc));
+	sample_idx = 0;
+	busy       = 0;
+	sample_us  = get_tmr_us();
+	busy_us    = sample_us;
+}
+
+void ums_actmon_end()
+{
+	actmon_dev_disable(ACTMON_DEV_AHB);
+	actmon_dev_disable(ACTMON_DEV_APB);
+	actmon_dev_disable(ACTMON_DEV_BPMP);
+	actmon_dev_disable(ACTMON_DEV_MC_ALL);
+	actmon_end();
+}
+
+static void _ums_actmon_busy_update(u32 now)
+{
+	busy_acc[busy] += now - busy_us;
+	busy_us = now;
+}
+
+void ums_actmon_busy(u32 unit, bool on)
+{
+	_ums_actmon_busy_update(get_tmr_us());
+
+	if (on)
+		busy |= unit;
+	else
+		busy &= ~unit;
+}
+
+void ums_actmon_cmd_done()
+{
+	cmds++;
+}
+
+/*
+ * Takes a sample once per period. Actmon counts in its own periods, so the loads
+ * lag the busy times by up to one period. Fine for steady transfers.
+ */
+void ums_actmon_poll()
+{
+	u32 now = get_tmr_us();
+
+	if (now - sample_us < UMS_ACTMON_PERIOD_US)
+		return;
+
+	_ums_actmon_busy_update(now);
+
+	ums_actmon_entry_t *smp = &samples[sample_idx & (UMS_ACTMON_ENTRIES - 1)];
+
+	smp->time_us   = now;
+	smp->cmds      = cmds;
+	smp->load.ahb  = actmon_dev_get_load(ACTMON_DEV_AHB);
+	smp->load.apb  = actmon_dev_get_load(ACTMON_DEV_APB);
+	smp->load.bpmp = actmon_dev_get_load(ACTMON_DEV_BPMP);
+	smp->load.mc   = actmon_dev_get_load(ACTMON_DEV_MC_ALL);
+	smp->period_us = now - sample_us;
+	smp->sdmmc_us  = busy_acc[UMS_ACTMON_SDMMC];
+	smp->usb_us    = busy_acc[UMS_ACTMON_USB];
+	smp->both_us   = busy_acc[UMS_ACTMON_SDMMC | UMS_ACTMON_USB];
+
+	memset(busy_acc, 0, sizeof(busy_acc));
+	sample_us = now;
+	sample_idx++;
+}
+
+u32 ums_actmon_total()
+{
+	return sample_idx;
+}
+
+// Average loads of the samples from sequence number first on, zero if there are none.
+void ums_actmon_avg(u32 first, ums_actmon_load_t *avg)
+{
+	u32 oldest = sample_idx - MIN(sample_idx, UMS_ACTMON_ENTRIES);
+	u32 sum[4] = { 0 };
+
+	first = MAX(first, oldest);
+	for (u32 seq = first; seq < sample_idx; seq++)
+	{
+		ums_actmon_load_t *load = &samples[seq & (UMS_ACTMON_ENTRIES - 1)].load;
+
+		sum[0] += load->ahb;
+		sum[1] += load->apb;
+		sum[2] += load->bpmp;
+		sum[3] += load->mc;
+	}
+
+	u32 count = first < sample_idx ? sample_idx - first : 0;
+	if (count)
+	{
+		for (u32 i = 0; i < 4; i++)
+			sum[i] /= count;
+	}
+
+	avg->ahb  = sum[0];
+	avg->apb  = sum[1];
+	avg->bpmp = sum[2];
+	avg->mc   = sum[3];
+}
+
+// Copies header and samples from sequence number first on, oldest first. Returns the size used.
+u32 ums_actmon_export(void *buf, u32 size, u32 first)
+{
+	ums_actmon_hdr_t *hdr = (ums_actmon_hdr_t *)buf;
+	ums_actmon_entry_t *smps = (ums_actmon_entry_t *)((u8 *)buf + sizeof(ums_actmon_hdr_t));
+
+	if (size < sizeof(ums_actmon_hdr_t))
+		return 0;
+
+	u32 oldest = sample_idx - MIN(sample_idx, UMS_ACTMON_ENTRIES);
+	if (first < oldest || first > sample_idx)
+		first = oldest;
+
+	u32 count = sample_idx - first;
+	count = MIN(count, (size - sizeof(ums_actmon_hdr_t)) / sizeof(ums_actmon_entry_t));
+
+	for (u32 i = 0; i < count; i++)
+		smps[i] = samples[(first + i) & (UMS_ACTMON_ENTRIES - 1)];
+
+	hdr->magic      = UMS_ACTMON_MAGIC;
+	hdr->entry_size = sizeof(ums_actmon_entry_t);
+	hdr->flags      = MC(MC_IRAM_BOM) == IRAM_BASE ? UMS_ACTMON_FLAG_AHB_REDIRECT : 0;
+	hdr->first      = first;
+	hdr->count      = count;
+	hdr->total      = sample_idx;
+	hdr->now_us     = get_tmr_us();
+
+	return sizeof(ums_actmon_hdr_t) + count * sizeof(ums_actmon_entry_t);
+}
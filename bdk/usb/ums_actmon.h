@@ -0,0 +1,82 @@
+/*
+ * Bus and memory controller load of the UMS gadget, sampled with actmon
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UMS_ACTMON_H_
+#define _UMS_ACTMON_H_
+
+#include <utils/types.h>
+
+#define UMS_ACTMON_ENTRIES   64 // Must be a power of 2.
+#define UMS_ACTMON_MAGIC     0x54434155 // UACT.
+#define UMS_ACTMON_PERIOD_US 20000 // Same as the actmon period.
+
+// Busy units, see ums_actmon_busy().
+#define UMS_ACTMON_SDMMC BIT(0)
+#define UMS_ACTMON_USB   BIT(1)
+
+#define UMS_ACTMON_FLAG_AHB_REDIRECT BIT(0)
+
+// Loads of the last actmon period in 0.1%, as actmon_dev_get_load().
+typedef struct _ums_actmon_load_t
+{
+	u16 ahb;
+	u16 apb;
+	u16 bpmp;
+	u16 mc;   // MC_ALL.
+} ums_actmon_load_t;
+
+/*
+ * One per period, 32 bytes. The times split the period by what was in flight:
+ * media access, a USB data transfer (from its start until it is reaped), both
+ * or neither (CBW wait, CSW and command handling).
+ */
+typedef struct _ums_actmon_entry_t
+{
+	u32 time_us;   // get_tmr_us() when sampled.
+	u32 cmds;      // Commands completed so far, the trace sequence number of the next one.
+	ums_actmon_load_t load;
+	u32 period_us; // Since the previous sample.
+	u32 sdmmc_us;  // Only media access.
+	u32 usb_us;    // Only USB data.
+	u32 both_us;
+} ums_actmon_entry_t;
+
+typedef struct _ums_actmon_hdr_t
+{
+	u32 magic;
+	u16 entry_size;
+	u16 flags;
+	u32 first;  // Sequence number of the first entry.
+	u32 count;  // Entries following the header.
+	u32 total;  // Samples taken so far.
+	u32 now_us;
+} ums_actmon_hdr_t;
+
+#ifdef BDK_UMS_ACTMON_SUPPORT
+void ums_actmon_start();
+void ums_actmon_end();
+void ums_actmon_busy(u32 unit, bool busy);
+void ums_actmon_cmd_done();
+void ums_actmon_poll();
+u32  ums_actmon_total();
+void ums_actmon_avg(u32 first, ums_actmon_load_t *avg);
+u32  ums_actmon_export(void *buf, u32 size, u32 first);
+#else
+static inline void ums_actmon_busy(u32 unit, bool busy) {}
+static inline void ums_actmon_cmd_done() {}
+#endif
+
+#endif
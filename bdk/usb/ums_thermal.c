@@ -0,0 +1,128 @@
+/*
+ * Thermal governor of the UMS gadget
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <storage/sd.h>
+#include <soc/timer.h>
+#include <thermal/fan.h>
+#include <thermal/tmp451.h>
+#include <usb/ums_thermal.h>
+
+// oC. The SD card has no sensor, the PCB is the closest.
+#define UMS_THERMAL_FAN_MAX_SOC  60
+#define UMS_THERMAL_FAN_MAX_PCB  50
+#define UMS_THERMAL_HOT_SOC      72
+#define UMS_THERMAL_HOT_PCB      58
+#define UMS_THERMAL_COOL_SOC     62
+#define UMS_THERMAL_COOL_PCB     50
+
+#define UMS_THERMAL_FAN_MAX_DUTY 235
+
+// Quiet time before a card stepped down by read/write errors is brought back up.
+#define UMS_THERMAL_RESTORE_MS     30000
+#define UMS_THERMAL_RESTORE_MAX_MS 480000
+
+typedef struct _ums_thermal_t
+{
+	bool hot;
+	bool restored;   // Mode set by the governor, no errors since.
+	u16  sd_fails;   // SD_ERROR_RW_FAIL count seen.
+	u32  fail_ms;    // When the count last changed.
+	u32  restore_ms; // Doubles when a restored mode fails again.
+	u32  sd_max;     // Mode at session start, the card may not tune higher.
+	u32  sd_want;
+} ums_thermal_t;
+
+static ums_thermal_t thermal;
+
+void ums_thermal_start()
+{
+	tmp451_init();
+
+	thermal.hot        = false;
+	thermal.restored   = false;
+	thermal.sd_fails   = sd_get_error_count()[SD_ERROR_RW_FAIL];
+	thermal.fail_ms    = get_tmr_ms();
+	thermal.restore_ms = UMS_THERMAL_RESTORE_MS;
+	thermal.sd_max     = sd_get_mode();
+	thermal.sd_want    = 0;
+}
+
+void ums_thermal_end()
+{
+	fan_set_duty(0);
+	tmp451_end();
+}
+
+void ums_thermal_poll()
+{
+	u32 now = get_tmr_ms();
+	u32 soc = tmp451_get_soc_temp(true);
+	u32 pcb = tmp451_get_pcb_temp(true);
+
+	// Docked the fan is off unless someone drives it.
+	if (soc >= UMS_THERMAL_FAN_MAX_SOC || pcb >= UMS_THERMAL_FAN_MAX_PCB)
+		fan_set_duty(UMS_THERMAL_FAN_MAX_DUTY);
+	else
+		fan_set_from_temp(soc);
+
+	if (!thermal.hot && (soc >= UMS_THERMAL_HOT_SOC || pcb >= UMS_THERMAL_HOT_PCB))
+		thermal.hot = true;
+	else if (thermal.hot && soc < UMS_THERMAL_COOL_SOC && pcb < UMS_THERMAL_COOL_PCB)
+		thermal.hot = false;
+
+	// The read/write retry path stepped the card down again.
+	u16 fails = sd_get_error_count()[SD_ERROR_RW_FAIL];
+	if (fails != thermal.sd_fails)
+	{
+		if (thermal.restored)
+			thermal.restore_ms = MIN(thermal.restore_ms * 2, UMS_THERMAL_RESTORE_MAX_MS);
+
+		thermal.sd_fails = fails;
+		thermal.fail_ms  = now;
+		thermal.restored = false;
+	}
+
+	// Hot costs one step, but never below SDR82. Going up waits for a quiet period.
+	u32 target = thermal.sd_max;
+	if (thermal.hot && target > SD_UHS_SDR82)
+		target--;
+
+	u32 mode = sd_get_mode();
+	if (target < mode || (target > mode && now - thermal.fail_ms >= thermal.restore_ms))
+		thermal.sd_want = target;
+	else
+		thermal.sd_want = 0;
+}
+
+u32 ums_thermal_sd_mode()
+{
+	return thermal.sd_want;
+}
+
+void ums_thermal_sd_done(bool ok)
+{
+	// A card that came up lower is left alone for longer.
+	ok &= sd_get_mode() >= thermal.sd_want;
+	if (!ok)
+		thermal.restore_ms = MIN(thermal.restore_ms * 2, UMS_THERMAL_RESTORE_MAX_MS);
+
+	thermal.sd_want  = 0;
+	thermal.restored = ok;
+
+	// Not again right away if the card did not come up.
+	thermal.sd_fails = sd_get_error_count()[SD_ERROR_RW_FAIL];
+	thermal.fail_ms  = get_tmr_ms();
+}
@@ -0,0 +1,35 @@
+/*
+ * Thermal governor of the UMS gadget
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UMS_THERMAL_H_
+#define _UMS_THERMAL_H_
+
+#include <utils/types.h>
+
+#define UMS_THERMAL_PERIOD_US 2000000
+
+void ums_thermal_start();
+void ums_thermal_end();
+void ums_thermal_poll();
+
+/*
+ * SD mode the governor wants, 0 if the current one is fine. Switching means a
+ * reinit of the card, so the gadget does it between commands and reports back.
+ */
+u32  ums_thermal_sd_mode();
+void ums_thermal_sd_done(bool ok);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * SCSI command trace for the UMS gadget
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <soc/timer.h>
+#include <usb/ums_trace.h>
+
+static ums_trace_entry_t trace_iram[UMS_TRACE_IRAM_ENTRIES];
+
+static ums_trace_entry_t *trace = trace_iram;
+static u32 trace_mask = UMS_TRACE_IRAM_ENTRIES - 1;
+static u32 trace_idx  = 0; // Completed commands. The current one is committed when its CSW is sent.
+
+// Moves the ring to a bigger buffer, e.g. in DRAM. Entries must be a power of 2.
+void ums_trace_set_buffer(void *buf, u32 entries)
+{
+	ums_trace_entry_t *new_trace = (ums_trace_entry_t *)buf;
+	u32 count = MIN(trace_idx, MIN(trace_mask + 1, entries));
+
+	for (u32 seq = trace_idx - count; seq != trace_idx; seq++)
+		new_trace[seq & (entries - 1)] = trace[seq & trace_mask];
+
+	trace      = new_trace;
+	trace_mask = entries - 1;
+}
+
+static inline ums_trace_entry_t *_ums_trace_cur()
+{
+	return &trace[trace_idx & trace_mask];
+}
+
+void ums_trace_cmd(u32 tag, u8 lun, const u8 *cdb)
+{
+	ums_trace_entry_t *evt = _ums_trace_cur();
+	u32 lba = 0;
+
+	switch (cdb[0] >> 5)
+	{
+	case 0: // 6 byte CDB. Only READ(6)/WRITE(6) have an LBA.
+		if (cdb[0] == 0x08 || cdb[0] == 0x0A)
+			lba = ((cdb[1] & 0x1F) << 16) | (cdb[2] << 8) | cdb[3];
+		break;
+	case 4: // 16 byte CDB, low 32 bits.
+		lba = (cdb[6] << 24) | (cdb[7] << 16) | (cdb[8] << 8) | cdb[9];
+		break;
+	default:
+		lba = (cdb[2] << 24) | (cdb[3] << 16) | (cdb[4] << 8) | cdb[5];
+		break;
+	}
+
+	evt->opcode     = cdb[0];
+	evt->lun        = lun;
+	evt->status     = 0;
+	evt->sense_key  = 0;
+	evt->tag        = tag;
+	evt->lba        = lba;
+	evt->length     = 0;
+	evt->cbw_us     = get_tmr_us();
+	evt->storage_us = 0;
+	evt->data_us    = 0;
+	evt->csw_us     = 0;
+}
+
+void ums_trace_length(u32 length)
+{
+	_ums_trace_cur()->length = length;
+}
+
+void ums_trace_storage_done()
+{
+	_ums_trace_cur()->storage_us = get_tmr_us();
+}
+
+void ums_trace_data_done()
+{
+	_ums_trace_cur()->data_us = get_tmr_us();
+}
+
+void ums_trace_status(u8 status, u32 sense)
+{
+	ums_trace_entry_t *evt = _ums_trace_cur();
+
+	evt->status    = status;
+	evt->sense_key = sense >> 16;
+	evt->csw_us    = get_tmr_us();
+
+	trace_idx++;
+}
+
+// Copies header and completed entries from sequence number first on, oldest first. Returns the size used.
+u32 ums_trace_export(void *buf, u32 size, u32 first)
+{
+	ums_trace_hdr_t *hdr = (ums_trace_hdr_t *)buf;
+	ums_trace_entry_t *evts = (ums_trace_entry_t *)((u8 *)buf + sizeof(ums_trace_hdr_t));
+
+	if (size < sizeof(ums_trace_hdr_t))
+		return 0;
+
+	// Entries older than the ring are gone, the host sees that from first.
+	u32 oldest = trace_idx - MIN(trace_idx, trace_mask + 1);
+	if (first < oldest || first > trace_idx)
+		first = oldest;
+
+	u32 count = trace_idx - first;
+	count = MIN(count, (size - sizeof(ums_trace_hdr_t)) / sizeof(ums_trace_entry_t));
+
+	for (u32 i = 0; i < count; i++)
+		evts[i] = trace[(first + i) & trace_mask];
+
+	hdr->magic      = UMS_TRACE_MAGIC;
+	hdr->entry_size = sizeof(ums_trace_entry_t);
+	hdr->rsvd       = 0;
+	hdr->first      = first;
+	hdr->count      = count;
+	hdr->total      = trace_idx;
+	hdr->now_us     = get_tmr_us();
+
+	return sizeof(ums_trace_hdr_t) + count * sizeof(ums_trace_entry_t);
+}
@@ -0,0 +1,69 @@
+/*
+ * SCSI command trace for the UMS gadget
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UMS_TRACE_H_
+#define _UMS_TRACE_H_
+
+#include <utils/types.h>
+
+#define UMS_TRACE_IRAM_ENTRIES 32 // Must be a power of 2.
+#define UMS_TRACE_MAGIC        0x43525455 // UTRC.
+
+// One per command, 32 bytes. Times are get_tmr_us(), 0 if the phase did not happen.
+typedef struct _ums_trace_entry_t
+{
+	u8  opcode;
+	u8  lun;
+	u8  status;     // CSW status.
+	u8  sense_key;
+	u32 tag;
+	u32 lba;        // LBA field of the CDB, 0 if the command has none.
+	u32 length;     // Data length from the CDB in bytes.
+	u32 cbw_us;     // CBW received.
+	u32 storage_us; // Last storage access done.
+	u32 data_us;    // Data stage done.
+	u32 csw_us;     // CSW sent.
+} ums_trace_entry_t;
+
+typedef struct _ums_trace_hdr_t
+{
+	u32 magic;
+	u16 entry_size;
+	u16 rsvd;
+	u32 first;  // Sequence number of the first entry.
+	u32 count;  // Entries following the header.
+	u32 total;  // Commands recorded so far.
+	u32 now_us;
+} ums_trace_hdr_t;
+
+#ifdef BDK_UMS_TRACE_SUPPORT
+void ums_trace_set_buffer(void *buf, u32 entries);
+void ums_trace_cmd(u32 tag, u8 lun, const u8 *cdb);
+void ums_trace_length(u32 length);
+void ums_trace_storage_done();
+void ums_trace_data_done();
+void ums_trace_status(u8 status, u32 sense);
+u32  ums_trace_export(void *buf, u32 size, u32 first);
+#else
+static inline void ums_trace_set_buffer(void *buf, u32 entries) {}
+static inline void ums_trace_cmd(u32 tag, u8 lun, const u8 *cdb) {}
+static inline void ums_trace_length(u32 length) {}
+static inline void ums_trace_storage_done() {}
+static inline void ums_trace_data_done() {}
+static inline void ums_trace_status(u8 status, u32 sense) {}
+#endif
+
+#endif
@@ -0,0 +1,866 @@
+/*
+ * USB Gadget compressed imaging driver for Tegra X1
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <libs/compr/lz4.h>
+#include <usb/usbd.h>
+#include <soc/ccplex_worker.h>
+#include <soc/timer.h>
+#include <soc/t210.h>
+#include <storage/emmc.h>
+#include <storage/sd.h>
+#include <storage/sdmmc.h>
+#include <utils/btn.h>
+#include <utils/sprintf.h>
+#include <utils/types.h>
+#include <utils/util.h>
+
+#include <memory_map.h>
+
+/*
+ * Protocol (all fields little endian), framed like the loopback gadget:
+ * Host sends a 32 byte command on EP1 OUT. A dump answers with frames on EP1 IN,
+ * then all commands end with a 32 byte status on EP1 IN.
+ * A frame is a 32 byte header, followed by its payload as a separate transfer if
+ * size is not 0. Each chunk is sent as LZ4 block or raw, whichever is smaller, and
+ * chunks of zeros are merged into one zero frame without payload. That way, USB
+ * only carries what is actually stored, and empty space costs one SDMMC read.
+ *
+ * With IMG_FLAG_USED, lba must be the start of a FAT32 or exFAT volume. Free
+ * clusters are then neither read nor sent, a skip frame marks them instead.
+ *
+ * With IMG_FLAG_CRC, raw and LZ4 frames carry the CRC32 (zlib) of their
+ * uncompressed data, in both directions. A restore checks it after writing.
+ *
+ * A restore is the same in the other direction. The device answers the command
+ * with a status first and only if that is OK, the host sends the frames on EP1 OUT,
+ * in LBA order, then reads the final status. Zero frames are erased/trimmed where
+ * the card reads those back as zeros, otherwise zeros are written.
+ */
+#define IMG_CMD_SIG      0x4D434D49 // IMCM.
+#define IMG_STS_SIG      0x54534D49 // IMST.
+#define IMG_FRAME_SIG    0x52464D49 // IMFR.
+#define IMG_CMD_LEN      32
+
+#define IMG_OP_INFO      0 // Status only, with the storage size.
+#define IMG_OP_DUMP      1
+#define IMG_OP_RESTORE   2
+#define IMG_OP_EXIT      3
+
+#define IMG_FLAG_NO_ERASE 1 // Restore: write zero frames.
+#define IMG_FLAG_USED     2 // Dump: only allocated clusters.
+#define IMG_FLAG_CRC      4 // Frames carry the CRC32 of their data.
+
+#define IMG_STORAGE_SD    0
+#define IMG_STORAGE_GPP   1
+#define IMG_STORAGE_BOOT0 2
+#define IMG_STORAGE_BOOT1 3
+
+#define IMG_FRAME_RAW    0
+#define IMG_FRAME_LZ4    1
+#define IMG_FRAME_ZERO   2
+#define IMG_FRAME_SKIP   3 // Free clusters, not read.
+
+#define IMG_STS_OK          0
+#define IMG_STS_BAD_CMD     1
+#define IMG_STS_XFER_ERR    2
+#define IMG_STS_STORAGE_ERR 3
+#define IMG_STS_ABORTED     4
+#define IMG_STS_NO_FS       5 // No FAT32/exFAT volume at lba.
+#define IMG_STS_CRC_ERR     6 // Restore: data written, but the CRC of a frame did not match.
+
+#define IMG_CHUNK_SECTORS (SZ_64K >> 9)
+#define IMG_LZ4_SKIP      8 // Chunks sent raw after one that did not compress.
+
+/*
+ * Chunks are read into the bulk OUT buffer, which only carries the commands.
+ * The bulk IN buffer holds the frame header, the FAT/bitmap cache of IMG_FLAG_USED,
+ * the LZ4 output and the LZ4 state.
+ * Output that does not fit was not worth it and the chunk goes out raw.
+ * A restore uses the same buffers for received LZ4 blocks and their decompressed
+ * chunks, so LZ4 frames from the host must fit in IMG_COMP_MAX (42KB).
+ */
+#define IMG_RD_BUF    ((u8 *)USB_EP_BULK_OUT_BUF_ADDR)
+#define IMG_HDR_BUF   ((u8 *)USB_EP_BULK_IN_BUF_ADDR)
+#define IMG_MAP_BUF   ((u8 *)USB_EP_BULK_IN_BUF_ADDR + SZ_1K)
+#define IMG_COMP_BUF  ((u8 *)USB_EP_BULK_IN_BUF_ADDR + SZ_1K + SZ_4K)
+#define IMG_LZ4_STATE ((u8 *)USB_EP_BULK_IN_BUF_ADDR + SZ_64K - SZ_16K - SZ_1K)
+#define IMG_COMP_MAX  (IMG_LZ4_STATE - IMG_COMP_BUF)
+
+#define IMG_MAP_SECTORS (SZ_4K >> 9)
+
+typedef struct _img_cmd_t
+{
+	u32 signature;
+	u32 tag;
+	u8  opcode;
+	u8  storage;
+	u8  flags;
+	u8  rsvd0;
+	u32 lba;
+	u32 sectors;
+	u32 accel;    // LZ4 acceleration, 0: no compression.
+	u32 rsvd1[2];
+} __attribute__((packed)) img_cmd_t;
+
+typedef struct _img_frame_t
+{
+	u32 signature;
+	u32 type;
+	u32 lba;
+	u32 sectors;
+	u32 size;     // Payload bytes.
+	u32 crc;      // IMG_FLAG_CRC: of the uncompressed data.
+	u32 rsvd[2];
+} __attribute__((packed)) img_frame_t;
+
+typedef struct _img_sts_t
+{
+	u32 signature;
+	u32 tag;
+	u32 status;
+	u32 sectors;       // Done.
+	u32 time_us;
+	u32 usb_bytes;     // Frame payloads.
+	u32 zero_sectors;
+	u32 total_sectors; // Storage size.
+} __attribute__((packed)) img_sts_t;
+
+typedef struct _img_ctxt_t
+{
+	bool sd_used;
+	bool emmc_used;
+} img_ctxt_t;
+
+typedef struct _img_alloc_t
+{
+	sdmmc_storage_t *storage;
+	bool valid;
+	bool exfat;
+	u32 clus_shift; // Sectors per cluster, log2.
+	u32 vol_lba;
+	u32 map_lba;    // FAT (FAT32) or allocation bitmap (exFAT). Volume relative, as the rest.
+	u32 heap_lba;   // Cluster 2.
+	u32 clusters;
+	u32 cache_lba;  // First sector in IMG_MAP_BUF.
+} img_alloc_t;
+
+static usb_ops_t usb_ops;
+
+static sdmmc_storage_t *_img_storage(img_ctxt_t *img, u32 id, u32 *sectors)
+{
+	switch (id)
+	{
+	case IMG_STORAGE_SD:
+		img->sd_used = true;
+		if (!sd_storage.initialized && !sd_initialize(false))
+			return NULL;
+
+		*sectors = sd_storage.sec_cnt;
+		return &sd_storage;
+
+	case IMG_STORAGE_GPP:
+	case IMG_STORAGE_BOOT0:
+	case IMG_STORAGE_BOOT1:
+		img->emmc_used = true;
+		if (!emmc_storage.initialized && !emmc_initialize(false))
+			return NULL;
+
+		if (emmc_storage.partition != id - IMG_STORAGE_GPP && !emmc_set_partition(id - IMG_STORAGE_GPP))
+			return NULL;
+
+		// Boot partitions are boot_mult x 128KB.
+		*sectors = id == IMG_STORAGE_GPP ? emmc_storage.sec_cnt : emmc_storage.ext_csd.boot_mult << 8;
+		return &emmc_storage;
+	}
+
+	return NULL;
+}
+
+static bool _img_is_zero(const u8 *buf, u32 size)
+{
+	const u32 *p = (const u32 *)buf;
+
+	for (u32 i = 0; i < size / sizeof(u32); i++)
+		if (p[i])
+			return false;
+
+	return true;
+}
+
+/*
+ * The CRC of a chunk runs on the A57 while the BPMP compresses or writes it.
+ * Without the worker, it is done here afterwards.
+ */
+static bool _img_crc_start(const u8 *buf, u32 size)
+{
+#ifdef BDK_CCPLEX_WORKER_SUPPORT
+	return ccplex_worker_start() && ccplex_worker_crc32_start(buf, size, 0);
+#else
+	return false;
+#endif
+}
+
+static u32 _img_crc_finish(bool started, const u8 *buf, u32 size)
+{
+#ifdef BDK_CCPLEX_WORKER_SUPPORT
+	u32 crc;
+	if (started && ccplex_worker_wait(&crc))
+		return crc;
+#endif
+
+	return crc32_calc(0, buf, size);
+}
+
+static int _img_send_frame(img_sts_t *sts, u32 type, u32 lba, u32 sectors, const u8 *payload, u32 size, u32 crc)
+{
+	img_frame_t *frame = (img_frame_t *)IMG_HDR_BUF;
+
+	memset(frame, 0, sizeof(img_frame_t));
+	frame->signature = IMG_FRAME_SIG;
+	frame->type      = type;
+	frame->lba       = lba;
+	frame->sectors   = sectors;
+	frame->size      = size;
+	frame->crc       = crc;
+
+	if (usb_ops.usb_device_ep1_in_write(IMG_HDR_BUF, IMG_CMD_LEN, NULL, USB_XFER_SYNCED_DATA))
+		return 1;
+
+	if (size && usb_ops.usb_device_ep1_in_write((u8 *)payload, size, NULL, USB_XFER_SYNCED_DATA))
+		return 1;
+
+	sts->usb_bytes += size;
+
+	return 0;
+}
+
+static u8 *_img_map_sector(img_alloc_t *alloc, u32 sector)
+{
+	u32 first = ALIGN_DOWN(sector, IMG_MAP_SECTORS);
+
+	if (alloc->cache_lba != first)
+	{
+		alloc->cache_lba = ~0;
+		if (!sdmmc_storage_read(alloc->storage, alloc->vol_lba + first, IMG_MAP_SECTORS, IMG_MAP_BUF))
+			return NULL;
+		alloc->cache_lba = first;
+	}
+
+	return IMG_MAP_BUF + ((sector - first) << 9);
+}
+
+static int _img_alloc_exfat(img_alloc_t *alloc, const u8 *vbr, u32 vol_sectors)
+{
+	// 512 byte sectors only, same as the storage.
+	if (vbr[108] != 9 || vbr[109] > 16)
+		return IMG_STS_NO_FS;
+
+	u32 fat_lba = *(u32 *)&vbr[80];
+	u32 root    = *(u32 *)&vbr[96];
+
+	alloc->exfat      = true;
+	alloc->clus_shift = vbr[109];
+	alloc->heap_lba   = *(u32 *)&vbr[88];
+	alloc->clusters   = *(u32 *)&vbr[92];
+
+	if ((u64)alloc->heap_lba + ((u64)alloc->clusters << alloc->clus_shift) > vol_sectors ||
+		root < 2 || root - 2 >= alloc->clusters)
+		return IMG_STS_NO_FS;
+
+	// The allocation bitmap entry is one of the first in the root directory.
+	u32 root_lba = alloc->heap_lba + ((root - 2) << alloc->clus_shift);
+	u32 bitmap = 0;
+	u32 bitmap_len = 0;
+	for (u32 i = 0; i < MIN(1u << alloc->clus_shift, IMG_MAP_SECTORS) * 512 && !bitmap; i += 32)
+	{
+		u8 *entry = _img_map_sector(alloc, root_lba + (i >> 9));
+		if (!entry)
+			return IMG_STS_STORAGE_ERR;
+		entry += i & 0x1FF;
+
+		if (!entry[0])
+			break; // End of directory.
+
+		if (entry[0] == 0x81)
+		{
+			bitmap     = *(u32 *)&entry[20];
+			bitmap_len = *(u32 *)&entry[24];
+		}
+	}
+
+	if (bitmap < 2 || bitmap - 2 >= alloc->clusters || bitmap_len < (alloc->clusters + 7) / 8)
+		return IMG_STS_NO_FS;
+
+	// Only a contiguous bitmap is supported. No FAT chain (0) is contiguous too.
+	u32 bitmap_clusters = ((bitmap_len - 1) >> (9 + alloc->clus_shift)) + 1;
+	for (u32 c = bitmap; c < bitmap + bitmap_clusters - 1; c++)
+	{
+		u32 *fat = (u32 *)_img_map_sector(alloc, fat_lba + (c >> 7));
+		if (!fat)
+			return IMG_STS_STORAGE_ERR;
+		if (fat[c & 0x7F] && fat[c & 0x7F] != c + 1)
+			return IMG_STS_NO_FS;
+	}
+
+	alloc->map_lba = alloc->heap_lba + ((bitmap - 2) << alloc->clus_shift);
+
+	return IMG_STS_OK;
+}
+
+static int _img_alloc_fat32(img_alloc_t *alloc, const u8 *vbr, u32 vol_sectors)
+{
+	u32 bps    = vbr[11] | (vbr[12] << 8);
+	u32 spc    = vbr[13];
+	u32 rsvd   = vbr[14] | (vbr[15] << 8);
+	u32 fats   = vbr[16];
+	u32 totsec = *(u32 *)&vbr[32];
+	u32 fatsz  = *(u32 *)&vbr[36];
+
+	if (bps != 512 || !spc || (spc & (spc - 1)) || !fats || !fatsz || totsec > vol_sectors)
+		return IMG_STS_NO_FS;
+
+	alloc->clus_shift = 0;
+	while ((1u << alloc->clus_shift) < spc)
+		alloc->clus_shift++;
+
+	alloc->map_lba  = rsvd;
+	alloc->heap_lba = rsvd + fats * fatsz;
+	if (alloc->heap_lba >= totsec)
+		return IMG_STS_NO_FS;
+
+	alloc->clusters = (totsec - alloc->heap_lba) >> alloc->clus_shift;
+	if ((u64)fatsz * 128 < alloc->clusters + 2)
+		return IMG_STS_NO_FS;
+
+	return IMG_STS_OK;
+}
+
+static int _img_alloc_init(img_alloc_t *alloc, sdmmc_storage_t *storage, u32 vol_lba, u32 vol_sectors)
+{
+	memset(alloc, 0, sizeof(img_alloc_t));
+	alloc->storage   = storage;
+	alloc->vol_lba   = vol_lba;
+	alloc->cache_lba = ~0;
+
+	if (vol_sectors < IMG_MAP_SECTORS)
+		return IMG_STS_NO_FS;
+
+	u8 *vbr = _img_map_sector(alloc, 0);
+	if (!vbr)
+		return IMG_STS_STORAGE_ERR;
+
+	if (vbr[510] != 0x55 || vbr[511] != 0xAA)
+		return IMG_STS_NO_FS;
+
+	int res;
+	if (!memcmp(&vbr[3], "EXFAT   ", 8))
+		res = _img_alloc_exfat(alloc, vbr, vol_sectors);
+	else if (!memcmp(&vbr[82], "FAT32   ", 8))
+		res = _img_alloc_fat32(alloc, vbr, vol_sectors);
+	else
+		res = IMG_STS_NO_FS;
+
+	alloc->valid = res == IMG_STS_OK;
+
+	return res;
+}
+
+// Returns 1 if the cluster (0 is cluster 2) is allocated, 0 if free and -1 on read error.
+static int _img_cluster_used(img_alloc_t *alloc, u32 clus)
+{
+	if (alloc->exfat)
+	{
+		u8 *bitmap = _img_map_sector(alloc, alloc->map_lba + (clus >> 12));
+		if (!bitmap)
+			return -1;
+
+		return (bitmap[(clus >> 3) & 0x1FF] >> (clus & 7)) & 1;
+	}
+
+	u32 entry = clus + 2;
+	u32 *fat = (u32 *)_img_map_sector(alloc, alloc->map_lba + (entry >> 7));
+	if (!fat)
+		return -1;
+
+	return (fat[entry & 0x7F] & 0x0FFFFFFF) != 0;
+}
+
+// Sectors from sector on that are all allocated (up to one chunk) or all free (up to max). 0 on read error.
+static u32 _img_alloc_run(img_alloc_t *alloc, u32 sector, u32 max, bool *used)
+{
+	*used = true;
+
+	// Boot region, FATs and anything after the cluster heap are always sent.
+	if (sector < alloc->heap_lba)
+		return MIN(max, MIN(alloc->heap_lba - sector, IMG_CHUNK_SECTORS));
+
+	u32 clus = (sector - alloc->heap_lba) >> alloc->clus_shift;
+	if (clus >= alloc->clusters)
+		return MIN(max, IMG_CHUNK_SECTORS);
+
+	int state = _img_cluster_used(alloc, clus);
+	if (state < 0)
+		return 0;
+
+	*used = state;
+	if (state)
+		max = MIN(max, IMG_CHUNK_SECTORS);
+
+	u32 run = alloc->heap_lba + ((clus + 1) << alloc->clus_shift) - sector;
+	while (run < max && ++clus < alloc->clusters)
+	{
+		int next = _img_cluster_used(alloc, clus);
+		if (next < 0)
+			return 0;
+		if (next != state)
+			break;
+
+		run += 1 << alloc->clus_shift;
+	}
+
+	return MIN(run, max);
+}
+
+static int _img_send_empty(img_sts_t *sts, u32 type, u32 lba, u32 *sectors)
+{
+	if (!*sectors)
+		return 0;
+
+	if (_img_send_frame(sts, type, lba, *sectors, NULL, 0, 0))
+		return 1;
+
+	if (type == IMG_FRAME_ZERO)
+		sts->zero_sectors += *sectors;
+	*sectors = 0;
+
+	return 0;
+}
+
+static int _img_dump(img_ctxt_t *img, const img_cmd_t *cmd, img_sts_t *sts)
+{
+	u32 total;
+	sdmmc_storage_t *storage = _img_storage(img, cmd->storage, &total);
+
+	if (!storage)
+		return IMG_STS_STORAGE_ERR;
+
+	sts->total_sectors = total;
+	if (cmd->lba > total || cmd->sectors > total - cmd->lba)
+		return IMG_STS_BAD_CMD;
+
+	int res = IMG_STS_OK;
+	img_alloc_t alloc = {0};
+	if (cmd->flags & IMG_FLAG_USED)
+	{
+		res = _img_alloc_init(&alloc, storage, cmd->lba, cmd->sectors);
+		if (res != IMG_STS_OK)
+			return res;
+	}
+
+	u32 lba = cmd->lba;
+	u32 end = cmd->lba + cmd->sectors;
+	u32 empty_type = IMG_FRAME_ZERO;
+	u32 empty_lba = 0;
+	u32 empty_cnt = 0;
+	u32 lz4_skip = 0;
+
+	u32 start = get_tmr_us();
+	while (lba < end)
+	{
+		if (btn_read_vol() == (BTN_VOL_UP | BTN_VOL_DOWN))
+		{
+			res = IMG_STS_ABORTED;
+			break;
+		}
+
+		u32 type = IMG_FRAME_RAW;
+		u32 cnt = MIN(end - lba, IMG_CHUNK_SECTORS);
+		if (alloc.valid)
+		{
+			bool used;
+			cnt = _img_alloc_run(&alloc, lba - cmd->lba, end - lba, &used);
+			if (!cnt)
+			{
+				res = IMG_STS_STORAGE_ERR;
+				break;
+			}
+			if (!used)
+				type = IMG_FRAME_SKIP;
+		}
+
+		if (type == IMG_FRAME_RAW)
+		{
+			if (!sdmmc_storage_read(storage, lba, cnt, IMG_RD_BUF))
+			{
+				res = IMG_STS_STORAGE_ERR;
+				break;
+			}
+
+			if (_img_is_zero(IMG_RD_BUF, cnt << 9))
+				type = IMG_FRAME_ZERO;
+		}
+
+		// Free and zero ranges are merged into one frame each.
+		if (type != IMG_FRAME_RAW)
+		{
+			if (empty_type != type && _img_send_empty(sts, empty_type, empty_lba, &empty_cnt))
+				return IMG_STS_XFER_ERR;
+
+			if (!empty_cnt)
+			{
+				empty_type = type;
+				empty_lba  = lba;
+			}
+			empty_cnt += cnt;
+			lba += cnt;
+			continue;
+		}
+
+		if (_img_send_empty(sts, empty_type, empty_lba, &empty_cnt))
+			return IMG_STS_XFER_ERR;
+
+		bool crc_async = false;
+		if (cmd->flags & IMG_FLAG_CRC)
+			crc_async = _img_crc_start(IMG_RD_BUF, cnt << 9);
+
+		// Data that does not compress usually continues for a while, so stop trying for some chunks.
+		int size = 0;
+		if (cmd->accel && !lz4_skip)
+		{
+			size = LZ4_compress_fast_extState(IMG_LZ4_STATE, (const char *)IMG_RD_BUF, (char *)IMG_COMP_BUF,
+				cnt << 9, IMG_COMP_MAX, cmd->accel);
+			if (size <= 0)
+				lz4_skip = IMG_LZ4_SKIP;
+		}
+		else if (lz4_skip)
+			lz4_skip--;
+
+		u32 crc = 0;
+		if (cmd->flags & IMG_FLAG_CRC)
+			crc = _img_crc_finish(crc_async, IMG_RD_BUF, cnt << 9);
+
+		if (size > 0)
+			res = _img_send_frame(sts, IMG_FRAME_LZ4, lba, cnt, IMG_COMP_BUF, size, crc);
+		else
+			res = _img_send_frame(sts, IMG_FRAME_RAW, lba, cnt, IMG_RD_BUF, cnt << 9, crc);
+		if (res)
+			return IMG_STS_XFER_ERR;
+
+		lba += cnt;
+	}
+
+	if (_img_send_empty(sts, empty_type, empty_lba, &empty_cnt))
+		return IMG_STS_XFER_ERR;
+
+	sts->sectors = lba - cmd->lba;
+	sts->time_us = get_tmr_us() - start;
+
+	return res;
+}
+
+static int _img_send_status(const img_sts_t *sts)
+{
+	memcpy(IMG_HDR_BUF, sts, sizeof(img_sts_t));
+
+	return usb_ops.usb_device_ep1_in_write(IMG_HDR_BUF, IMG_CMD_LEN, NULL, USB_XFER_SYNCED_DATA);
+}
+
+static int _img_recv(u8 *buf, u32 size)
+{
+	u32 bytes;
+
+	if (usb_ops.usb_device_ep1_out_read(buf, size, &bytes, USB_XFER_SYNCED_DATA) || bytes != size)
+		return 1;
+
+	return 0;
+}
+
+static int _img_write_zeros(sdmmc_storage_t *storage, u32 lba, u32 sectors, bool *erase)
+{
+	if (*erase)
+	{
+		if (sdmmc_storage_erase(storage, lba, sectors))
+			return 1;
+
+		// Not supported or failed, zeros are written from now on.
+		*erase = false;
+	}
+
+	memset(IMG_RD_BUF, 0, SZ_64K);
+	while (sectors)
+	{
+		u32 cnt = MIN(sectors, IMG_CHUNK_SECTORS);
+		if (!sdmmc_storage_write(storage, lba, cnt, IMG_RD_BUF))
+			return 0;
+
+		lba += cnt;
+		sectors -= cnt;
+	}
+
+	return 1;
+}
+
+static int _img_restore(img_ctxt_t *img, const img_cmd_t *cmd, img_sts_t *sts)
+{
+	u32 total;
+	sdmmc_storage_t *storage = _img_storage(img, cmd->storage, &total);
+
+	if (!storage)
+		return IMG_STS_STORAGE_ERR;
+
+	sts->total_sectors = total;
+	if (cmd->lba > total || cmd->sectors > total - cmd->lba)
+		return IMG_STS_BAD_CMD;
+
+	// Host starts sending frames after this.
+	if (_img_send_status(sts))
+		return IMG_STS_XFER_ERR;
+
+	int res = IMG_STS_OK;
+	u32 lba = cmd->lba;
+	u32 end = cmd->lba + cmd->sectors;
+	u32 done = 0;
+	bool erase = !(cmd->flags & IMG_FLAG_NO_ERASE);
+	img_frame_t frame;
+
+	u32 start = get_tmr_us();
+	while (lba < end)
+	{
+		if (btn_read_vol() == (BTN_VOL_UP | BTN_VOL_DOWN))
+			return IMG_STS_ABORTED;
+
+		if (_img_recv(IMG_HDR_BUF, IMG_CMD_LEN))
+			return IMG_STS_XFER_ERR;
+		memcpy(&frame, IMG_HDR_BUF, sizeof(img_frame_t));
+
+		// A frame that does not fit means host and device are out of sync.
+		u32 cnt = frame.sectors;
+		if (frame.signature != IMG_FRAME_SIG || frame.lba != lba || !cnt || cnt > end - lba)
+			return IMG_STS_BAD_CMD;
+
+		switch (frame.type)
+		{
+		case IMG_FRAME_RAW:
+			if (cnt > IMG_CHUNK_SECTORS || frame.size != cnt << 9)
+				return IMG_STS_BAD_CMD;
+			if (_img_recv(IMG_RD_BUF, frame.size))
+				return IMG_STS_XFER_ERR;
+			break;
+		case IMG_FRAME_LZ4:
+			if (cnt > IMG_CHUNK_SECTORS || !frame.size || frame.size > (u32)IMG_COMP_MAX)
+				return IMG_STS_BAD_CMD;
+			if (_img_recv(IMG_COMP_BUF, frame.size))
+				return IMG_STS_XFER_ERR;
+			if (res == IMG_STS_OK &&
+				LZ4_decompress_safe((const char *)IMG_COMP_BUF, (char *)IMG_RD_BUF, frame.size, SZ_64K) != (int)(cnt << 9))
+				res = IMG_STS_BAD_CMD;
+			break;
+		case IMG_FRAME_ZERO:
+			if (frame.size)
+				return IMG_STS_BAD_CMD;
+			break;
+		default:
+			return IMG_STS_BAD_CMD;
+		}
+		sts->usb_bytes += frame.size;
+		lba += cnt;
+
+		// After an error the rest is only received, so the host gets the status at the end.
+		if (res != IMG_STS_OK)
+			continue;
+
+		if (frame.type == IMG_FRAME_ZERO)
+		{
+			if (!_img_write_zeros(storage, frame.lba, cnt, &erase))
+				res = IMG_STS_STORAGE_ERR;
+			else
+				sts->zero_sectors += cnt;
+		}
+		else
+		{
+			bool check_crc = cmd->flags & IMG_FLAG_CRC;
+			bool crc_async = check_crc && _img_crc_start(IMG_RD_BUF, cnt << 9);
+
+			if (!sdmmc_storage_write(storage, frame.lba, cnt, IMG_RD_BUF))
+				res = IMG_STS_STORAGE_ERR;
+
+			// Also collected after a write error, the worker takes one job at a time.
+			if (check_crc && _img_crc_finish(crc_async, IMG_RD_BUF, cnt << 9) != frame.crc && res == IMG_STS_OK)
+				res = IMG_STS_CRC_ERR;
+		}
+
+		if (res == IMG_STS_OK)
+			done = lba - cmd->lba;
+	}
+
+	sts->sectors = done;
+	sts->time_us = get_tmr_us() - start;
+
+	return res;
+}
+
+int usb_device_gadget_image(usb_ctxt_t *usbs)
+{
+	int res = 0;
+	char text[32];
+	u32 bytes;
+	bool cmd_queued = false;
+	img_ctxt_t img = {0};
+
+#ifdef BDK_USB2_SUPPORT
+	if (usbs->backend == USB_BACKEND_USB2)
+		usb_device_get_ops(&usb_ops);
+	else
+#endif
+		xusb_device_get_ops(&usb_ops);
+
+	usbs->set_text(usbs->label, "Started USB");
+
+	if (usb_ops.usb_device_init())
+	{
+		usb_ops.usbd_end(false, true);
+		return 1;
+	}
+
+	usbs->set_text(usbs->label, "Waiting for connection");
+
+	// Initialize Control Endpoint.
+	if (usb_ops.usb_device_enumerate(USB_GADGET_IMAGE))
+	{
+		usbs->set_text(usbs->label, "ERR: Timeout/canceled");
+		goto error;
+	}
+
+	usbs->set_text(usbs->label, "Ready");
+
+	while (true)
+	{
+		if (btn_read_vol() == (BTN_VOL_UP | BTN_VOL_DOWN))
+			break;
+
+		// Handle bulk reset.
+		usb_ops.usbd_handle_ep0_ctrl_setup();
+
+		// Only one command request may be queued, see UMS CBW handling.
+		if (!cmd_queued)
+			res = usb_ops.usb_device_ep1_out_read(IMG_RD_BUF, IMG_CMD_LEN, &bytes, USB_XFER_SYNCED_CMD);
+		else
+			res = usb_ops.usb_device_ep1_out_reading_finish(&bytes, USB_XFER_SYNCED_CMD);
+		cmd_queued = true;
+
+		if (res == USB_ERROR_TIMEOUT)
+		{
+			if (usb_ops.usb_device_get_suspended())
+				break; // Disconnected.
+			continue;
+		}
+		cmd_queued = false;
+		if (res)
+		{
+			usbs->set_text(usbs->label, "ERR: EP OUT XFer");
+			goto error;
+		}
+
+		img_cmd_t cmd;
+		memcpy(&cmd, IMG_RD_BUF, sizeof(img_cmd_t));
+		if (bytes != IMG_CMD_LEN || cmd.signature != IMG_CMD_SIG)
+			continue;
+
+		if (cmd.opcode == IMG_OP_EXIT)
+			break;
+
+		img_sts_t sts = {0};
+		sts.signature = IMG_STS_SIG;
+		sts.tag       = cmd.tag;
+
+		u32 total = 0;
+		switch (cmd.opcode)
+		{
+		case IMG_OP_INFO:
+			sts.status = _img_storage(&img, cmd.storage, &total) ? IMG_STS_OK : IMG_STS_STORAGE_ERR;
+			sts.total_sectors = total;
+			break;
+		case IMG_OP_DUMP:
+			usbs->set_text(usbs->label, "Dumping");
+			sts.status = _img_dump(&img, &cmd, &sts);
+			break;
+		case IMG_OP_RESTORE:
+			usbs->set_text(usbs->label, "Restoring");
+			sts.status = _img_restore(&img, &cmd, &sts);
+			break;
+		default:
+			sts.status = IMG_STS_BAD_CMD;
+			break;
+		}
+
+		if (_img_send_status(&sts))
+		{
+			usbs->set_text(usbs->label, "ERR: EP IN XFer");
+			goto error;
+		}
+
+		switch (sts.status)
+		{
+		case IMG_STS_OK:
+			if (sts.time_us)
+			{
+				u32 kbps = (u32)(((u64)sts.sectors * 512 * 1000000 / 1024) / sts.time_us);
+				s_printf(text, "%d KB/s", kbps);
+				usbs->set_text(usbs->label, text);
+			}
+			break;
+		case IMG_STS_BAD_CMD:
+			usbs->set_text(usbs->label, "ERR: Bad command");
+			break;
+		case IMG_STS_STORAGE_ERR:
+			usbs->set_text(usbs->label, "ERR: Storage");
+			break;
+		case IMG_STS_ABORTED:
+			usbs->set_text(usbs->label, "Aborted");
+			break;
+		case IMG_STS_NO_FS:
+			usbs->set_text(usbs->label, "ERR: No FAT32/exFAT");
+			break;
+		case IMG_STS_CRC_ERR:
+			usbs->set_text(usbs->label, "ERR: CRC mismatch");
+			break;
+		}
+	}
+
+	usbs->set_text(usbs->label, "Imaging ended");
+	res = 0;
+	goto exit;
+
+error:
+	res = 1;
+
+exit:
+#ifdef BDK_CCPLEX_WORKER_SUPPORT
+	ccplex_worker_stop();
+#endif
+
+	if (img.emmc_used)
+		emmc_end();
+
+	if (img.sd_used)
+		sd_end();
+
+	usb_ops.usbd_end(true, false);
+
+	return res;
+}
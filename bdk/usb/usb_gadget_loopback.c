@@ -0,0 +1,265 @@
+/*
+ * USB Gadget loopback/source-sink driver for Tegra X1
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <usb/usbd.h>
+#include <soc/hw_init.h>
+#include <soc/timer.h>
+#include <soc/t210.h>
+#include <utils/btn.h>
+#include <utils/sprintf.h>
+#include <utils/types.h>
+#include <utils/util.h>
+
+#include <memory_map.h>
+
+/*
+ * Protocol (all fields little endian):
+ * Host sends a 32 byte command on EP1 OUT, then the data phase of the opcode
+ * runs, then the device sends a 32 byte status on EP1 IN.
+ * Data is moved in bursts of trb_cnt * trb_size bytes. A burst of one TRB
+ * uses the single TRB path, more are queued as one chained transfer.
+ */
+#define LB_CMD_SIG      0x4D43424C // LBCM.
+#define LB_STS_SIG      0x5453424C // LBST.
+#define LB_CMD_LEN      32
+
+#define LB_OP_SINK      0 // Host to device, data is dropped.
+#define LB_OP_SOURCE    1 // Device to host, data comes from IRAM.
+#define LB_OP_LOOP      2 // Each burst is received and sent back.
+#define LB_OP_EXIT      3
+
+#define LB_STS_OK       0
+#define LB_STS_BAD_CMD  1
+#define LB_STS_XFER_ERR 2
+
+// Bulk IN and OUT buffers are contiguous, so the big transfers fit.
+#define LB_BUF          ((u8 *)USB_EP_BULK_IN_BUF_ADDR)
+
+typedef struct _lb_cmd_t
+{
+	u32 signature;
+	u32 tag;
+	u8  opcode;
+	u8  rsvd0[3];
+	u32 trb_size;
+	u32 trb_cnt;
+	u32 total;
+	u32 rsvd1[2];
+} __attribute__((packed)) lb_cmd_t;
+
+typedef struct _lb_sts_t
+{
+	u32 signature;
+	u32 tag;
+	u32 status;
+	u32 bytes;
+	u32 time_us;   // Data phase only, measured on the device.
+	u32 bursts;
+	u32 burst_max_us;
+	u32 chip_id;   // HIDREV major, T210 or T210B01.
+} __attribute__((packed)) lb_sts_t;
+
+static usb_ops_t usb_ops;
+
+static int _lb_xfer(bool in, bool chain, u8 *buf, u32 len, u32 *bytes)
+{
+	int res;
+	u32 actual = 0;
+
+	if (in)
+	{
+		if (chain)
+			res = usb_ops.usb_device_ep1_in_write_big(buf, len, NULL);
+		else
+			res = usb_ops.usb_device_ep1_in_write(buf, len, NULL, USB_XFER_SYNCED_DATA);
+		if (!res)
+			actual = len;
+	}
+	else
+	{
+		if (chain)
+			res = usb_ops.usb_device_ep1_out_read_big(buf, len, &actual);
+		else
+			res = usb_ops.usb_device_ep1_out_read(buf, len, &actual, USB_XFER_SYNCED_DATA);
+	}
+
+	*bytes = actual;
+
+	return res;
+}
+
+static int _lb_run(const lb_cmd_t *cmd, lb_sts_t *sts)
+{
+	// More than one TRB per burst is queued as a single chained transfer.
+	bool chain = cmd->trb_cnt > 1;
+	u32 burst = cmd->trb_size * cmd->trb_cnt;
+	u32 remaining = cmd->total;
+
+	u32 start = get_tmr_us();
+	while (remaining)
+	{
+		u32 burst_len = MIN(remaining, burst);
+
+		for (u32 dir = 0; dir < 2; dir++)
+		{
+			bool in;
+			if (cmd->opcode == LB_OP_LOOP)
+				in = dir;
+			else if (dir)
+				break;
+			else
+				in = cmd->opcode == LB_OP_SOURCE;
+
+			u32 bytes;
+			u32 burst_start = get_tmr_us();
+			if (_lb_xfer(in, chain, LB_BUF, burst_len, &bytes))
+				return LB_STS_XFER_ERR;
+			sts->burst_max_us = MAX(sts->burst_max_us, get_tmr_us() - burst_start);
+
+			sts->bursts++;
+			sts->bytes += bytes;
+
+			// Short packet ends the burst, loop sends back only what it got.
+			burst_len = bytes;
+		}
+
+		if (!burst_len)
+			break;
+
+		remaining -= MIN(remaining, burst_len);
+	}
+	sts->time_us = get_tmr_us() - start;
+
+	return LB_STS_OK;
+}
+
+int usb_device_gadget_loopback(usb_ctxt_t *usbs)
+{
+	int res = 0;
+	char text[32];
+	u32 bytes;
+	bool cmd_queued = false;
+
+#ifdef BDK_USB2_SUPPORT
+	if (usbs->backend == USB_BACKEND_USB2)
+		usb_device_get_ops(&usb_ops);
+	else
+#endif
+		xusb_device_get_ops(&usb_ops);
+
+	usbs->set_text(usbs->label, "Started USB");
+
+	if (usb_ops.usb_device_init())
+	{
+		usb_ops.usbd_end(false, true);
+		return 1;
+	}
+
+	usbs->set_text(usbs->label, "Waiting for connection");
+
+	// Initialize Control Endpoint.
+	if (usb_ops.usb_device_enumerate(USB_GADGET_LOOPBACK))
+	{
+		usbs->set_text(usbs->label, "ERR: Timeout/canceled");
+		goto error;
+	}
+
+	usbs->set_text(usbs->label, "Started loopback");
+
+	while (true)
+	{
+		if (btn_read_vol() == (BTN_VOL_UP | BTN_VOL_DOWN))
+			break;
+
+		// Handle bulk reset.
+		usb_ops.usbd_handle_ep0_ctrl_setup();
+
+		// Only one command request may be queued, see UMS CBW handling.
+		if (!cmd_queued)
+			res = usb_ops.usb_device_ep1_out_read(LB_BUF, LB_CMD_LEN, &bytes, USB_XFER_SYNCED_CMD);
+		else
+			res = usb_ops.usb_device_ep1_out_reading_finish(&bytes, USB_XFER_SYNCED_CMD);
+		cmd_queued = true;
+
+		if (res == USB_ERROR_TIMEOUT)
+		{
+			if (usb_ops.usb_device_get_suspended())
+				break; // Disconnected.
+			continue;
+		}
+		cmd_queued = false;
+		if (res)
+		{
+			usbs->set_text(usbs->label, "ERR: EP OUT XFer");
+			goto error;
+		}
+
+		lb_cmd_t cmd;
+		memcpy(&cmd, LB_BUF, sizeof(lb_cmd_t));
+		if (bytes != LB_CMD_LEN || cmd.signature != LB_CMD_SIG)
+			continue;
+
+		if (cmd.opcode == LB_OP_EXIT)
+			break;
+
+		lb_sts_t sts = {0};
+		sts.signature = LB_STS_SIG;
+		sts.tag       = cmd.tag;
+		sts.chip_id   = hw_get_chip_id();
+
+		if (cmd.opcode > LB_OP_LOOP || !cmd.trb_size || cmd.trb_size > USB_EP_BUFFER_MAX_SIZE ||
+			(cmd.trb_size & 0x1FF) || !cmd.trb_cnt || cmd.trb_cnt > USB_EP_BULK_OUT_EXT_MAX_XFER / cmd.trb_size)
+			sts.status = LB_STS_BAD_CMD;
+		else
+		{
+			s_printf(text, "%s %dKx%d", cmd.opcode == LB_OP_SINK ? "Sink" : (cmd.opcode == LB_OP_SOURCE ? "Source" : "Loop"),
+				cmd.trb_size >> 10, cmd.trb_cnt);
+			usbs->set_text(usbs->label, text);
+
+			sts.status = _lb_run(&cmd, &sts);
+		}
+
+		memcpy(LB_BUF, &sts, sizeof(lb_sts_t));
+		if (usb_ops.usb_device_ep1_in_write(LB_BUF, LB_CMD_LEN, NULL, USB_XFER_SYNCED_DATA))
+		{
+			usbs->set_text(usbs->label, "ERR: EP IN XFer");
+			goto error;
+		}
+
+		if (sts.status == LB_STS_OK && sts.time_us)
+		{
+			u32 kbps = (u32)(((u64)sts.bytes * 1000000 / 1024) / sts.time_us);
+			s_printf(text, "%d KB/s", kbps);
+			usbs->set_text(usbs->label, text);
+		}
+		else if (sts.status == LB_STS_BAD_CMD)
+			usbs->set_text(usbs->label, "ERR: Bad command");
+	}
+
+	usbs->set_text(usbs->label, "Loopback ended");
+	res = 0;
+	goto exit;
+
+error:
+	res = 1;
+
+exit:
+	usb_ops.usbd_end(true, false);
+
+	return res;
+}
@@ -22,8 +22,14 @@
 #include <gfx.h>
 #include <string.h>
 
+#include <usb/ums_actmon.h>
+#include <usb/ums_thermal.h>
+#include <usb/ums_trace.h>
 #include <usb/usbd.h>
 #include <gfx_utils.h>
+#ifdef BDK_UMS_XTS_SUPPORT
+#include <sec/se.h>
+#endif
 #include <soc/hw_init.h>
 #include <soc/timer.h>
 #include <soc/t210.h>
@@ -33,6 +39,8 @@
 #include <storage/sdmmc_driver.h>
 #include <utils/btn.h>
 #include <utils/sprintf.h>
+#include <utils/sched.h>
+#include <utils/timeline.h>
 #include <utils/types.h>
 #include <utils/util.h>
 
@@ -63,6 +71,10 @@
 
 #define UMS_EP_OUT_MAX_XFER (USB_EP_BULK_OUT_MAX_XFER)
 
+#define UMS_BTN_POLL_US     50000
+#define UMS_STATS_PERIOD_US 500000
+#define UMS_STATUS_TEXT_LEN 40
+
 // Length of a SCSI Command Data Block.
 #define SCSI_MAX_CMD_SZ 16
 
@@ -97,6 +109,14 @@
 #define SC_WRITE_10           0x2A
 #define SC_WRITE_12           0xAA
 
+// Vendor specific SCSI commands.
+#define SC_VENDOR_READ_TIMELINE 0xC0
+#define SC_VENDOR_READ_TRACE    0xC1
+#define SC_VENDOR_SET_XTS_KEY   0xC2
+#define SC_VENDOR_COPY_RANGE    0xC3
+#define SC_VENDOR_COPY_STATUS   0xC4
+#define SC_VENDOR_READ_ACTMON   0xC5
+
 // SCSI Sense Key/Additional Sense Code/ASC Qualifier values.
 #define SS_NO_SENSE                           0x0
 #define SS_COMMUNICATION_FAILURE              0x40800
@@ -174,6 +194,7 @@ typedef struct _logical_unit_t
 	int unmounted;
 
 	u32 ro;
+	u32 written; // RAM disk: all below this sector is host data or zeros.
 	u32 type;
 	u32 partition;
 	u32 removable;
@@ -184,6 +205,20 @@ typedef struct _logical_unit_t
 	u32 sense_data;
 	u32 sense_data_info;
 	u32 unit_attention_data;
+
+	// Read/write counters of the current stats period.
+	u64 bytes;
+	u32 period_rd;
+	u32 period_wr;
+	u32 period_cmds;
+	u32 period_lat_us;
+	u32 part_switches;
+	bool stats_idle; // Last report was all zero.
+
+#ifdef BDK_UMS_XTS_SUPPORT
+	u8  *xts_key;     // Decrypted view if set, points into ums_xts.
+	bool xts_key_set; // No medium until the host sent it.
+#endif
 } logical_unit_t;
 
 typedef struct _bulk_ctxt_t {
@@ -235,11 +270,77 @@ typedef struct _usbd_gadget_ums_t {
 	u32 timeouts;
 	bool xusb;
 
+	u32 bulk_out_max_xfer;
+	u32 read_io_max; // In sectors.
+
+	bool stop_req; // Force unmount button combo seen.
+
+	u32 cmd_start_us;
+	u32 stats_start_us;
+
 	void (*system_maintenance)(bool);
 	void *label;
 	void (*set_text)(void *, const char *);
+	void (*show_stats)(void *, const usb_ums_stats_t *);
 } usbd_gadget_ums_t;
 
+typedef struct _ums_status_t
+{
+	void *label;
+	void (*set_text)(void *, const char *);
+	char text[UMS_STATUS_TEXT_LEN];
+	bool pending;
+	bool deferred;
+	int  task;
+} ums_status_t;
+
+static ums_status_t ums_status;
+
+// Timeline marks of the session, checked on every TUR and READ.
+static bool ums_first_tur;
+static bool ums_first_read;
+
+typedef struct _ums_boot_cache_t
+{
+	u8  *buf;      // BOOT0, then BOOT1.
+	u32  sectors;  // Cached per partition.
+	bool valid[2];
+} ums_boot_cache_t;
+
+static ums_boot_cache_t ums_boot_cache;
+
+#ifdef BDK_UMS_XTS_SUPPORT
+#define UMS_XTS_KS_CRYPT        10
+#define UMS_XTS_KS_TWEAK        11
+#define UMS_XTS_CLUSTER_SECTORS 32 // 16KB crypto sectors, same as nx_emmc_bis.
+#define UMS_XTS_KEY_SZ          (SE_KEY_128_SIZE * 2)
+
+typedef struct _ums_xts_t
+{
+	u8  keys[16][UMS_XTS_KEY_SZ]; // Per LUN. Crypt key, then tweak key, like a BIS key.
+	logical_unit_t *loaded;       // LUN with its keys in the keyslots.
+} ums_xts_t;
+
+static ums_xts_t ums_xts;
+#endif
+
+#ifdef BDK_UMS_COPY_SUPPORT
+#define UMS_COPY_MAX_SECTORS    (SZ_64M >> UMS_DISK_LBA_SHIFT) // Per command, keeps it well inside host timeouts.
+#define UMS_COPY_STATUS_MAGIC   0x59504355 // UCPY.
+
+typedef struct _ums_copy_t
+{
+	u32 magic;
+	u32 ranges;  // Finished COPY RANGE commands.
+	u32 sectors; // Copied by all of them.
+	u32 time_ms;
+	u32 err_lun; // Last failure, the LBA is in that LUN.
+	u32 err_lba; // 0xFFFFFFFF if none.
+} ums_copy_t;
+
+static ums_copy_t ums_copy;
+#endif
+
 static usb_ops_t usb_ops;
 
 static inline void put_array_le_to_be16(u16 val, void *p)
@@ -290,6 +391,145 @@ static void raise_exception(usbd_gadget_ums_t *ums, enum ums_state new_state)
 	}
 }
 
+/*
+ * While UMS runs, status updates are drawn by a scheduled task. That keeps
+ * drawing out of the SCSI command path and runs it while waiting for the host.
+ */
+static void _ums_set_text(void *label, const char *text)
+{
+	if (!ums_status.deferred)
+	{
+		ums_status.set_text(label, text);
+		return;
+	}
+
+	strncpy(ums_status.text, text, UMS_STATUS_TEXT_LEN - 1);
+	ums_status.text[UMS_STATUS_TEXT_LEN - 1] = 0;
+	ums_status.pending = true;
+
+	sched_signal(ums_status.task);
+}
+
+static void _ums_status_task(void *data)
+{
+	if (!ums_status.pending)
+		return;
+
+	ums_status.pending = false;
+	ums_status.set_text(ums_status.label, ums_status.text);
+}
+
+static void _ums_stats_task(void *data)
+{
+	usbd_gadget_ums_t *ums = (usbd_gadget_ums_t *)data;
+	u32 now = get_tmr_us();
+	u32 elapsed = now - ums->stats_start_us;
+
+	if (!elapsed)
+		return;
+
+	ums->stats_start_us = now;
+
+	for (u32 i = 0; i < ums->lun_cnt; i++)
+	{
+		logical_unit_t *lun = &ums->luns[i];
+		usb_ums_stats_t stats;
+
+		// Only redraw what changed.
+		if (!lun->period_cmds && lun->stats_idle)
+			continue;
+
+		stats.lun       = i;
+		stats.type      = lun->type;
+		stats.partition = lun->partition;
+		stats.rd_kbps   = ((u64)lun->period_rd * 1000000 / elapsed) >> 10;
+		stats.wr_kbps   = ((u64)lun->period_wr * 1000000 / elapsed) >> 10;
+		stats.iops      = (u64)lun->period_cmds * 1000000 / elapsed;
+		stats.lat_us    = lun->period_cmds ? lun->period_lat_us / lun->period_cmds : 0;
+		stats.bytes     = lun->bytes;
+
+		stats.part_switches = lun->part_switches;
+
+		lun->stats_idle    = !lun->period_cmds;
+		lun->period_rd     = 0;
+		lun->period_wr     = 0;
+		lun->period_cmds   = 0;
+		lun->period_lat_us = 0;
+
+		ums->show_stats(ums->label, &stats);
+	}
+}
+
+static void _ums_stats_cmd_done(usbd_gadget_ums_t *ums)
+{
+	if (ums->lun_idx >= ums->lun_cnt)
+		return;
+
+	logical_unit_t *lun = &ums->luns[ums->lun_idx];
+	u32 amount = ums->data_size - ums->residue;
+
+	switch (ums->cmnd[0])
+	{
+	case SC_READ_6:
+	case SC_READ_10:
+	case SC_READ_12:
+		lun->period_rd += amount;
+		break;
+	case SC_WRITE_6:
+	case SC_WRITE_10:
+	case SC_WRITE_12:
+		lun->period_wr += amount;
+		break;
+	default:
+		return;
+	}
+
+	lun->bytes += amount;
+	lun->period_cmds++;
+	lun->period_lat_us += get_tmr_us() - ums->cmd_start_us;
+}
+
+static void _ums_btn_task(void *data)
+{
+	usbd_gadget_ums_t *ums = (usbd_gadget_ums_t *)data;
+
+	if (btn_read_vol() == (BTN_VOL_UP | BTN_VOL_DOWN))
+		ums->stop_req = true;
+}
+
+#ifdef BDK_UMS_ACTMON_SUPPORT
+static void _ums_actmon_task(void *data)
+{
+	ums_actmon_poll();
+}
+#endif
+
+#ifdef BDK_UMS_THERMAL_SUPPORT
+static void _ums_thermal_task(void *data)
+{
+	ums_thermal_poll();
+}
+
+// Reinits the card into the mode the governor wants. Only between commands, the host sees one slow command.
+static void _ums_thermal_sd_switch(usbd_gadget_ums_t *ums)
+{
+	u32 mode = ums_thermal_sd_mode();
+	bool up  = mode > sd_get_mode();
+	bool ok  = sd_reinit_mode(mode);
+
+	ums_thermal_sd_done(ok);
+
+	if (!ok)
+		ums->set_text(ums->label, "ERR: SD reinit");
+	else if (!up)
+		ums->set_text(ums->label, "Hot: SD slowed down");
+	else if (sd_get_mode() >= mode)
+		ums->set_text(ums->label, "SD speed restored");
+	else
+		ums->set_text(ums->label, "Warn: SD restore fail");
+}
+#endif
+
 static void _handle_ep0_ctrl(usbd_gadget_ums_t *ums)
 {
 	if (usb_ops.usbd_handle_ep0_ctrl_setup())
@@ -325,6 +565,10 @@ static void _flush_endpoint(u32 ep)
 
 static void _transfer_start(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt, u32 ep, u32 sync_timeout)
 {
+	// Only data transfers count as busy, a CBW wait is idle time.
+	if (sync_timeout != USB_XFER_SYNCED_CMD)
+		ums_actmon_busy(UMS_ACTMON_USB, true);
+
 	if (ep == bulk_ctxt->bulk_in)
 	{
 		bulk_ctxt->bulk_in_status = usb_ops.usb_device_ep1_in_write(
@@ -359,10 +603,15 @@ static void _transfer_start(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt, u32
 		if (sync_timeout)
 			bulk_ctxt->bulk_out_buf_state = BUF_STATE_FULL;
 	}
+
+	if (sync_timeout)
+		ums_actmon_busy(UMS_ACTMON_USB, false);
 }
 
 static void _transfer_out_big_read(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 {
+		ums_actmon_busy(UMS_ACTMON_USB, true);
+
 		bulk_ctxt->bulk_out_status = usb_ops.usb_device_ep1_out_read_big(
 			bulk_ctxt->bulk_out_buf, bulk_ctxt->bulk_out_length,
 			&bulk_ctxt->bulk_out_length_actual);
@@ -374,6 +623,8 @@ static void _transfer_out_big_read(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctx
 		}
 
 		bulk_ctxt->bulk_out_buf_state = BUF_STATE_FULL;
+
+		ums_actmon_busy(UMS_ACTMON_USB, false);
 }
 
 static void _transfer_finish(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt, u32 ep, u32 sync_timeout)
@@ -404,6 +655,8 @@ static void _transfer_finish(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt, u32
 
 		bulk_ctxt->bulk_out_buf_state = BUF_STATE_FULL;
 	}
+
+	ums_actmon_busy(UMS_ACTMON_USB, false);
 }
 
 static void _reset_buffer(bulk_ctxt_t *bulk_ctxt, u32 ep)
@@ -414,6 +667,203 @@ static void _reset_buffer(bulk_ctxt_t *bulk_ctxt, u32 ep)
 		bulk_ctxt->bulk_out_buf = (u8 *)USB_EP_BULK_OUT_BUF_ADDR;
 }
 
+/*
+ * eMMC partitions are switched with CMD6 and a busy wait. Hosts probe all LUNs
+ * round-robin, so only switch when the media is actually accessed.
+ */
+static int _lun_set_partition(logical_unit_t *lun)
+{
+	if (lun->type != MMC_EMMC || lun->partition - 1 == lun->storage->partition)
+		return 1;
+
+	DPRINTF("Change active part. to %d (was %d)\n", lun->partition - 1, lun->storage->partition);
+	lun->part_switches++;
+
+	return sdmmc_storage_set_mmc_partition(lun->storage, lun->partition - 1);
+}
+
+// Cache slot of a BOOT0/BOOT1 LUN, if there is one and the range fits.
+static u8 *_lun_boot_cache(logical_unit_t *lun, u32 sector, u32 num_sectors)
+{
+	if (!ums_boot_cache.buf || lun->type != MMC_EMMC ||
+		(lun->partition != EMMC_BOOT0 + 1 && lun->partition != EMMC_BOOT1 + 1) ||
+		sector + num_sectors > ums_boot_cache.sectors)
+		return NULL;
+
+	return ums_boot_cache.buf + (lun->partition - 1 - EMMC_BOOT0) * USB_UMS_BOOT_CACHE_SZ;
+}
+
+// Write-through, so the cache never holds data the media does not.
+static void _lun_boot_cache_update(logical_unit_t *lun, u32 sector, u32 num_sectors, void *buf)
+{
+	u8 *cache = _lun_boot_cache(lun, sector, num_sectors);
+	if (cache && ums_boot_cache.valid[lun->partition - 1 - EMMC_BOOT0])
+		memcpy(cache + (sector << UMS_DISK_LBA_SHIFT), buf, num_sectors << UMS_DISK_LBA_SHIFT);
+}
+
+#ifdef BDK_UMS_XTS_SUPPORT
+/*
+ * BIS style AES-XTS over 16KB crypto sectors, numbered from the LUN start like
+ * the console does for a partition. Works in place on the transfer buffer, so
+ * a read is decrypted while the previous buffer is still going out over USB.
+ */
+static int _lun_xts_crypt(logical_unit_t *lun, u32 enc, u32 sector, u32 num_sectors, u8 *buf)
+{
+	u8 tweak[SE_KEY_128_SIZE] __attribute__((aligned(4)));
+
+	if (ums_xts.loaded != lun)
+	{
+		se_aes_key_set(UMS_XTS_KS_CRYPT, lun->xts_key, SE_KEY_128_SIZE);
+		se_aes_key_set(UMS_XTS_KS_TWEAK, lun->xts_key + SE_KEY_128_SIZE, SE_KEY_128_SIZE);
+		ums_xts.loaded = lun;
+	}
+
+	sector -= lun->offset;
+	while (num_sectors)
+	{
+		u32 sector_in_cluster = sector % UMS_XTS_CLUSTER_SECTORS;
+		u32 amount = MIN(num_sectors, UMS_XTS_CLUSTER_SECTORS - sector_in_cluster);
+
+		if (!se_aes_xts_crypt_sec_nx(UMS_XTS_KS_TWEAK, UMS_XTS_KS_CRYPT, enc, sector / UMS_XTS_CLUSTER_SECTORS,
+			tweak, true, sector_in_cluster, buf, buf, amount << UMS_DISK_LBA_SHIFT))
+			return 0;
+
+		sector      += amount;
+		num_sectors -= amount;
+		buf         += amount << UMS_DISK_LBA_SHIFT;
+	}
+
+	return 1;
+}
+#endif
+
+// Returns nonzero on success, same as sdmmc_storage_read/write.
+static int _lun_read_media(logical_unit_t *lun, u32 sector, u32 num_sectors, void *buf)
+{
+#ifdef BDK_UMS_RAMDISK_SUPPORT
+	if (lun->type == MMC_RAMDISK)
+	{
+		memcpy(buf, (void *)(RAM_DISK_ADDR + (sector << UMS_DISK_LBA_SHIFT)), num_sectors << UMS_DISK_LBA_SHIFT);
+		return 1;
+	}
+#endif
+
+	u8 *cache = _lun_boot_cache(lun, sector, num_sectors);
+	if (cache)
+	{
+		bool *valid = &ums_boot_cache.valid[lun->partition - 1 - EMMC_BOOT0];
+
+		// Whole partition on first access, it's small.
+		if (!*valid)
+		{
+			if (!_lun_set_partition(lun))
+				return 0;
+
+			ums_actmon_busy(UMS_ACTMON_SDMMC, true);
+			int res = sdmmc_storage_read(lun->storage, 0, ums_boot_cache.sectors, cache);
+			ums_actmon_busy(UMS_ACTMON_SDMMC, false);
+			if (!res)
+				return 0;
+			ums_trace_storage_done();
+			*valid = true;
+		}
+
+		memcpy(buf, cache + (sector << UMS_DISK_LBA_SHIFT), num_sectors << UMS_DISK_LBA_SHIFT);
+		return 1;
+	}
+
+	if (!_lun_set_partition(lun))
+		return 0;
+
+	ums_actmon_busy(UMS_ACTMON_SDMMC, true);
+	int res = sdmmc_storage_read(lun->storage, sector, num_sectors, buf);
+	ums_actmon_busy(UMS_ACTMON_SDMMC, false);
+	ums_trace_storage_done();
+
+	return res;
+}
+
+static int _lun_read(logical_unit_t *lun, u32 sector, u32 num_sectors, void *buf)
+{
+	int res = _lun_read_media(lun, sector, num_sectors, buf);
+
+#ifdef BDK_UMS_XTS_SUPPORT
+	if (res && lun->xts_key)
+		res = _lun_xts_crypt(lun, DECRYPT, sector, num_sectors, buf);
+#endif
+
+	return res;
+}
+
+static int _lun_write(logical_unit_t *lun, u32 sector, u32 num_sectors, void *buf)
+{
+#ifdef BDK_UMS_XTS_SUPPORT
+	// The host data is not needed after the write, so encrypt it in place.
+	// The boot cache then gets the same as the media.
+	if (lun->xts_key && !_lun_xts_crypt(lun, ENCRYPT, sector, num_sectors, buf))
+		return 0;
+#endif
+
+#ifdef BDK_UMS_RAMDISK_SUPPORT
+	if (lun->type == MMC_RAMDISK)
+	{
+		// DRAM past the written part was never cleared. Zero the gap, so a commit never stores stale data.
+		if (sector > lun->written)
+			memset((void *)(RAM_DISK_ADDR + (lun->written << UMS_DISK_LBA_SHIFT)), 0, (sector - lun->written) << UMS_DISK_LBA_SHIFT);
+
+		memcpy((void *)(RAM_DISK_ADDR + (sector << UMS_DISK_LBA_SHIFT)), buf, num_sectors << UMS_DISK_LBA_SHIFT);
+		lun->written = MAX(lun->written, sector + num_sectors);
+		return 1;
+	}
+#endif
+
+	if (!_lun_set_partition(lun))
+		return 0;
+
+	ums_actmon_busy(UMS_ACTMON_SDMMC, true);
+	int res = sdmmc_storage_write(lun->storage, sector, num_sectors, buf);
+	ums_actmon_busy(UMS_ACTMON_SDMMC, false);
+	ums_trace_storage_done();
+
+	if (res)
+		_lun_boot_cache_update(lun, sector, num_sectors, buf);
+
+	return res;
+}
+
+/*
+ * Split media write, so the next chunk can come in over USB while the card is
+ * busy. Plain SD/eMMC LUNs only, the caller checks that. If the start fails,
+ * nothing was written and _lun_write() does the chunk instead.
+ */
+static int _lun_write_start(logical_unit_t *lun, sdmmc_storage_xfer_t *xfer, u32 sector, u32 num_sectors, void *buf)
+{
+	if (!_lun_set_partition(lun))
+		return 0;
+
+	ums_actmon_busy(UMS_ACTMON_SDMMC, true);
+	int res = sdmmc_storage_xfer_start(lun->storage, xfer, sector, num_sectors, buf, 1);
+	if (!res)
+		ums_actmon_busy(UMS_ACTMON_SDMMC, false);
+
+	return res;
+}
+
+static int _lun_write_finish(logical_unit_t *lun, sdmmc_storage_xfer_t *xfer, u32 sector, u32 num_sectors, void *buf)
+{
+	int res = sdmmc_storage_xfer_wait(lun->storage, xfer);
+	ums_actmon_busy(UMS_ACTMON_SDMMC, false);
+	ums_trace_storage_done();
+
+	// The split path has no retries, the normal one reinits the card if needed.
+	if (!res)
+		return _lun_write(lun, sector, num_sectors, buf);
+
+	_lun_boot_cache_update(lun, sector, num_sectors, buf);
+
+	return res;
+}
+
 /*
  * The following are old data based on max 64KB SCSI transfers.
  * The endpoint xfer is actually 41.2 MB/s and SD card max 39.2 MB/s, with higher SCSI
@@ -491,6 +941,9 @@ static int _scsi_read(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 	u32 max_io_transfer = (amount_left >= UMS_SCSI_TRANSFER_512K) ?
 		UMS_DISK_MAX_IO_TRANSFER_64K : UMS_DISK_MAX_IO_TRANSFER_32K;
 
+	if (ums->read_io_max)
+		max_io_transfer = ums->read_io_max;
+
 	max_io_transfer = MIN(max_io_transfer, sdmmc_buf1_sz >> UMS_DISK_LBA_SHIFT);
 
 	max_io_transfer = MIN(max_io_transfer, sdmmc_buf2_sz >> UMS_DISK_LBA_SHIFT);
@@ -514,7 +967,7 @@ static int _scsi_read(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 		}
 
 		// Do the SDMMC read.
-		if (!sdmmc_storage_read(ums->luns[ums->lun_idx].storage, ums->luns[ums->lun_idx].offset + lba_offset, amount, sdmmc_buf_current))
+		if (!_lun_read(&ums->luns[ums->lun_idx], ums->luns[ums->lun_idx].offset + lba_offset, amount, sdmmc_buf_current))
 			amount = 0;
 
 		use_buf1 = !use_buf1;
@@ -563,10 +1016,27 @@ static int _scsi_read(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 /*
  * Writes are another story.
  * Tests showed that big writes are faster than concurrent 32K usb reads + writes.
- * The only thing that can help here is caching the writes. But for the simplicity
- * of this implementation it will not be implemented yet.
+ * Bulk IN is idle during a write though, so SD/eMMC LUNs take turns with the IN
+ * and OUT buffers: the card writes one 64K chunk while the next one comes in over
+ * USB. RAM disk and decrypted LUNs keep one big buffer and write in between.
  */
 
+// Waits for the chunk that was written while the next one came in. Returns the bytes written.
+static u32 _scsi_write_wait(usbd_gadget_ums_t *ums, sdmmc_storage_xfer_t *xfer, u32 lba_offset, u32 amount, u8 *buf)
+{
+	logical_unit_t *lun = &ums->luns[ums->lun_idx];
+
+	if (_lun_write_finish(lun, xfer, lun->offset + lba_offset, amount >> UMS_DISK_LBA_SHIFT, buf))
+		return amount;
+
+	ums->set_text(ums->label, "ERR: SDMMC Write");
+	lun->sense_data = SS_WRITE_ERROR;
+	lun->sense_data_info = lba_offset;
+	lun->info_valid = 1;
+
+	return 0;
+}
+
 static int _scsi_write(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 {
 	static char txt_buf[256];
@@ -574,6 +1044,14 @@ static int _scsi_write(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 	u32 usb_lba_offset, lba_offset;
 	u32 amount;
 
+	u8 *bufs[2] = { (u8 *)USB_EP_BULK_OUT_BUF_ADDR, (u8 *)USB_EP_BULK_IN_BUF_ADDR };
+	u32 cur = 0;
+
+	sdmmc_storage_xfer_t xfer;
+	bool wr_async = false;
+	u32 wr_lba_offset = 0;
+	u32 wr_amount = 0;
+
 	if (ums->luns[ums->lun_idx].ro)
 	{
 		ums->set_text(ums->label, "Warn: Write - RO");
@@ -606,6 +1084,13 @@ static int _scsi_write(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 		return UMS_RES_INVALID_ARG;
 	}
 
+	// Overlap the card write with the next USB chunk. Not for the RAM disk and decrypted LUNs.
+	bool overlap = ums->luns[ums->lun_idx].storage != NULL;
+#ifdef BDK_UMS_XTS_SUPPORT
+	overlap &= !ums->luns[ums->lun_idx].xts_key;
+#endif
+	u32 max_xfer = overlap ? MIN(ums->bulk_out_max_xfer, USB_EP_BULK_IN_MAX_XFER) : ums->bulk_out_max_xfer;
+
 	// Carry out the file writes.
 	usb_lba_offset       = lba_offset;
 	amount_left_to_req   = ums->data_size_from_cmnd;
@@ -618,7 +1103,7 @@ static int _scsi_write(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 		{
 
 			// Limit write to max supported read from EP OUT.
-			amount = MIN(amount_left_to_req, UMS_EP_OUT_MAX_XFER);
+			amount = MIN(amount_left_to_req, max_xfer);
 
 			if (usb_lba_offset >= ums->luns[ums->lun_idx].num_sectors)
 			{
@@ -635,10 +1120,23 @@ static int _scsi_write(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 			amount_left_to_req   -= amount;
 
 			bulk_ctxt->bulk_out_length = amount;
+			bulk_ctxt->bulk_out_buf    = bufs[cur];
 
 			_transfer_out_big_read(ums, bulk_ctxt);
 		}
 
+		// The previous chunk was written to the card meanwhile.
+		if (wr_async)
+		{
+			wr_async = false;
+
+			amount = _scsi_write_wait(ums, &xfer, wr_lba_offset, wr_amount, bufs[cur ^ 1]);
+			amount_left_to_write -= amount;
+			ums->residue         -= amount;
+			if (!amount)
+				break;
+		}
+
 		if (bulk_ctxt->bulk_out_buf_state == BUF_STATE_FULL)
 		{
 			bulk_ctxt->bulk_out_buf_state = BUF_STATE_EMPTY;
@@ -674,8 +1172,22 @@ static int _scsi_write(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 			if (amount == 0)
 				goto empty_write;
 
+			// Start the write and get the next chunk meanwhile, unless this was the last one.
+			if (overlap && amount_left_to_req > 0 &&
+				_lun_write_start(&ums->luns[ums->lun_idx], &xfer, ums->luns[ums->lun_idx].offset + lba_offset,
+				amount >> UMS_DISK_LBA_SHIFT, bufs[cur]))
+			{
+				wr_async      = true;
+				wr_lba_offset = lba_offset;
+				wr_amount     = amount;
+
+				lba_offset += amount >> UMS_DISK_LBA_SHIFT;
+				cur ^= 1;
+				goto empty_write;
+			}
+
 			// Perform the write.
-			if (!sdmmc_storage_write(ums->luns[ums->lun_idx].storage, ums->luns[ums->lun_idx].offset + lba_offset,
+			if (!_lun_write(&ums->luns[ums->lun_idx], ums->luns[ums->lun_idx].offset + lba_offset,
 				amount >> UMS_DISK_LBA_SHIFT, (u8 *)bulk_ctxt->bulk_out_buf))
 				amount = 0;
 
@@ -706,6 +1218,12 @@ DPRINTF("file write %X @ %X\n", amount, lba_offset);
 		}
 	}
 
+	// A write still runs if the loop stopped before the next chunk came in.
+	if (wr_async)
+		ums->residue -= _scsi_write_wait(ums, &xfer, wr_lba_offset, wr_amount, bufs[cur ^ 1]);
+
+	_reset_buffer(bulk_ctxt, bulk_ctxt->bulk_out);
+
 	return UMS_RES_IO_ERROR; // No default reply.
 }
 
@@ -747,7 +1265,7 @@ static int _scsi_verify(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 			break;
 		}
 
-		if (!sdmmc_storage_read(ums->luns[ums->lun_idx].storage, ums->luns[ums->lun_idx].offset + lba_offset, amount, bulk_ctxt->bulk_in_buf))
+		if (!_lun_read(&ums->luns[ums->lun_idx], ums->luns[ums->lun_idx].offset + lba_offset, amount, bulk_ctxt->bulk_in_buf))
 			amount = 0;
 
 DPRINTF("File read %X @ %X\n", amount, lba_offset);
@@ -781,6 +1299,11 @@ static int _scsi_inquiry(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 		buf[3] = 20;  // Additional length.
 
 		buf += 4;
+#ifdef BDK_UMS_RAMDISK_SUPPORT
+		if (ums->luns[ums->lun_idx].type == MMC_RAMDISK)
+			strcpy((char *)buf, "0000 RAM ");
+		else
+#endif
 		s_printf((char *)buf, "%04X%s",
 			ums->luns[ums->lun_idx].storage->cid.serial, ums->luns[ums->lun_idx].type == MMC_SD ? " SD " : " eMMC ");
 
@@ -823,7 +1346,7 @@ static int _scsi_inquiry(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 		switch (ums->luns[ums->lun_idx].partition)
 		{
 		case 0:
-			s_printf((char *)buf, "%s", "SD RAW");
+			s_printf((char *)buf, "%s", ums->luns[ums->lun_idx].type == MMC_RAMDISK ? "RAM Disk" : "SD RAW");
 			break;
 		case EMMC_GPP + 1:
 			s_printf((char *)buf, "%s%s",
@@ -1131,6 +1654,237 @@ static int _scsi_prevent_allow_removal(usbd_gadget_ums_t *ums)
 	return UMS_RES_OK;
 }
 
+// Boot timeline. Header followed by id/timestamp pairs, see timeline.h.
+static int _scsi_read_timeline(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
+{
+	return timeline_export(bulk_ctxt->bulk_in_buf, MIN(ums->data_size_from_cmnd, USB_EP_BUFFER_MAX_SIZE));
+}
+
+#ifdef BDK_UMS_TRACE_SUPPORT
+// Command trace. Header followed by the entries from the sequence number in the LBA field on, see ums_trace.h.
+static int _scsi_read_trace(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
+{
+	return ums_trace_export(bulk_ctxt->bulk_in_buf, MIN(ums->data_size_from_cmnd, USB_EP_BUFFER_MAX_SIZE),
+		get_array_be_to_le32(&ums->cmnd[2]));
+}
+#endif
+
+#ifdef BDK_UMS_ACTMON_SUPPORT
+// Load samples. Header followed by the samples from the sequence number in the LBA field on, see ums_actmon.h.
+static int _scsi_read_actmon(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
+{
+	return ums_actmon_export(bulk_ctxt->bulk_in_buf, MIN(ums->data_size_from_cmnd, USB_EP_BUFFER_MAX_SIZE),
+		get_array_be_to_le32(&ums->cmnd[2]));
+}
+#endif
+
+#ifdef BDK_UMS_XTS_SUPPORT
+// Keys of a decrypted LUN, crypt key then tweak key. No data clears them.
+static int _scsi_set_xts_key(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
+{
+	logical_unit_t *lun = &ums->luns[ums->lun_idx];
+	u32 len = ums->data_size_from_cmnd;
+
+	if (!lun->xts_key || (len && len != UMS_XTS_KEY_SZ))
+	{
+		lun->sense_data = SS_INVALID_FIELD_IN_CDB;
+
+		return UMS_RES_INVALID_ARG;
+	}
+
+	if (len)
+	{
+		bulk_ctxt->bulk_out_length = len;
+		_transfer_start(ums, bulk_ctxt, bulk_ctxt->bulk_out, USB_XFER_SYNCED_DATA);
+		bulk_ctxt->bulk_out_buf_state = BUF_STATE_EMPTY;
+		ums->usb_amount_left -= len;
+
+		if (bulk_ctxt->bulk_out_status || bulk_ctxt->bulk_out_length_actual != len)
+		{
+			if (!bulk_ctxt->bulk_out_status)
+				ums->short_packet_received = 1;
+			lun->sense_data = SS_COMMUNICATION_FAILURE;
+
+			return UMS_RES_INVALID_ARG;
+		}
+		ums->residue -= len;
+
+		memcpy(lun->xts_key, bulk_ctxt->bulk_out_buf, UMS_XTS_KEY_SZ);
+		memset(bulk_ctxt->bulk_out_buf, 0, UMS_XTS_KEY_SZ);
+	}
+	else
+		memset(lun->xts_key, 0, UMS_XTS_KEY_SZ);
+
+	// Medium shows up or goes away, let the host re-read it.
+	lun->xts_key_set = len != 0;
+	lun->unit_attention_data = SS_NOT_READY_TO_READY_TRANSITION;
+	ums_xts.loaded = NULL;
+
+	return UMS_RES_OK;
+}
+
+static void _ums_xts_end()
+{
+	se_aes_key_clear(UMS_XTS_KS_CRYPT);
+	se_aes_key_clear(UMS_XTS_KS_TWEAK);
+	memset(&ums_xts, 0, sizeof(ums_xts));
+}
+#endif
+
+#ifdef BDK_UMS_COPY_SUPPORT
+static void _ums_copy_error(usbd_gadget_ums_t *ums, u32 sense, u32 lun_idx, u32 lba)
+{
+	logical_unit_t *lun = &ums->luns[ums->lun_idx];
+
+	lun->sense_data      = sense;
+	lun->sense_data_info = lba;
+	lun->info_valid      = 1;
+
+	ums_copy.err_lun = lun_idx;
+	ums_copy.err_lba = lba;
+}
+
+/*
+ * Copies between two LUNs without the data crossing USB. The command goes to
+ * the destination LUN, the source LUN is in byte 1. If the source is on the
+ * other controller, the next chunk is read while the current one is written.
+ */
+static int _scsi_copy_range(usbd_gadget_ums_t *ums)
+{
+	logical_unit_t *dst = &ums->luns[ums->lun_idx];
+	u32 src_idx = ums->cmnd[1] & 0xF;
+	u32 src_lba = get_array_be_to_le32(&ums->cmnd[2]);
+	u32 dst_lba = get_array_be_to_le32(&ums->cmnd[6]);
+	u32 cnt     = get_array_be_to_le32(&ums->cmnd[10]);
+
+	if (src_idx >= ums->lun_cnt || cnt > UMS_COPY_MAX_SECTORS)
+	{
+		dst->sense_data = SS_INVALID_FIELD_IN_CDB;
+
+		return UMS_RES_INVALID_ARG;
+	}
+
+	logical_unit_t *src = &ums->luns[src_idx];
+
+	if (dst->ro)
+	{
+		ums->set_text(ums->label, "Warn: Copy - RO");
+		dst->sense_data = SS_WRITE_PROTECTED;
+
+		return UMS_RES_INVALID_ARG;
+	}
+
+	bool src_present = !src->unmounted;
+#ifdef BDK_UMS_XTS_SUPPORT
+	src_present &= !src->xts_key || src->xts_key_set;
+#endif
+	if (!src_present)
+	{
+		dst->sense_data = SS_MEDIUM_NOT_PRESENT;
+
+		return UMS_RES_INVALID_ARG;
+	}
+
+	if (!cnt)
+		return UMS_RES_OK;
+
+	if (src_lba >= src->num_sectors || cnt > src->num_sectors - src_lba ||
+		dst_lba >= dst->num_sectors || cnt > dst->num_sectors - dst_lba)
+	{
+		ums->set_text(ums->label, "Warn: Copy - OOR");
+		dst->sense_data = SS_LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE;
+
+		return UMS_RES_INVALID_ARG;
+	}
+
+	// Chunks go front to back, so overlapping ranges on the same media are refused.
+	u32 src_start = src->offset + src_lba;
+	u32 dst_start = dst->offset + dst_lba;
+	if (src->storage == dst->storage && src->partition == dst->partition &&
+		src_start < dst_start + cnt && dst_start < src_start + cnt)
+	{
+		dst->sense_data = SS_INVALID_FIELD_IN_CDB;
+
+		return UMS_RES_INVALID_ARG;
+	}
+
+	u8 *bufs[2] = { (u8 *)USB_EP_BULK_IN_BUF_ADDR, (u8 *)USB_EP_BULK_OUT_BUF_ADDR };
+	u32 chunk = USB_EP_BULK_IN_MAX_XFER >> UMS_DISK_LBA_SHIFT;
+	sdmmc_storage_xfer_t xfer;
+
+	// Background reads are plain media access, decrypted LUNs take turns.
+	bool overlap = src->storage && src->storage != dst->storage;
+#ifdef BDK_UMS_XTS_SUPPORT
+	overlap &= !src->xts_key;
+#endif
+
+	u32 start_ms = get_tmr_ms();
+	u32 pos = 0;
+	u32 amount = MIN(chunk, cnt);
+	u32 cur = 0;
+
+	if (!_lun_read(src, src_start, amount, bufs[cur]))
+	{
+		ums->set_text(ums->label, "ERR: Copy - Read");
+		_ums_copy_error(ums, SS_UNRECOVERED_READ_ERROR, src_idx, src_lba);
+		goto out;
+	}
+
+	while (true)
+	{
+		u32 next = pos + amount;
+		u32 next_amount = MIN(chunk, cnt - next);
+
+		bool rd_async = overlap && next_amount && !_lun_boot_cache(src, src_start + next, next_amount) &&
+			_lun_set_partition(src) && sdmmc_storage_xfer_start(src->storage, &xfer, src_start + next, next_amount, bufs[cur ^ 1], 0);
+
+		int res = _lun_write(dst, dst_start + pos, amount, bufs[cur]);
+
+		if (rd_async)
+			rd_async = sdmmc_storage_xfer_wait(src->storage, &xfer);
+
+		if (!res)
+		{
+			ums->set_text(ums->label, "ERR: Copy - Write");
+			_ums_copy_error(ums, SS_WRITE_ERROR, ums->lun_idx, dst_lba + pos);
+			break;
+		}
+
+		pos = next;
+		if (!next_amount)
+		{
+			ums_copy.ranges++;
+			break;
+		}
+
+		cur ^= 1;
+		amount = next_amount;
+
+		// Also the retry if the background read failed.
+		if (!rd_async && !_lun_read(src, src_start + pos, amount, bufs[cur]))
+		{
+			ums->set_text(ums->label, "ERR: Copy - Read");
+			_ums_copy_error(ums, SS_UNRECOVERED_READ_ERROR, src_idx, src_lba + pos);
+			break;
+		}
+	}
+
+out:
+	ums_copy.sectors += pos;
+	ums_copy.time_ms += get_tmr_ms() - start_ms;
+
+	return UMS_RES_OK;
+}
+
+static int _scsi_copy_status(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
+{
+	ums_copy.magic = UMS_COPY_STATUS_MAGIC;
+	memcpy(bulk_ctxt->bulk_in_buf, &ums_copy, sizeof(ums_copy));
+
+	return sizeof(ums_copy);
+}
+#endif
+
 static int _scsi_read_format_capacities(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 {
 	u8 *buf = (u8 *)bulk_ctxt->bulk_in_buf;
@@ -1234,9 +1988,33 @@ DPRINTF("SCSI command: %X;  Dc=%d, D%c=%X;  Hc=%d, H%c=%X\n",
 		return UMS_RES_INVALID_ARG;
 	}
 
+#ifdef BDK_UMS_XTS_SUPPORT
+	// Same for a decrypted LUN without keys.
+	if (ums->luns[ums->lun_idx].xts_key && !ums->luns[ums->lun_idx].xts_key_set && needs_medium)
+	{
+		ums->luns[ums->lun_idx].sense_data = SS_MEDIUM_NOT_PRESENT;
+
+		return UMS_RES_INVALID_ARG;
+	}
+#endif
+
 	return UMS_RES_OK;
 }
 
+static void _scsi_first_read(usbd_gadget_ums_t *ums)
+{
+	static char txt_buf[32];
+
+	if (ums_first_read)
+		return;
+
+	ums_first_read = true;
+	timeline_mark(TIMELINE_SCSI_FIRST_READ);
+
+	s_printf(txt_buf, "Started UMS (%d ms)", timeline_get_time(TIMELINE_SCSI_FIRST_READ) / 1000);
+	ums->set_text(ums->label, txt_buf);
+}
+
 static int _parse_scsi_cmd(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 {
 	u32 len;
@@ -1308,6 +2086,7 @@ static int _parse_scsi_cmd(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 		break;
 
 	case SC_READ_6:
+		_scsi_first_read(ums);
 		len = ums->cmnd[4];
 		ums->data_size_from_cmnd = (len == 0 ? 256 : len) << UMS_DISK_LBA_SHIFT;
 		reply = _check_scsi_cmd(ums, 6, DATA_DIR_TO_HOST, (7<<1) | (1<<4), 1);
@@ -1316,6 +2095,7 @@ static int _parse_scsi_cmd(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 		break;
 
 	case SC_READ_10:
+		_scsi_first_read(ums);
 		ums->data_size_from_cmnd = get_array_be_to_le16(&ums->cmnd[7]) << UMS_DISK_LBA_SHIFT;
 		reply = _check_scsi_cmd(ums, 10, DATA_DIR_TO_HOST, (1<<1) | (0xf<<2) | (3<<7), 1);
 		if (reply == 0)
@@ -1323,6 +2103,7 @@ static int _parse_scsi_cmd(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 		break;
 
 	case SC_READ_12:
+		_scsi_first_read(ums);
 		ums->data_size_from_cmnd = get_array_be_to_le32(&ums->cmnd[6]) << UMS_DISK_LBA_SHIFT;
 		reply = _check_scsi_cmd(ums, 12, DATA_DIR_TO_HOST, (1<<1) | (0xf<<2) | (0xf<<6), 1);
 		if (reply == 0)
@@ -1364,6 +2145,11 @@ static int _parse_scsi_cmd(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 		break;
 
 	case SC_TEST_UNIT_READY:
+		if (!ums_first_tur)
+		{
+			ums_first_tur = true;
+			timeline_mark(TIMELINE_SCSI_FIRST_TUR);
+		}
 		ums->data_size_from_cmnd = 0;
 		reply = _check_scsi_cmd(ums, 6, DATA_DIR_NONE, 0, 1);
 		break;
@@ -1398,6 +2184,56 @@ static int _parse_scsi_cmd(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 			reply = _scsi_write(ums, bulk_ctxt);
 		break;
 
+	case SC_VENDOR_READ_TIMELINE:
+		ums->data_size_from_cmnd = get_array_be_to_le16(&ums->cmnd[7]);
+		reply = _check_scsi_cmd(ums, 10, DATA_DIR_TO_HOST, (3<<7), 0);
+		if (reply == 0)
+			reply = _scsi_read_timeline(ums, bulk_ctxt);
+		break;
+
+#ifdef BDK_UMS_TRACE_SUPPORT
+	case SC_VENDOR_READ_TRACE:
+		ums->data_size_from_cmnd = get_array_be_to_le16(&ums->cmnd[7]);
+		reply = _check_scsi_cmd(ums, 10, DATA_DIR_TO_HOST, (0xf<<2) | (3<<7), 0);
+		if (reply == 0)
+			reply = _scsi_read_trace(ums, bulk_ctxt);
+		break;
+#endif
+
+#ifdef BDK_UMS_XTS_SUPPORT
+	case SC_VENDOR_SET_XTS_KEY:
+		ums->data_size_from_cmnd = get_array_be_to_le16(&ums->cmnd[7]);
+		reply = _check_scsi_cmd(ums, 10, DATA_DIR_FROM_HOST, (3<<7), 0);
+		if (reply == 0)
+			reply = _scsi_set_xts_key(ums, bulk_ctxt);
+		break;
+#endif
+
+#ifdef BDK_UMS_COPY_SUPPORT
+	case SC_VENDOR_COPY_RANGE:
+		ums->data_size_from_cmnd = 0;
+		reply = _check_scsi_cmd(ums, 16, DATA_DIR_NONE, (1<<1) | (0xf<<2) | (0xf<<6) | (0xf<<10), 1);
+		if (reply == 0)
+			reply = _scsi_copy_range(ums);
+		break;
+
+	case SC_VENDOR_COPY_STATUS:
+		ums->data_size_from_cmnd = get_array_be_to_le16(&ums->cmnd[7]);
+		reply = _check_scsi_cmd(ums, 10, DATA_DIR_TO_HOST, (3<<7), 0);
+		if (reply == 0)
+			reply = _scsi_copy_status(ums, bulk_ctxt);
+		break;
+#endif
+
+#ifdef BDK_UMS_ACTMON_SUPPORT
+	case SC_VENDOR_READ_ACTMON:
+		ums->data_size_from_cmnd = get_array_be_to_le16(&ums->cmnd[7]);
+		reply = _check_scsi_cmd(ums, 10, DATA_DIR_TO_HOST, (0xf<<2) | (3<<7), 0);
+		if (reply == 0)
+			reply = _scsi_read_actmon(ums, bulk_ctxt);
+		break;
+#endif
+
 	// Mandatory commands that we don't implement. No need.
 	case SC_READ_HEADER:
 	case SC_READ_TOC:
@@ -1416,6 +2252,8 @@ static int _parse_scsi_cmd(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 		break;
 	}
 
+	ums_trace_length(ums->data_size_from_cmnd);
+
 	if (reply == UMS_RES_INVALID_ARG)
 		reply = 0;    // Error reply length.
 
@@ -1450,9 +2288,10 @@ static int _pad_with_zeros(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 	return UMS_RES_OK;
 }
 
+// Reads in all data the host still sends, one buffer at a time.
 static int _throw_away_data(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 {
-	if (bulk_ctxt->bulk_out_buf_state != BUF_STATE_EMPTY || ums->usb_amount_left > 0)
+	while (bulk_ctxt->bulk_out_buf_state != BUF_STATE_EMPTY || ums->usb_amount_left > 0)
 	{
 		// Try to submit another request if we need one.
 		if (bulk_ctxt->bulk_out_buf_state == BUF_STATE_EMPTY && ums->usb_amount_left > 0)
@@ -1463,7 +2302,7 @@ static int _throw_away_data(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 			_transfer_start(ums, bulk_ctxt, bulk_ctxt->bulk_out, USB_XFER_SYNCED_DATA);
 			ums->usb_amount_left -= amount;
 
-			return UMS_RES_OK;
+			continue;
 		}
 
 		// Throw away the data in a filled buffer.
@@ -1676,6 +2515,8 @@ static int _received_cbw(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 	// Save the command for later.
 	ums->cmnd_size = cbw->Length;
 	memcpy(ums->cmnd, cbw->CDB, ums->cmnd_size);
+	ums->cmd_start_us = get_tmr_us();
+	ums_trace_cmd(cbw->Tag, cbw->Lun, ums->cmnd);
 
 	if (cbw->Flags & USB_BULK_IN_FLAG)
 		ums->data_dir = DATA_DIR_TO_HOST;
@@ -1687,13 +2528,9 @@ static int _received_cbw(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 	if (ums->data_size == 0)
 		ums->data_dir = DATA_DIR_NONE;
 
+	// The eMMC partition is switched on the first media access.
 	if(cbw->Lun != ums->lun_idx){
 		DPRINTF("Change active LUN to %d (was %d)\n", cbw->Lun, ums->lun_idx);
-		if(ums->luns[cbw->Lun].type == MMC_EMMC && ums->luns[cbw->Lun].partition - 1 != ums->luns[cbw->Lun].storage->partition){
-			//No need to change part on SD
-			DPRINTF("Change active part. to %d (was %d)\n", ums->luns[cbw->Lun].partition - 1, ums->luns[cbw->Lun].storage->partition);
-			sdmmc_storage_set_mmc_partition(ums->luns[cbw->Lun].storage, ums->luns[cbw->Lun].partition - 1);
-		}
 		ums->lun_idx = cbw->Lun;
 	}
 
@@ -1753,6 +2590,8 @@ static void _send_status(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 	u8  status = USB_STATUS_PASS;
 	u32 sd = ums->luns[ums->lun_idx].sense_data;
 
+	ums_trace_data_done();
+
 	if (ums->phase_error)
 	{
 		ums->set_text(ums->label, "ERR: Phase-error");
@@ -1777,6 +2616,11 @@ static void _send_status(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
 
 	bulk_ctxt->bulk_in_length = USB_BULK_CS_WRAP_LEN;
 	_transfer_start(ums, bulk_ctxt, bulk_ctxt->bulk_in, USB_XFER_SYNCED_CMD);
+
+	ums_trace_status(status, sd);
+	ums_actmon_cmd_done();
+	if (ums->show_stats)
+		_ums_stats_cmd_done(ums);
 }
 
 static void _handle_exception(usbd_gadget_ums_t *ums, bulk_ctxt_t *bulk_ctxt)
@@ -1875,7 +2719,15 @@ int usb_device_gadget_ums(usb_ctxt_t *usbs)
 	}
 
 	ums.xusb = true;
-	xusb_device_get_ops(&usb_ops);
+#ifdef BDK_USB2_SUPPORT
+	if (usbs->backend == USB_BACKEND_USB2)
+	{
+		ums.xusb = false;
+		usb_device_get_ops(&usb_ops);
+	}
+	else
+#endif
+		xusb_device_get_ops(&usb_ops);
 
 	usbs->set_text(usbs->label, "Started USB");
 
@@ -1885,6 +2737,8 @@ int usb_device_gadget_ums(usb_ctxt_t *usbs)
 		return 1;
 	}
 
+	timeline_mark(TIMELINE_USB_INIT);
+
 	ums.state = UMS_STATE_NORMAL;
 	ums.can_stall = 0;
 
@@ -1894,10 +2748,35 @@ int usb_device_gadget_ums(usb_ctxt_t *usbs)
 	ums.bulk_ctxt.bulk_out     = USB_EP_BULK_OUT;
 	ums.bulk_ctxt.bulk_out_buf = (u8 *)USB_EP_BULK_OUT_BUF_ADDR;
 
+	// Bigger writes are faster. Use the extended buffer if the caller allows it.
+	ums.bulk_out_max_xfer = usbs->bulk_out_max_xfer ? MIN(usbs->bulk_out_max_xfer, USB_EP_BULK_OUT_EXT_MAX_XFER) : UMS_EP_OUT_MAX_XFER;
+	ums.read_io_max = usbs->read_io_max >> UMS_DISK_LBA_SHIFT;
+
 	// Set system functions
 	ums.label = usbs->label;
-	ums.set_text = usbs->set_text;
+	ums.set_text = _ums_set_text;
 	ums.system_maintenance = usbs->system_maintenance;
+	ums.show_stats = usbs->show_stats;
+
+	ums_status.label    = usbs->label;
+	ums_status.set_text = usbs->set_text;
+	ums_status.pending  = false;
+	ums_status.deferred = false;
+	ums_status.task     = -1;
+	ums_first_tur       = false;
+	ums_first_read      = false;
+	memset(&ums_boot_cache, 0, sizeof(ums_boot_cache));
+#ifdef BDK_UMS_XTS_SUPPORT
+	memset(&ums_xts, 0, sizeof(ums_xts));
+#endif
+#ifdef BDK_UMS_COPY_SUPPORT
+	memset(&ums_copy, 0, sizeof(ums_copy));
+	ums_copy.err_lba = 0xFFFFFFFF;
+#endif
+	int btn_task        = -1;
+	int stats_task      = -1;
+	int actmon_task     = -1;
+	int thermal_task    = -1;
 
 	// Set LUN parameters
 	ums.lun_idx = 16; //Set active LUN index to invalid value at the beginning
@@ -1915,7 +2794,23 @@ int usb_device_gadget_ums(usb_ctxt_t *usbs)
 		ums.luns[i].removable           = 1;
 		ums.luns[i].unit_attention_data = SS_RESET_OCCURRED;
 		ums.luns[i].num_sectors         = usbs->volumes[i].sectors;
+#ifdef BDK_UMS_XTS_SUPPORT
+		ums.luns[i].xts_key             = usbs->volumes[i].xts ? ums_xts.keys[i] : NULL;
+#endif
 		
+#ifdef BDK_UMS_RAMDISK_SUPPORT
+		if(ums.luns[i].type == MMC_RAMDISK){
+			// DRAM is expected to be initialized by the caller.
+			ums.luns[i].storage = NULL;
+			ums.luns[i].sdmmc   = NULL;
+			ums.luns[i].written = usbs->volumes[i].written;
+			if(!ums.luns[i].num_sectors){
+				ums.luns[i].num_sectors = (RAM_DISK_SZ >> UMS_DISK_LBA_SHIFT) - ums.luns[i].offset;
+			}
+			continue;
+		}
+#endif
+
 		if(ums.luns[i].type == MMC_SD){
 			if(!sd_used){
 				ums.set_text(ums.label, "Mounting SD");
@@ -1937,6 +2832,10 @@ int usb_device_gadget_ums(usb_ctxt_t *usbs)
 					ums.set_text(ums.label, "ERR: MMC init fail");
 					goto error;
 				}
+
+				// Boot partitions are boot_mult x 128KB.
+				ums_boot_cache.buf     = usbs->boot_cache;
+				ums_boot_cache.sectors = MIN(emmc_storage.ext_csd.boot_mult << 8, USB_UMS_BOOT_CACHE_SZ >> UMS_DISK_LBA_SHIFT);
 			}
 			ums.luns[i].storage = &emmc_storage;
 			ums.luns[i].sdmmc   = &emmc_sdmmc;
@@ -1955,6 +2854,8 @@ int usb_device_gadget_ums(usb_ctxt_t *usbs)
 		goto error;
 	}
 
+	timeline_mark(TIMELINE_USB_ENUMERATED);
+
 	ums.set_text(ums.label, "Waiting for LUN");
 
 	if (usb_ops.usb_device_class_send_max_lun(ums.lun_cnt - 1)){
@@ -1962,15 +2863,41 @@ int usb_device_gadget_ums(usb_ctxt_t *usbs)
 		goto error;
 	}
 
+	timeline_mark(TIMELINE_USB_MAX_LUN);
+
 	ums.set_text(ums.label, "Started UMS");
 
+	// Housekeeping is scheduled and also runs while waiting for USB events.
+	ums_status.task     = sched_add(_ums_status_task, NULL, 0);
+	btn_task            = sched_add(_ums_btn_task, &ums, UMS_BTN_POLL_US);
+	ums_status.deferred = ums_status.task >= 0;
+	if (ums.show_stats)
+	{
+		ums.stats_start_us = get_tmr_us();
+		stats_task         = sched_add(_ums_stats_task, &ums, UMS_STATS_PERIOD_US);
+	}
+#ifdef BDK_UMS_ACTMON_SUPPORT
+	actmon_task = sched_add(_ums_actmon_task, NULL, UMS_ACTMON_PERIOD_US);
+	if (actmon_task >= 0)
+		ums_actmon_start();
+#endif
+#ifdef BDK_UMS_THERMAL_SUPPORT
+	thermal_task = sched_add(_ums_thermal_task, NULL, UMS_THERMAL_PERIOD_US);
+	if (thermal_task >= 0)
+		ums_thermal_start();
+#endif
+
 	do{
 		// Do DRAM training and update system tasks.
 		// _system_maintainance(&ums);
 
+		sched_poll();
+
 		// Check for force unmount button combo.
-		if (btn_read_vol() == (BTN_VOL_UP | BTN_VOL_DOWN))
+		if (ums.stop_req)
 		{
+			ums.stop_req = false;
+
 			if (_get_prevent_media_removal(&ums))
 				ums.set_text(ums.label, "Unload prevented");
 			else
@@ -1983,6 +2910,11 @@ int usb_device_gadget_ums(usb_ctxt_t *usbs)
 			continue;
 		}
 
+#ifdef BDK_UMS_THERMAL_SUPPORT
+		if (sd_used && ums_thermal_sd_mode())
+			_ums_thermal_sd_switch(&ums);
+#endif
+
 		_handle_ep0_ctrl(&ums);
 
 		if (_get_next_command(&ums, &ums.bulk_ctxt) || (ums.state > UMS_STATE_NORMAL))
@@ -2003,6 +2935,15 @@ int usb_device_gadget_ums(usb_ctxt_t *usbs)
 		_send_status(&ums, &ums.bulk_ctxt);
 	} while (ums.state != UMS_STATE_TERMINATED);
 
+	// Draw any pending status and stop the housekeeping tasks.
+	ums_status.deferred = false;
+	_ums_status_task(NULL);
+	sched_remove(ums_status.task);
+	sched_remove(btn_task);
+	sched_remove(stats_task);
+	sched_remove(actmon_task);
+	sched_remove(thermal_task);
+
 	if (_get_prevent_media_removal(&ums))
 		ums.set_text(ums.label, "ERR: Unsafe eject");
 	else
@@ -2013,12 +2954,33 @@ error:
 	res = 1;
 
 exit:
+#ifdef BDK_UMS_RAMDISK_SUPPORT
+	// LUNs not set up yet have no type and keep what the caller passed.
+	for (u32 i = 0; i < usbs->volumes_cnt; i++)
+		if (ums.luns[i].type == MMC_RAMDISK)
+			usbs->volumes[i].written = ums.luns[i].written;
+#endif
+
 	if (mmc_used)
 		emmc_end();
 
 	if (sd_used)
 		sd_end();
 
+	timeline_mark(TIMELINE_UMS_END);
+
+#ifdef BDK_UMS_XTS_SUPPORT
+	_ums_xts_end();
+#endif
+#ifdef BDK_UMS_ACTMON_SUPPORT
+	if (actmon_task >= 0)
+		ums_actmon_end();
+#endif
+#ifdef BDK_UMS_THERMAL_SUPPORT
+	if (thermal_task >= 0)
+		ums_thermal_end();
+#endif
+
 init_fail:
 	usb_ops.usbd_end(true, false);
 
@@ -33,9 +33,14 @@
 #include <soc/timer.h>
 #include <soc/t210.h>
 #include <utils/btn.h>
+#include <utils/sched.h>
 
 #include <memory_map.h>
 
+// Enough 16KB dTDs to cover the extended bulk OUT transfer in a single list.
+#define USB_EP_DTD_CNT 8
+#define USB_EP_DTD_MAX_XFER (USB_EP_DTD_CNT * USB_TD_BUFFER_MAX_SIZE)
+
 typedef enum
 {
 	USB_HW_EP0 = 0,
@@ -81,7 +86,7 @@ typedef struct _dQH_t
 
 typedef struct _usbd_t
 {
-	volatile dTD_t dtds[4 * 4]; // 4 dTD per endpoint.
+	volatile dTD_t dtds[4 * USB_EP_DTD_CNT]; // 8 dTD per endpoint.
 	volatile dQH_t *qhs;
 	int ep_configured[4];
 	int ep_bytes_requested[4];
@@ -113,6 +118,12 @@ extern u32 hid_report_descriptor_touch_size;
 extern usb_desc_t usb_gadget_hid_jc_descriptors;
 extern usb_desc_t usb_gadget_hid_touch_descriptors;
 extern usb_desc_t usb_gadget_ums_descriptors;
+#ifdef BDK_USB_LOOPBACK_SUPPORT
+extern usb_desc_t usb_gadget_loopback_descriptors;
+#endif
+#ifdef BDK_USB_IMAGE_SUPPORT
+extern usb_desc_t usb_gadget_image_descriptors;
+#endif
 
 usbd_t *usbdaemon;
 
@@ -516,7 +527,7 @@ static void _usbd_initialize_ep_ctrl(u32 endpoint)
 	{
 		u32 endpoint_type = usbd_otg->regs->endptctrl[actual_ep] & ~USB2D_ENDPTCTRL_TX_EP_TYPE_MASK;
 		if (actual_ep)
-			endpoint_type |= usbd_otg->gadget ? USB2D_ENDPTCTRL_TX_EP_TYPE_INTR : USB2D_ENDPTCTRL_TX_EP_TYPE_BULK;
+			endpoint_type |= usbd_otg->gadget == USB_GADGET_HID_GAMEPAD || usbd_otg->gadget == USB_GADGET_HID_TOUCHPAD ? USB2D_ENDPTCTRL_TX_EP_TYPE_INTR : USB2D_ENDPTCTRL_TX_EP_TYPE_BULK;
 		else
 			endpoint_type |= USB2D_ENDPTCTRL_TX_EP_TYPE_CTRL;
 
@@ -533,7 +544,7 @@ static void _usbd_initialize_ep_ctrl(u32 endpoint)
 	{
 		u32 endpoint_type = usbd_otg->regs->endptctrl[actual_ep] & ~USB2D_ENDPTCTRL_RX_EP_TYPE_MASK;
 		if (actual_ep)
-			endpoint_type |= usbd_otg->gadget ? USB2D_ENDPTCTRL_RX_EP_TYPE_INTR : USB2D_ENDPTCTRL_RX_EP_TYPE_BULK;
+			endpoint_type |= usbd_otg->gadget == USB_GADGET_HID_GAMEPAD || usbd_otg->gadget == USB_GADGET_HID_TOUCHPAD ? USB2D_ENDPTCTRL_RX_EP_TYPE_INTR : USB2D_ENDPTCTRL_RX_EP_TYPE_BULK;
 		else
 			endpoint_type |= USB2D_ENDPTCTRL_RX_EP_TYPE_CTRL;
 
@@ -550,7 +561,7 @@ static void _usbd_initialize_ep_ctrl(u32 endpoint)
 static int _usbd_initialize_ep0()
 {
 	memset((void *)usbdaemon->qhs,  0, sizeof(dQH_t) * 4); // Clear all used EP queue heads.
-	memset((void *)usbdaemon->dtds, 0, sizeof(dTD_t) * 4); // Clear all used EP0 token heads.
+	memset((void *)usbdaemon->dtds, 0, sizeof(dTD_t) * 2 * USB_EP_DTD_CNT); // Clear all used EP0 token heads.
 
 	usbd_otg->regs->asynclistaddr = (u32)usbdaemon->qhs;
 
@@ -671,7 +682,7 @@ static void _usbd_mark_ep_complete(u32 endpoint)
 
 	usbd_flush_endpoint(endpoint);
 
-	memset((void *)&usbdaemon->dtds[endpoint * 4], 0, sizeof(dTD_t) * 4);
+	memset((void *)&usbdaemon->dtds[endpoint * USB_EP_DTD_CNT], 0, sizeof(dTD_t) * USB_EP_DTD_CNT);
 	memset((void *)&usbdaemon->qhs[endpoint],      0, sizeof(dQH_t));
 
 	usbdaemon->ep_configured[endpoint]      = 0;
@@ -737,16 +748,21 @@ static usb_ep_status_t _usbd_get_ep_status(usb_ep_t endpoint)
 	return USB_EP_STATUS_IDLE;
 }
 
+// Primes one dTD list per call. The endpoint is reset first, so a list is never appended to one that is still active.
+//! TODO: Append the next list to an active one (ATDTW tripwire) to keep the endpoint primed across transfers.
 static int _usbd_ep_operation(usb_ep_t endpoint, u8 *buf, u32 len, u32 sync_timeout)
 {
 	if (!buf)
 		len = 0;
 
+	if (len > USB_EP_DTD_MAX_XFER)
+		len = USB_EP_DTD_MAX_XFER;
+
 	u32 prime_bit;
 	usb_hw_ep_t actual_ep = (endpoint & 2) >> 1;
 	usb_dir_t direction = endpoint & 1;
 	u32 length_left = len;
-	u32 dtd_ep_idx = endpoint * 4;
+	u32 dtd_ep_idx = endpoint * USB_EP_DTD_CNT;
 
 	_usbd_mark_ep_complete(endpoint);
 
@@ -825,6 +841,7 @@ static int _usbd_ep_operation(usb_ep_t endpoint, u8 *buf, u32 len, u32 sync_time
 						res = USB2_ERROR_XFER_EP_DISABLED;
 					goto out;
 				}
+				sched_poll();
 				retries--;
 				usleep(1);
 			}
@@ -937,7 +954,7 @@ static void _usbd_handle_get_descriptor(bool *transmit_data, void **descriptor,
 		return;
 		}
 	case USB_DESCRIPTOR_CONFIGURATION:
-		if (usbd_otg->gadget == USB_GADGET_UMS)
+		if (usbd_otg->gadget == USB_GADGET_UMS || usbd_otg->gadget == USB_GADGET_LOOPBACK || usbd_otg->gadget == USB_GADGET_IMAGE)
 		{
 			if (usbd_otg->port_speed == USB_HIGH_SPEED) // High speed. 512 bytes.
 			{
@@ -1193,7 +1210,8 @@ static int _usbd_handle_ep0_control_transfer()
 			memset(descriptor, 0, _wLength);
 			size = _wLength;
 		}
-		else if (_bRequest == USB_REQUEST_GET_DESCRIPTOR && (_wValue >> 8) == USB_DESCRIPTOR_HID_REPORT && usbd_otg->gadget > USB_GADGET_UMS)
+		else if (_bRequest == USB_REQUEST_GET_DESCRIPTOR && (_wValue >> 8) == USB_DESCRIPTOR_HID_REPORT &&
+				 (usbd_otg->gadget == USB_GADGET_HID_GAMEPAD || usbd_otg->gadget == USB_GADGET_HID_TOUCHPAD))
 		{
 			if (usbd_otg->gadget == USB_GADGET_HID_GAMEPAD)
 			{
@@ -1386,6 +1404,20 @@ int usb_device_enumerate(usb_gadget_type gadget)
 	case USB_GADGET_HID_TOUCHPAD:
 		usbd_otg->desc = &usb_gadget_hid_touch_descriptors;
 		break;
+	case USB_GADGET_LOOPBACK:
+#ifdef BDK_USB_LOOPBACK_SUPPORT
+		usbd_otg->desc = &usb_gadget_loopback_descriptors;
+		break;
+#else
+		return USB_ERROR_INIT;
+#endif
+	case USB_GADGET_IMAGE:
+#ifdef BDK_USB_IMAGE_SUPPORT
+		usbd_otg->desc = &usb_gadget_image_descriptors;
+		break;
+#else
+		return USB_ERROR_INIT;
+#endif
 	}
 
 	usbd_otg->gadget = gadget;
@@ -1446,28 +1478,16 @@ int usb_device_ep1_out_read_big(u8 *buf, u32 len, u32 *bytes_read)
 	if ((u32)buf % USB_EP_BUFFER_ALIGN)
 		return USB2_ERROR_XFER_NOT_ALIGNED;
 
-	if (len > USB_EP_BULK_OUT_MAX_XFER)
-		len = USB_EP_BULK_OUT_MAX_XFER;
+	// Caller must make sure that the buffer can take more than the default max.
+	if (len > USB_EP_BULK_OUT_EXT_MAX_XFER)
+		len = USB_EP_BULK_OUT_EXT_MAX_XFER;
 
-	int res;
-	u32 bytes = 0;
-	*bytes_read = 0;
-	u8 *buf_curr = buf;
+	// All dTDs are primed as one list, so the controller moves to the next one without waiting for software.
+	int res = _usbd_ep_operation(USB_EP_BULK_OUT, buf, len, USB_XFER_SYNCED_DATA);
 
-	while (len)
-	{
-		u32 len_ep = MIN(len, USB_EP_BUFFER_MAX_SIZE);
+	*bytes_read = res ? 0 : len;
 
-		res = usb_device_ep1_out_read(buf_curr, len_ep, &bytes, USB_XFER_SYNCED_DATA);
-		if (res)
-			return res;
-
-		len -= len_ep;
-		buf_curr += len_ep;
-		*bytes_read = *bytes_read + bytes;
-	}
-
-	return USB_RES_OK;
+	return res;
 }
 
 static int _usbd_get_ep1_out_bytes_read()
@@ -1488,6 +1508,7 @@ int usb_device_ep1_out_reading_finish(u32 *pending_bytes, u32 sync_timeout)
 			break;
 
 		usbd_handle_ep0_ctrl_setup();
+		sched_poll();
 	}
 	while ((ep_status == USB_EP_STATUS_ACTIVE) || (ep_status == USB_EP_STATUS_STALLED));
 
@@ -1519,6 +1540,23 @@ int usb_device_ep1_in_write(u8 *buf, u32 len, u32 *bytes_written, u32 sync_timeo
 	return res;
 }
 
+int usb_device_ep1_in_write_big(u8 *buf, u32 len, u32 *bytes_written)
+{
+	if ((u32)buf % USB_EP_BUFFER_ALIGN)
+		return USB2_ERROR_XFER_NOT_ALIGNED;
+
+	// Caller must make sure that the buffer holds more than the default max.
+	if (len > USB_EP_BULK_OUT_EXT_MAX_XFER)
+		len = USB_EP_BULK_OUT_EXT_MAX_XFER;
+
+	int res = _usbd_ep_operation(USB_EP_BULK_IN, buf, len, USB_XFER_SYNCED_DATA);
+
+	if (bytes_written)
+		*bytes_written = res ? 0 : len;
+
+	return res;
+}
+
 static int _usbd_get_ep1_in_bytes_written()
 {
 	if (_usbd_get_ep_status(USB_EP_BULK_IN) != USB_EP_STATUS_IDLE)
@@ -1537,6 +1575,7 @@ int usb_device_ep1_in_writing_finish(u32 *pending_bytes, u32 sync_timeout)
 			break;
 
 		usbd_handle_ep0_ctrl_setup();
+		sched_poll();
 	}
 	while ((ep_status == USB_EP_STATUS_ACTIVE) || (ep_status == USB_EP_STATUS_STALLED));
 
@@ -1613,6 +1652,7 @@ void usb_device_get_ops(usb_ops_t *ops)
 	ops->usb_device_ep1_out_read_big       = usb_device_ep1_out_read_big;
 	ops->usb_device_ep1_out_reading_finish = usb_device_ep1_out_reading_finish;
 	ops->usb_device_ep1_in_write           = usb_device_ep1_in_write;
+	ops->usb_device_ep1_in_write_big       = usb_device_ep1_in_write_big;
 	ops->usb_device_ep1_in_writing_finish  = usb_device_ep1_in_writing_finish;
 }
 
@@ -48,8 +48,16 @@ typedef enum _usb_gadget_type
 	USB_GADGET_UMS          = 0,
 	USB_GADGET_HID_GAMEPAD  = 1,
 	USB_GADGET_HID_TOUCHPAD = 2,
+	USB_GADGET_LOOPBACK     = 3,
+	USB_GADGET_IMAGE        = 4,
 } usb_gadget_type;
 
+typedef enum _usb_backend_t
+{
+	USB_BACKEND_XUSB = 0, // XUSB device controller (USB3/USB2 PHY).
+	USB_BACKEND_USB2 = 1, // ChipIdea USB2 device controller.
+} usb_backend_t;
+
 typedef enum {
 	USB_DIR_OUT = 0,
 	USB_DIR_IN  = 1,
@@ -178,6 +186,7 @@ typedef struct _usb_ops_t
 	int  (*usb_device_ep1_out_read_big)(u8 *, u32, u32 *);
 	int  (*usb_device_ep1_out_reading_finish)(u32 *, u32);
 	int  (*usb_device_ep1_in_write)(u8 *, u32, u32 *, u32);
+	int  (*usb_device_ep1_in_write_big)(u8 *, u32, u32 *);
 	int  (*usb_device_ep1_in_writing_finish)(u32 *, u32);
 	bool (*usb_device_get_suspended)();
 	bool (*usb_device_get_port_in_sleep)();
@@ -189,8 +198,26 @@ typedef struct usb_ctxt_vol_t{
 	u32 offset;
 	u32 sectors;
 	u32 ro;
+	u32 xts; // Encrypted with BIS style AES-XTS, keys come from the host. Needs BDK_UMS_XTS_SUPPORT.
+	u32 written; // RAM disk, in/out: sectors from the start that hold host data or zeros.
 }usb_ctxt_vol_t;
 
+#define USB_UMS_BOOT_CACHE_SZ SZ_4M // Per boot partition.
+
+// Per LUN, rates over the last stats period.
+typedef struct _usb_ums_stats_t
+{
+	u32 lun;
+	u32 type;      // Same as usb_ctxt_vol_t.
+	u32 partition;
+	u32 rd_kbps;
+	u32 wr_kbps;
+	u32 iops;      // Read/write commands per second.
+	u32 lat_us;    // Average read/write command time, CBW to CSW.
+	u64 bytes;     // Read and written since start.
+	u32 part_switches; // eMMC partition switches to this LUN since start.
+} usb_ums_stats_t;
+
 typedef struct _usb_ctxt_t
 {
 	u32 volumes_cnt;
@@ -198,6 +225,11 @@ typedef struct _usb_ctxt_t
 	void (*system_maintenance)(bool);
 	void *label;
 	void (*set_text)(void *, const char *);
+	void (*show_stats)(void *, const usb_ums_stats_t *); // Optional. Called for LUNs with changes, every 500ms at most.
+	u32 bulk_out_max_xfer; // 0: USB_EP_BULK_OUT_MAX_XFER.
+	u32 read_io_max;       // Max SDMMC read size in bytes. 0: 32KB, 64KB for 512KB+ reads.
+	void *boot_cache;      // Optional, 2 x USB_UMS_BOOT_CACHE_SZ. Serves BOOT0/BOOT1 reads without partition switches.
+	u32 backend;           // usb_backend_t.
 } usb_ctxt_t;
 
 void usb_device_get_ops(usb_ops_t *ops);
@@ -205,5 +237,7 @@ void xusb_device_get_ops(usb_ops_t *ops);
 
 int  usb_device_gadget_ums(usb_ctxt_t *usbs);
 int  usb_device_gadget_hid(usb_ctxt_t *usbs);
+int  usb_device_gadget_loopback(usb_ctxt_t *usbs);
+int  usb_device_gadget_image(usb_ctxt_t *usbs);
 
 #endif
\ No newline at end of file
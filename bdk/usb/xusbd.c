@@ -31,6 +31,7 @@
 #include <soc/timer.h>
 #include <soc/t210.h>
 #include <utils/btn.h>
+#include <utils/sched.h>
 
 #include <memory_map.h>
 
@@ -370,6 +371,9 @@ typedef struct _xusbd_controller_t
 	u32 device_state;
 	u32 tx_bytes[2];
 	u32 tx_count[2];
+	u8 *xfer_buf[2];         // Start of the last issued bulk transfer.
+	data_trb_t *td_last[2];  // Last TRB of the last issued bulk transfer.
+	data_trb_t *td_skip[2];  // Last TRB of a chain that was ended by a short packet.
 	u32 ctrl_seq_num;
 	u32 config_num;
 	u32 interface_num;
@@ -391,6 +395,12 @@ extern u8 hid_report_descriptor_touch[];
 extern usb_desc_t usb_gadget_hid_jc_descriptors;
 extern usb_desc_t usb_gadget_hid_touch_descriptors;
 extern usb_desc_t usb_gadget_ums_descriptors;
+#ifdef BDK_USB_LOOPBACK_SUPPORT
+extern usb_desc_t usb_gadget_loopback_descriptors;
+#endif
+#ifdef BDK_USB_IMAGE_SUPPORT
+extern usb_desc_t usb_gadget_image_descriptors;
+#endif
 
 // All rings and EP context must be aligned to 0x10.
 typedef struct _xusbd_event_queues_t
@@ -423,6 +433,22 @@ static int _xusb_xhci_mask_wait(u32 reg, u32 mask, u32 val, u32 retries)
 	return USB_ERROR_TIMEOUT;
 }
 
+// Same as above, but lets scheduled tasks run while waiting for an event.
+static int _xusb_event_wait(u32 retries)
+{
+	do
+	{
+		if (XUSB_DEV_XHCI(XUSB_DEV_XHCI_ST) & XHCI_ST_IP)
+			return USB_RES_OK;
+		sched_poll();
+		usleep(1);
+		--retries;
+	}
+	while (retries);
+
+	return USB_ERROR_TIMEOUT;
+}
+
 // Event rings aligned to 0x10
 static void _xusbd_ep_init_event_ring()
 {
@@ -510,6 +536,8 @@ static void _xusb_ep_set_type_and_metrics(u32 ep_idx, volatile xusb_ep_ctx_t *ep
 		switch (usbd_xotg->gadget)
 		{
 		case USB_GADGET_UMS:
+		case USB_GADGET_LOOPBACK:
+		case USB_GADGET_IMAGE:
 			ep_ctxt->avg_trb_len = 3072;
 			break;
 		case USB_GADGET_HID_GAMEPAD:
@@ -599,6 +627,8 @@ static void _xusb_ep_set_type_and_metrics(u32 ep_idx, volatile xusb_ep_ctx_t *ep
 		switch (usbd_xotg->gadget)
 		{
 		case USB_GADGET_UMS:
+		case USB_GADGET_LOOPBACK:
+		case USB_GADGET_IMAGE:
 			ep_ctxt->avg_trb_len = 3072;
 			break;
 		case USB_GADGET_HID_GAMEPAD:
@@ -794,6 +824,7 @@ static void _xusb_disable_ep1()
 	usbd_xotg->device_state = XUSB_DEFAULT;
 }
 
+// UTMI (USB2) pad only. SuperSpeed also needs the UPHY lane and PLLE, which are not set up, so links train at HS at most.
 static void _xusb_init_phy()
 {
 	// Configure and enable PLLU.
@@ -1011,6 +1042,27 @@ static void _xusb_device_power_down()
 	CLOCK(CLK_RST_CONTROLLER_CLK_ENB_W_CLR) = BIT(CLK_W_XUSB);
 }
 
+static void _xusb_ring_doorbell(u32 ep_idx)
+{
+	// Flush data before transfer.
+	bpmp_mmu_maintenance(BPMP_MMU_MAINT_CLEAN_WAY, false);
+
+	u32 target_id = (ep_idx << 8) & 0xFFFF;
+	if (ep_idx == XUSB_EP_CTRL_IN)
+		target_id |= usbd_xotg->ctrl_seq_num << 16;
+
+	XUSB_DEV_XHCI(XUSB_DEV_XHCI_DB) = target_id;
+}
+
+static data_trb_t *_xusb_next_trb(data_trb_t *trb)
+{
+	trb++;
+	if (trb->trb_type == XUSB_TRB_LINK)
+		trb = (data_trb_t *)(trb->databufptr_lo & 0xFFFFFFF0);
+
+	return trb;
+}
+
 static int _xusb_queue_trb(u32 ep_idx, const void *trb, bool ring_doorbell)
 {
 	int res = USB_RES_OK;
@@ -1039,6 +1091,10 @@ static int _xusb_queue_trb(u32 ep_idx, const void *trb, bool ring_doorbell)
 		break;
 
 	case USB_EP_BULK_OUT:
+		// Slot is reused, a late event for a skipped chain can no longer come.
+		if (usbd_xotg->bulkout_epenqueue_ptr == usbd_xotg->td_skip[USB_DIR_OUT])
+			usbd_xotg->td_skip[USB_DIR_OUT] = NULL;
+
 		memcpy(usbd_xotg->bulkout_epenqueue_ptr, trb, sizeof(data_trb_t));
 
 		// Advance queue and if Link TRB set index to 0 and toggle cycle bit.
@@ -1048,6 +1104,7 @@ static int _xusb_queue_trb(u32 ep_idx, const void *trb, bool ring_doorbell)
 			link_trb = (link_trb_t *)next_trb;
 			link_trb->cycle = usbd_xotg->bulkout_producer_cycle & 1;
 			link_trb->toggle_cycle = 1;
+			link_trb->chain = ((const normal_trb_t *)trb)->chain; // Chain must go through the link.
 
 			next_trb = (data_trb_t *)(link_trb->ring_seg_ptrlo << 4);
 
@@ -1057,6 +1114,10 @@ static int _xusb_queue_trb(u32 ep_idx, const void *trb, bool ring_doorbell)
 		break;
 
 	case USB_EP_BULK_IN:
+		// Slot is reused, a late event for a skipped chain can no longer come.
+		if (usbd_xotg->bulkin_epenqueue_ptr == usbd_xotg->td_skip[USB_DIR_IN])
+			usbd_xotg->td_skip[USB_DIR_IN] = NULL;
+
 		memcpy(usbd_xotg->bulkin_epenqueue_ptr, trb, sizeof(data_trb_t));
 
 		// Advance queue and if Link TRB set index to 0 and toggle cycle bit.
@@ -1066,6 +1127,7 @@ static int _xusb_queue_trb(u32 ep_idx, const void *trb, bool ring_doorbell)
 			link_trb = (link_trb_t *)next_trb;
 			link_trb->cycle = usbd_xotg->bulkin_producer_cycle & 1;
 			link_trb->toggle_cycle = 1;
+			link_trb->chain = ((const normal_trb_t *)trb)->chain; // Chain must go through the link.
 
 			next_trb = (data_trb_t *)(link_trb->ring_seg_ptrlo << 4);
 
@@ -1082,16 +1144,7 @@ static int _xusb_queue_trb(u32 ep_idx, const void *trb, bool ring_doorbell)
 
 	// Ring doorbell.
 	if (ring_doorbell)
-	{
-		// Flush data before transfer.
-		bpmp_mmu_maintenance(BPMP_MMU_MAINT_CLEAN_WAY, false);
-
-		u32 target_id = (ep_idx << 8) & 0xFFFF;
-		if (ep_idx == XUSB_EP_CTRL_IN)
-			target_id |= usbd_xotg->ctrl_seq_num << 16;
-
-		XUSB_DEV_XHCI(XUSB_DEV_XHCI_DB) = target_id;
-	}
+		_xusb_ring_doorbell(ep_idx);
 
 	return res;
 }
@@ -1171,6 +1224,9 @@ static int _xusb_issue_normal_trb(u8 *buf, u32 len, usb_dir_t direction)
 	if (direction == USB_DIR_OUT)
 		ep_idx = USB_EP_BULK_OUT;
 
+	usbd_xotg->xfer_buf[direction] = buf;
+	usbd_xotg->td_last[direction]  = direction == USB_DIR_OUT ? usbd_xotg->bulkout_epenqueue_ptr : usbd_xotg->bulkin_epenqueue_ptr;
+
 	int res = _xusb_queue_trb(ep_idx, &trb, EP_RING_DOORBELL);
 	if (!res)
 		usbd_xotg->wait_for_event_trb = XUSB_TRB_NORMAL;
@@ -1178,6 +1234,83 @@ static int _xusb_issue_normal_trb(u8 *buf, u32 len, usb_dir_t direction)
 	return res;
 }
 
+/*
+ * Queue a transfer as one TD of chained normal TRBs, split at 64KB boundaries.
+ * Only the last TRB interrupts on completion and the doorbell is rung once,
+ * so the controller streams the whole transfer without CPU intervention.
+ */
+static int _xusb_issue_normal_trb_chain(u8 *buf, u32 len, usb_dir_t direction)
+{
+	u32 trbs = 0;
+	u32 max_packet = 64;
+	if (usbd_xotg->port_speed == XUSB_SUPER_SPEED)
+		max_packet = 1024;
+	else if (usbd_xotg->port_speed == XUSB_HIGH_SPEED)
+		max_packet = 512;
+
+	// A TRB buffer must not cross a 64KB boundary.
+	for (u32 pos = (u32)buf, left = len; left; trbs++)
+	{
+		u32 trb_len = MIN(left, SZ_64K - (pos & (SZ_64K - 1)));
+		pos  += trb_len;
+		left -= trb_len;
+	}
+
+	if (trbs <= 1)
+		return _xusb_issue_normal_trb(buf, len, direction);
+
+	// Keep one free slot, so a full ring is never mistaken for an empty one.
+	if (trbs > XUSB_LINK_TRB_IDX - 1)
+		return USB_ERROR_XFER_ERROR;
+
+	u32 ep_idx = USB_EP_BULK_IN;
+	data_trb_t **enqueue_ptr = &usbd_xotg->bulkin_epenqueue_ptr;
+	if (direction == USB_DIR_OUT)
+	{
+		ep_idx = USB_EP_BULK_OUT;
+		enqueue_ptr = &usbd_xotg->bulkout_epenqueue_ptr;
+	}
+
+	data_trb_t *first_trb = *enqueue_ptr;
+	u32 first_cycle = 0;
+
+	usbd_xotg->xfer_buf[direction] = buf;
+
+	while (len)
+	{
+		normal_trb_t trb = {0};
+		u32 trb_len = MIN(len, SZ_64K - ((u32)buf & (SZ_64K - 1)));
+		u32 packets_left = (len - trb_len + max_packet - 1) / max_packet;
+
+		_xusb_create_normal_trb(&trb, buf, trb_len, direction);
+		trb.td_size = MIN(packets_left, 31);
+		trb.chain   = len != trb_len;
+		trb.ioc     = len == trb_len;
+
+		// Hand the first TRB over last, after the rest of the chain is in place.
+		if (*enqueue_ptr == first_trb)
+		{
+			first_cycle = trb.cycle;
+			trb.cycle ^= 1;
+		}
+
+		if (!trb.chain)
+			usbd_xotg->td_last[direction] = *enqueue_ptr;
+
+		_xusb_queue_trb(ep_idx, &trb, EP_DONT_RING);
+
+		buf += trb_len;
+		len -= trb_len;
+	}
+
+	first_trb->cycle = first_cycle;
+	usbd_xotg->wait_for_event_trb = XUSB_TRB_NORMAL;
+
+	_xusb_ring_doorbell(ep_idx);
+
+	return USB_RES_OK;
+}
+
 static int _xusb_issue_data_trb(u8 *buf, u32 len, usb_dir_t direction)
 {
 	data_trb_t trb = {0};
@@ -1230,6 +1363,8 @@ static int _xusb_handle_transfer_event(const transfer_event_trb_t *trb)
 {
 	// Advance dequeue list.
 	data_trb_t *next_trb;
+	data_trb_t *event_trb = NULL;
+	usb_dir_t dir;
 	switch (trb->ep_id)
 	{
 	case XUSB_EP_CTRL_IN:
@@ -1239,16 +1374,30 @@ static int _xusb_handle_transfer_event(const transfer_event_trb_t *trb)
 		usbd_xotg->cntrl_epdequeue_ptr = next_trb;
 		break;
 	case USB_EP_BULK_OUT:
-		next_trb = &usbd_xotg->bulkout_epdequeue_ptr[1];
-		if (next_trb->trb_type == XUSB_TRB_LINK)
-			next_trb = (data_trb_t *)(next_trb->databufptr_lo & 0xFFFFFFF0);
-		usbd_xotg->bulkout_epdequeue_ptr = next_trb;
-		break;
 	case USB_EP_BULK_IN:
-		next_trb = &usbd_xotg->bulkin_epdequeue_ptr[1];
-		if (next_trb->trb_type == XUSB_TRB_LINK)
-			next_trb = (data_trb_t *)(next_trb->databufptr_lo & 0xFFFFFFF0);
-		usbd_xotg->bulkin_epdequeue_ptr = next_trb;
+		dir = trb->ep_id == USB_EP_BULK_IN ? USB_DIR_IN : USB_DIR_OUT;
+		event_trb = (data_trb_t *)trb->trb_pointer_lo;
+
+		// The controller may still report the IOC TRB of a chain that a short packet ended.
+		if (event_trb == usbd_xotg->td_skip[dir])
+		{
+			usbd_xotg->td_skip[dir] = NULL;
+			return USB_RES_OK;
+		}
+
+		// A short packet ends the TD, the rest of the chain is not executed.
+		next_trb = event_trb;
+		if (trb->comp_code == XUSB_COMP_SHORT_PKT && event_trb != usbd_xotg->td_last[dir])
+		{
+			next_trb = usbd_xotg->td_last[dir];
+			usbd_xotg->td_skip[dir] = next_trb;
+		}
+		next_trb = _xusb_next_trb(next_trb);
+
+		if (dir == USB_DIR_OUT)
+			usbd_xotg->bulkout_epdequeue_ptr = next_trb;
+		else
+			usbd_xotg->bulkin_epdequeue_ptr = next_trb;
 		break;
 	default:
 		// Should never happen.
@@ -1297,7 +1446,9 @@ static int _xusb_handle_transfer_event(const transfer_event_trb_t *trb)
 
 		case USB_EP_BULK_OUT:
 			// If short packet and Bulk OUT, it's not an error because we prime EP for 4KB.
-			usbd_xotg->tx_bytes[USB_DIR_OUT] -= trb->trb_tx_len;
+			// Residue is per TRB, so count from the start of the transfer for chains.
+			usbd_xotg->tx_bytes[USB_DIR_OUT] = event_trb->databufptr_lo + event_trb->trb_tx_len - trb->trb_tx_len -
+											   (u32)usbd_xotg->xfer_buf[USB_DIR_OUT];
 			if (usbd_xotg->tx_count[USB_DIR_OUT])
 				usbd_xotg->tx_count[USB_DIR_OUT]--;
 			break;
@@ -1518,7 +1669,7 @@ static int _xusb_handle_get_descriptor(const usb_ctrl_setup_t *ctrl_setup)
 		break;
 	case USB_DESCRIPTOR_CONFIGURATION:
 		//! TODO USB3: Provide a super speed descriptor.
-		if (usbd_xotg->gadget == USB_GADGET_UMS)
+		if (usbd_xotg->gadget == USB_GADGET_UMS || usbd_xotg->gadget == USB_GADGET_LOOPBACK || usbd_xotg->gadget == USB_GADGET_IMAGE)
 		{
 			if (usbd_xotg->port_speed == XUSB_HIGH_SPEED) // High speed. 512 bytes.
 			{
@@ -1774,7 +1925,8 @@ static int _xusbd_handle_ep0_control_transfer(usb_ctrl_setup_t *ctrl_setup)
 			size = sizeof(xusb_status_descriptor);
 			transmit_data = true;
 		}
-		else if (_bRequest == USB_REQUEST_GET_DESCRIPTOR && (_wValue >> 8) == USB_DESCRIPTOR_HID_REPORT && usbd_xotg->gadget > USB_GADGET_UMS)
+		else if (_bRequest == USB_REQUEST_GET_DESCRIPTOR && (_wValue >> 8) == USB_DESCRIPTOR_HID_REPORT &&
+				 (usbd_xotg->gadget == USB_GADGET_HID_GAMEPAD || usbd_xotg->gadget == USB_GADGET_HID_TOUCHPAD))
 		{
 			if (usbd_xotg->gadget == USB_GADGET_HID_GAMEPAD)
 			{
@@ -1875,7 +2027,7 @@ static int _xusb_ep_operation(u32 tries)
 	setup_event_trb_t *setup_event_trb;
 
 	// Wait for an interrupt event.
-	int res = _xusb_xhci_mask_wait(XUSB_DEV_XHCI_ST, XHCI_ST_IP, XHCI_ST_IP, tries);
+	int res = _xusb_event_wait(tries);
 	if (res)
 		return res;
 
@@ -1949,6 +2101,20 @@ int xusb_device_enumerate(usb_gadget_type gadget)
 	case USB_GADGET_HID_TOUCHPAD:
 		usbd_xotg->desc = &usb_gadget_hid_touch_descriptors;
 		break;
+	case USB_GADGET_LOOPBACK:
+#ifdef BDK_USB_LOOPBACK_SUPPORT
+		usbd_xotg->desc = &usb_gadget_loopback_descriptors;
+		break;
+#else
+		return USB_ERROR_INIT;
+#endif
+	case USB_GADGET_IMAGE:
+#ifdef BDK_USB_IMAGE_SUPPORT
+		usbd_xotg->desc = &usb_gadget_image_descriptors;
+		break;
+#else
+		return USB_ERROR_INIT;
+#endif
 	}
 
 	usbd_xotg->gadget = gadget;
@@ -2061,27 +2227,27 @@ int xusb_device_ep1_out_read(u8 *buf, u32 len, u32 *bytes_read, u32 sync_tries)
 
 int xusb_device_ep1_out_read_big(u8 *buf, u32 len, u32 *bytes_read)
 {
-	if (len > USB_EP_BULK_OUT_MAX_XFER)
-		len = USB_EP_BULK_OUT_MAX_XFER;
+	// Caller must make sure that the buffer can take more than the default max.
+	if (len > USB_EP_BULK_OUT_EXT_MAX_XFER)
+		len = USB_EP_BULK_OUT_EXT_MAX_XFER;
 
-	u32 bytes = 0;
-	*bytes_read = 0;
-	u8 *buf_curr = buf;
+	usbd_xotg->tx_count[USB_DIR_OUT] = 0;
+	usbd_xotg->tx_bytes[USB_DIR_OUT] = len;
 
-	while (len)
-	{
-		u32 len_ep = MIN(len, USB_EP_BUFFER_MAX_SIZE);
+	// One chained TD for the whole transfer.
+	int res = _xusb_issue_normal_trb_chain(buf, len, USB_DIR_OUT);
+	if (!res)
+		usbd_xotg->tx_count[USB_DIR_OUT]++;
 
-		int res = xusb_device_ep1_out_read(buf_curr, len_ep, &bytes, USB_XFER_SYNCED_DATA);
-		if (res)
-			return res;
+	while (!res && usbd_xotg->tx_count[USB_DIR_OUT])
+		res = _xusb_ep_operation(USB_XFER_SYNCED_DATA);
 
-		len -= len_ep;
-		buf_curr += len_ep;
-		*bytes_read = *bytes_read + bytes;
-	}
+	*bytes_read = res ? 0 : usbd_xotg->tx_bytes[USB_DIR_OUT];
 
-	return USB_RES_OK;
+	// Invalidate data after transfer.
+	bpmp_mmu_maintenance(BPMP_MMU_MAINT_INVALID_WAY, false);
+
+	return res;
 }
 
 int xusb_device_ep1_out_reading_finish(u32 *pending_bytes, u32 sync_tries)
@@ -2136,6 +2302,29 @@ int xusb_device_ep1_in_write(u8 *buf, u32 len, u32 *bytes_written, u32 sync_trie
 	return res;
 }
 
+int xusb_device_ep1_in_write_big(u8 *buf, u32 len, u32 *bytes_written)
+{
+	// Caller must make sure that the buffer holds more than the default max.
+	if (len > USB_EP_BULK_OUT_EXT_MAX_XFER)
+		len = USB_EP_BULK_OUT_EXT_MAX_XFER;
+
+	usbd_xotg->tx_count[USB_DIR_IN] = 0;
+	usbd_xotg->tx_bytes[USB_DIR_IN] = len;
+
+	// One chained TD for the whole transfer. Doorbell flushes the data.
+	int res = _xusb_issue_normal_trb_chain(buf, len, USB_DIR_IN);
+	if (!res)
+		usbd_xotg->tx_count[USB_DIR_IN]++;
+
+	while (!res && usbd_xotg->tx_count[USB_DIR_IN])
+		res = _xusb_ep_operation(USB_XFER_SYNCED_DATA);
+
+	if (bytes_written)
+		*bytes_written = res ? 0 : usbd_xotg->tx_bytes[USB_DIR_IN];
+
+	return res;
+}
+
 int xusb_device_ep1_in_writing_finish(u32 *pending_bytes, u32 sync_tries)
 {
 	int res = USB_RES_OK;
@@ -2211,5 +2400,6 @@ void xusb_device_get_ops(usb_ops_t *ops)
 	ops->usb_device_ep1_out_read_big       = xusb_device_ep1_out_read_big;
 	ops->usb_device_ep1_out_reading_finish = xusb_device_ep1_out_reading_finish;
 	ops->usb_device_ep1_in_write           = xusb_device_ep1_in_write;
+	ops->usb_device_ep1_in_write_big       = xusb_device_ep1_in_write_big;
 	ops->usb_device_ep1_in_writing_finish  = xusb_device_ep1_in_writing_finish;
 }
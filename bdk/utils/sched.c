@@ -0,0 +1,102 @@
+/*
+ * Cooperative task scheduler for Tegra X1
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <soc/timer.h>
+#include <utils/sched.h>
+
+typedef struct _sched_task_t
+{
+	sched_task_fn_t fn;
+	void *data;
+	u32 period_us; // 0: Only when signaled.
+	u32 next_us;
+	bool signaled;
+} sched_task_t;
+
+static sched_task_t sched_tasks[SCHED_MAX_TASKS];
+static u32  sched_cnt = 0; // Highest used slot + 1.
+static bool sched_running = false;
+
+int sched_add(sched_task_fn_t fn, void *data, u32 period_us)
+{
+	for (u32 i = 0; i < SCHED_MAX_TASKS; i++)
+	{
+		sched_task_t *task = &sched_tasks[i];
+		if (task->fn)
+			continue;
+
+		task->data      = data;
+		task->period_us = period_us;
+		task->next_us   = get_tmr_us() + period_us;
+		task->signaled  = false;
+		task->fn        = fn;
+
+		if (i >= sched_cnt)
+			sched_cnt = i + 1;
+
+		return i;
+	}
+
+	return -1;
+}
+
+void sched_remove(int id)
+{
+	if (id < 0 || id >= SCHED_MAX_TASKS)
+		return;
+
+	sched_tasks[id].fn = NULL;
+
+	while (sched_cnt && !sched_tasks[sched_cnt - 1].fn)
+		sched_cnt--;
+}
+
+void sched_signal(int id)
+{
+	if (id < 0 || id >= SCHED_MAX_TASKS)
+		return;
+
+	sched_tasks[id].signaled = true;
+}
+
+void sched_poll()
+{
+	// Tasks may end up in a driver wait that polls again.
+	if (sched_running || !sched_cnt)
+		return;
+
+	sched_running = true;
+
+	u32 now = get_tmr_us();
+	for (u32 i = 0; i < sched_cnt; i++)
+	{
+		sched_task_t *task = &sched_tasks[i];
+		if (!task->fn)
+			continue;
+
+		bool due = task->period_us && (s32)(now - task->next_us) >= 0;
+		if (!due && !task->signaled)
+			continue;
+
+		task->signaled = false;
+		if (due)
+			task->next_us = now + task->period_us;
+
+		task->fn(task->data);
+	}
+
+	sched_running = false;
+}
@@ -0,0 +1,36 @@
+/*
+ * Cooperative task scheduler for Tegra X1
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include <utils/types.h>
+
+#define SCHED_MAX_TASKS 8
+
+typedef void (*sched_task_fn_t)(void *data);
+
+/*
+ * Tasks run to completion from sched_poll(), either every period_us or when
+ * signaled. Drivers poll while busy waiting for hardware, so tasks must not
+ * call back into drivers that may be waiting.
+ */
+int  sched_add(sched_task_fn_t fn, void *data, u32 period_us);
+void sched_remove(int id);
+void sched_signal(int id);
+void sched_poll();
+
+#endif
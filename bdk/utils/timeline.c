@@ -0,0 +1,79 @@
+/*
+ * Boot timeline for Tegra X1
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <soc/timer.h>
+#include <utils/timeline.h>
+
+static timeline_evt_t timeline[TIMELINE_MAX_EVENTS];
+static u32 timeline_idx = 0; // Total events. Wraps around the ring.
+
+void timeline_mark(u32 id)
+{
+	timeline_evt_t *evt = &timeline[timeline_idx & (TIMELINE_MAX_EVENTS - 1)];
+
+	evt->id      = id;
+	evt->time_us = get_tmr_us();
+
+	timeline_idx++;
+}
+
+// Newest event with that id, so a later UMS session gets its own times.
+static timeline_evt_t *_timeline_find(u32 id)
+{
+	u32 count = MIN(timeline_idx, TIMELINE_MAX_EVENTS);
+
+	for (u32 i = 1; i <= count; i++)
+	{
+		timeline_evt_t *evt = &timeline[(timeline_idx - i) & (TIMELINE_MAX_EVENTS - 1)];
+		if (evt->id == id)
+			return evt;
+	}
+
+	return NULL;
+}
+
+u32 timeline_get_time(u32 id)
+{
+	timeline_evt_t *evt = _timeline_find(id);
+
+	return evt ? evt->time_us : 0;
+}
+
+// Copies header and events, oldest first. Returns the size used.
+u32 timeline_export(void *buf, u32 size)
+{
+	timeline_hdr_t *hdr = (timeline_hdr_t *)buf;
+	timeline_evt_t *evts = (timeline_evt_t *)((u8 *)buf + sizeof(timeline_hdr_t));
+
+	if (size < sizeof(timeline_hdr_t))
+		return 0;
+
+	u32 count = MIN(timeline_idx, TIMELINE_MAX_EVENTS);
+	count = MIN(count, (size - sizeof(timeline_hdr_t)) / sizeof(timeline_evt_t));
+
+	u32 first = timeline_idx - MIN(timeline_idx, TIMELINE_MAX_EVENTS);
+	for (u32 i = 0; i < count; i++)
+		evts[i] = timeline[(first + i) & (TIMELINE_MAX_EVENTS - 1)];
+
+	hdr->magic  = TIMELINE_MAGIC;
+	hdr->count  = count;
+	hdr->now_us = get_tmr_us();
+	hdr->rsvd   = 0;
+
+	return sizeof(timeline_hdr_t) + count * sizeof(timeline_evt_t);
+}
@@ -0,0 +1,59 @@
+/*
+ * Boot timeline for Tegra X1
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TIMELINE_H_
+#define _TIMELINE_H_
+
+#include <utils/types.h>
+
+#define TIMELINE_MAX_EVENTS 32 // Must be a power of 2.
+#define TIMELINE_MAGIC      0x4E4C4D54 // TMLN.
+
+typedef enum _timeline_evt_id_t
+{
+	TIMELINE_IPL_START       = 0,
+	TIMELINE_HW_INIT         = 1,
+	TIMELINE_DISPLAY_INIT    = 2,
+	TIMELINE_SD_PROBE        = 3,
+	TIMELINE_EMMC_PROBE      = 4,
+	TIMELINE_UMS_START       = 5,
+	TIMELINE_USB_INIT        = 6,
+	TIMELINE_USB_ENUMERATED  = 7,
+	TIMELINE_USB_MAX_LUN     = 8,
+	TIMELINE_SCSI_FIRST_TUR  = 9,
+	TIMELINE_SCSI_FIRST_READ = 10,
+	TIMELINE_UMS_END         = 11,
+} timeline_evt_id_t;
+
+typedef struct _timeline_evt_t
+{
+	u32 id;
+	u32 time_us; // Since reset.
+} timeline_evt_t;
+
+typedef struct _timeline_hdr_t
+{
+	u32 magic;
+	u32 count;
+	u32 now_us;
+	u32 rsvd;
+} timeline_hdr_t;
+
+void timeline_mark(u32 id);
+u32  timeline_get_time(u32 id);
+u32  timeline_export(void *buf, u32 size);
+
+#endif
@@ -0,0 +1,59 @@
+#!/bin/sh
+# Runs the UMS gadget over FunctionFS on dummy_hcd, so it shows up as a local
+# USB disk (e.g. /dev/sdX) for dd, fio, mkfs and friends. Needs root.
+#
+# usage: sudo tools/host-sim/ffs-setup.sh [ums-ffs options]
+# e.g.:  sudo tools/host-sim/ffs-setup.sh -e emmc.img -v gpp -v boot0:ro -V
+#
+# Ctrl+C ejects like the VOL+/VOL- combo, the gadget is torn down on exit.
+
+set -e
+
+BIN=${UMS_FFS:-$(dirname "$0")/../../build/host-sim/ums-ffs}
+CFG=/sys/kernel/config
+G=$CFG/usb_gadget/ums-ffs
+FFS=/dev/ffs-ums
+
+cleanup() {
+	[ -e $G/UDC ] && echo "" > $G/UDC 2>/dev/null || true
+	mountpoint -q $FFS && umount $FFS
+	rm -f $G/configs/c.1/ffs.ums
+	rmdir $G/configs/c.1/strings/0x409 $G/configs/c.1 $G/functions/ffs.ums $G/strings/0x409 $G 2>/dev/null || true
+}
+
+modprobe libcomposite
+modprobe dummy_hcd
+mountpoint -q $CFG || mount -t configfs none $CFG
+
+trap cleanup EXIT INT TERM
+
+mkdir -p $G
+echo 0x11EC > $G/idVendor
+echo 0xA7E0 > $G/idProduct
+echo 0x0210 > $G/bcdUSB
+mkdir -p $G/strings/0x409
+echo "UMS Loader" > $G/strings/0x409/product
+echo "FunctionFS" > $G/strings/0x409/serialnumber
+mkdir -p $G/configs/c.1/strings/0x409
+echo "UMS" > $G/configs/c.1/strings/0x409/configuration
+mkdir -p $G/functions/ffs.ums
+ln -sf $G/functions/ffs.ums $G/configs/c.1/
+
+mkdir -p $FFS
+mountpoint -q $FFS || mount -t functionfs ums $FFS
+
+"$BIN" "$@" $FFS &
+PID=$!
+
+# The UDC can only be bound after the descriptors are written.
+while [ ! -e $FFS/ep2 ]; do
+	kill -0 $PID 2>/dev/null || exit 1
+	sleep 0.1
+done
+ls /sys/class/udc | grep dummy_udc | head -n 1 > $G/UDC
+
+# Ctrl+C from the terminal reaches the gadget directly, let it eject first.
+trap '' INT
+while kill -0 $PID 2>/dev/null; do
+	wait $PID || true
+done
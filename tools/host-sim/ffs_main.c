@@ -0,0 +1,208 @@
+/*
+ * UMS gadget over Linux FunctionFS
+ *
+ * Runs bdk/usb/usb_gadget_ums.c in a user process on a FunctionFS mount with
+ * file backed LUNs, so real host tools can drive it (e.g. over dummy_hcd).
+ * tools/host-sim/ffs-setup.sh sets up the gadget and starts this.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <soc/timer.h>
+#include <usb/usbd.h>
+#include <utils/types.h>
+
+#include "sim.h"
+
+static bool verbose = false;
+
+static void _set_text(void *label, const char *text)
+{
+	if (verbose)
+		fprintf(stderr, "[%10.3f s] %s\n", get_tmr_us() / 1000000.0, text);
+}
+
+static void _show_stats(void *label, const usb_ums_stats_t *stats)
+{
+	if (verbose)
+		fprintf(stderr, "[%10.3f s] LUN %d: rd %d KB/s, wr %d KB/s, %d IOPS, %d us, %llu MB, %d switches\n", get_tmr_us() / 1000000.0, stats->lun,
+			stats->rd_kbps, stats->wr_kbps, stats->iops, stats->lat_us, (unsigned long long)(stats->bytes >> 20),
+			stats->part_switches);
+}
+
+static void _system_maintenance(bool refresh)
+{
+}
+
+static int _parse_model(const char *spec, u32 *vals, u32 cnt)
+{
+	char *end = (char *)spec;
+
+	for (u32 i = 0; i < cnt; i++)
+	{
+		vals[i] = strtoul(end, &end, 0);
+		if ((i != cnt - 1 && *end++ != ',') || (i == cnt - 1 && *end))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void _usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [options] FFS_DIR\n"
+		"  -s, --sd SPEC          SD card image file or RAM disk size (e.g. 1G)\n"
+		"  -e, --emmc SPEC        eMMC GPP image file or RAM disk size\n"
+		"      --boot0 SPEC       eMMC BOOT0 (default 4M RAM disk)\n"
+		"      --boot1 SPEC       eMMC BOOT1 (default 4M RAM disk)\n"
+		"  -v, --volume NAME[:ro] Add a LUN: sd, gpp, boot0, boot1 (repeatable)\n"
+		"                         NAME@OFFSET[+SECTORS] for a part of it, :xts to decrypt\n"
+		"  -b, --backend NAME     Gadget quirks: xusb (default) or usb2\n"
+		"  -d, --delays           Sleep for the SD/eMMC model times\n"
+		"      --sd-model M       RD_LAT_US,WR_LAT_US,RD_MBPS,WR_MBPS\n"
+		"      --emmc-model M     RD_LAT_US,WR_LAT_US,RD_MBPS,WR_MBPS\n"
+		"      --switch-us US     eMMC partition switch time\n"
+		"      --bulk-out-max N   Max bulk OUT transfer in bytes (0: default)\n"
+		"  -V, --verbose          Print gadget status text and throughput\n"
+		"Ctrl+C ejects like the VOL+/VOL- combo, a second one quits.\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_opts[] = {
+		{ "sd",           required_argument, NULL, 's' },
+		{ "emmc",         required_argument, NULL, 'e' },
+		{ "boot0",        required_argument, NULL, '0' },
+		{ "boot1",        required_argument, NULL, '1' },
+		{ "volume",       required_argument, NULL, 'v' },
+		{ "backend",      required_argument, NULL, 'b' },
+		{ "delays",       no_argument,       NULL, 'd' },
+		{ "sd-model",     required_argument, NULL, 'S' },
+		{ "emmc-model",   required_argument, NULL, 'E' },
+		{ "switch-us",    required_argument, NULL, 'w' },
+		{ "bulk-out-max", required_argument, NULL, 'o' },
+		{ "verbose",      no_argument,       NULL, 'V' },
+		{ "help",         no_argument,       NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	const char *volume_specs[SIM_MAX_LUNS];
+	u32 volume_cnt = 0;
+	int opt;
+
+	usb_ctxt_t usbs = {0};
+	usb_ctxt_vol_t vols[SIM_MAX_LUNS];
+	sim_lun_t luns[SIM_MAX_LUNS];
+
+	sim_clock = SIM_CLOCK_REAL;
+
+	while ((opt = getopt_long(argc, argv, "s:e:v:b:dVh", long_opts, NULL)) != -1)
+	{
+		int err = 0;
+
+		switch (opt)
+		{
+		case 's':
+			err = sim_disk_open(SIM_DISK_SD, optarg);
+			break;
+		case 'e':
+			err = sim_disk_open(SIM_DISK_GPP, optarg);
+			break;
+		case '0':
+			err = sim_disk_open(SIM_DISK_BOOT0, optarg);
+			break;
+		case '1':
+			err = sim_disk_open(SIM_DISK_BOOT1, optarg);
+			break;
+		case 'v':
+			err = volume_cnt == SIM_MAX_LUNS;
+			if (!err)
+				volume_specs[volume_cnt++] = optarg;
+			break;
+		case 'b':
+			if (!strcmp(optarg, "usb2"))
+				usbs.backend = USB_BACKEND_USB2;
+			else
+				err = strcmp(optarg, "xusb");
+			break;
+		case 'd':
+			sim_clock = SIM_CLOCK_REAL_DELAYS;
+			break;
+		case 'S':
+			err = _parse_model(optarg, &sim_sd_model.rd_lat_us, 4);
+			break;
+		case 'E':
+			err = _parse_model(optarg, &sim_emmc_model.rd_lat_us, 4);
+			break;
+		case 'w':
+			sim_emmc_switch_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			usbs.bulk_out_max_xfer = strtoul(optarg, NULL, 0);
+			break;
+		case 'V':
+			verbose = true;
+			break;
+		case 'h':
+			_usage(argv[0]);
+			return 0;
+		default:
+			err = 1;
+			break;
+		}
+
+		if (err)
+		{
+			_usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (optind != argc - 1 || !sim_sd_model.rd_mbps || !sim_sd_model.wr_mbps ||
+		!sim_emmc_model.rd_mbps || !sim_emmc_model.wr_mbps)
+	{
+		_usage(argv[0]);
+		return 2;
+	}
+
+	volume_cnt = sim_volumes_setup(volume_specs, volume_cnt, vols, luns);
+	if (!volume_cnt || sim_map_iram())
+		return 2;
+
+	ffs_set_path(argv[optind]);
+	sim_catch_sigint();
+
+	usbs.volumes_cnt        = volume_cnt;
+	usbs.volumes            = vols;
+	usbs.label              = NULL;
+	usbs.set_text           = _set_text;
+	usbs.show_stats         = _show_stats;
+	usbs.system_maintenance = _system_maintenance;
+
+	int res = usb_device_gadget_ums(&usbs);
+
+	printf("storage: %llu reads %.2f MiB, %llu writes %.2f MiB, %llu part switches\n",
+		(unsigned long long)sim_storage_stats.rd_ops, sim_storage_stats.rd_bytes / 1048576.0,
+		(unsigned long long)sim_storage_stats.wr_ops, sim_storage_stats.wr_bytes / 1048576.0,
+		(unsigned long long)sim_storage_stats.part_switches);
+
+	sim_disk_close_all();
+
+	return res ? 1 : 0;
+}
@@ -0,0 +1,709 @@
+/*
+ * Linux FunctionFS backend for the UMS gadget
+ *
+ * Implements usb_ops_t on top of a FunctionFS mount, so the unmodified gadget
+ * runs in a user process and a real host (e.g. over dummy_hcd) drives it.
+ * Bulk transfers use kernel AIO, which maps to the started/finished transfer
+ * model of the hardware backends.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Keep before the kernel headers, ch9.h redefines some of its names as macros.
+#include <usb/usbd.h>
+#include <utils/btn.h>
+#include <utils/types.h>
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/aio_abi.h>
+#include <linux/usb/functionfs.h>
+
+#include "sim.h"
+
+#define FFS_STR_INTERFACE "UMS Loader"
+
+#define FFS_BULK_GET_MAX_LUN 0xFE
+#define FFS_BULK_RESET       0xFF
+
+#define FFS_POLL_SLICE_MS    100
+
+typedef enum _ffs_ep_idx_t
+{
+	FFS_EP_IN  = 0, // ep1.
+	FFS_EP_OUT = 1, // ep2.
+	FFS_EP_MAX
+} ffs_ep_idx_t;
+
+typedef struct _ffs_ep_t
+{
+	int fd;
+	struct iocb iocb;
+	bool busy;  // Submitted and not reaped yet.
+	bool done;  // Reaped, result not consumed yet.
+	s64 res;
+	u8 *buf;
+	u32 len;
+} ffs_ep_t;
+
+typedef struct _ffs_t
+{
+	const char *path;
+	int ep0;
+	int efd;
+	aio_context_t ctx;
+	ffs_ep_t ep[FFS_EP_MAX];
+
+	bool enabled;
+	bool suspended;
+	bool bulk_reset;
+
+	int  max_lun;   // -1 until the gadget sets it.
+	bool max_lun_req;
+	bool max_lun_sent;
+} ffs_t;
+
+static ffs_t ffsd = { .ep0 = -1, .efd = -1, .ep = { { .fd = -1 }, { .fd = -1 } }, .max_lun = -1 };
+
+typedef struct _ffs_ep_descs_t
+{
+	struct usb_interface_descriptor intf;
+	struct usb_endpoint_descriptor_no_audio in;
+	struct usb_endpoint_descriptor_no_audio out;
+} __attribute__((packed)) ffs_ep_descs_t;
+
+typedef struct _ffs_ss_ep_descs_t
+{
+	struct usb_interface_descriptor intf;
+	struct usb_endpoint_descriptor_no_audio in;
+	struct usb_ss_ep_comp_descriptor in_comp;
+	struct usb_endpoint_descriptor_no_audio out;
+	struct usb_ss_ep_comp_descriptor out_comp;
+} __attribute__((packed)) ffs_ss_ep_descs_t;
+
+typedef struct _ffs_descs_t
+{
+	struct usb_functionfs_descs_head_v2 header;
+	__le32 fs_count;
+	__le32 hs_count;
+	__le32 ss_count;
+	ffs_ep_descs_t fs;
+	ffs_ep_descs_t hs;
+	ffs_ss_ep_descs_t ss;
+} __attribute__((packed)) ffs_descs_t;
+
+typedef struct _ffs_strings_t
+{
+	struct usb_functionfs_strings_head header;
+	struct
+	{
+		__le16 code;
+		char str1[sizeof(FFS_STR_INTERFACE)];
+	} __attribute__((packed)) lang0;
+} __attribute__((packed)) ffs_strings_t;
+
+void ffs_set_path(const char *path)
+{
+	ffsd.path = path;
+}
+
+static u32 _ffs_get_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Kernel AIO, no libaio needed.
+ */
+
+static int _io_setup(u32 nr, aio_context_t *ctx)
+{
+	return syscall(__NR_io_setup, nr, ctx);
+}
+
+static int _io_destroy(aio_context_t ctx)
+{
+	return syscall(__NR_io_destroy, ctx);
+}
+
+static int _io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp)
+{
+	return syscall(__NR_io_submit, ctx, nr, iocbpp);
+}
+
+static int _io_getevents(aio_context_t ctx, long min_nr, long max_nr, struct io_event *events, struct timespec *timeout)
+{
+	return syscall(__NR_io_getevents, ctx, min_nr, max_nr, events, timeout);
+}
+
+static int _io_cancel(aio_context_t ctx, struct iocb *iocb, struct io_event *result)
+{
+	return syscall(__NR_io_cancel, ctx, iocb, result);
+}
+
+static void _ffs_reap()
+{
+	struct io_event events[FFS_EP_MAX];
+	struct timespec ts = { 0, 0 };
+	u64 cnt;
+
+	if (read(ffsd.efd, &cnt, sizeof(cnt)) != sizeof(cnt))
+		return;
+
+	int res = _io_getevents(ffsd.ctx, 0, FFS_EP_MAX, events, &ts);
+	for (int i = 0; i < res; i++)
+	{
+		ffs_ep_t *ep = (ffs_ep_t *)(uintptr_t)events[i].data;
+
+		ep->busy = false;
+		ep->done = true;
+		ep->res  = events[i].res;
+	}
+}
+
+static int _ffs_submit(ffs_ep_t *ep, u8 *buf, u32 len, bool read)
+{
+	struct iocb *iocbp = &ep->iocb;
+
+	memset(&ep->iocb, 0, sizeof(struct iocb));
+	ep->iocb.aio_data       = (uintptr_t)ep;
+	ep->iocb.aio_lio_opcode = read ? IOCB_CMD_PREAD : IOCB_CMD_PWRITE;
+	ep->iocb.aio_fildes     = ep->fd;
+	ep->iocb.aio_buf        = (uintptr_t)buf;
+	ep->iocb.aio_nbytes     = len;
+	ep->iocb.aio_flags      = IOCB_FLAG_RESFD;
+	ep->iocb.aio_resfd      = ffsd.efd;
+
+	ep->buf  = buf;
+	ep->len  = len;
+	ep->done = false;
+	if (_io_submit(ffsd.ctx, 1, &iocbp) != 1)
+		return errno == ESHUTDOWN ? USB2_ERROR_XFER_EP_DISABLED : USB_ERROR_XFER_ERROR;
+	ep->busy = true;
+
+	return USB_RES_OK;
+}
+
+static void _ffs_cancel(ffs_ep_t *ep)
+{
+	struct io_event event;
+
+	if (ep->busy && !_io_cancel(ffsd.ctx, &ep->iocb, &event))
+		ep->busy = false;
+
+	// Cancelled requests may still complete, do not let them reach a new one.
+	for (u32 i = 0; i < 10 && ep->busy; i++)
+	{
+		poll(NULL, 0, 10);
+		_ffs_reap();
+	}
+
+	ep->busy = false;
+	ep->done = false;
+}
+
+/*
+ * Control endpoint.
+ */
+
+static void _ffs_ep0_stall(const struct usb_ctrlrequest *setup)
+{
+	// FunctionFS halts EP0 when the data stage goes the wrong way.
+	if (setup->bRequestType & USB_DIR_IN)
+		(void)!read(ffsd.ep0, NULL, 0);
+	else
+		(void)!write(ffsd.ep0, NULL, 0);
+}
+
+static void _ffs_send_max_lun()
+{
+	u8 max_lun = ffsd.max_lun;
+
+	ffsd.max_lun_req  = false;
+	ffsd.max_lun_sent = write(ffsd.ep0, &max_lun, 1) == 1;
+}
+
+static void _ffs_handle_setup(const struct usb_ctrlrequest *setup)
+{
+	if ((setup->bRequestType & USB_TYPE_MASK) == USB_TYPE_CLASS)
+	{
+		switch (setup->bRequest)
+		{
+		case FFS_BULK_GET_MAX_LUN:
+			if (!(setup->bRequestType & USB_DIR_IN) || !le16toh(setup->wLength))
+				break;
+
+			// Answered once the gadget knows its LUNs.
+			ffsd.max_lun_req = true;
+			if (ffsd.max_lun >= 0)
+				_ffs_send_max_lun();
+			return;
+
+		case FFS_BULK_RESET:
+			if (setup->bRequestType & USB_DIR_IN)
+				break;
+
+			(void)!read(ffsd.ep0, NULL, 0); // Status stage.
+			ffsd.bulk_reset = true;
+			return;
+		}
+	}
+
+	_ffs_ep0_stall(setup);
+}
+
+static void _ffs_handle_events(u32 timeout_ms)
+{
+	struct pollfd pfd[2] = {
+		{ .fd = ffsd.ep0, .events = POLLIN },
+		{ .fd = ffsd.efd, .events = POLLIN }
+	};
+
+	if (poll(pfd, 2, timeout_ms) <= 0)
+		return;
+
+	if (pfd[1].revents & POLLIN)
+		_ffs_reap();
+
+	if (!(pfd[0].revents & POLLIN))
+		return;
+
+	struct usb_functionfs_event events[4];
+	int len = read(ffsd.ep0, events, sizeof(events));
+
+	for (int i = 0; i < len / (int)sizeof(struct usb_functionfs_event); i++)
+	{
+		switch (events[i].type)
+		{
+		case FUNCTIONFS_ENABLE:
+			ffsd.enabled   = true;
+			ffsd.suspended = false;
+			break;
+
+		case FUNCTIONFS_DISABLE:
+		case FUNCTIONFS_UNBIND:
+			ffsd.enabled = false;
+			for (u32 ep = 0; ep < FFS_EP_MAX; ep++)
+				_ffs_cancel(&ffsd.ep[ep]);
+			break;
+
+		case FUNCTIONFS_SUSPEND:
+			ffsd.suspended = true;
+			break;
+
+		case FUNCTIONFS_RESUME:
+			ffsd.suspended = false;
+			break;
+
+		case FUNCTIONFS_SETUP:
+			_ffs_handle_setup(&events[i].u.setup);
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+/*
+ * Bulk endpoints.
+ */
+
+static int _ffs_xfer_wait(ffs_ep_t *ep, u32 *actual, u32 sync_timeout)
+{
+	u32 start = _ffs_get_ms();
+	u32 timeout_ms = sync_timeout / 1000;
+
+	while (!ep->done)
+	{
+		if (!ffsd.enabled)
+		{
+			_ffs_cancel(ep);
+			return USB2_ERROR_XFER_EP_DISABLED;
+		}
+
+		u32 elapsed = _ffs_get_ms() - start;
+		if (sync_timeout != (u32)USB_XFER_SYNCED && elapsed >= timeout_ms)
+			return USB_ERROR_TIMEOUT; // Stays queued, like on XUSB.
+
+		u32 slice = FFS_POLL_SLICE_MS;
+		if (sync_timeout != (u32)USB_XFER_SYNCED)
+			slice = MIN(slice, timeout_ms - elapsed);
+
+		_ffs_handle_events(slice);
+	}
+
+	ep->done = false;
+
+	if (ep->res < 0)
+	{
+		if (actual)
+			*actual = 0;
+		return ep->res == -ESHUTDOWN ? USB2_ERROR_XFER_EP_DISABLED : USB_ERROR_XFER_ERROR;
+	}
+
+	if (actual)
+		*actual = ep->res;
+
+	return USB_RES_OK;
+}
+
+static int _ffs_xfer(ffs_ep_idx_t idx, u8 *buf, u32 len, u32 *actual, u32 sync_timeout)
+{
+	ffs_ep_t *ep = &ffsd.ep[idx];
+
+	if (!ffsd.enabled)
+		return USB2_ERROR_XFER_EP_DISABLED;
+
+	// Only a CBW read left queued by a timeout is picked up again, anything else is stale.
+	if ((ep->busy || ep->done) && (idx != FFS_EP_OUT || ep->buf != buf || ep->len != len))
+		_ffs_cancel(ep);
+
+	if (!ep->busy && !ep->done)
+	{
+		int res = _ffs_submit(ep, buf, len, idx == FFS_EP_OUT);
+		if (res)
+			return res;
+	}
+
+	if (sync_timeout == USB_XFER_START)
+		return USB_RES_OK;
+
+	return _ffs_xfer_wait(ep, actual, sync_timeout);
+}
+
+static int _ffs_flush_endpoint(u32 ep)
+{
+	for (u32 i = 0; i < FFS_EP_MAX; i++)
+	{
+		if (ep == USB_EP_ALL || ep == (i == FFS_EP_IN ? USB_EP_BULK_IN : USB_EP_BULK_OUT))
+		{
+			_ffs_cancel(&ffsd.ep[i]);
+			ioctl(ffsd.ep[i].fd, FUNCTIONFS_FIFO_FLUSH);
+		}
+	}
+
+	return USB_RES_OK;
+}
+
+static int _ffs_set_ep_stall(u32 ep, int stall)
+{
+	ffs_ep_t *fep;
+
+	if (ep == USB_EP_BULK_IN)
+		fep = &ffsd.ep[FFS_EP_IN];
+	else if (ep == USB_EP_BULK_OUT)
+		fep = &ffsd.ep[FFS_EP_OUT];
+	else
+		return USB_RES_OK;
+
+	if (stall == USB_EP_CFG_CLEAR)
+		ioctl(fep->fd, FUNCTIONFS_CLEAR_HALT);
+	else if (fep == &ffsd.ep[FFS_EP_IN])
+		(void)!read(fep->fd, NULL, 0);  // Wrong direction halts the endpoint.
+	else
+		(void)!write(fep->fd, NULL, 0);
+
+	return USB_RES_OK;
+}
+
+static int _ffs_handle_ep0_ctrl_setup()
+{
+	_ffs_handle_events(0);
+
+	if (ffsd.bulk_reset)
+	{
+		ffsd.bulk_reset = false;
+		return USB_RES_BULK_RESET;
+	}
+
+	return USB_RES_OK;
+}
+
+static void _ffs_end(bool reset_ep, bool only_controller)
+{
+	for (u32 i = 0; i < FFS_EP_MAX; i++)
+	{
+		if (ffsd.ep[i].fd < 0)
+			continue;
+
+		_ffs_cancel(&ffsd.ep[i]);
+		close(ffsd.ep[i].fd);
+		ffsd.ep[i].fd = -1;
+	}
+
+	if (ffsd.ctx)
+		_io_destroy(ffsd.ctx);
+	ffsd.ctx = 0;
+
+	if (ffsd.efd >= 0)
+		close(ffsd.efd);
+	ffsd.efd = -1;
+
+	if (ffsd.ep0 >= 0)
+		close(ffsd.ep0);
+	ffsd.ep0 = -1;
+
+	ffsd.enabled = false;
+}
+
+static void _ffs_ep_desc(struct usb_endpoint_descriptor_no_audio *desc, u8 addr, u16 max_packet)
+{
+	desc->bLength          = USB_DT_ENDPOINT_SIZE;
+	desc->bDescriptorType  = USB_DT_ENDPOINT;
+	desc->bEndpointAddress = addr;
+	desc->bmAttributes     = USB_ENDPOINT_XFER_BULK;
+	desc->wMaxPacketSize   = htole16(max_packet);
+}
+
+static void _ffs_intf_desc(struct usb_interface_descriptor *desc)
+{
+	desc->bLength            = USB_DT_INTERFACE_SIZE;
+	desc->bDescriptorType    = USB_DT_INTERFACE;
+	desc->bNumEndpoints      = 2;
+	desc->bInterfaceClass    = USB_CLASS_MASS_STORAGE;
+	desc->bInterfaceSubClass = 0x06; // SCSI Transparent command set.
+	desc->bInterfaceProtocol = 0x50; // Bulk-Only Transport.
+	desc->iInterface         = 1;
+}
+
+static void _ffs_ss_comp_desc(struct usb_ss_ep_comp_descriptor *desc)
+{
+	desc->bLength         = USB_DT_SS_EP_COMP_SIZE;
+	desc->bDescriptorType = USB_DT_SS_ENDPOINT_COMP;
+	desc->bMaxBurst       = 15;
+}
+
+static int _ffs_write_descriptors()
+{
+	ffs_descs_t descs = {0};
+	ffs_strings_t strings = {0};
+
+	descs.header.magic  = htole32(FUNCTIONFS_DESCRIPTORS_MAGIC_V2);
+	descs.header.length = htole32(sizeof(descs));
+	descs.header.flags  = htole32(FUNCTIONFS_HAS_FS_DESC | FUNCTIONFS_HAS_HS_DESC | FUNCTIONFS_HAS_SS_DESC);
+	descs.fs_count      = htole32(3);
+	descs.hs_count      = htole32(3);
+	descs.ss_count      = htole32(5);
+
+	// Same endpoint order as the hardware descriptors. ep1 is IN, ep2 is OUT.
+	_ffs_intf_desc(&descs.fs.intf);
+	_ffs_ep_desc(&descs.fs.in,  1 | USB_DIR_IN, 64);
+	_ffs_ep_desc(&descs.fs.out, 2 | USB_DIR_OUT, 64);
+	_ffs_intf_desc(&descs.hs.intf);
+	_ffs_ep_desc(&descs.hs.in,  1 | USB_DIR_IN, 512);
+	_ffs_ep_desc(&descs.hs.out, 2 | USB_DIR_OUT, 512);
+	_ffs_intf_desc(&descs.ss.intf);
+	_ffs_ep_desc(&descs.ss.in,  1 | USB_DIR_IN, 1024);
+	_ffs_ss_comp_desc(&descs.ss.in_comp);
+	_ffs_ep_desc(&descs.ss.out, 2 | USB_DIR_OUT, 1024);
+	_ffs_ss_comp_desc(&descs.ss.out_comp);
+
+	strings.header.magic      = htole32(FUNCTIONFS_STRINGS_MAGIC);
+	strings.header.length     = htole32(sizeof(strings));
+	strings.header.str_count  = htole32(1);
+	strings.header.lang_count = htole32(1);
+	strings.lang0.code        = htole16(0x0409); // English US.
+	memcpy(strings.lang0.str1, FFS_STR_INTERFACE, sizeof(FFS_STR_INTERFACE));
+
+	if (write(ffsd.ep0, &descs, sizeof(descs)) != sizeof(descs))
+		return 1;
+
+	if (write(ffsd.ep0, &strings, sizeof(strings)) != sizeof(strings))
+		return 1;
+
+	return 0;
+}
+
+static int _ffs_device_init()
+{
+	char path[PATH_MAX];
+
+	if (!ffsd.path)
+		return USB_ERROR_INIT;
+
+	snprintf(path, sizeof(path), "%s/ep0", ffsd.path);
+	ffsd.ep0 = open(path, O_RDWR);
+	if (ffsd.ep0 < 0 || _ffs_write_descriptors())
+	{
+		fprintf(stderr, "ffs: cannot set up %s: %s\n", path, strerror(errno));
+		goto error;
+	}
+
+	for (u32 i = 0; i < FFS_EP_MAX; i++)
+	{
+		snprintf(path, sizeof(path), "%s/ep%d", ffsd.path, i + 1);
+		ffsd.ep[i].fd = open(path, O_RDWR);
+		if (ffsd.ep[i].fd < 0)
+		{
+			fprintf(stderr, "ffs: cannot open %s: %s\n", path, strerror(errno));
+			goto error;
+		}
+	}
+
+	ffsd.efd = eventfd(0, EFD_NONBLOCK);
+	if (ffsd.efd < 0 || _io_setup(FFS_EP_MAX, &ffsd.ctx))
+	{
+		fprintf(stderr, "ffs: cannot set up AIO: %s\n", strerror(errno));
+		goto error;
+	}
+
+	ffsd.max_lun      = -1;
+	ffsd.max_lun_req  = false;
+	ffsd.max_lun_sent = false;
+	ffsd.bulk_reset   = false;
+
+	return USB_RES_OK;
+
+error:
+	_ffs_end(false, false);
+
+	return USB_ERROR_INIT;
+}
+
+static int _ffs_device_enumerate(usb_gadget_type gadget)
+{
+	if (gadget != USB_GADGET_UMS)
+		return USB_ERROR_INIT;
+
+	// The UDC is bound from outside, wait for the host to set the configuration.
+	while (!ffsd.enabled)
+	{
+		if (btn_read_vol() == (BTN_VOL_UP | BTN_VOL_DOWN))
+			return USB_ERROR_USER_ABORT;
+
+		_ffs_handle_events(FFS_POLL_SLICE_MS);
+	}
+
+	return USB_RES_OK;
+}
+
+static int _ffs_class_send_max_lun(u8 max_lun)
+{
+	// Timeout if get MAX_LUN request doesn't happen in 10s.
+	u32 timer = _ffs_get_ms() + 10000;
+
+	ffsd.max_lun = max_lun;
+	if (ffsd.max_lun_req)
+		_ffs_send_max_lun();
+
+	while (!ffsd.max_lun_sent)
+	{
+		_ffs_handle_events(FFS_POLL_SLICE_MS);
+		if (timer < _ffs_get_ms() || btn_read_vol() == (BTN_VOL_UP | BTN_VOL_DOWN))
+			return USB_ERROR_TIMEOUT;
+	}
+
+	return USB_RES_OK;
+}
+
+static int _ffs_class_send_hid_report()
+{
+	return USB_ERROR_XFER_ERROR;
+}
+
+static int _ffs_ep1_out_read(u8 *buf, u32 len, u32 *bytes_read, u32 sync_timeout)
+{
+	return _ffs_xfer(FFS_EP_OUT, buf, len, bytes_read, sync_timeout);
+}
+
+static int _ffs_ep1_out_read_big(u8 *buf, u32 len, u32 *bytes_read)
+{
+	return _ffs_xfer(FFS_EP_OUT, buf, len, bytes_read, USB_XFER_SYNCED_DATA);
+}
+
+static int _ffs_ep1_out_reading_finish(u32 *pending_bytes, u32 sync_timeout)
+{
+	ffs_ep_t *ep = &ffsd.ep[FFS_EP_OUT];
+
+	if (!ep->busy && !ep->done)
+		return USB_ERROR_XFER_ERROR;
+
+	return _ffs_xfer_wait(ep, pending_bytes, sync_timeout);
+}
+
+static int _ffs_ep1_in_write(u8 *buf, u32 len, u32 *bytes_written, u32 sync_timeout)
+{
+	return _ffs_xfer(FFS_EP_IN, buf, len, bytes_written, sync_timeout);
+}
+
+static int _ffs_ep1_in_write_big(u8 *buf, u32 len, u32 *bytes_written)
+{
+	return _ffs_xfer(FFS_EP_IN, buf, len, bytes_written, USB_XFER_SYNCED_DATA);
+}
+
+static int _ffs_ep1_in_writing_finish(u32 *pending_bytes, u32 sync_timeout)
+{
+	ffs_ep_t *ep = &ffsd.ep[FFS_EP_IN];
+
+	if (!ep->busy && !ep->done)
+		return USB_ERROR_XFER_ERROR;
+
+	return _ffs_xfer_wait(ep, pending_bytes, sync_timeout);
+}
+
+static bool _ffs_get_suspended()
+{
+	return ffsd.suspended || !ffsd.enabled;
+}
+
+static bool _ffs_get_port_in_sleep()
+{
+	return ffsd.suspended;
+}
+
+static void _ffs_get_ops(usb_ops_t *ops)
+{
+	ops->usbd_flush_endpoint               = _ffs_flush_endpoint;
+	ops->usbd_set_ep_stall                 = _ffs_set_ep_stall;
+	ops->usbd_handle_ep0_ctrl_setup        = _ffs_handle_ep0_ctrl_setup;
+	ops->usbd_end                          = _ffs_end;
+	ops->usb_device_init                   = _ffs_device_init;
+	ops->usb_device_enumerate              = _ffs_device_enumerate;
+	ops->usb_device_class_send_max_lun     = _ffs_class_send_max_lun;
+	ops->usb_device_class_send_hid_report  = _ffs_class_send_hid_report;
+	ops->usb_device_ep1_out_read           = _ffs_ep1_out_read;
+	ops->usb_device_ep1_out_read_big       = _ffs_ep1_out_read_big;
+	ops->usb_device_ep1_out_reading_finish = _ffs_ep1_out_reading_finish;
+	ops->usb_device_ep1_in_write           = _ffs_ep1_in_write;
+	ops->usb_device_ep1_in_write_big       = _ffs_ep1_in_write_big;
+	ops->usb_device_ep1_in_writing_finish  = _ffs_ep1_in_writing_finish;
+	ops->usb_device_get_suspended          = _ffs_get_suspended;
+	ops->usb_device_get_port_in_sleep      = _ffs_get_port_in_sleep;
+}
+
+// Both controllers map to FunctionFS, the gadget only picks its quirks by backend.
+void usb_device_get_ops(usb_ops_t *ops)
+{
+	_ffs_get_ops(ops);
+}
+
+void xusb_device_get_ops(usb_ops_t *ops)
+{
+	_ffs_get_ops(ops);
+}
@@ -0,0 +1,152 @@
+/*
+ * Host side simulation of the UMS gadget
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <usb/usbd.h>
+#include <utils/types.h>
+
+#define SIM_SECTOR_SZ   512
+#define SIM_MAX_LUNS    8
+#define SIM_XTS_KEY_SZ  32
+
+// Fixed cost per operation plus bytes / (MB/s) in us. 1 MB is 10^6 bytes here.
+typedef struct _sim_media_model_t
+{
+	u32 rd_lat_us;
+	u32 wr_lat_us;
+	u32 rd_mbps;
+	u32 wr_mbps;
+} sim_media_model_t;
+
+typedef struct _sim_usb_model_t
+{
+	u32 mbps;
+	u32 xfer_lat_us; // Per transfer, covers host scheduling and the handshake.
+} sim_usb_model_t;
+
+typedef enum _sim_disk_t
+{
+	SIM_DISK_SD    = 0,
+	SIM_DISK_GPP   = 1,
+	SIM_DISK_BOOT0 = 2,
+	SIM_DISK_BOOT1 = 3,
+	SIM_DISK_MAX
+} sim_disk_t;
+
+typedef struct _sim_stats_t
+{
+	u64 rd_ops;
+	u64 wr_ops;
+	u64 rd_bytes;
+	u64 wr_bytes;
+	u64 busy_us;
+	u64 part_switches;
+} sim_stats_t;
+
+typedef enum _sim_clock_t
+{
+	SIM_CLOCK_VIRTUAL     = 0, // Time only moves when a model says so.
+	SIM_CLOCK_REAL        = 1, // Wall clock, models add no delay.
+	SIM_CLOCK_REAL_DELAYS = 2, // Wall clock, models sleep for their time.
+} sim_clock_t;
+
+// Virtual clock.
+extern sim_clock_t sim_clock;
+extern u64 sim_now_us;
+void sim_advance_us(u64 us);
+void sim_wait_until_us(u64 us);
+
+// Host CPU time, minus the time spent in the fake devices.
+u64  sim_cpu_ns();
+void sim_exclude_begin();
+void sim_exclude_end();
+
+// Fake storage.
+extern sim_media_model_t sim_sd_model;
+extern sim_media_model_t sim_emmc_model;
+extern u32 sim_emmc_switch_us;
+extern sim_stats_t sim_storage_stats;
+
+int  sim_disk_open(sim_disk_t disk, const char *spec);
+u64  sim_disk_sectors(sim_disk_t disk);
+int  sim_disk_peek(sim_disk_t disk, u64 sector, u32 num_sectors, void *buf);
+void sim_disk_close_all();
+void sim_media_access(sim_disk_t disk, u64 sector, u32 num_sectors, bool write);
+
+// Cache policy model in front of the storage. Only timing, data always goes straight to the disks.
+typedef struct _sim_cache_cfg_t
+{
+	u32 chunk;     // Bytes per buffer.
+	u32 bufs;      // Buffers. IRAM use is chunk * bufs.
+	u32 ra_chunks; // Read-ahead on sequential reads.
+	u32 wc_chunks; // Write-back cache, taken from the buffers.
+	u32 copy_mbps; // Cost of a hit or an absorbed write.
+} sim_cache_cfg_t;
+
+typedef struct _sim_cache_stats_t
+{
+	u64 hit_sectors;
+	u64 miss_sectors;
+	u64 ra_chunks;
+	u64 ra_used;
+	u64 wc_sectors;
+	u64 flushes;
+} sim_cache_stats_t;
+
+extern sim_cache_cfg_t sim_cache_cfg;
+extern sim_cache_stats_t sim_cache_stats;
+
+int  sim_cache_init();
+bool sim_cache_enabled();
+void sim_cache_access(sim_disk_t disk, u64 sector, u32 num_sectors, bool write);
+void sim_cache_flush();
+
+// Scripted host and fake usb_ops_t.
+extern sim_usb_model_t sim_usb_model;
+extern sim_stats_t sim_usb_stats;
+
+typedef struct _sim_lun_t
+{
+	sim_disk_t disk;
+	u32 offset;
+	u32 sectors;
+	bool ro;
+	bool xts;
+	u8 xts_key[SIM_XTS_KEY_SZ]; // Last one the gadget took.
+} sim_lun_t;
+
+// Software SE for decrypted LUNs and the reference the host checks them with.
+int  sim_xts_selftest();
+void sim_xts_crypt(const u8 *key, bool enc, u64 sector, u8 *buf, u32 num_sectors);
+
+// Board glue.
+void sim_catch_sigint();
+int  sim_map_iram();
+int  sim_volumes_setup(const char **specs, u32 cnt, usb_ctxt_vol_t *vols, sim_lun_t *luns);
+
+// FunctionFS backend.
+void ffs_set_path(const char *path);
+
+int  sim_host_load_script(const char *path, const sim_lun_t *luns, u32 lun_cnt);
+int  sim_host_load_replay(const char *path, const sim_lun_t *luns, u32 lun_cnt, bool gaps);
+void sim_host_set_verify(bool verify);
+int  sim_host_open_trace(const char *path);
+int  sim_host_report();
+void sim_host_summary(const char *name);
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Host side simulation of the UMS gadget - board glue
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <storage/sdmmc.h>
+#include <usb/usbd.h>
+#include <utils/btn.h>
+#include <utils/types.h>
+
+#include <memory_map.h>
+
+#include "sim.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+static volatile sig_atomic_t stop_req = 0;
+
+// First Ctrl+C is the VOL+/VOL- unmount combo, the second one kills the process.
+static void _sigint_handler(int sig)
+{
+	if (stop_req)
+		_exit(1);
+
+	stop_req = 1;
+}
+
+void sim_catch_sigint()
+{
+	signal(SIGINT, _sigint_handler);
+}
+
+u8 btn_read_vol()
+{
+	return stop_req ? (BTN_VOL_UP | BTN_VOL_DOWN) : 0;
+}
+
+// The gadget uses fixed IRAM buffers, so put some memory where it expects them.
+int sim_map_iram()
+{
+	void *iram = mmap((void *)IRAM_START, IPL_STACK_TOP - IRAM_START, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+	if (iram != (void *)IRAM_START)
+	{
+		fprintf(stderr, "sim: cannot map IRAM at 0x%X\n", IRAM_START);
+		return 1;
+	}
+
+	return 0;
+}
+
+// <disk>[@<offset>[+<sectors>]][:ro][:xts]
+static int _parse_volume(const char *spec, usb_ctxt_vol_t *vol, sim_lun_t *lun)
+{
+	static const char *names[SIM_DISK_MAX] = { "sd", "gpp", "boot0", "boot1" };
+	u32 len = strcspn(spec, "@:");
+
+	memset(vol, 0, sizeof(usb_ctxt_vol_t));
+	memset(lun, 0, sizeof(sim_lun_t));
+
+	for (u32 i = 0; i < SIM_DISK_MAX; i++)
+	{
+		if (strlen(names[i]) != len || strncmp(spec, names[i], len))
+			continue;
+
+		const char *opt = spec + len;
+		char *end;
+
+		lun->disk = i;
+		if (*opt == '@')
+		{
+			lun->offset = strtoul(opt + 1, &end, 0);
+			lun->sectors = sim_disk_sectors(i) > lun->offset ? sim_disk_sectors(i) - lun->offset : 0;
+			if (*end == '+')
+				lun->sectors = strtoul(end + 1, &end, 0);
+			opt = end;
+			if (!lun->sectors || (u64)lun->offset + lun->sectors > sim_disk_sectors(i))
+				return 1;
+		}
+
+		while (*opt == ':')
+		{
+			u32 opt_len = strcspn(opt + 1, ":");
+
+			if (opt_len == 2 && !strncmp(opt + 1, "ro", 2))
+				lun->ro = true;
+			else if (opt_len == 3 && !strncmp(opt + 1, "xts", 3))
+				lun->xts = true;
+			else
+				return 1;
+			opt += opt_len + 1;
+		}
+
+		vol->ro      = lun->ro;
+		vol->xts     = lun->xts;
+		vol->offset  = lun->offset;
+		vol->sectors = lun->sectors;
+
+		if (i == SIM_DISK_SD)
+			vol->type = MMC_SD;
+		else
+		{
+			vol->type      = MMC_EMMC;
+			vol->partition = i - SIM_DISK_GPP + 1; // EMMC_GPP + 1 based.
+		}
+
+		// Boot partitions are smaller than what the storage reports.
+		if (i >= SIM_DISK_BOOT0 && !lun->sectors)
+		{
+			vol->sectors = sim_disk_sectors(i);
+			lun->sectors = vol->sectors;
+		}
+
+		return *opt != 0;
+	}
+
+	return 1;
+}
+
+int sim_volumes_setup(const char **specs, u32 cnt, usb_ctxt_vol_t *vols, sim_lun_t *luns)
+{
+	const char *defaults[2];
+
+	// Boot partitions are always there on a real eMMC.
+	if (sim_disk_sectors(SIM_DISK_GPP))
+	{
+		if (!sim_disk_sectors(SIM_DISK_BOOT0))
+			sim_disk_open(SIM_DISK_BOOT0, "4M");
+		if (!sim_disk_sectors(SIM_DISK_BOOT1))
+			sim_disk_open(SIM_DISK_BOOT1, "4M");
+	}
+
+	// Default to everything that was given.
+	if (!cnt)
+	{
+		specs = defaults;
+		if (sim_disk_sectors(SIM_DISK_SD))
+			defaults[cnt++] = "sd";
+		if (sim_disk_sectors(SIM_DISK_GPP))
+			defaults[cnt++] = "gpp";
+	}
+
+	for (u32 i = 0; i < cnt; i++)
+	{
+		if (_parse_volume(specs[i], &vols[i], &luns[i]) || !sim_disk_sectors(luns[i].disk))
+		{
+			fprintf(stderr, "sim: bad or missing volume %s\n", specs[i]);
+			return 0;
+		}
+
+		if (luns[i].xts && sim_xts_selftest())
+		{
+			fprintf(stderr, "sim: AES self test failed\n");
+			return 0;
+		}
+	}
+
+	return cnt;
+}
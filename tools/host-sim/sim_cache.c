@@ -0,0 +1,248 @@
+/*
+ * Host side simulation of the UMS gadget - cache policy model
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+/*
+ * Projects what a chunk cache in IRAM would do for a workload, before any of it
+ * is written for the device. The buffers are split into a write-back part that
+ * collects one sequential run and an LRU read part that also takes the read-ahead.
+ * The SDMMC driver blocks, so every media access is charged right away.
+ */
+
+sim_cache_cfg_t sim_cache_cfg = { .copy_mbps = 400 };
+sim_cache_stats_t sim_cache_stats;
+
+typedef struct _sim_cache_line_t
+{
+	sim_disk_t disk;
+	u64 chunk;
+	u64 lru;
+	bool valid;
+	bool prefetched; // Not hit since read-ahead brought it in.
+} sim_cache_line_t;
+
+static sim_cache_line_t *lines = NULL;
+static u32 line_cnt = 0;
+static u32 chunk_sectors = 0;
+static u64 lru_clock = 0;
+static u64 seq_end[SIM_DISK_MAX];
+
+// Dirty run of the write-back cache.
+static sim_disk_t dirty_disk;
+static u64 dirty_start;
+static u32 dirty_sectors = 0;
+
+int sim_cache_init()
+{
+	const sim_cache_cfg_t *cfg = &sim_cache_cfg;
+
+	if (!cfg->bufs)
+		return 0;
+
+	if (!cfg->chunk || cfg->chunk % SIM_SECTOR_SZ || cfg->wc_chunks > cfg->bufs ||
+		cfg->ra_chunks > cfg->bufs - cfg->wc_chunks || !cfg->copy_mbps)
+	{
+		fprintf(stderr, "sim: bad cache config (read-ahead and write cache must fit in the buffers)\n");
+		return 1;
+	}
+
+	chunk_sectors = cfg->chunk / SIM_SECTOR_SZ;
+	line_cnt = cfg->bufs - cfg->wc_chunks;
+	lines = calloc(line_cnt ? line_cnt : 1, sizeof(sim_cache_line_t));
+
+	return !lines;
+}
+
+bool sim_cache_enabled()
+{
+	return lines != NULL;
+}
+
+static void _copy_cost(u32 num_sectors)
+{
+	u64 us = (u64)num_sectors * SIM_SECTOR_SZ / sim_cache_cfg.copy_mbps;
+
+	sim_advance_us(us);
+}
+
+static sim_cache_line_t *_line_find(sim_disk_t disk, u64 chunk)
+{
+	for (u32 i = 0; i < line_cnt; i++)
+		if (lines[i].valid && lines[i].disk == disk && lines[i].chunk == chunk)
+			return &lines[i];
+
+	return NULL;
+}
+
+static void _line_insert(sim_disk_t disk, u64 chunk, bool prefetched)
+{
+	sim_cache_line_t *victim = NULL;
+
+	if (!line_cnt)
+		return;
+
+	for (u32 i = 0; i < line_cnt; i++)
+	{
+		if (!lines[i].valid)
+		{
+			victim = &lines[i];
+			break;
+		}
+		if (!victim || lines[i].lru < victim->lru)
+			victim = &lines[i];
+	}
+
+	victim->disk       = disk;
+	victim->chunk      = chunk;
+	victim->lru        = ++lru_clock;
+	victim->valid      = true;
+	victim->prefetched = prefetched;
+}
+
+// Whole chunks in one access, cut at the end of the disk. Chunks from ra_first on are read-ahead.
+static void _fetch(sim_disk_t disk, u64 first, u64 cnt, u64 ra_first)
+{
+	u64 start = first * chunk_sectors;
+	u64 end = MIN((first + cnt) * chunk_sectors, sim_disk_sectors(disk));
+
+	if (start >= end)
+		return;
+
+	sim_media_access(disk, start, end - start, false);
+	for (u64 c = first; c < first + cnt && c * chunk_sectors < end; c++)
+		_line_insert(disk, c, c >= ra_first);
+}
+
+void sim_cache_flush()
+{
+	if (!dirty_sectors)
+		return;
+
+	sim_media_access(dirty_disk, dirty_start, dirty_sectors, true);
+	sim_cache_stats.flushes++;
+	dirty_sectors = 0;
+}
+
+static void _read(sim_disk_t disk, u64 sector, u32 num_sectors)
+{
+	u64 first = sector / chunk_sectors;
+	u64 last  = (sector + num_sectors - 1) / chunk_sectors;
+	u64 miss_first = 0, miss_cnt = 0;
+	bool sequential = sector == seq_end[disk];
+
+	// Read after write of the same sectors.
+	if (dirty_sectors && dirty_disk == disk && sector < dirty_start + dirty_sectors && dirty_start < sector + num_sectors)
+		sim_cache_flush();
+
+	if (!line_cnt)
+	{
+		sim_media_access(disk, sector, num_sectors, false);
+		seq_end[disk] = sector + num_sectors;
+		return;
+	}
+
+	for (u64 c = first; c <= last; c++)
+	{
+		sim_cache_line_t *line = _line_find(disk, c);
+		u32 in_chunk = MIN((c + 1) * chunk_sectors, sector + num_sectors) - MAX(c * chunk_sectors, sector);
+
+		if (line)
+		{
+			line->lru = ++lru_clock;
+			if (line->prefetched)
+				sim_cache_stats.ra_used++;
+			line->prefetched = false;
+			sim_cache_stats.hit_sectors += in_chunk;
+			_copy_cost(in_chunk);
+			continue;
+		}
+
+		sim_cache_stats.miss_sectors += in_chunk;
+		if (miss_cnt && miss_first + miss_cnt == c)
+			miss_cnt++;
+		else
+		{
+			_fetch(disk, miss_first, miss_cnt, ~0ull);
+			miss_first = c;
+			miss_cnt = 1;
+		}
+	}
+
+	// Read-ahead rides along with the last miss if it ends the request, so it costs one access.
+	u64 ra_cnt = 0;
+	if (sequential && sim_cache_cfg.ra_chunks)
+	{
+		while (ra_cnt < sim_cache_cfg.ra_chunks && !_line_find(disk, last + 1 + ra_cnt))
+			ra_cnt++;
+	}
+
+	if (miss_cnt && miss_first + miss_cnt == last + 1)
+		_fetch(disk, miss_first, miss_cnt + ra_cnt, last + 1);
+	else
+	{
+		_fetch(disk, miss_first, miss_cnt, ~0ull);
+		_fetch(disk, last + 1, ra_cnt, last + 1);
+	}
+	sim_cache_stats.ra_chunks += ra_cnt;
+
+	seq_end[disk] = sector + num_sectors;
+}
+
+static void _write(sim_disk_t disk, u64 sector, u32 num_sectors)
+{
+	u32 wc_sectors = sim_cache_cfg.wc_chunks * chunk_sectors;
+
+	// Drop stale read lines.
+	for (u32 i = 0; i < line_cnt; i++)
+	{
+		if (lines[i].valid && lines[i].disk == disk && lines[i].chunk * chunk_sectors < sector + num_sectors &&
+			(lines[i].chunk + 1) * chunk_sectors > sector)
+			lines[i].valid = false;
+	}
+
+	if (dirty_sectors && (dirty_disk != disk || dirty_start + dirty_sectors != sector ||
+		dirty_sectors + num_sectors > wc_sectors))
+		sim_cache_flush();
+
+	if (num_sectors > wc_sectors)
+	{
+		sim_media_access(disk, sector, num_sectors, true);
+		return;
+	}
+
+	if (!dirty_sectors)
+	{
+		dirty_disk  = disk;
+		dirty_start = sector;
+	}
+	dirty_sectors += num_sectors;
+
+	sim_cache_stats.wc_sectors += num_sectors;
+	_copy_cost(num_sectors);
+}
+
+void sim_cache_access(sim_disk_t disk, u64 sector, u32 num_sectors, bool write)
+{
+	if (write)
+		_write(disk, sector, num_sectors);
+	else
+		_read(disk, sector, num_sectors);
+}
@@ -0,0 +1,323 @@
+/*
+ * Host side simulation of the UMS gadget
+ *
+ * Runs bdk/usb/usb_gadget_ums.c against a scripted host, fake USB and
+ * file backed SD/eMMC models on a virtual clock.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <usb/ums_trace.h>
+#include <usb/usbd.h>
+#include <utils/types.h>
+
+#include "sim.h"
+
+static bool verbose = false;
+
+static void _set_text(void *label, const char *text)
+{
+	if (verbose)
+		fprintf(stderr, "[%10.3f ms] %s\n", sim_now_us / 1000.0, text);
+}
+
+static void _show_stats(void *label, const usb_ums_stats_t *stats)
+{
+	if (verbose)
+		fprintf(stderr, "[%10.3f ms] LUN %d: rd %d KB/s, wr %d KB/s, %d IOPS, %d us, %llu MB, %d switches\n", sim_now_us / 1000.0, stats->lun,
+			stats->rd_kbps, stats->wr_kbps, stats->iops, stats->lat_us, (unsigned long long)(stats->bytes >> 20),
+			stats->part_switches);
+}
+
+static void _system_maintenance(bool refresh)
+{
+}
+
+#ifdef BDK_UMS_TRACE_SUPPORT
+#define SIM_DEV_TRACE_ENTRIES 65536 // Same as the DRAM ring on the device.
+
+static ums_trace_entry_t *dev_trace_buf = NULL;
+
+static int _dev_trace_write(const char *path)
+{
+	u32 size = sizeof(ums_trace_hdr_t) + SIM_DEV_TRACE_ENTRIES * sizeof(ums_trace_entry_t);
+	void *buf = malloc(size);
+	FILE *fp = fopen(path, "wb");
+
+	if (!buf || !fp)
+	{
+		fprintf(stderr, "sim: cannot write %s\n", path);
+		free(buf);
+		if (fp)
+			fclose(fp);
+		return 1;
+	}
+
+	fwrite(buf, 1, ums_trace_export(buf, size, 0), fp);
+	fclose(fp);
+	free(buf);
+
+	return 0;
+}
+#endif
+
+static int _parse_model(const char *spec, u32 *vals, u32 cnt)
+{
+	char *end = (char *)spec;
+
+	for (u32 i = 0; i < cnt; i++)
+	{
+		vals[i] = strtoul(end, &end, 0);
+		if ((i != cnt - 1 && *end++ != ',') || (i == cnt - 1 && *end))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void _usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [options] script\n"
+		"       %s [options] -r trace\n"
+		"  -s, --sd SPEC          SD card image file or RAM disk size (e.g. 1G)\n"
+		"  -e, --emmc SPEC        eMMC GPP image file or RAM disk size\n"
+		"      --boot0 SPEC       eMMC BOOT0 (default 4M RAM disk)\n"
+		"      --boot1 SPEC       eMMC BOOT1 (default 4M RAM disk)\n"
+		"  -v, --volume NAME[:ro] Add a LUN: sd, gpp, boot0, boot1 (repeatable)\n"
+		"                         NAME@OFFSET[+SECTORS] for a part of it, :xts to decrypt\n"
+		"  -b, --backend NAME     xusb (default) or usb2\n"
+		"  -u, --usb MODEL        hs (default), ss or MBPS,LAT_US\n"
+		"      --sd-model M       RD_LAT_US,WR_LAT_US,RD_MBPS,WR_MBPS\n"
+		"      --emmc-model M     RD_LAT_US,WR_LAT_US,RD_MBPS,WR_MBPS\n"
+		"      --switch-us US     eMMC partition switch time\n"
+		"      --bulk-out-max N   Max bulk OUT transfer in bytes (0: default)\n"
+		"      --read-io N        Max SDMMC read size in bytes (0: gadget default)\n"
+		"      --boot-cache       Give the gadget a BOOT0/BOOT1 read cache (DRAM on the device)\n"
+		"      --cache C,B,RA,WC  Cache model: chunk KB, buffers, read-ahead and write cache chunks\n"
+		"      --copy-mbps N      Cache hit and cached write cost (default 400)\n"
+		"  -r, --replay FILE      Replay a device trace (tools/ums_trace.py) or blkparse output\n"
+		"      --gaps             Keep the time between replayed commands\n"
+		"      --summary NAME     Print a one line CSV summary, see tools/host-sim/sweep.py\n"
+		"  -c, --verify           Check read and written data against the disks\n"
+		"  -t, --trace FILE       Write a per command CSV trace\n"
+		"  -D, --dev-trace FILE   Write the gadget's own command trace (see tools/ums_trace.py)\n"
+		"  -V, --verbose          Print gadget status text and throughput\n"
+		"Exits with 1 on protocol errors, data mismatches or failed reads/writes.\n", name, name);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_opts[] = {
+		{ "sd",           required_argument, NULL, 's' },
+		{ "emmc",         required_argument, NULL, 'e' },
+		{ "boot0",        required_argument, NULL, '0' },
+		{ "boot1",        required_argument, NULL, '1' },
+		{ "volume",       required_argument, NULL, 'v' },
+		{ "backend",      required_argument, NULL, 'b' },
+		{ "usb",          required_argument, NULL, 'u' },
+		{ "sd-model",     required_argument, NULL, 'S' },
+		{ "emmc-model",   required_argument, NULL, 'E' },
+		{ "switch-us",    required_argument, NULL, 'w' },
+		{ "bulk-out-max", required_argument, NULL, 'o' },
+		{ "read-io",      required_argument, NULL, 'R' },
+		{ "boot-cache",   no_argument,       NULL, 'B' },
+		{ "cache",        required_argument, NULL, 'C' },
+		{ "copy-mbps",    required_argument, NULL, 'M' },
+		{ "replay",       required_argument, NULL, 'r' },
+		{ "gaps",         no_argument,       NULL, 'g' },
+		{ "summary",      required_argument, NULL, 'y' },
+		{ "verify",       no_argument,       NULL, 'c' },
+		{ "trace",        required_argument, NULL, 't' },
+		{ "dev-trace",    required_argument, NULL, 'D' },
+		{ "verbose",      no_argument,       NULL, 'V' },
+		{ "help",         no_argument,       NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	const char *volume_specs[SIM_MAX_LUNS];
+	const char *trace = NULL;
+	const char *dev_trace = NULL;
+	const char *replay = NULL;
+	const char *summary = NULL;
+	bool gaps = false;
+	u32 volume_cnt = 0;
+	int opt;
+
+	usb_ctxt_t usbs = {0};
+	usb_ctxt_vol_t vols[SIM_MAX_LUNS];
+	sim_lun_t luns[SIM_MAX_LUNS];
+
+	while ((opt = getopt_long(argc, argv, "s:e:v:b:u:r:ct:D:Vh", long_opts, NULL)) != -1)
+	{
+		int err = 0;
+
+		switch (opt)
+		{
+		case 's':
+			err = sim_disk_open(SIM_DISK_SD, optarg);
+			break;
+		case 'e':
+			err = sim_disk_open(SIM_DISK_GPP, optarg);
+			break;
+		case '0':
+			err = sim_disk_open(SIM_DISK_BOOT0, optarg);
+			break;
+		case '1':
+			err = sim_disk_open(SIM_DISK_BOOT1, optarg);
+			break;
+		case 'v':
+			err = volume_cnt == SIM_MAX_LUNS;
+			if (!err)
+				volume_specs[volume_cnt++] = optarg;
+			break;
+		case 'b':
+			if (!strcmp(optarg, "usb2"))
+				usbs.backend = USB_BACKEND_USB2;
+			else
+				err = strcmp(optarg, "xusb");
+			break;
+		case 'u':
+			if (!strcmp(optarg, "hs"))
+				sim_usb_model = (sim_usb_model_t){ .mbps = 40, .xfer_lat_us = 60 };
+			else if (!strcmp(optarg, "ss"))
+				sim_usb_model = (sim_usb_model_t){ .mbps = 350, .xfer_lat_us = 15 };
+			else
+				err = _parse_model(optarg, &sim_usb_model.mbps, 2);
+			break;
+		case 'S':
+			err = _parse_model(optarg, &sim_sd_model.rd_lat_us, 4);
+			break;
+		case 'E':
+			err = _parse_model(optarg, &sim_emmc_model.rd_lat_us, 4);
+			break;
+		case 'w':
+			sim_emmc_switch_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			usbs.bulk_out_max_xfer = strtoul(optarg, NULL, 0);
+			break;
+		case 'R':
+			usbs.read_io_max = strtoul(optarg, NULL, 0);
+			break;
+		case 'B':
+			usbs.boot_cache = calloc(2, USB_UMS_BOOT_CACHE_SZ);
+			break;
+		case 'C':
+			err = _parse_model(optarg, &sim_cache_cfg.chunk, 4);
+			sim_cache_cfg.chunk *= 1024;
+			break;
+		case 'M':
+			sim_cache_cfg.copy_mbps = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			replay = optarg;
+			break;
+		case 'g':
+			gaps = true;
+			break;
+		case 'y':
+			summary = optarg;
+			break;
+		case 'c':
+			sim_host_set_verify(true);
+			break;
+		case 't':
+			trace = optarg;
+			break;
+		case 'D':
+			dev_trace = optarg;
+			break;
+		case 'V':
+			verbose = true;
+			break;
+		case 'h':
+			_usage(argv[0]);
+			return 0;
+		default:
+			err = 1;
+			break;
+		}
+
+		if (err)
+		{
+			_usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (optind != argc - (replay ? 0 : 1) || !sim_usb_model.mbps || !sim_sd_model.rd_mbps || !sim_sd_model.wr_mbps ||
+		!sim_emmc_model.rd_mbps || !sim_emmc_model.wr_mbps)
+	{
+		_usage(argv[0]);
+		return 2;
+	}
+
+	volume_cnt = sim_volumes_setup(volume_specs, volume_cnt, vols, luns);
+	if (!volume_cnt || sim_map_iram())
+		return 2;
+
+	if (replay ? sim_host_load_replay(replay, luns, volume_cnt, gaps) : sim_host_load_script(argv[optind], luns, volume_cnt))
+		return 2;
+
+	if (sim_cache_init())
+		return 2;
+
+	if (trace && sim_host_open_trace(trace))
+		return 2;
+
+	// Like the device with DRAM up, so the whole run fits.
+	if (dev_trace)
+	{
+#ifdef BDK_UMS_TRACE_SUPPORT
+		dev_trace_buf = calloc(SIM_DEV_TRACE_ENTRIES, sizeof(ums_trace_entry_t));
+		if (!dev_trace_buf)
+			return 2;
+		ums_trace_set_buffer(dev_trace_buf, SIM_DEV_TRACE_ENTRIES);
+#else
+		fprintf(stderr, "sim: built with UMS_TRACE=0\n");
+		return 2;
+#endif
+	}
+
+	usbs.volumes_cnt        = volume_cnt;
+	usbs.volumes            = vols;
+	usbs.label              = NULL;
+	usbs.set_text           = _set_text;
+	usbs.show_stats         = _show_stats;
+	usbs.system_maintenance = _system_maintenance;
+
+	int res = usb_device_gadget_ums(&usbs);
+
+	if (res)
+		printf("gadget returned %d\n", res);
+
+	res |= sim_host_report();
+
+	if (summary)
+		sim_host_summary(summary);
+
+#ifdef BDK_UMS_TRACE_SUPPORT
+	if (dev_trace)
+		res |= _dev_trace_write(dev_trace);
+#endif
+
+	sim_disk_close_all();
+
+	return res ? 1 : 0;
+}
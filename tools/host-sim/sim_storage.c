@@ -0,0 +1,311 @@
+/*
+ * Host side simulation of the UMS gadget - file backed SD/eMMC
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <storage/sd.h>
+#include <storage/emmc.h>
+#include <storage/sdmmc.h>
+
+#include "sim.h"
+
+/*
+ * Reads are a least squares fit of the RAW SDMMC rows of the benchmark table in
+ * usb_gadget_ums.c (8KB to 128KB, within 10%). Writes are rough guesses for a
+ * UHS-I A1 card and the stock HS400 eMMC.
+ */
+sim_media_model_t sim_sd_model   = { .rd_lat_us = 338, .wr_lat_us = 400, .rd_mbps = 90,  .wr_mbps = 40  };
+sim_media_model_t sim_emmc_model = { .rd_lat_us = 150, .wr_lat_us = 200, .rd_mbps = 296, .wr_mbps = 110 };
+u32 sim_emmc_switch_us = 500;
+
+sim_stats_t sim_storage_stats;
+
+sdmmc_t sd_sdmmc;
+sdmmc_storage_t sd_storage;
+sdmmc_t emmc_sdmmc;
+sdmmc_storage_t emmc_storage;
+
+typedef struct _sim_disk_backing_t
+{
+	int fd;     // -1 when memory backed.
+	u8 *mem;
+	u64 size;
+} sim_disk_backing_t;
+
+static sim_disk_backing_t disks[SIM_DISK_MAX] = {
+	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }
+};
+
+// A plain size (e.g. 256M) creates a zeroed RAM disk, anything else is a file.
+static u64 _parse_size(const char *spec)
+{
+	char *end;
+	u64 size = strtoull(spec, &end, 0);
+
+	if (end == spec)
+		return 0;
+
+	switch (*end)
+	{
+	case 'G':
+	case 'g':
+		size <<= 10;
+	case 'M':
+	case 'm':
+		size <<= 10;
+	case 'K':
+	case 'k':
+		size <<= 10;
+		end++;
+		break;
+	}
+
+	return *end ? 0 : size;
+}
+
+int sim_disk_open(sim_disk_t disk, const char *spec)
+{
+	sim_disk_backing_t *d = &disks[disk];
+	u64 size = _parse_size(spec);
+
+	if (size)
+	{
+		d->mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (d->mem == MAP_FAILED)
+		{
+			d->mem = NULL;
+			fprintf(stderr, "sim: cannot allocate %llu bytes for disk %d\n", (unsigned long long)size, disk);
+			return 1;
+		}
+	}
+	else
+	{
+		struct stat st;
+
+		d->fd = open(spec, O_RDWR);
+		if (d->fd < 0 || fstat(d->fd, &st))
+		{
+			fprintf(stderr, "sim: cannot open %s: %s\n", spec, strerror(errno));
+			return 1;
+		}
+		size = st.st_size;
+	}
+
+	if (size < SIM_SECTOR_SZ || size / SIM_SECTOR_SZ > 0xFFFFFFFFull)
+	{
+		fprintf(stderr, "sim: %s: unsupported disk size\n", spec);
+		return 1;
+	}
+
+	d->size = size & ~(u64)(SIM_SECTOR_SZ - 1);
+
+	return 0;
+}
+
+u64 sim_disk_sectors(sim_disk_t disk)
+{
+	return disks[disk].size / SIM_SECTOR_SZ;
+}
+
+void sim_disk_close_all()
+{
+	for (u32 i = 0; i < SIM_DISK_MAX; i++)
+	{
+		if (disks[i].fd >= 0)
+			close(disks[i].fd);
+		else if (disks[i].mem)
+			munmap(disks[i].mem, disks[i].size);
+		disks[i].fd   = -1;
+		disks[i].mem  = NULL;
+		disks[i].size = 0;
+	}
+}
+
+static int _disk_rw(sim_disk_t disk, u64 sector, u32 num_sectors, void *buf, bool write)
+{
+	sim_disk_backing_t *d = &disks[disk];
+	u64 off = sector * SIM_SECTOR_SZ;
+	u64 len = (u64)num_sectors * SIM_SECTOR_SZ;
+
+	if (!d->size || off + len > d->size)
+		return 0;
+
+	if (d->mem)
+	{
+		if (write)
+			memcpy(d->mem + off, buf, len);
+		else
+			memcpy(buf, d->mem + off, len);
+		return 1;
+	}
+
+	ssize_t res = write ? pwrite(d->fd, buf, len, off) : pread(d->fd, buf, len, off);
+
+	return res == (ssize_t)len;
+}
+
+int sim_disk_peek(sim_disk_t disk, u64 sector, u32 num_sectors, void *buf)
+{
+	sim_exclude_begin();
+	int res = _disk_rw(disk, sector, num_sectors, buf, false);
+	sim_exclude_end();
+
+	return res;
+}
+
+static sim_disk_t _storage_disk(sdmmc_storage_t *storage)
+{
+	if (storage == &sd_storage)
+		return SIM_DISK_SD;
+
+	return SIM_DISK_GPP + storage->partition;
+}
+
+static void _storage_init(sdmmc_storage_t *storage, sdmmc_t *sdmmc, sim_disk_t disk)
+{
+	memset(storage, 0, sizeof(sdmmc_storage_t));
+	storage->sdmmc       = sdmmc;
+	storage->sec_cnt     = sim_disk_sectors(disk);
+	storage->initialized = 1;
+	storage->cid.serial  = 0x53494D00 | disk; // SIM.
+}
+
+bool sd_initialize(bool power_cycle)
+{
+	if (!sim_disk_sectors(SIM_DISK_SD))
+		return false;
+
+	_storage_init(&sd_storage, &sd_sdmmc, SIM_DISK_SD);
+
+	return true;
+}
+
+void sd_end()
+{
+	sd_storage.initialized = 0;
+}
+
+bool emmc_initialize(bool power_cycle)
+{
+	if (!sim_disk_sectors(SIM_DISK_GPP))
+		return false;
+
+	_storage_init(&emmc_storage, &emmc_sdmmc, SIM_DISK_GPP);
+	emmc_storage.partition = EMMC_GPP;
+	emmc_storage.ext_csd.boot_mult = sim_disk_sectors(SIM_DISK_BOOT0) >> 8; // 128KB units.
+
+	return true;
+}
+
+void emmc_end()
+{
+	emmc_storage.initialized = 0;
+}
+
+// Charges one SDMMC access to the clock.
+void sim_media_access(sim_disk_t disk, u64 sector, u32 num_sectors, bool write)
+{
+	const sim_media_model_t *model = disk == SIM_DISK_SD ? &sim_sd_model : &sim_emmc_model;
+	u64 bytes = (u64)num_sectors * SIM_SECTOR_SZ;
+
+	u64 us = write ? model->wr_lat_us + bytes / model->wr_mbps : model->rd_lat_us + bytes / model->rd_mbps;
+	sim_advance_us(us);
+
+	sim_storage_stats.busy_us += us;
+	if (write)
+	{
+		sim_storage_stats.wr_ops++;
+		sim_storage_stats.wr_bytes += bytes;
+	}
+	else
+	{
+		sim_storage_stats.rd_ops++;
+		sim_storage_stats.rd_bytes += bytes;
+	}
+}
+
+static int _storage_rw(sdmmc_storage_t *storage, u32 sector, u32 num_sectors, void *buf, bool write)
+{
+	sim_disk_t disk = _storage_disk(storage);
+
+	if (!storage->initialized || !num_sectors)
+		return 0;
+
+	sim_exclude_begin();
+	int res = _disk_rw(disk, sector, num_sectors, buf, write);
+	sim_exclude_end();
+
+	if (sim_cache_enabled())
+		sim_cache_access(disk, sector, num_sectors, write);
+	else
+		sim_media_access(disk, sector, num_sectors, write);
+
+	return res;
+}
+
+int sdmmc_storage_read(sdmmc_storage_t *storage, u32 sector, u32 num_sectors, void *buf)
+{
+	return _storage_rw(storage, sector, num_sectors, buf, false);
+}
+
+int sdmmc_storage_write(sdmmc_storage_t *storage, u32 sector, u32 num_sectors, void *buf)
+{
+	return _storage_rw(storage, sector, num_sectors, buf, true);
+}
+
+// The access is charged from the start time, the clock only catches up on the wait.
+static u64 xfer_end_us[2];
+
+int sdmmc_storage_xfer_start(sdmmc_storage_t *storage, sdmmc_storage_xfer_t *xfer, u32 sector, u32 num_sectors, void *buf, u32 is_write)
+{
+	u64 start_us = sim_now_us;
+
+	int res = _storage_rw(storage, sector, num_sectors, buf, is_write);
+	xfer_end_us[storage != &sd_storage] = sim_now_us;
+	sim_now_us = start_us;
+
+	return res;
+}
+
+int sdmmc_storage_xfer_wait(sdmmc_storage_t *storage, sdmmc_storage_xfer_t *xfer)
+{
+	sim_wait_until_us(xfer_end_us[storage != &sd_storage]);
+
+	return 1;
+}
+
+int sdmmc_storage_set_mmc_partition(sdmmc_storage_t *storage, u32 partition)
+{
+	if (storage != &emmc_storage || partition > EMMC_BOOT1)
+		return 0;
+
+	sim_cache_flush();
+
+	sim_advance_us(sim_emmc_switch_us);
+	sim_storage_stats.busy_us += sim_emmc_switch_us;
+	sim_storage_stats.part_switches++;
+
+	storage->partition = partition;
+
+	return 1;
+}
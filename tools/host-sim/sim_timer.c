@@ -0,0 +1,136 @@
+/*
+ * Host side simulation of the UMS gadget - virtual timer
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+#include <soc/timer.h>
+
+#include "sim.h"
+
+/*
+ * In virtual mode time only moves when a fake device says so. The gadget code
+ * itself is free, its real cost is reported separately as host CPU time.
+ * Real mode is for the FunctionFS backend, where a real host is on the bus.
+ */
+sim_clock_t sim_clock = SIM_CLOCK_VIRTUAL;
+u64 sim_now_us = 0;
+
+static u64 excluded_ns = 0;
+static u64 exclude_start_ns = 0;
+static u32 exclude_depth = 0;
+
+static u64 _real_us()
+{
+	static u64 start_ns = 0;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	u64 ns = (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	if (!start_ns)
+		start_ns = ns;
+
+	return (ns - start_ns) / 1000;
+}
+
+static void _real_sleep_us(u64 us)
+{
+	struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+
+	while (nanosleep(&ts, &ts))
+		;
+}
+
+void sim_advance_us(u64 us)
+{
+	if (sim_clock == SIM_CLOCK_VIRTUAL)
+		sim_now_us += us;
+	else if (sim_clock == SIM_CLOCK_REAL_DELAYS)
+		_real_sleep_us(us);
+}
+
+void sim_wait_until_us(u64 us)
+{
+	if (sim_clock != SIM_CLOCK_VIRTUAL)
+		return;
+
+	if (us > sim_now_us)
+		sim_now_us = us;
+}
+
+static u64 _now_us()
+{
+	if (sim_clock == SIM_CLOCK_VIRTUAL)
+		return sim_now_us;
+
+	sim_now_us = _real_us();
+
+	return sim_now_us;
+}
+
+static u64 _thread_cpu_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+u64 sim_cpu_ns()
+{
+	return _thread_cpu_ns() - excluded_ns;
+}
+
+void sim_exclude_begin()
+{
+	if (!exclude_depth++)
+		exclude_start_ns = _thread_cpu_ns();
+}
+
+void sim_exclude_end()
+{
+	if (!--exclude_depth)
+		excluded_ns += _thread_cpu_ns() - exclude_start_ns;
+}
+
+u32 get_tmr_us()
+{
+	return (u32)_now_us();
+}
+
+u32 get_tmr_ms()
+{
+	return (u32)(_now_us() / 1000);
+}
+
+u32 get_tmr_s()
+{
+	return (u32)(_now_us() / 1000000);
+}
+
+void usleep(u32 us)
+{
+	if (sim_clock == SIM_CLOCK_VIRTUAL)
+		sim_advance_us(us);
+	else
+		_real_sleep_us(us);
+}
+
+void msleep(u32 ms)
+{
+	usleep(ms * 1000);
+}
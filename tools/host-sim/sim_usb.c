@@ -0,0 +1,1243 @@
+/*
+ * Host side simulation of the UMS gadget - scripted BOT host and fake usb_ops_t
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <usb/usbd.h>
+#include <utils/types.h>
+
+#include "sim.h"
+
+#define SIM_CBW_SIG 0x43425355 // USBC.
+#define SIM_CSW_SIG 0x53425355 // USBS.
+#define SIM_CBW_LEN 31
+#define SIM_CSW_LEN 13
+
+#define SIM_SENSE_LEN         18
+#define SIM_SK_UNIT_ATTENTION 6
+
+#define SIM_OP_SET_XTS_KEY    0xC2
+#define SIM_OP_COPY_RANGE     0xC3
+
+// Give up if the gadget keeps polling after the script ended or misbehaves.
+#define SIM_MAX_IDLE_POLLS    1000
+#define SIM_MAX_PROTO_ERRORS  1000
+
+typedef enum _sim_op_t
+{
+	SIM_OP_READ  = 0,
+	SIM_OP_WRITE = 1,
+	SIM_OP_OTHER = 2,
+	SIM_OP_MAX
+} sim_op_t;
+
+static const char *sim_op_names[SIM_OP_MAX] = { "read", "write", "other" };
+
+typedef struct _sim_cmd_t
+{
+	u8  cdb[16];
+	u8  cdb_len;
+	u8  lun;
+	u8  dir_in;
+	u8  op;
+	u32 data_len;
+	u32 lba;
+	u8 *data; // OUT data, the pattern if NULL.
+	bool replayed;
+	u64 at_us; // Replay: issue time relative to the first replayed command.
+} sim_cmd_t;
+
+typedef enum _host_state_t
+{
+	HOST_CBW,
+	HOST_DATA_OUT,
+	HOST_DATA_IN,
+	HOST_CSW
+} host_state_t;
+
+typedef struct _sim_op_stats_t
+{
+	u64 cmds;
+	u64 failed;
+	u64 bytes;
+	u64 time_us;
+	u64 max_us;
+	u64 cpu_ns;
+	u32 *lat_us; // Per command, for percentiles.
+	u32 lat_alloc;
+} sim_op_stats_t;
+
+typedef struct _sim_host_t
+{
+	sim_cmd_t *cmds;
+	u32 cmd_cnt;
+	u32 cmd_alloc;
+	u32 cmd_idx;
+
+	sim_lun_t luns[SIM_MAX_LUNS];
+	u32 lun_cnt;
+
+	host_state_t state;
+	sim_cmd_t cur;
+	u32 tag;
+	u32 xfered;
+	u64 start_us;
+	u64 start_cpu_ns;
+
+	// Auto sense. A unit attention is retried once, like a real host does.
+	sim_cmd_t failed;
+	bool sense_pending;
+	bool retry_pending;
+	bool retried;
+	u8 sense[SIM_SENSE_LEN];
+
+	// Async transfers. Index is usb_dir_t.
+	u64 busy_until[2];
+	u64 busy_us[2];
+	u32 pending[2];
+	u8 *last_out_buf;
+
+	bool verify;
+	FILE *trace;
+
+	// Replay with the original gaps between commands.
+	bool gaps;
+	bool gaps_started;
+	u64 gaps_base_us;
+
+	u32 idle_polls;
+	u64 first_us;
+	u64 end_us;
+	u64 proto_errors;
+	u64 mismatches;
+	u64 stalls;
+	sim_op_stats_t ops[SIM_OP_MAX];
+} sim_host_t;
+
+static sim_host_t host;
+
+sim_usb_model_t sim_usb_model = { .mbps = 40, .xfer_lat_us = 60 };
+sim_stats_t sim_usb_stats;
+
+static void _proto_error(const char *msg)
+{
+	fprintf(stderr, "sim: protocol error: %s (tag %d, state %d)\n", msg, host.tag, host.state);
+
+	if (++host.proto_errors > SIM_MAX_PROTO_ERRORS)
+	{
+		fprintf(stderr, "sim: too many protocol errors, giving up\n");
+		exit(2);
+	}
+}
+
+/*
+ * Script.
+ */
+
+static sim_cmd_t *_cmd_add(u8 lun, sim_op_t op, bool dir_in, u32 data_len)
+{
+	if (host.cmd_cnt == host.cmd_alloc)
+	{
+		host.cmd_alloc = host.cmd_alloc ? host.cmd_alloc * 2 : 256;
+		host.cmds = realloc(host.cmds, host.cmd_alloc * sizeof(sim_cmd_t));
+		if (!host.cmds)
+		{
+			fprintf(stderr, "sim: out of memory\n");
+			exit(2);
+		}
+	}
+
+	sim_cmd_t *cmd = &host.cmds[host.cmd_cnt++];
+	memset(cmd, 0, sizeof(sim_cmd_t));
+	cmd->lun      = lun;
+	cmd->op       = op;
+	cmd->dir_in   = dir_in;
+	cmd->data_len = data_len;
+
+	return cmd;
+}
+
+static void _cmd_add_rw(u8 lun, bool write, u32 lba, u32 blocks)
+{
+	sim_cmd_t *cmd = _cmd_add(lun, write ? SIM_OP_WRITE : SIM_OP_READ, !write, blocks * SIM_SECTOR_SZ);
+
+	cmd->lba     = lba;
+	cmd->cdb_len = 10;
+	cmd->cdb[0]  = write ? 0x2A : 0x28; // WRITE(10)/READ(10).
+	cmd->cdb[2]  = lba >> 24;
+	cmd->cdb[3]  = lba >> 16;
+	cmd->cdb[4]  = lba >> 8;
+	cmd->cdb[5]  = lba;
+	cmd->cdb[7]  = blocks >> 8;
+	cmd->cdb[8]  = blocks;
+}
+
+static void _cmd_add_simple(u8 lun, u8 opcode, u32 data_len, u8 cdb4)
+{
+	sim_cmd_t *cmd = _cmd_add(lun, SIM_OP_OTHER, data_len != 0, data_len);
+
+	cmd->cdb_len = (opcode & 0xE0) ? 10 : 6;
+	cmd->cdb[0]  = opcode;
+	cmd->cdb[4]  = cdb4;
+}
+
+static int _parse_hex(const char *text, u8 *buf, u32 len)
+{
+	if (strlen(text) != len * 2)
+		return 1;
+
+	for (u32 i = 0; i < len; i++)
+	{
+		char byte[3] = { text[i * 2], text[i * 2 + 1], 0 };
+		char *end;
+
+		buf[i] = strtoul(byte, &end, 16);
+		if (*end)
+			return 1;
+	}
+
+	return 0;
+}
+
+static u32 _lun_sectors(const sim_lun_t *lun)
+{
+	if (lun->sectors)
+		return lun->sectors;
+
+	return sim_disk_sectors(lun->disk) - lun->offset;
+}
+
+static u32 _rand_next(u32 *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+
+	return *seed >> 1;
+}
+
+static int _parse_line(char *line, int line_num)
+{
+	char *argv[24];
+	u32 argc = 0;
+
+	char *comment = strchr(line, '#');
+	if (comment)
+		*comment = 0;
+
+	for (char *tok = strtok(line, " \t\r\n"); tok && argc < 24; tok = strtok(NULL, " \t\r\n"))
+		argv[argc++] = tok;
+
+	if (!argc)
+		return 0;
+
+	u32 arg[4] = { 0, 0, 1, 1 };
+	for (u32 i = 1; i < argc && i <= 4; i++)
+		arg[i - 1] = strtoul(argv[i], NULL, 0);
+
+	if (argc < 2 || arg[0] >= host.lun_cnt)
+		goto bad;
+
+	u8 lun = arg[0];
+	const char *op = argv[0];
+	u32 sectors = _lun_sectors(&host.luns[lun]);
+
+	if (!strcmp(op, "read") || !strcmp(op, "write"))
+	{
+		// read/write <lun> <lba> <blocks> [count]: sequential, wraps at the end.
+		u32 lba = arg[1], blocks = arg[2], count = argc > 4 ? arg[3] : 1;
+		if (argc < 4 || !blocks || blocks > 0xFFFF || blocks > sectors)
+			goto bad;
+
+		for (u32 i = 0; i < count; i++)
+		{
+			if (lba + blocks > sectors)
+				lba = 0;
+			_cmd_add_rw(lun, op[0] == 'w', lba, blocks);
+			lba += blocks;
+		}
+	}
+	else if (!strcmp(op, "rread") || !strcmp(op, "rwrite"))
+	{
+		// rread/rwrite <lun> <blocks> <count> [seed]: random, aligned to blocks.
+		u32 blocks = arg[1], count = arg[2], seed = argc > 4 ? arg[3] : 1;
+		if (argc < 4 || !blocks || blocks > 0xFFFF || blocks > sectors)
+			goto bad;
+
+		for (u32 i = 0; i < count; i++)
+			_cmd_add_rw(lun, op[1] == 'w', (_rand_next(&seed) % (sectors / blocks)) * blocks, blocks);
+	}
+	else if (!strcmp(op, "tur"))
+		_cmd_add_simple(lun, 0x00, 0, 0);
+	else if (!strcmp(op, "sense"))
+		_cmd_add_simple(lun, 0x03, SIM_SENSE_LEN, SIM_SENSE_LEN);
+	else if (!strcmp(op, "inquiry"))
+		_cmd_add_simple(lun, 0x12, 36, 36);
+	else if (!strcmp(op, "capacity"))
+		_cmd_add_simple(lun, 0x25, 8, 0);
+	else if (!strcmp(op, "sync"))
+		_cmd_add_simple(lun, 0x35, 0, 0);
+	else if (!strcmp(op, "prevent"))
+		_cmd_add_simple(lun, 0x1E, 0, argc > 2 ? arg[1] & 1 : 1);
+	else if (!strcmp(op, "eject"))
+		_cmd_add_simple(lun, 0x1B, 0, 0x02); // Stop, LoEj.
+	else if (!strcmp(op, "xtskey"))
+	{
+		// xtskey <lun> [64 hex digits]: crypt key, then tweak key. No key clears it.
+		u8 key[SIM_XTS_KEY_SZ];
+		if (argc > 3 || (argc == 3 && _parse_hex(argv[2], key, sizeof(key))))
+			goto bad;
+
+		sim_cmd_t *cmd = _cmd_add(lun, SIM_OP_OTHER, false, argc == 3 ? sizeof(key) : 0);
+		cmd->cdb_len = 10;
+		cmd->cdb[0]  = SIM_OP_SET_XTS_KEY;
+		cmd->cdb[8]  = cmd->data_len;
+		if (cmd->data_len)
+		{
+			cmd->data = malloc(sizeof(key));
+			if (!cmd->data)
+			{
+				fprintf(stderr, "sim: out of memory\n");
+				exit(2);
+			}
+			memcpy(cmd->data, key, sizeof(key));
+		}
+	}
+	else if (!strcmp(op, "copy"))
+	{
+		// copy <dst lun> <src lun> <src lba> <dst lba> <blocks>: vendor COPY RANGE.
+		if (argc != 6 || arg[1] >= host.lun_cnt)
+			goto bad;
+
+		u32 blocks = strtoul(argv[5], NULL, 0);
+		sim_cmd_t *cmd = _cmd_add(lun, SIM_OP_OTHER, false, 0);
+		cmd->lba     = arg[3];
+		cmd->cdb_len = 16;
+		cmd->cdb[0]  = SIM_OP_COPY_RANGE;
+		cmd->cdb[1]  = arg[1];
+		for (u32 i = 0; i < 4; i++)
+		{
+			cmd->cdb[2 + i]  = arg[2] >> (24 - i * 8);
+			cmd->cdb[6 + i]  = arg[3] >> (24 - i * 8);
+			cmd->cdb[10 + i] = blocks >> (24 - i * 8);
+		}
+	}
+	else if (!strcmp(op, "raw"))
+	{
+		// raw <lun> in|out|none <len> <cdb bytes>
+		if (argc < 5 || argc - 4 > 16)
+			goto bad;
+
+		bool dir_in = !strcmp(argv[2], "in");
+		u32 len = strtoul(argv[3], NULL, 0);
+		if (!dir_in && strcmp(argv[2], "out") && strcmp(argv[2], "none"))
+			goto bad;
+
+		sim_cmd_t *cmd = _cmd_add(lun, SIM_OP_OTHER, dir_in, argv[2][0] == 'n' ? 0 : len);
+		cmd->cdb_len = argc - 4;
+		for (u32 i = 4; i < argc; i++)
+			cmd->cdb[i - 4] = strtoul(argv[i], NULL, 16);
+	}
+	else
+		goto bad;
+
+	return 0;
+
+bad:
+	fprintf(stderr, "sim: script line %d: bad command '%s'\n", line_num, argv[0]);
+	return 1;
+}
+
+// Probe every LUN first like a real host, this also clears the power on unit attention.
+static void _host_setup(const sim_lun_t *luns, u32 lun_cnt)
+{
+	memcpy(host.luns, luns, lun_cnt * sizeof(sim_lun_t));
+	host.lun_cnt = lun_cnt;
+
+	for (u32 i = 0; i < lun_cnt; i++)
+	{
+		_cmd_add_simple(i, 0x12, 36, 36);
+		_cmd_add_simple(i, 0x00, 0, 0);
+	}
+}
+
+int sim_host_load_script(const char *path, const sim_lun_t *luns, u32 lun_cnt)
+{
+	char line[512];
+	int line_num = 0;
+	int res = 0;
+
+	FILE *fp = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!fp)
+	{
+		fprintf(stderr, "sim: cannot open script %s\n", path);
+		return 1;
+	}
+
+	_host_setup(luns, lun_cnt);
+
+	while (!res && fgets(line, sizeof(line), fp))
+		res = _parse_line(line, ++line_num);
+
+	if (fp != stdin)
+		fclose(fp);
+
+	return res;
+}
+
+/*
+ * Trace replay.
+ */
+
+#define SIM_TRACE_MAGIC 0x43525455 // UTRC, see bdk/usb/ums_trace.h.
+
+typedef struct _sim_replay_t
+{
+	u32 added;
+	u32 skipped;
+	u32 wrapped;
+} sim_replay_t;
+
+// Splits what does not fit into a 10 byte CDB and wraps what is past the end of the LUN.
+static void _replay_rw(sim_replay_t *rp, u32 lun, bool write, u64 lba, u64 blocks, u64 at_us)
+{
+	if (lun >= host.lun_cnt || !blocks)
+	{
+		rp->skipped++;
+		return;
+	}
+
+	u32 sectors = _lun_sectors(&host.luns[lun]);
+	while (blocks)
+	{
+		u32 cnt = MIN(blocks, MIN(0xFFFF, sectors));
+
+		if (lba + cnt > sectors)
+		{
+			lba %= sectors;
+			if (lba + cnt > sectors)
+				lba = 0;
+			rp->wrapped++;
+		}
+
+		_cmd_add_rw(lun, write, lba, cnt);
+		host.cmds[host.cmd_cnt - 1].replayed = true;
+		host.cmds[host.cmd_cnt - 1].at_us = at_us;
+		rp->added++;
+
+		lba    += cnt;
+		blocks -= cnt;
+	}
+}
+
+static void _replay_sync(sim_replay_t *rp, u32 lun, u64 at_us)
+{
+	if (lun >= host.lun_cnt)
+	{
+		rp->skipped++;
+		return;
+	}
+
+	_cmd_add_simple(lun, 0x35, 0, 0);
+	host.cmds[host.cmd_cnt - 1].replayed = true;
+	host.cmds[host.cmd_cnt - 1].at_us = at_us;
+	rp->added++;
+}
+
+// Device trace from tools/ums_trace.py or ums-sim -D. Only media access and sync are replayed.
+static int _replay_ums_trace(sim_replay_t *rp, FILE *fp)
+{
+	u32 hdr[6];
+	u8 e[32];
+	u32 first_us = 0;
+	bool first = true;
+
+	if (fread(hdr, sizeof(hdr), 1, fp) != 1 || hdr[0] != SIM_TRACE_MAGIC || (hdr[1] & 0xFFFF) != sizeof(e))
+		return 1;
+
+	while (fread(e, sizeof(e), 1, fp) == 1)
+	{
+		u32 lba, length, cbw_us;
+		memcpy(&lba, e + 8, 4);
+		memcpy(&length, e + 12, 4);
+		memcpy(&cbw_us, e + 16, 4);
+
+		if (first)
+			first_us = cbw_us;
+		first = false;
+
+		u64 at_us = (u32)(cbw_us - first_us);
+
+		switch (e[0])
+		{
+		case 0x08: // READ(6/10/12).
+		case 0x28:
+		case 0xA8:
+			_replay_rw(rp, e[1], false, lba, length / SIM_SECTOR_SZ, at_us);
+			break;
+		case 0x0A: // WRITE(6/10/12).
+		case 0x2A:
+		case 0xAA:
+			_replay_rw(rp, e[1], true, lba, length / SIM_SECTOR_SZ, at_us);
+			break;
+		case 0x35:
+			_replay_sync(rp, e[1], at_us);
+			break;
+		default:
+			rp->skipped++;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * blkparse text output of the host side disk, e.g.:
+ *   8,16   2   15   0.001234567   412  D   R 2048 + 256 [dd]
+ * Issue (D) events are used, queue (Q) events if there are none. Everything goes to LUN 0.
+ */
+static int _replay_blktrace(sim_replay_t *rp, FILE *fp)
+{
+	char line[512];
+	bool have_d = false;
+	double first_s = -1;
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		char want = have_d ? 'D' : 'Q';
+
+		rewind(fp);
+		while (fgets(line, sizeof(line), fp))
+		{
+			char act, rwbs[8];
+			double time_s;
+			unsigned long long sector = 0;
+			unsigned int blocks = 0;
+
+			int n = sscanf(line, "%*s %*u %*u %lf %*u %c %7s %llu + %u", &time_s, &act, rwbs, &sector, &blocks);
+			if (n < 3)
+				continue;
+
+			if (!pass)
+			{
+				have_d |= act == 'D';
+				continue;
+			}
+
+			if (act != want)
+				continue;
+
+			if (first_s < 0)
+				first_s = time_s;
+			u64 at_us = (time_s - first_s) * 1000000.0;
+
+			if (strchr(rwbs, 'F') && n < 5)
+				_replay_sync(rp, 0, at_us);
+			else if (n == 5 && strchr(rwbs, 'R'))
+				_replay_rw(rp, 0, false, sector, blocks, at_us);
+			else if (n == 5 && strchr(rwbs, 'W'))
+				_replay_rw(rp, 0, true, sector, blocks, at_us);
+			else
+				rp->skipped++;
+		}
+	}
+
+	return 0;
+}
+
+int sim_host_load_replay(const char *path, const sim_lun_t *luns, u32 lun_cnt, bool gaps)
+{
+	sim_replay_t rp = {0};
+	u32 magic = 0;
+
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+	{
+		fprintf(stderr, "sim: cannot open trace %s\n", path);
+		return 1;
+	}
+
+	_host_setup(luns, lun_cnt);
+	host.gaps = gaps;
+
+	int res;
+	if (fread(&magic, 4, 1, fp) == 1 && magic == SIM_TRACE_MAGIC)
+	{
+		rewind(fp);
+		res = _replay_ums_trace(&rp, fp);
+	}
+	else
+		res = _replay_blktrace(&rp, fp);
+
+	fclose(fp);
+
+	if (res || !rp.added)
+	{
+		fprintf(stderr, "sim: %s: no usable commands\n", path);
+		return 1;
+	}
+
+	fprintf(stderr, "sim: replaying %d commands, %d skipped, %d wrapped to the LUN size\n",
+		rp.added, rp.skipped, rp.wrapped);
+
+	return 0;
+}
+
+void sim_host_set_verify(bool verify)
+{
+	host.verify = verify;
+}
+
+int sim_host_open_trace(const char *path)
+{
+	host.trace = fopen(path, "w");
+	if (!host.trace)
+	{
+		fprintf(stderr, "sim: cannot create %s\n", path);
+		return 1;
+	}
+
+	fprintf(host.trace, "tag,op,lun,lba,bytes,status,start_us,time_us,cpu_ns\n");
+
+	return 0;
+}
+
+/*
+ * Data patterns and verification.
+ */
+
+static u32 _pattern_word(u32 lba, u32 tag, u32 pos)
+{
+	u32 sector = lba + pos / SIM_SECTOR_SZ;
+
+	return (sector * 0x9E3779B1) ^ (tag << 16) ^ (pos % SIM_SECTOR_SZ);
+}
+
+static void _pattern_fill(u8 *buf, u32 pos, u32 len)
+{
+	sim_exclude_begin();
+	for (u32 i = 0; i + 4 <= len; i += 4)
+	{
+		u32 word = _pattern_word(host.cur.lba, host.tag, pos + i);
+		memcpy(buf + i, &word, 4);
+	}
+	sim_exclude_end();
+}
+
+// Compares sectors the gadget sent or wrote against the disk, without touching the virtual clock.
+static void _verify(const u8 *data, u32 pos, u32 len, bool pattern)
+{
+	static u8 disk_buf[SIM_SECTOR_SZ];
+	const sim_lun_t *lun = &host.luns[host.cur.lun];
+
+	if (!host.verify)
+		return;
+
+	sim_exclude_begin();
+	for (u32 off = 0; off + SIM_SECTOR_SZ <= len; off += SIM_SECTOR_SZ)
+	{
+		u32 sector = host.cur.lba + (pos + off) / SIM_SECTOR_SZ;
+		bool ok = sim_disk_peek(lun->disk, (u64)lun->offset + sector, 1, disk_buf);
+
+		if (ok && lun->xts)
+			sim_xts_crypt(lun->xts_key, false, sector, disk_buf, 1);
+
+		if (ok && pattern)
+		{
+			for (u32 i = 0; ok && i < SIM_SECTOR_SZ; i += 4)
+			{
+				u32 word = _pattern_word(host.cur.lba, host.tag, pos + off + i);
+				ok = !memcmp(disk_buf + i, &word, 4);
+			}
+		}
+		else if (ok)
+			ok = !memcmp(disk_buf, data + off, SIM_SECTOR_SZ);
+
+		if (!ok)
+		{
+			if (!host.mismatches)
+				fprintf(stderr, "sim: data mismatch: lun %d sector %d (tag %d)\n", host.cur.lun, sector, host.tag);
+			host.mismatches++;
+			break;
+		}
+	}
+	sim_exclude_end();
+}
+
+static bool _peek_lun(const sim_lun_t *lun, u32 sector, u8 *buf)
+{
+	if (!sim_disk_peek(lun->disk, (u64)lun->offset + sector, 1, buf))
+		return false;
+
+	if (lun->xts)
+		sim_xts_crypt(lun->xts_key, false, sector, buf, 1);
+
+	return true;
+}
+
+// Both ranges of a COPY RANGE must read the same afterwards.
+static void _verify_copy()
+{
+	static u8 src_buf[SIM_SECTOR_SZ];
+	static u8 dst_buf[SIM_SECTOR_SZ];
+	const u8 *cdb = host.cur.cdb;
+	u32 src_lba = (cdb[2] << 24) | (cdb[3] << 16) | (cdb[4] << 8) | cdb[5];
+	u32 dst_lba = (cdb[6] << 24) | (cdb[7] << 16) | (cdb[8] << 8) | cdb[9];
+	u32 blocks  = (cdb[10] << 24) | (cdb[11] << 16) | (cdb[12] << 8) | cdb[13];
+
+	if (!host.verify)
+		return;
+
+	sim_exclude_begin();
+	for (u32 i = 0; i < blocks; i++)
+	{
+		bool ok = _peek_lun(&host.luns[cdb[1] & 0xF], src_lba + i, src_buf) &&
+			_peek_lun(&host.luns[host.cur.lun], dst_lba + i, dst_buf) &&
+			!memcmp(src_buf, dst_buf, SIM_SECTOR_SZ);
+
+		if (!ok)
+		{
+			if (!host.mismatches)
+				fprintf(stderr, "sim: data mismatch: lun %d sector %d (tag %d)\n", host.cur.lun, dst_lba + i, host.tag);
+			host.mismatches++;
+			break;
+		}
+	}
+	sim_exclude_end();
+}
+
+/*
+ * Bulk Only Transport host.
+ */
+
+static bool _next_cmd(sim_cmd_t *cmd)
+{
+	if (host.sense_pending)
+	{
+		memset(cmd, 0, sizeof(sim_cmd_t));
+		cmd->lun      = host.failed.lun;
+		cmd->op       = SIM_OP_OTHER;
+		cmd->dir_in   = 1;
+		cmd->data_len = SIM_SENSE_LEN;
+		cmd->cdb_len  = 6;
+		cmd->cdb[0]   = 0x03; // REQUEST SENSE.
+		cmd->cdb[4]   = SIM_SENSE_LEN;
+		return true;
+	}
+
+	if (host.retry_pending)
+	{
+		host.retry_pending = false;
+		*cmd = host.failed;
+		return true;
+	}
+
+	if (host.cmd_idx < host.cmd_cnt)
+	{
+		host.retried = false;
+		*cmd = host.cmds[host.cmd_idx++];
+		return true;
+	}
+
+	return false;
+}
+
+static u32 _usb_xfer_us(u32 len)
+{
+	return sim_usb_model.xfer_lat_us + len / sim_usb_model.mbps;
+}
+
+// Synced transfers block the gadget. Started ones run in the background until finished.
+static void _usb_xfer(usb_dir_t dir, u32 len, bool sync)
+{
+	u32 us = _usb_xfer_us(len);
+	u64 start = host.busy_until[dir] > sim_now_us ? host.busy_until[dir] : sim_now_us;
+
+	host.busy_until[dir] = start + us;
+	if (sync)
+		sim_wait_until_us(host.busy_until[dir]);
+
+	host.busy_us[dir]     += us;
+	sim_usb_stats.busy_us += us;
+	if (dir == USB_DIR_IN)
+	{
+		sim_usb_stats.rd_ops++;
+		sim_usb_stats.rd_bytes += len;
+	}
+	else
+	{
+		sim_usb_stats.wr_ops++;
+		sim_usb_stats.wr_bytes += len;
+	}
+}
+
+static u32 _send_cbw(u8 *buf, u32 len)
+{
+	if (len < SIM_CBW_LEN)
+	{
+		_proto_error("CBW buffer too small");
+		return 0;
+	}
+
+	// Host think time from the replayed trace.
+	if (host.gaps && host.cur.replayed)
+	{
+		if (!host.gaps_started)
+			host.gaps_base_us = sim_now_us - host.cur.at_us;
+		host.gaps_started = true;
+		sim_wait_until_us(host.gaps_base_us + host.cur.at_us);
+	}
+
+	host.tag++;
+	host.xfered = 0;
+	host.start_us = sim_now_us;
+	host.start_cpu_ns = sim_cpu_ns();
+	if (!host.first_us)
+		host.first_us = sim_now_us;
+
+	memset(buf, 0, SIM_CBW_LEN);
+	u32 sig = SIM_CBW_SIG;
+	memcpy(buf, &sig, 4);
+	memcpy(buf + 4, &host.tag, 4);
+	memcpy(buf + 8, &host.cur.data_len, 4);
+	buf[12] = host.cur.dir_in ? 0x80 : 0;
+	buf[13] = host.cur.lun;
+	buf[14] = host.cur.cdb_len;
+	memcpy(buf + 15, host.cur.cdb, host.cur.cdb_len);
+
+	if (!host.cur.data_len)
+		host.state = HOST_CSW;
+	else
+		host.state = host.cur.dir_in ? HOST_DATA_IN : HOST_DATA_OUT;
+
+	// A device cache would be written back on these.
+	if (host.cur.cdb[0] == 0x35 || host.cur.cdb[0] == 0x1B)
+		sim_cache_flush();
+
+	return SIM_CBW_LEN;
+}
+
+static void _receive_csw(const u8 *buf)
+{
+	u32 tag, residue;
+	u8 status = buf[12];
+
+	memcpy(&tag, buf + 4, 4);
+	memcpy(&residue, buf + 8, 4);
+
+	if (tag != host.tag)
+		_proto_error("CSW tag mismatch");
+	// A short reply padded with zeros moves all data, but still reports the residue.
+	if (status == 0 && (residue > host.cur.data_len ||
+		(host.xfered != host.cur.data_len && residue != host.cur.data_len - host.xfered)))
+		_proto_error("CSW residue mismatch");
+
+	u64 time_us = sim_now_us - host.start_us;
+	u64 cpu_ns  = sim_cpu_ns() - host.start_cpu_ns;
+
+	sim_op_stats_t *ops = &host.ops[host.cur.op];
+	ops->cmds++;
+	ops->bytes   += host.xfered;
+	ops->time_us += time_us;
+	ops->cpu_ns  += cpu_ns;
+	if (time_us > ops->max_us)
+		ops->max_us = time_us;
+
+	if (ops->cmds > ops->lat_alloc)
+	{
+		ops->lat_alloc = ops->lat_alloc ? ops->lat_alloc * 2 : 256;
+		ops->lat_us = realloc(ops->lat_us, ops->lat_alloc * sizeof(u32));
+		if (!ops->lat_us)
+		{
+			fprintf(stderr, "sim: out of memory\n");
+			exit(2);
+		}
+	}
+	ops->lat_us[ops->cmds - 1] = MIN(time_us, 0xFFFFFFFF);
+
+	if (host.trace)
+	{
+		fprintf(host.trace, "%d,%s,%d,%d,%d,%d,%llu,%llu,%llu\n", host.tag, sim_op_names[host.cur.op],
+			host.cur.lun, host.cur.lba, host.xfered, status,
+			(unsigned long long)host.start_us, (unsigned long long)time_us, (unsigned long long)cpu_ns);
+	}
+
+	bool was_sense = host.sense_pending;
+	host.sense_pending = false;
+
+	if (was_sense)
+	{
+		// Retry once on unit attention, count anything else as a failure.
+		if ((host.sense[2] & 0xF) == SIM_SK_UNIT_ATTENTION && !host.retried)
+		{
+			host.retried = true;
+			host.retry_pending = true;
+		}
+		else
+			host.ops[host.failed.op].failed++;
+	}
+	else if (status == 1)
+	{
+		host.failed = host.cur;
+		host.sense_pending = true;
+	}
+	else if (status)
+		_proto_error("CSW phase error");
+	else if (host.cur.op == SIM_OP_WRITE)
+		_verify(NULL, 0, host.xfered, true);
+	else if (host.cur.cdb[0] == SIM_OP_COPY_RANGE)
+		_verify_copy();
+	else if (host.cur.cdb[0] == SIM_OP_SET_XTS_KEY)
+	{
+		u8 *key = host.luns[host.cur.lun].xts_key;
+
+		if (host.cur.data)
+			memcpy(key, host.cur.data, SIM_XTS_KEY_SZ);
+		else
+			memset(key, 0, SIM_XTS_KEY_SZ);
+	}
+
+	host.state = HOST_CBW;
+}
+
+/*
+ * Fake usb_ops_t.
+ */
+
+static int _sim_flush_endpoint(u32 ep)
+{
+	return USB_RES_OK;
+}
+
+static int _sim_set_ep_stall(u32 ep, int stall)
+{
+	if (stall != USB_EP_CFG_STALL)
+		return USB_RES_OK;
+
+	host.stalls++;
+
+	// The host gives up on the data stage and goes for the CSW.
+	if ((ep == USB_EP_BULK_IN && host.state == HOST_DATA_IN) || (ep == USB_EP_BULK_OUT && host.state == HOST_DATA_OUT))
+		host.state = HOST_CSW;
+
+	return USB_RES_OK;
+}
+
+static int _sim_handle_ep0_ctrl_setup()
+{
+	return USB_RES_OK;
+}
+
+static void _sim_end(bool reset_ep, bool only_controller)
+{
+	if (!host.end_us)
+		host.end_us = sim_now_us;
+}
+
+static int _sim_device_init()
+{
+	return USB_RES_OK;
+}
+
+static int _sim_device_enumerate(usb_gadget_type gadget)
+{
+	if (gadget != USB_GADGET_UMS)
+		return USB_ERROR_INIT;
+
+	return USB_RES_OK;
+}
+
+static int _sim_class_send_max_lun(u8 max_lun)
+{
+	if (max_lun != host.lun_cnt - 1)
+		_proto_error("wrong max LUN");
+
+	return USB_RES_OK;
+}
+
+static int _sim_class_send_hid_report()
+{
+	return USB_ERROR_XFER_ERROR;
+}
+
+static int _sim_ep1_out_read(u8 *buf, u32 len, u32 *bytes_read, u32 sync_timeout)
+{
+	u32 actual = 0;
+
+	host.last_out_buf = buf;
+
+	switch (host.state)
+	{
+	case HOST_CBW:
+		if (!_next_cmd(&host.cur))
+		{
+			if (!host.end_us)
+			{
+				sim_cache_flush();
+				host.end_us = sim_now_us;
+			}
+			if (++host.idle_polls > SIM_MAX_IDLE_POLLS)
+			{
+				fprintf(stderr, "sim: gadget did not exit after the script ended\n");
+				exit(2);
+			}
+
+			// Looks like a disconnect to the gadget.
+			return USB2_ERROR_XFER_EP_DISABLED;
+		}
+		actual = _send_cbw(buf, len);
+		break;
+
+	case HOST_DATA_OUT:
+		actual = MIN(len, host.cur.data_len - host.xfered);
+		if (host.cur.data)
+			memcpy(buf, host.cur.data + host.xfered, actual);
+		else
+			_pattern_fill(buf, host.xfered, actual);
+		host.xfered += actual;
+		if (host.xfered == host.cur.data_len)
+			host.state = HOST_CSW;
+		break;
+
+	default:
+		_proto_error("unexpected OUT transfer");
+		return USB_ERROR_XFER_ERROR;
+	}
+
+	_usb_xfer(USB_DIR_OUT, actual, sync_timeout != USB_XFER_START);
+	host.pending[USB_DIR_OUT] = actual;
+
+	if (bytes_read)
+		*bytes_read = actual;
+
+	return USB_RES_OK;
+}
+
+static int _sim_ep1_out_read_big(u8 *buf, u32 len, u32 *bytes_read)
+{
+	return _sim_ep1_out_read(buf, len, bytes_read, USB_XFER_SYNCED_DATA);
+}
+
+static int _sim_ep1_out_reading_finish(u32 *pending_bytes, u32 sync_timeout)
+{
+	// A CBW request left queued by a timeout completes with the next command.
+	if (host.state == HOST_CBW && host.last_out_buf)
+		return _sim_ep1_out_read(host.last_out_buf, SIM_CBW_LEN, pending_bytes, sync_timeout);
+
+	sim_wait_until_us(host.busy_until[USB_DIR_OUT]);
+	if (pending_bytes)
+		*pending_bytes = host.pending[USB_DIR_OUT];
+
+	return USB_RES_OK;
+}
+
+static int _sim_ep1_in_write(u8 *buf, u32 len, u32 *bytes_written, u32 sync_timeout)
+{
+	u32 sig;
+
+	memcpy(&sig, buf, 4);
+
+	if (len == SIM_CSW_LEN && sig == SIM_CSW_SIG && host.state != HOST_CBW)
+	{
+		// A real host would still be pushing data and end up in a reset recovery.
+		if (host.state == HOST_DATA_OUT)
+			_proto_error("CSW before the OUT data stage ended");
+
+		_usb_xfer(USB_DIR_IN, len, sync_timeout != USB_XFER_START);
+		_receive_csw(buf);
+	}
+	else if (host.state == HOST_DATA_IN)
+	{
+		u32 actual = MIN(len, host.cur.data_len - host.xfered);
+
+		if (host.cur.op == SIM_OP_READ)
+			_verify(buf, host.xfered, actual, false);
+		else if (host.sense_pending)
+			memcpy(host.sense, buf, MIN(actual, SIM_SENSE_LEN));
+
+		host.xfered += actual;
+		if (host.xfered == host.cur.data_len)
+			host.state = HOST_CSW;
+
+		_usb_xfer(USB_DIR_IN, len, sync_timeout != USB_XFER_START);
+	}
+	else
+	{
+		_proto_error("unexpected IN transfer");
+		return USB_ERROR_XFER_ERROR;
+	}
+
+	host.pending[USB_DIR_IN] = len;
+	if (bytes_written)
+		*bytes_written = len;
+
+	return USB_RES_OK;
+}
+
+static int _sim_ep1_in_write_big(u8 *buf, u32 len, u32 *bytes_written)
+{
+	return _sim_ep1_in_write(buf, len, bytes_written, USB_XFER_SYNCED_DATA);
+}
+
+static int _sim_ep1_in_writing_finish(u32 *pending_bytes, u32 sync_timeout)
+{
+	sim_wait_until_us(host.busy_until[USB_DIR_IN]);
+	if (pending_bytes)
+		*pending_bytes = host.pending[USB_DIR_IN];
+
+	return USB_RES_OK;
+}
+
+static bool _sim_get_false()
+{
+	return false;
+}
+
+static void _sim_get_ops(usb_ops_t *ops)
+{
+	ops->usbd_flush_endpoint               = _sim_flush_endpoint;
+	ops->usbd_set_ep_stall                 = _sim_set_ep_stall;
+	ops->usbd_handle_ep0_ctrl_setup        = _sim_handle_ep0_ctrl_setup;
+	ops->usbd_end                          = _sim_end;
+	ops->usb_device_init                   = _sim_device_init;
+	ops->usb_device_enumerate              = _sim_device_enumerate;
+	ops->usb_device_class_send_max_lun     = _sim_class_send_max_lun;
+	ops->usb_device_class_send_hid_report  = _sim_class_send_hid_report;
+	ops->usb_device_ep1_out_read           = _sim_ep1_out_read;
+	ops->usb_device_ep1_out_read_big       = _sim_ep1_out_read_big;
+	ops->usb_device_ep1_out_reading_finish = _sim_ep1_out_reading_finish;
+	ops->usb_device_ep1_in_write           = _sim_ep1_in_write;
+	ops->usb_device_ep1_in_write_big       = _sim_ep1_in_write_big;
+	ops->usb_device_ep1_in_writing_finish  = _sim_ep1_in_writing_finish;
+	ops->usb_device_get_suspended          = _sim_get_false;
+	ops->usb_device_get_port_in_sleep      = _sim_get_false;
+}
+
+// Both controllers map to the same fake, the gadget only picks its quirks by backend.
+void usb_device_get_ops(usb_ops_t *ops)
+{
+	_sim_get_ops(ops);
+}
+
+void xusb_device_get_ops(usb_ops_t *ops)
+{
+	_sim_get_ops(ops);
+}
+
+/*
+ * Report.
+ */
+
+static int _lat_cmp(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static u32 _lat_percentile(sim_op_stats_t *ops, u32 pct)
+{
+	if (!ops->cmds)
+		return 0;
+
+	qsort(ops->lat_us, ops->cmds, sizeof(u32), _lat_cmp);
+
+	return ops->lat_us[(ops->cmds * pct + 99) / 100 - 1];
+}
+
+static double _op_mbps(const sim_op_stats_t *ops)
+{
+	return ops->time_us ? (double)ops->bytes / ops->time_us : 0.0;
+}
+
+static double _op_avg_us(const sim_op_stats_t *ops)
+{
+	return ops->cmds ? (double)ops->time_us / ops->cmds : 0.0;
+}
+
+int sim_host_report()
+{
+	u64 run_us = host.end_us > host.first_us ? host.end_us - host.first_us : 0;
+	u64 failed = 0;
+
+	if (host.trace)
+		fclose(host.trace);
+
+	printf("%-6s %8s %10s %9s %9s %9s %9s %11s %7s\n", "op", "cmds", "MiB", "MB/s", "avg us", "p99 us", "max us",
+		"cpu ns/cmd", "failed");
+	for (u32 i = 0; i < SIM_OP_MAX; i++)
+	{
+		sim_op_stats_t *ops = &host.ops[i];
+		if (!ops->cmds)
+			continue;
+
+		printf("%-6s %8llu %10.2f %9.2f %9.1f %9d %9llu %11llu %7llu\n", sim_op_names[i],
+			(unsigned long long)ops->cmds, ops->bytes / 1048576.0, _op_mbps(ops), _op_avg_us(ops),
+			_lat_percentile(ops, 99), (unsigned long long)ops->max_us,
+			(unsigned long long)(ops->cpu_ns / ops->cmds), (unsigned long long)ops->failed);
+
+		if (i != SIM_OP_OTHER)
+			failed += ops->failed;
+	}
+
+	printf("\nvirtual time %.3f s, script %d/%d commands, %llu stalls\n", run_us / 1000000.0,
+		host.cmd_idx, host.cmd_cnt, (unsigned long long)host.stalls);
+	printf("storage: %llu reads %.2f MiB, %llu writes %.2f MiB, %llu part switches, busy %.1f%%\n",
+		(unsigned long long)sim_storage_stats.rd_ops, sim_storage_stats.rd_bytes / 1048576.0,
+		(unsigned long long)sim_storage_stats.wr_ops, sim_storage_stats.wr_bytes / 1048576.0,
+		(unsigned long long)sim_storage_stats.part_switches,
+		run_us ? sim_storage_stats.busy_us * 100.0 / run_us : 0.0);
+	printf("usb:     %llu IN %.2f MiB busy %.1f%%, %llu OUT %.2f MiB busy %.1f%%\n",
+		(unsigned long long)sim_usb_stats.rd_ops, sim_usb_stats.rd_bytes / 1048576.0,
+		run_us ? host.busy_us[USB_DIR_IN] * 100.0 / run_us : 0.0,
+		(unsigned long long)sim_usb_stats.wr_ops, sim_usb_stats.wr_bytes / 1048576.0,
+		run_us ? host.busy_us[USB_DIR_OUT] * 100.0 / run_us : 0.0);
+
+	if (sim_cache_enabled())
+	{
+		u64 looked_up = sim_cache_stats.hit_sectors + sim_cache_stats.miss_sectors;
+
+		printf("cache:   %d KB IRAM, read hits %.1f%%, read-ahead %llu/%llu chunks used, "
+			"%.2f MiB write cached in %llu flushes\n",
+			sim_cache_cfg.chunk * sim_cache_cfg.bufs / 1024,
+			looked_up ? sim_cache_stats.hit_sectors * 100.0 / looked_up : 0.0,
+			(unsigned long long)sim_cache_stats.ra_used, (unsigned long long)sim_cache_stats.ra_chunks,
+			sim_cache_stats.wc_sectors * SIM_SECTOR_SZ / 1048576.0, (unsigned long long)sim_cache_stats.flushes);
+	}
+
+	if (host.proto_errors || host.mismatches || failed || host.cmd_idx != host.cmd_cnt)
+	{
+		printf("FAIL: %llu protocol errors, %llu data mismatches, %llu failed read/write commands\n",
+			(unsigned long long)host.proto_errors, (unsigned long long)host.mismatches, (unsigned long long)failed);
+		return 1;
+	}
+
+	return 0;
+}
+
+// One CSV line for sweeps: name,read MB/s,write MB/s,overall MB/s,read avg/p99 us,write avg/p99 us,SDMMC reads,SDMMC writes.
+void sim_host_summary(const char *name)
+{
+	u64 run_us = host.end_us > host.first_us ? host.end_us - host.first_us : 0;
+	sim_op_stats_t *rd = &host.ops[SIM_OP_READ];
+	sim_op_stats_t *wr = &host.ops[SIM_OP_WRITE];
+
+	printf("summary,%s,%.2f,%.2f,%.2f,%.1f,%d,%.1f,%d,%llu,%llu\n", name,
+		_op_mbps(rd), _op_mbps(wr), run_us ? (double)(rd->bytes + wr->bytes) / run_us : 0.0,
+		_op_avg_us(rd), _lat_percentile(rd, 99), _op_avg_us(wr), _lat_percentile(wr, 99),
+		(unsigned long long)sim_storage_stats.rd_ops, (unsigned long long)sim_storage_stats.wr_ops);
+}
@@ -0,0 +1,350 @@
+/*
+ * Host side simulation of the UMS gadget - software SE for decrypted LUNs
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <sec/se.h>
+#include <utils/types.h>
+
+#include "sim.h"
+
+/*
+ * Replaces the parts of bdk/sec/se.c the gadget uses with a plain AES-128.
+ * se_aes_xts_crypt_sec_nx() follows the SE version step by step. The host
+ * checks the data with sim_xts_crypt(), a separate textbook XTS over 16KB
+ * crypto sectors, so both have to agree on what ends up on the disk.
+ */
+
+#define SIM_KEYSLOTS      16
+#define SIM_AES_ROUNDS    10
+#define SIM_XTS_CLUSTER   0x4000
+
+static const u8 sbox[256] = {
+	0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
+	0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0, 0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0,
+	0xB7, 0xFD, 0x93, 0x26, 0x36, 0x3F, 0xF7, 0xCC, 0x34, 0xA5, 0xE5, 0xF1, 0x71, 0xD8, 0x31, 0x15,
+	0x04, 0xC7, 0x23, 0xC3, 0x18, 0x96, 0x05, 0x9A, 0x07, 0x12, 0x80, 0xE2, 0xEB, 0x27, 0xB2, 0x75,
+	0x09, 0x83, 0x2C, 0x1A, 0x1B, 0x6E, 0x5A, 0xA0, 0x52, 0x3B, 0xD6, 0xB3, 0x29, 0xE3, 0x2F, 0x84,
+	0x53, 0xD1, 0x00, 0xED, 0x20, 0xFC, 0xB1, 0x5B, 0x6A, 0xCB, 0xBE, 0x39, 0x4A, 0x4C, 0x58, 0xCF,
+	0xD0, 0xEF, 0xAA, 0xFB, 0x43, 0x4D, 0x33, 0x85, 0x45, 0xF9, 0x02, 0x7F, 0x50, 0x3C, 0x9F, 0xA8,
+	0x51, 0xA3, 0x40, 0x8F, 0x92, 0x9D, 0x38, 0xF5, 0xBC, 0xB6, 0xDA, 0x21, 0x10, 0xFF, 0xF3, 0xD2,
+	0xCD, 0x0C, 0x13, 0xEC, 0x5F, 0x97, 0x44, 0x17, 0xC4, 0xA7, 0x7E, 0x3D, 0x64, 0x5D, 0x19, 0x73,
+	0x60, 0x81, 0x4F, 0xDC, 0x22, 0x2A, 0x90, 0x88, 0x46, 0xEE, 0xB8, 0x14, 0xDE, 0x5E, 0x0B, 0xDB,
+	0xE0, 0x32, 0x3A, 0x0A, 0x49, 0x06, 0x24, 0x5C, 0xC2, 0xD3, 0xAC, 0x62, 0x91, 0x95, 0xE4, 0x79,
+	0xE7, 0xC8, 0x37, 0x6D, 0x8D, 0xD5, 0x4E, 0xA9, 0x6C, 0x56, 0xF4, 0xEA, 0x65, 0x7A, 0xAE, 0x08,
+	0xBA, 0x78, 0x25, 0x2E, 0x1C, 0xA6, 0xB4, 0xC6, 0xE8, 0xDD, 0x74, 0x1F, 0x4B, 0xBD, 0x8B, 0x8A,
+	0x70, 0x3E, 0xB5, 0x66, 0x48, 0x03, 0xF6, 0x0E, 0x61, 0x35, 0x57, 0xB9, 0x86, 0xC1, 0x1D, 0x9E,
+	0xE1, 0xF8, 0x98, 0x11, 0x69, 0xD9, 0x8E, 0x94, 0x9B, 0x1E, 0x87, 0xE9, 0xCE, 0x55, 0x28, 0xDF,
+	0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42, 0x68, 0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16
+};
+
+static u8 inv_sbox[256];
+
+typedef struct _sim_aes_key_t
+{
+	u8 rk[(SIM_AES_ROUNDS + 1) * 16];
+} sim_aes_key_t;
+
+static sim_aes_key_t keyslots[SIM_KEYSLOTS];
+
+static u8 _xtime(u8 b)
+{
+	return (b << 1) ^ (b & 0x80 ? 0x1B : 0);
+}
+
+static u8 _gmul(u8 a, u8 b)
+{
+	u8 res = 0;
+
+	while (b)
+	{
+		if (b & 1)
+			res ^= a;
+		a = _xtime(a);
+		b >>= 1;
+	}
+
+	return res;
+}
+
+static void _aes_expand(sim_aes_key_t *key, const u8 *raw)
+{
+	u8 rcon = 1;
+
+	if (!inv_sbox[sbox[1]])
+	{
+		for (u32 i = 0; i < 256; i++)
+			inv_sbox[sbox[i]] = i;
+	}
+
+	memcpy(key->rk, raw, 16);
+	for (u32 i = 16; i < sizeof(key->rk); i += 4)
+	{
+		u8 t[4];
+
+		memcpy(t, key->rk + i - 4, 4);
+		if (!(i % 16))
+		{
+			u8 b = t[0];
+			t[0] = sbox[t[1]] ^ rcon;
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[b];
+			rcon = _xtime(rcon);
+		}
+
+		for (u32 j = 0; j < 4; j++)
+			key->rk[i + j] = key->rk[i - 16 + j] ^ t[j];
+	}
+}
+
+// State is column major, same as the byte order of the block.
+static void _aes_encrypt(const sim_aes_key_t *key, u8 *blk)
+{
+	u8 t[16];
+
+	for (u32 i = 0; i < 16; i++)
+		blk[i] ^= key->rk[i];
+
+	for (u32 r = 1; r <= SIM_AES_ROUNDS; r++)
+	{
+		// SubBytes and ShiftRows.
+		for (u32 i = 0; i < 16; i++)
+			t[i] = sbox[blk[(i + (i % 4) * 4) % 16]];
+
+		// MixColumns, except in the last round.
+		for (u32 c = 0; c < 16 && r < SIM_AES_ROUNDS; c += 4)
+		{
+			u8 a0 = t[c], a1 = t[c + 1], a2 = t[c + 2], a3 = t[c + 3];
+
+			t[c]     = _xtime(a0) ^ _xtime(a1) ^ a1 ^ a2 ^ a3;
+			t[c + 1] = a0 ^ _xtime(a1) ^ _xtime(a2) ^ a2 ^ a3;
+			t[c + 2] = a0 ^ a1 ^ _xtime(a2) ^ _xtime(a3) ^ a3;
+			t[c + 3] = _xtime(a0) ^ a0 ^ a1 ^ a2 ^ _xtime(a3);
+		}
+
+		for (u32 i = 0; i < 16; i++)
+			blk[i] = t[i] ^ key->rk[r * 16 + i];
+	}
+}
+
+static void _aes_decrypt(const sim_aes_key_t *key, u8 *blk)
+{
+	u8 t[16];
+
+	for (u32 i = 0; i < 16; i++)
+		blk[i] ^= key->rk[SIM_AES_ROUNDS * 16 + i];
+
+	for (u32 r = SIM_AES_ROUNDS; r >= 1; r--)
+	{
+		// InvShiftRows and InvSubBytes.
+		for (u32 i = 0; i < 16; i++)
+			t[(i + (i % 4) * 4) % 16] = inv_sbox[blk[i]];
+
+		for (u32 i = 0; i < 16; i++)
+			t[i] ^= key->rk[(r - 1) * 16 + i];
+
+		// InvMixColumns, except after the last round.
+		for (u32 c = 0; c < 16 && r > 1; c += 4)
+		{
+			u8 a0 = t[c], a1 = t[c + 1], a2 = t[c + 2], a3 = t[c + 3];
+
+			t[c]     = _gmul(a0, 14) ^ _gmul(a1, 11) ^ _gmul(a2, 13) ^ _gmul(a3, 9);
+			t[c + 1] = _gmul(a0, 9)  ^ _gmul(a1, 14) ^ _gmul(a2, 11) ^ _gmul(a3, 13);
+			t[c + 2] = _gmul(a0, 13) ^ _gmul(a1, 9)  ^ _gmul(a2, 14) ^ _gmul(a3, 11);
+			t[c + 3] = _gmul(a0, 11) ^ _gmul(a1, 13) ^ _gmul(a2, 9)  ^ _gmul(a3, 14);
+		}
+
+		memcpy(blk, t, 16);
+	}
+}
+
+// FIPS-197 appendix C.1.
+int sim_xts_selftest()
+{
+	static const u8 ct[16] = {
+		0x69, 0xC4, 0xE0, 0xD8, 0x6A, 0x7B, 0x04, 0x30, 0xD8, 0xCD, 0xB7, 0x80, 0x70, 0xB4, 0xC5, 0x5A
+	};
+	sim_aes_key_t key;
+	u8 raw[16], blk[16];
+
+	for (u32 i = 0; i < 16; i++)
+	{
+		raw[i] = i;
+		blk[i] = i * 0x11;
+	}
+
+	_aes_expand(&key, raw);
+	_aes_encrypt(&key, blk);
+	if (memcmp(blk, ct, 16))
+		return 1;
+
+	_aes_decrypt(&key, blk);
+	for (u32 i = 0; i < 16; i++)
+		if (blk[i] != i * 0x11)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * SE stand-ins.
+ */
+
+void se_aes_key_set(u32 ks, const void *key, u32 size)
+{
+	if (ks < SIM_KEYSLOTS && size == SE_KEY_128_SIZE)
+		_aes_expand(&keyslots[ks], key);
+}
+
+void se_aes_key_clear(u32 ks)
+{
+	if (ks < SIM_KEYSLOTS)
+		memset(&keyslots[ks], 0, sizeof(sim_aes_key_t));
+}
+
+static int _se_aes_crypt_ecb(u32 ks, u32 enc, void *dst, u32 size)
+{
+	u8 *p = dst;
+
+	if (ks >= SIM_KEYSLOTS || size % 16)
+		return 0;
+
+	for (u32 i = 0; i < size; i += 16)
+	{
+		if (enc)
+			_aes_encrypt(&keyslots[ks], p + i);
+		else
+			_aes_decrypt(&keyslots[ks], p + i);
+	}
+
+	return 1;
+}
+
+static void _gf256_mul_x_le(void *block)
+{
+	u32 *pdata = (u32 *)block;
+	u32 carry = 0;
+
+	for (u32 i = 0; i < 4; i++)
+	{
+		u32 b = pdata[i];
+		pdata[i] = (b << 1) | carry;
+		carry = b >> 31;
+	}
+
+	if (carry)
+		pdata[0x0] ^= 0x87;
+}
+
+int se_aes_xts_crypt_sec_nx(u32 tweak_ks, u32 crypt_ks, u32 enc, u64 sec, u8 *tweak, bool regen_tweak, u32 tweak_exp, void *dst, void *src, u32 sec_size)
+{
+	u32 *pdst = (u32 *)dst;
+	u32 *psrc = (u32 *)src;
+	u32 *ptweak = (u32 *)tweak;
+
+	if (regen_tweak)
+	{
+		for (int i = 0xF; i >= 0; i--)
+		{
+			tweak[i] = sec & 0xFF;
+			sec >>= 8;
+		}
+		if (!_se_aes_crypt_ecb(tweak_ks, ENCRYPT, tweak, SE_KEY_128_SIZE))
+			return 0;
+	}
+
+	for (u32 i = 0; i < (tweak_exp << 5); i++)
+		_gf256_mul_x_le(tweak);
+
+	u8 orig_tweak[SE_KEY_128_SIZE] __attribute__((aligned(4)));
+	memcpy(orig_tweak, tweak, SE_KEY_128_SIZE);
+
+	for (u32 i = 0; i < (sec_size >> 4); i++)
+	{
+		for (u32 j = 0; j < 4; j++)
+			pdst[j] = psrc[j] ^ ptweak[j];
+
+		_gf256_mul_x_le(tweak);
+		psrc += 4;
+		pdst += 4;
+	}
+
+	if (!_se_aes_crypt_ecb(crypt_ks, enc, dst, sec_size))
+		return 0;
+
+	pdst = (u32 *)dst;
+	ptweak = (u32 *)orig_tweak;
+	for (u32 i = 0; i < (sec_size >> 4); i++)
+	{
+		for (u32 j = 0; j < 4; j++)
+			pdst[j] = pdst[j] ^ ptweak[j];
+
+		_gf256_mul_x_le(orig_tweak);
+		pdst += 4;
+	}
+
+	return 1;
+}
+
+/*
+ * Reference for the host side checks. Sector by sector, with the tweak worked
+ * out from the crypto sector number every time.
+ */
+
+void sim_xts_crypt(const u8 *key, bool enc, u64 sector, u8 *buf, u32 num_sectors)
+{
+	sim_aes_key_t crypt_key, tweak_key;
+
+	_aes_expand(&crypt_key, key);
+	_aes_expand(&tweak_key, key + 16);
+
+	for (u32 s = 0; s < num_sectors; s++, sector++, buf += SIM_SECTOR_SZ)
+	{
+		u64 cluster = sector * SIM_SECTOR_SZ / SIM_XTS_CLUSTER;
+		u32 first_blk = sector * SIM_SECTOR_SZ % SIM_XTS_CLUSTER / 16;
+		u8 tweak[16];
+
+		// Big endian crypto sector number.
+		for (u32 i = 0; i < 16; i++)
+			tweak[i] = i < 8 ? 0 : cluster >> ((15 - i) * 8);
+		_aes_encrypt(&tweak_key, tweak);
+
+		for (u32 blk = 0; blk < first_blk + SIM_SECTOR_SZ / 16; blk++)
+		{
+			if (blk >= first_blk)
+			{
+				u8 *p = buf + (blk - first_blk) * 16;
+
+				for (u32 i = 0; i < 16; i++)
+					p[i] ^= tweak[i];
+				if (enc)
+					_aes_encrypt(&crypt_key, p);
+				else
+					_aes_decrypt(&crypt_key, p);
+				for (u32 i = 0; i < 16; i++)
+					p[i] ^= tweak[i];
+			}
+
+			// Multiply by x, little endian 128-bit value.
+			u8 carry = tweak[15] >> 7;
+			for (u32 i = 15; i > 0; i--)
+				tweak[i] = (tweak[i] << 1) | (tweak[i - 1] >> 7);
+			tweak[0] = (tweak[0] << 1) ^ (carry ? 0x87 : 0);
+		}
+	}
+}
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+# Runs ums-sim over a grid of cache configurations and ranks them, e.g.:
+#   tools/host-sim/sweep.py --budget 128 -- -e 1G -v gpp -r trace.bin
+#   tools/host-sim/sweep.py --chunk 32,64 --wc 0,2 -- -s 1G script.txt
+#
+# Everything after -- goes to ums-sim as is (disks, volumes, models, script or
+# --replay). The chunk size is used for the cache buffers and as the gadget's
+# SDMMC read size. Read-ahead and write cache are taken from the buffers.
+
+import argparse
+import concurrent.futures
+import itertools
+import os
+import subprocess
+import sys
+
+FIELDS = ['name', 'rd_mbps', 'wr_mbps', 'mbps', 'rd_avg_us', 'rd_p99_us', 'wr_avg_us', 'wr_p99_us',
+          'media_rd', 'media_wr']
+
+
+def int_list(text):
+    return [int(x) for x in text.split(',')]
+
+
+def run(sim, sim_args, name, extra):
+    cmd = [sim] + extra + ['--summary', name] + sim_args
+    res = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+
+    for line in res.stdout.splitlines():
+        if line.startswith('summary,'):
+            vals = line.split(',')[1:]
+            row = dict(zip(FIELDS, vals))
+            for key in FIELDS[1:]:
+                row[key] = float(row[key])
+            row['ok'] = res.returncode == 0
+            return row
+
+    sys.exit('%s failed:\n%s' % (' '.join(cmd), res.stderr))
+
+
+def main():
+    default_sim = os.path.join(os.path.dirname(__file__), '..', '..', 'build', 'host-sim', 'ums-sim')
+
+    parser = argparse.ArgumentParser(description='ums-sim cache policy sweep')
+    parser.add_argument('--sim', default=default_sim, help='ums-sim binary (default: build/host-sim/ums-sim)')
+    parser.add_argument('--chunk', type=int_list, default=[16, 32, 64], help='chunk sizes in KB')
+    parser.add_argument('--bufs', type=int_list, default=[2, 4, 8], help='buffer counts')
+    parser.add_argument('--ra', type=int_list, default=[0, 1, 2, 4], help='read-ahead depths in chunks')
+    parser.add_argument('--wc', type=int_list, default=[0, 1, 2, 4], help='write cache sizes in chunks')
+    parser.add_argument('--budget', type=int, default=0, help='max IRAM for the buffers in KB (0: no limit)')
+    parser.add_argument('--sort', choices=['mbps', 'rd_mbps', 'wr_mbps', 'rd_p99_us', 'wr_p99_us'], default='mbps')
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count())
+    parser.add_argument('sim_args', nargs=argparse.REMAINDER, help='-- followed by ums-sim options')
+    args = parser.parse_args()
+
+    sim_args = args.sim_args[1:] if args.sim_args[:1] == ['--'] else args.sim_args
+    if not sim_args:
+        parser.error('ums-sim options missing, e.g. -- -e 1G -r trace.bin')
+
+    jobs = [('baseline', [])]
+    for chunk, bufs, ra, wc in itertools.product(args.chunk, args.bufs, args.ra, args.wc):
+        if wc > bufs or ra > bufs - wc or (args.budget and chunk * bufs > args.budget):
+            continue
+        jobs.append(('%dKx%d ra%d wc%d' % (chunk, bufs, ra, wc),
+                     ['--cache', '%d,%d,%d,%d' % (chunk, bufs, ra, wc), '--read-io', str(chunk * 1024)]))
+
+    with concurrent.futures.ThreadPoolExecutor(args.jobs) as pool:
+        rows = list(pool.map(lambda job: run(args.sim, sim_args, job[0], job[1]), jobs))
+
+    base = rows[0]
+    reverse = not args.sort.endswith('_us')
+    rows.sort(key=lambda r: r[args.sort], reverse=reverse)
+
+    print('%-18s %8s %8s %8s %8s %9s %8s %9s %9s %9s' % (
+        'config', 'MB/s', 'vs base', 'rd MB/s', 'rd avg', 'rd p99', 'wr MB/s', 'wr p99', 'SDMMC rd', 'SDMMC wr'))
+    for r in rows:
+        print('%-18s %8.2f %7.1f%% %8.2f %8.0f %9.0f %8.2f %9.0f %9d %9d%s' % (
+            r['name'], r['mbps'], (r['mbps'] / base['mbps'] - 1) * 100 if base['mbps'] else 0,
+            r['rd_mbps'], r['rd_avg_us'], r['rd_p99_us'], r['wr_mbps'], r['wr_p99_us'],
+            r['media_rd'], r['media_wr'], '' if r['ok'] else '  FAILED'))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+# Copies sectors between two LUNs of ums-loader on the device (vendor command 0xC3),
+# the data does not cross USB. Needs sg_raw from sg3_utils and write access to the
+# destination disk node, e.g.:
+#   sudo tools/ums_copy.py /dev/sdY --src /dev/sdX --src-lba 0 --dst-lba 0 --count 0x100000
+#   sudo tools/ums_copy.py /dev/sdY --src-lun 0 --count 0x100000
+#
+# The host does not know the device changed the destination, so unmount it first
+# and drop its page cache afterwards (e.g. blockdev --flushbufs /dev/sdY).
+
+import argparse
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+OP_COPY_RANGE  = 0xC3
+OP_COPY_STATUS = 0xC4
+MAX_SECTORS = 0x20000 # 64MB per command on the device.
+
+MAGIC = 0x59504355 # UCPY.
+STATUS_FMT = '<IIIIII'
+STATUS_SZ = struct.calcsize(STATUS_FMT)
+
+
+def scsi_addr(dev):
+    # /sys/block/sdX/device links to .../host:channel:target:lun.
+    path = os.path.realpath('/sys/block/%s/device' % os.path.basename(dev))
+    try:
+        return [int(x) for x in os.path.basename(path).split(':')]
+    except ValueError:
+        sys.exit('%s is not a SCSI disk' % dev)
+
+
+def be32(value):
+    return [(value >> 24) & 0xFF, (value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF]
+
+
+def copy_range(dev, src_lun, src_lba, dst_lba, count):
+    cdb = [OP_COPY_RANGE, src_lun] + be32(src_lba) + be32(dst_lba) + be32(count) + [0, 0]
+    res = subprocess.run(['sg_raw', '-q', '-t', '60', dev] + ['%02x' % b for b in cdb],
+                         stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, universal_newlines=True)
+    if res.returncode:
+        sys.exit('\ncopy of %d sectors at %d failed:\n%s' % (count, src_lba, res.stderr.strip()))
+
+
+def read_status(dev):
+    cdb = [OP_COPY_STATUS, 0, 0, 0, 0, 0, 0, 0, STATUS_SZ, 0]
+
+    with tempfile.NamedTemporaryFile() as out:
+        subprocess.run(['sg_raw', '-q', '-r', str(STATUS_SZ), '-o', out.name, dev] + ['%02x' % b for b in cdb],
+                       check=True, stdout=subprocess.DEVNULL)
+        data = out.read()
+
+    if len(data) < STATUS_SZ:
+        raise RuntimeError('short copy status (%d bytes)' % len(data))
+    magic, ranges, sectors, time_ms, err_lun, err_lba = struct.unpack_from(STATUS_FMT, data)
+    if magic != MAGIC:
+        raise RuntimeError('not a ums-loader copy status (magic %08x)' % magic)
+
+    return ranges, sectors, time_ms, err_lun, err_lba
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ums-loader on-device copy between LUNs')
+    parser.add_argument('device', help='disk node of the destination LUN, e.g. /dev/sdY')
+    parser.add_argument('--src', help='disk node of the source LUN (same gadget), e.g. /dev/sdX')
+    parser.add_argument('--src-lun', type=int, help='source LUN number instead of --src')
+    parser.add_argument('--src-lba', type=lambda x: int(x, 0), default=0, help='first source sector')
+    parser.add_argument('--dst-lba', type=lambda x: int(x, 0), default=0, help='first destination sector')
+    parser.add_argument('--count', type=lambda x: int(x, 0), required=True, help='number of 512 byte sectors')
+    args = parser.parse_args()
+
+    if args.src:
+        src, dst = scsi_addr(args.src), scsi_addr(args.device)
+        if src[:3] != dst[:3]:
+            parser.error('%s and %s are not on the same gadget' % (args.src, args.device))
+        src_lun = src[3]
+    elif args.src_lun is not None:
+        src_lun = args.src_lun
+    else:
+        parser.error('one of --src or --src-lun is needed')
+
+    start = time.monotonic()
+    done = 0
+    while done < args.count:
+        count = min(MAX_SECTORS, args.count - done)
+        copy_range(args.device, src_lun, args.src_lba + done, args.dst_lba + done, count)
+        done += count
+
+        elapsed = time.monotonic() - start
+        sys.stdout.write('\r%d/%d MB, %.1f MB/s' % (done >> 11, args.count >> 11, (done / 2048) / max(elapsed, 0.001)))
+        sys.stdout.flush()
+    print()
+
+    ranges, sectors, time_ms, err_lun, err_lba = read_status(args.device)
+    print('device: %d ranges, %d MB in %.1fs since the gadget started' % (ranges, sectors >> 11, time_ms / 1000))
+    if err_lba != 0xFFFFFFFF:
+        print('last error: LUN %d sector %d' % (err_lun, err_lba))
+
+
+if __name__ == '__main__':
+    main()
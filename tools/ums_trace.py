@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+# Reads the SCSI command trace of ums-loader (vendor command 0xC1).
+# Needs sg_raw from sg3_utils and read access to the disk node, e.g.:
+#   sudo tools/ums_trace.py /dev/sdX -o trace.bin --csv trace.csv
+#
+# A saved trace (from here or from ums-sim --dev-trace) can be decoded again
+# with --load. Only one LUN of the gadget needs to be given, the trace covers all.
+#
+# With --actmon the bus load samples of a UMS_ACTMON=1 build (vendor command 0xC5)
+# are read too and matched to the commands by sequence number.
+
+import argparse
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+
+OP_READ_TRACE = 0xC1
+OP_READ_ACTMON = 0xC5
+MAX_ALLOC = 0xFFFF
+
+MAGIC = 0x43525455 # UTRC.
+HDR_FMT = '<IHHIIII'
+HDR_SZ = struct.calcsize(HDR_FMT)
+ENTRY_FMT = '<BBBBIIIIIII'
+ENTRY_SZ = struct.calcsize(ENTRY_FMT)
+
+ACTMON_MAGIC = 0x54434155 # UACT.
+ACTMON_FMT = '<IIHHHHIIII'
+ACTMON_SZ = struct.calcsize(ACTMON_FMT)
+FLAG_AHB_REDIRECT = 1
+
+ACTMON_FIELDS = ['time_us', 'cmds', 'ahb', 'apb', 'bpmp', 'mc', 'period_us', 'sdmmc_us', 'usb_us', 'both_us']
+
+FIELDS = ['seq', 'tag', 'opcode', 'lun', 'lba', 'length', 'status', 'sense_key',
+          'cbw_us', 'storage_us', 'data_us', 'csw_us']
+
+OP_NAMES = {
+    0x00: 'tur', 0x03: 'sense', 0x08: 'read6', 0x0A: 'write6', 0x12: 'inquiry',
+    0x1A: 'msense6', 0x1B: 'start_stop', 0x1E: 'prevent', 0x23: 'rfmtcap',
+    0x25: 'capacity', 0x28: 'read10', 0x2A: 'write10', 0x2F: 'verify',
+    0x35: 'sync', 0x5A: 'msense10', 0xA8: 'read12', 0xAA: 'write12',
+    0xC0: 'timeline', 0xC1: 'trace', 0xC3: 'copy', 0xC4: 'copy_status', 0xC5: 'actmon',
+}
+
+READ_OPS  = (0x08, 0x28, 0xA8)
+WRITE_OPS = (0x0A, 0x2A, 0xAA)
+
+
+def parse(data):
+    magic, entry_size, _, first, count, total, now_us = struct.unpack_from(HDR_FMT, data)
+    if magic != MAGIC or entry_size != ENTRY_SZ:
+        raise RuntimeError('not a ums-loader trace (magic %08x, entry size %d)' % (magic, entry_size))
+
+    count = min(count, (len(data) - HDR_SZ) // ENTRY_SZ)
+    entries = []
+    for i in range(count):
+        (opcode, lun, status, sense_key, tag, lba, length,
+         cbw_us, storage_us, data_us, csw_us) = struct.unpack_from(ENTRY_FMT, data, HDR_SZ + i * ENTRY_SZ)
+        entries.append({
+            'seq': first + i, 'tag': tag, 'opcode': opcode, 'lun': lun, 'lba': lba, 'length': length,
+            'status': status, 'sense_key': sense_key, 'cbw_us': cbw_us, 'storage_us': storage_us,
+            'data_us': data_us, 'csw_us': csw_us,
+        })
+
+    return first, total, now_us, entries
+
+
+def parse_actmon(data):
+    magic, entry_size, flags, first, count, total, now_us = struct.unpack_from(HDR_FMT, data)
+    if magic != ACTMON_MAGIC or entry_size != ACTMON_SZ:
+        raise RuntimeError('no actmon samples, not a UMS_ACTMON=1 build? (magic %08x)' % magic)
+
+    count = min(count, (len(data) - HDR_SZ) // ACTMON_SZ)
+    samples = []
+    for i in range(count):
+        smp = dict(zip(ACTMON_FIELDS, struct.unpack_from(ACTMON_FMT, data, HDR_SZ + i * ACTMON_SZ)))
+        smp['seq'] = first + i
+        samples.append(smp)
+
+    return flags, total, samples
+
+
+def read_raw(dev, op, first):
+    cdb = [op, 0, (first >> 24) & 0xFF, (first >> 16) & 0xFF, (first >> 8) & 0xFF, first & 0xFF,
+           0, MAX_ALLOC >> 8, MAX_ALLOC & 0xFF, 0]
+
+    with tempfile.NamedTemporaryFile() as out:
+        subprocess.run(['sg_raw', '-q', '-r', str(MAX_ALLOC), '-o', out.name, dev] + ['%02x' % b for b in cdb],
+                       check=True, stdout=subprocess.DEVNULL)
+        return out.read()
+
+
+def read_chunk(dev, first):
+    return parse(read_raw(dev, OP_READ_TRACE, first))
+
+
+def read_actmon(dev):
+    # The ring holds the last 64 samples (1.28s), all of them fit in one read.
+    return parse_actmon(read_raw(dev, OP_READ_ACTMON, 0))
+
+
+def read_device(dev):
+    # Everything recorded so far. Stops at the total of the first read, commands
+    # that come after (like these reads themselves) are left for the next run.
+    first, total, now_us, entries = read_chunk(dev, 0)
+    while entries and entries[-1]['seq'] + 1 < total:
+        _, _, _, more = read_chunk(dev, entries[-1]['seq'] + 1)
+        if not more:
+            break
+        entries += [e for e in more if e['seq'] < total]
+
+    return first, total, now_us, entries
+
+
+def save(path, first, total, now_us, entries):
+    with open(path, 'wb') as f:
+        f.write(struct.pack(HDR_FMT, MAGIC, ENTRY_SZ, 0, first, len(entries), total, now_us))
+        for e in entries:
+            f.write(struct.pack(ENTRY_FMT, e['opcode'], e['lun'], e['status'], e['sense_key'], e['tag'],
+                                e['lba'], e['length'], e['cbw_us'], e['storage_us'], e['data_us'], e['csw_us']))
+
+
+def delta(e, key, base='cbw_us'):
+    return (e[key] - e[base]) & 0xFFFFFFFF if e[key] else None
+
+
+def summary(entries):
+    print('%-10s %7s %9s %9s %9s %9s %9s' % ('op', 'cmds', 'MiB', 'avg us', 'max us', 'storage', 'failed'))
+
+    groups = {}
+    for e in entries:
+        groups.setdefault(OP_NAMES.get(e['opcode'], '0x%02x' % e['opcode']), []).append(e)
+
+    for name, group in sorted(groups.items(), key=lambda g: -len(g[1])):
+        times = [delta(e, 'csw_us') or 0 for e in group]
+        storage = [delta(e, 'storage_us') for e in group if e['storage_us']]
+        print('%-10s %7d %9.2f %9.0f %9d %9s %9d' % (
+            name, len(group), sum(e['length'] for e in group) / (1024 * 1024),
+            sum(times) / len(times), max(times),
+            '%.0f' % (sum(storage) / len(storage)) if storage else '-',
+            sum(1 for e in group if e['status'])))
+
+
+def actmon_report(flags, samples, entries, csv):
+    # Commands completed in a sample are the ones from the cmds of the previous sample on.
+    by_seq = {e['seq']: e for e in entries}
+    rows = []
+    for prev, smp in zip(samples, samples[1:]):
+        period = smp['period_us'] or 1
+        cmds = [by_seq[s] for s in range(prev['cmds'], smp['cmds']) if s in by_seq]
+        idle = max(0, period - smp['sdmmc_us'] - smp['usb_us'] - smp['both_us'])
+        rows.append({
+            'time_ms': ((smp['time_us'] - samples[0]['time_us']) & 0xFFFFFFFF) / 1000,
+            'cmds': smp['cmds'] - prev['cmds'],
+            'mib_s': sum(e['length'] for e in cmds) / (1024 * 1024) / (period / 1000000),
+            'ahb': smp['ahb'] / 10, 'apb': smp['apb'] / 10, 'bpmp': smp['bpmp'] / 10, 'mc': smp['mc'] / 10,
+            'sdmmc': 100 * smp['sdmmc_us'] / period, 'usb': 100 * smp['usb_us'] / period,
+            'both': 100 * smp['both_us'] / period, 'idle': 100 * idle / period,
+        })
+
+    print('\n%d load samples, AHB redirect %s' % (len(samples), 'on' if flags & FLAG_AHB_REDIRECT else 'off'))
+    if not rows:
+        return
+
+    if csv:
+        keys = list(rows[0].keys())
+        with open(csv, 'w') as f:
+            f.write(','.join(keys) + '\n')
+            for row in rows:
+                f.write(','.join('%.1f' % row[k] if isinstance(row[k], float) else str(row[k]) for k in keys) + '\n')
+
+    # Grouped by what took most of the period. Compare 'both' (USB and media DMA
+    # in flight) with 'sdmmc' and 'usb' alone to see what concurrency costs.
+    print('%-8s %7s %8s %6s %6s %6s %6s' % ('busy', 'samples', 'MiB/s', 'AHB %', 'MC %', 'BPMP %', 'APB %'))
+    for state in ('both', 'sdmmc', 'usb', 'idle'):
+        group = [r for r in rows if max(('both', 'sdmmc', 'usb', 'idle'), key=lambda k: r[k]) == state]
+        if not group:
+            continue
+        avg = lambda k: sum(r[k] for r in group) / len(group)
+        print('%-8s %7d %8.1f %6.1f %6.1f %6.1f %6.1f' % (
+            state, len(group), avg('mib_s'), avg('ahb'), avg('mc'), avg('bpmp'), avg('apb')))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ums-loader SCSI command trace reader')
+    parser.add_argument('device', nargs='?', help='disk node of any gadget LUN, e.g. /dev/sdX')
+    parser.add_argument('-l', '--load', help='decode a saved trace instead of reading the device')
+    parser.add_argument('-o', '--out', help='save the raw trace')
+    parser.add_argument('--csv', help='write one CSV line per command, times relative to the first CBW')
+    parser.add_argument('--actmon', action='store_true', help='also read the bus load samples (UMS_ACTMON=1 builds)')
+    parser.add_argument('--actmon-csv', help='write one CSV line per load sample')
+    args = parser.parse_args()
+
+    if bool(args.device) == bool(args.load):
+        parser.error('give either a device or --load')
+    if (args.actmon or args.actmon_csv) and not args.device:
+        parser.error('--actmon needs the device')
+
+    if args.load:
+        with open(args.load, 'rb') as f:
+            first, total, now_us, entries = parse(f.read())
+    else:
+        if not os.path.exists(args.device):
+            sys.exit('%s not found' % args.device)
+        # Samples first, so the trace has all commands they cover.
+        if args.actmon or args.actmon_csv:
+            actmon = read_actmon(args.device)
+        first, total, now_us, entries = read_device(args.device)
+
+    if entries and entries[0]['seq'] > first:
+        first = entries[0]['seq']
+    print('%d commands recorded, %d in trace (from #%d)' % (total, len(entries), first))
+    if not entries:
+        return
+
+    if args.out:
+        save(args.out, first, total, now_us, entries)
+
+    if args.csv:
+        start = entries[0]['cbw_us']
+        with open(args.csv, 'w') as f:
+            f.write(','.join(FIELDS) + '\n')
+            for e in entries:
+                row = dict(e)
+                row['cbw_us'] = (e['cbw_us'] - start) & 0xFFFFFFFF
+                for key in ('storage_us', 'data_us', 'csw_us'):
+                    row[key] = delta(e, key, 'cbw_us') if e[key] else ''
+                f.write(','.join(str(row[k]) for k in FIELDS) + '\n')
+
+    summary(entries)
+
+    if args.actmon or args.actmon_csv:
+        flags, _, samples = actmon
+        actmon_report(flags, samples, entries, args.actmon_csv)
+
+
+if __name__ == '__main__':
+    main()
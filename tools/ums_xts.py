@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+# Sends the BIS key of a decrypted ums-loader LUN (vendor command 0xC2).
+# Needs sg_raw from sg3_utils and write access to the disk node, e.g.:
+#   sudo tools/ums_xts.py /dev/sdX --keys prod.keys --part SYSTEM
+#   sudo tools/ums_xts.py /dev/sdX --key <64 hex digits, crypt key then tweak key>
+#   sudo tools/ums_xts.py /dev/sdX --clear
+#
+# The LUN reports no medium until it has a key. The key goes to sg_raw over
+# stdin and is never written to a file.
+
+import argparse
+import subprocess
+import sys
+
+OP_SET_XTS_KEY = 0xC2
+KEY_SZ = 32
+
+# bis_key_XX of prod.keys per partition.
+PART_KEYS = {'PRODINFO': 0, 'PRODINFOF': 0, 'SAFE': 1, 'SYSTEM': 2, 'USER': 3}
+
+
+def parse_hex(text):
+    try:
+        key = bytes.fromhex(text.strip())
+    except ValueError:
+        sys.exit('key is not hex')
+    if len(key) != KEY_SZ:
+        sys.exit('key must be %d bytes (crypt key then tweak key), got %d' % (KEY_SZ, len(key)))
+
+    return key
+
+
+def load_key(path, index):
+    name = 'bis_key_%02d' % index
+    with open(path) as f:
+        for line in f:
+            key, _, value = line.partition('=')
+            if key.strip().lower() == name:
+                return parse_hex(value)
+
+    sys.exit('%s not found in %s' % (name, path))
+
+
+def set_key(dev, key):
+    length = len(key)
+    cdb = [OP_SET_XTS_KEY, 0, 0, 0, 0, 0, 0, length >> 8, length & 0xFF, 0]
+    args = ['sg_raw', '-q'] + (['-s', str(length)] if length else []) + [dev] + ['%02x' % b for b in cdb]
+
+    subprocess.run(args, input=key, check=True, stdout=subprocess.DEVNULL)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ums-loader BIS key loader')
+    parser.add_argument('device', help='disk node of the decrypted LUN, e.g. /dev/sdX')
+    parser.add_argument('--key', help='32 byte key as hex, crypt key then tweak key')
+    parser.add_argument('--keys', help='prod.keys to take bis_key_XX from')
+    parser.add_argument('--part', choices=sorted(PART_KEYS), help='partition the LUN exposes (picks the bis key)')
+    parser.add_argument('--bis', type=int, choices=range(4), help='bis key index instead of --part')
+    parser.add_argument('--clear', action='store_true', help='drop the key, the LUN reports no medium again')
+    args = parser.parse_args()
+
+    if args.clear:
+        set_key(args.device, b'')
+        return
+
+    if args.key:
+        key = parse_hex(args.key)
+    elif args.keys:
+        if args.bis is None and args.part is None:
+            parser.error('--keys needs --part or --bis')
+        key = load_key(args.keys, args.bis if args.bis is not None else PART_KEYS[args.part])
+    else:
+        parser.error('one of --key, --keys or --clear is needed')
+
+    set_key(args.device, key)
+    print('key set, the host re-reads the medium on the next access')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,434 @@
+#!/usr/bin/env python3
+# Host side of the ums-loader USB image gadget (build with USB_IMAGE=1).
+# Needs pyusb (libusb backend): pip install pyusb
+# Uses the lz4 module for decompression if installed, a slower built-in decoder otherwise.
+#
+#   tools/usb_image.py info gpp
+#   tools/usb_image.py dump gpp emmc.bin
+#   tools/usb_image.py dump sd sd_head.bin --lba 0 --count 2048 --no-compress
+#   tools/usb_image.py dump sd sd.bin --used
+#   tools/usb_image.py restore gpp emmc.bin
+#   tools/usb_image.py --crc dump gpp emmc.bin
+#
+# Empty (all zero) ranges are not sent and become holes in the output file. With
+# --used, FAT32/exFAT partitions (from the MBR or GPT, or the given range) only
+# send their allocated clusters, free ones become holes as well. On
+# restore they are erased/trimmed on the device instead of written, where the
+# card reads those back as zeros. Compressing for restore needs the lz4 module,
+# without it only empty ranges are skipped.
+#
+# --crc adds the CRC32 of the data to every raw and LZ4 frame, checked here on
+# dump and on the device after writing on restore. Payloads built with
+# CCPLEX_WORKER=1 compute it on the A57 cores, alongside LZ4 on the BPMP.
+
+import argparse
+import io
+import os
+import struct
+import sys
+import time
+import zlib
+
+import usb.core
+import usb.util
+
+try:
+    import lz4.block as lz4_block
+except ImportError:
+    lz4_block = None
+
+VID = 0x11EC
+PID = 0xA7E2
+
+EP_OUT = 0x01
+EP_IN  = 0x81
+
+CMD_SIG   = 0x4D434D49 # IMCM.
+STS_SIG   = 0x54534D49 # IMST.
+FRAME_SIG = 0x52464D49 # IMFR.
+
+OP_INFO    = 0
+OP_DUMP    = 1
+OP_RESTORE = 2
+OP_EXIT    = 3
+
+FLAG_NO_ERASE = 1
+FLAG_USED     = 2
+FLAG_CRC      = 4
+
+STORAGE = {'sd': 0, 'gpp': 1, 'boot0': 2, 'boot1': 3}
+
+FRAME_RAW  = 0
+FRAME_LZ4  = 1
+FRAME_ZERO = 2
+FRAME_SKIP = 3
+
+STS_NO_FS = 5
+
+STATUS_NAMES = {0: 'ok', 1: 'bad command', 2: 'transfer error', 3: 'storage error', 4: 'aborted',
+                5: 'no FAT32/exFAT volume', 6: 'CRC mismatch'}
+
+SECTOR = 512
+CHUNK = 64 * 1024
+LZ4_MAX = 42 * 1024 # Biggest LZ4 block the device takes (IMG_COMP_MAX).
+TIMEOUT_MS = 10000
+
+
+def lz4_decompress(src, size):
+    # LZ4 block format: token (literal length, match length), literals, 2 byte offset.
+    if lz4_block:
+        return lz4_block.decompress(src, uncompressed_size=size)
+
+    dst = bytearray()
+    i = 0
+    while i < len(src):
+        token = src[i]
+        i += 1
+
+        lit = token >> 4
+        if lit == 15:
+            while True:
+                b = src[i]
+                i += 1
+                lit += b
+                if b != 255:
+                    break
+        dst += src[i:i + lit]
+        i += lit
+        if i >= len(src):
+            break # Last sequence has literals only.
+
+        offset = src[i] | (src[i + 1] << 8)
+        i += 2
+        match = token & 15
+        if match == 15:
+            while True:
+                b = src[i]
+                i += 1
+                match += b
+                if b != 255:
+                    break
+        match += 4
+
+        start = len(dst) - offset
+        if offset >= match:
+            dst += dst[start:start + match]
+        else:
+            for k in range(match): # Overlapping copy repeats the pattern.
+                dst.append(dst[start + k])
+
+    if len(dst) != size:
+        raise RuntimeError('LZ4 block decoded to %d bytes, expected %d' % (len(dst), size))
+    return bytes(dst)
+
+
+def send_cmd(dev, tag, op, storage=0, lba=0, sectors=0, accel=0, flags=0):
+    cmd = struct.pack('<IIBBBxIII8x', CMD_SIG, tag, op, storage, flags, lba, sectors, accel)
+    dev.write(EP_OUT, cmd, TIMEOUT_MS)
+
+
+def read_block(dev):
+    blk = bytes(dev.read(EP_IN, 32, TIMEOUT_MS))
+    if len(blk) != 32:
+        raise RuntimeError('short block (%d bytes)' % len(blk))
+    return blk
+
+
+def parse_status(blk, tag):
+    sig, sts_tag, status, sectors, time_us, usb_bytes, zero_sectors, total = struct.unpack('<8I', blk)
+    if sig != STS_SIG or sts_tag != tag:
+        raise RuntimeError('bad status block')
+    return {'status': status, 'sectors': sectors, 'time_us': time_us, 'usb_bytes': usb_bytes,
+            'zero_sectors': zero_sectors, 'total': total}
+
+
+def info(dev, tag, storage):
+    send_cmd(dev, tag, OP_INFO, storage)
+    return parse_status(read_block(dev), tag)
+
+
+def new_frames():
+    return {FRAME_RAW: 0, FRAME_LZ4: 0, FRAME_ZERO: 0, FRAME_SKIP: 0, 'skipped': 0}
+
+
+def dump(dev, tag, storage, lba, count, out, accel, flags=0, base=0, frames=None):
+    # Output offsets are relative to base, so several ranges can go to one file.
+    send_cmd(dev, tag, OP_DUMP, storage, lba, count, accel, flags)
+
+    frames = frames if frames is not None else new_frames()
+    while True:
+        blk = read_block(dev)
+        sig, ftype, flba, fsectors, size, crc = struct.unpack_from('<6I', blk)
+        if sig != FRAME_SIG:
+            return parse_status(blk, tag), frames
+
+        frames[ftype] = frames.get(ftype, 0) + 1
+        payload = bytes(dev.read(EP_IN, size, TIMEOUT_MS)) if size else b''
+        if len(payload) != size:
+            raise RuntimeError('short frame payload (%d of %d bytes)' % (len(payload), size))
+
+        out.seek((flba - base) * SECTOR)
+        if ftype in (FRAME_RAW, FRAME_LZ4):
+            data = payload if ftype == FRAME_RAW else lz4_decompress(payload, fsectors * SECTOR)
+            if flags & FLAG_CRC and zlib.crc32(data) != crc:
+                raise RuntimeError('CRC mismatch in the frame at sector %d' % flba)
+            out.write(data)
+        elif ftype == FRAME_SKIP:
+            frames['skipped'] += fsectors
+        elif ftype != FRAME_ZERO:
+            raise RuntimeError('unknown frame type %d' % ftype)
+
+        done = flba + fsectors - lba
+        print('\r%6.2f%%' % (done * 100 / count if count else 100), end='', file=sys.stderr, flush=True)
+
+
+def read_sectors(dev, tag, storage, lba, count):
+    buf = io.BytesIO()
+    sts, _ = dump(dev, tag, storage, lba, count, buf, 0, base=lba)
+    if sts['status']:
+        raise RuntimeError('reading sector %d: %s' % (lba, STATUS_NAMES.get(sts['status'], sts['status'])))
+    return buf.getvalue().ljust(count * SECTOR, b'\0')
+
+
+def partitions(dev, tag, storage):
+    # (first sector, sectors) of the MBR or GPT partitions. Extended MBR partitions are left as they are.
+    mbr = read_sectors(dev, tag, storage, 0, 1)
+    if mbr[510:512] != b'\x55\xAA':
+        return []
+
+    parts = []
+    for i in range(4):
+        ptype, first, cnt = struct.unpack_from('<4xB3xII', mbr, 446 + i * 16)
+        if ptype == 0xEE:
+            break
+        if ptype and ptype not in (0x05, 0x0F) and cnt:
+            parts.append((first, cnt))
+    else:
+        return parts
+
+    hdr = read_sectors(dev, tag, storage, 1, 1)
+    if hdr[:8] != b'EFI PART':
+        return []
+    entries_lba, entries, entry_size = struct.unpack_from('<QII', hdr, 72)
+    table = read_sectors(dev, tag, storage, entries_lba, (entries * entry_size + SECTOR - 1) // SECTOR)
+    for i in range(entries):
+        entry = table[i * entry_size:(i + 1) * entry_size]
+        first, last = struct.unpack_from('<QQ', entry, 32)
+        if any(entry[:16]) and last >= first:
+            parts.append((first, last - first + 1))
+
+    return parts
+
+
+def dump_plan(parts, lba, count):
+    # Ranges of (first, sectors, used) covering lba to lba + count, gaps are dumped in full.
+    plan = []
+    pos = lba
+    end = lba + count
+    for first, cnt in sorted(parts):
+        start = max(first, pos)
+        stop = min(first + cnt, end)
+        if stop <= start:
+            continue
+        if start > pos:
+            plan.append((pos, start - pos, False))
+        # A cut partition does not start with its boot sector.
+        plan.append((start, stop - start, start == first))
+        pos = stop
+    if pos < end:
+        plan.append((pos, end - pos, False))
+
+    return plan
+
+
+def send_frame(dev, ftype, lba, sectors, payload=b'', crc=0):
+    dev.write(EP_OUT, struct.pack('<6I8x', FRAME_SIG, ftype, lba, sectors, len(payload), crc), TIMEOUT_MS)
+    if payload:
+        dev.write(EP_OUT, payload, TIMEOUT_MS)
+
+
+def restore(dev, tag, storage, lba, count, src, accel, flags):
+    send_cmd(dev, tag, OP_RESTORE, storage, lba, count, 0, flags)
+    sts = parse_status(read_block(dev), tag)
+    if sts['status']:
+        return sts, None
+
+    frames = {FRAME_RAW: 0, FRAME_LZ4: 0, FRAME_ZERO: 0}
+    zero_lba = zero_cnt = 0
+    done = 0
+    try:
+        while done < count:
+            data = src.read(min(CHUNK, (count - done) * SECTOR))
+            cnt = len(data) // SECTOR
+            cur = lba + done
+            done += cnt
+
+            if data.count(0) != len(data):
+                if zero_cnt:
+                    send_frame(dev, FRAME_ZERO, zero_lba, zero_cnt)
+                    frames[FRAME_ZERO] += 1
+                    zero_cnt = 0
+
+                crc = zlib.crc32(data) if flags & FLAG_CRC else 0
+                comp = lz4_block.compress(data, mode='fast', acceleration=accel, store_size=False) \
+                    if accel and lz4_block else None
+                if comp and len(comp) < len(data) and len(comp) <= LZ4_MAX:
+                    send_frame(dev, FRAME_LZ4, cur, cnt, comp, crc)
+                    frames[FRAME_LZ4] += 1
+                else:
+                    send_frame(dev, FRAME_RAW, cur, cnt, data, crc)
+                    frames[FRAME_RAW] += 1
+            else:
+                if not zero_cnt:
+                    zero_lba = cur
+                zero_cnt += cnt
+
+            print('\r%6.2f%%' % (done * 100 / count), end='', file=sys.stderr, flush=True)
+
+        if zero_cnt:
+            send_frame(dev, FRAME_ZERO, zero_lba, zero_cnt)
+            frames[FRAME_ZERO] += 1
+    except usb.core.USBError:
+        # The device stops taking frames when it aborts or gets out of sync, it sends the status then.
+        pass
+
+    return parse_status(read_block(dev), tag), frames
+
+
+def print_result(args, sts, frames, count, host_s):
+    data = sts['sectors'] * SECTOR
+    print('%s: %s, %d of %d sectors' % (args.storage, STATUS_NAMES.get(sts['status'], sts['status']),
+                                         sts['sectors'], count))
+    print('frames: %d raw, %d lz4, %d zero (%.2f MiB empty)' % (
+        frames[FRAME_RAW], frames[FRAME_LZ4], frames[FRAME_ZERO], sts['zero_sectors'] * SECTOR / (1024 * 1024)))
+    if frames.get(FRAME_SKIP):
+        print('free clusters: %d ranges, %.2f MiB not read' % (
+            frames[FRAME_SKIP], frames['skipped'] * SECTOR / (1024 * 1024)))
+    print('USB: %.2f MiB for %.2f MiB (%.1f%%)' % (
+        sts['usb_bytes'] / (1024 * 1024), data / (1024 * 1024), sts['usb_bytes'] * 100 / data if data else 0))
+    print('speed: %.2f MiB/s host, %.2f MiB/s device' % (
+        data / host_s / (1024 * 1024) if host_s else 0,
+        data / (sts['time_us'] / 1000000) / (1024 * 1024) if sts['time_us'] else 0))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ums-loader USB image tool')
+    sub = parser.add_subparsers(dest='cmd', required=True)
+
+    p = sub.add_parser('info', help='print storage size')
+    p.add_argument('storage', choices=STORAGE.keys())
+
+    p = sub.add_parser('dump', help='read storage into a file')
+    p.add_argument('storage', choices=STORAGE.keys())
+    p.add_argument('out', help='output file')
+    p.add_argument('--lba', type=int, default=0, help='first sector (default 0)')
+    p.add_argument('--count', type=int, default=0, help='sectors (default: to the end)')
+    p.add_argument('--accel', type=int, default=1, help='LZ4 acceleration, higher is faster but compresses less (default 1)')
+    p.add_argument('--no-compress', action='store_true', help='send raw data, only zero ranges are skipped')
+    p.add_argument('--used', action='store_true',
+                   help='only allocated clusters of FAT32/exFAT partitions (the range itself with --lba/--count)')
+
+    p = sub.add_parser('restore', help='write a file to storage')
+    p.add_argument('storage', choices=STORAGE.keys())
+    p.add_argument('image', help='input file, size must be a multiple of 512')
+    p.add_argument('--lba', type=int, default=0, help='first sector (default 0)')
+    p.add_argument('--accel', type=int, default=1, help='LZ4 acceleration (default 1)')
+    p.add_argument('--no-compress', action='store_true', help='send raw data, only zero ranges are skipped')
+    p.add_argument('--no-erase', action='store_true', help='write zeros instead of erasing empty ranges')
+
+    parser.add_argument('-x', '--exit', action='store_true', help='stop the gadget when done')
+    parser.add_argument('--crc', action='store_true', help='check the CRC32 of every frame')
+    args = parser.parse_args()
+
+    dev = usb.core.find(idVendor=VID, idProduct=PID)
+    if dev is None:
+        sys.exit('Image gadget not found')
+
+    try:
+        if dev.is_kernel_driver_active(0):
+            dev.detach_kernel_driver(0)
+    except (NotImplementedError, usb.core.USBError):
+        pass
+    dev.set_configuration()
+
+    storage = STORAGE[args.storage]
+    tag = 1
+    sts = info(dev, tag, storage)
+    tag += 1
+    if sts['status']:
+        sys.exit('%s: %s' % (args.storage, STATUS_NAMES.get(sts['status'], sts['status'])))
+
+    total = sts['total']
+    if args.cmd == 'info':
+        print('%s: %d sectors (%.2f MiB)' % (args.storage, total, total * SECTOR / (1024 * 1024)))
+    elif args.cmd == 'restore':
+        size = os.path.getsize(args.image)
+        if size % SECTOR:
+            sys.exit('%s: size is not a multiple of %d' % (args.image, SECTOR))
+        count = size // SECTOR
+        if args.lba + count > total:
+            sys.exit('%s: %d sectors do not fit at %d (%d sectors)' % (args.image, count, args.lba, total))
+        if not args.no_compress and not lz4_block:
+            print('lz4 module not found, sending uncompressed', file=sys.stderr)
+
+        with open(args.image, 'rb') as src:
+            start = time.perf_counter()
+            sts, frames = restore(dev, tag, storage, args.lba, count, src, 0 if args.no_compress else args.accel,
+                                  (FLAG_NO_ERASE if args.no_erase else 0) | (FLAG_CRC if args.crc else 0))
+            host_s = time.perf_counter() - start
+            tag += 1
+        print(file=sys.stderr)
+
+        if frames is None:
+            sys.exit('%s: %s' % (args.storage, STATUS_NAMES.get(sts['status'], sts['status'])))
+        print_result(args, sts, frames, count, host_s)
+        if sts['status']:
+            sys.exit(1)
+    else:
+        count = args.count or total - args.lba
+        accel = 0 if args.no_compress else args.accel
+        crc_flag = FLAG_CRC if args.crc else 0
+
+        plan = [(args.lba, count, args.used)]
+        if args.used and not args.lba and not args.count:
+            parts = partitions(dev, tag, storage)
+            tag += 1
+            if parts:
+                plan = dump_plan(parts, 0, count)
+
+        sts = {'status': 0, 'sectors': 0, 'time_us': 0, 'usb_bytes': 0, 'zero_sectors': 0}
+        frames = new_frames()
+        with open(args.out, 'wb') as out:
+            start = time.perf_counter()
+            for first, cnt, used in plan:
+                part_sts, _ = dump(dev, tag, storage, first, cnt, out, accel, (FLAG_USED if used else 0) | crc_flag,
+                                   args.lba, frames)
+                tag += 1
+                if part_sts['status'] == STS_NO_FS:
+                    part_sts, _ = dump(dev, tag, storage, first, cnt, out, accel, crc_flag, args.lba, frames)
+                    tag += 1
+                elif used:
+                    print('\r%d: %d sectors, allocated clusters only' % (first, cnt), file=sys.stderr)
+
+                for key in ('sectors', 'time_us', 'usb_bytes', 'zero_sectors'):
+                    sts[key] += part_sts[key]
+                sts['status'] = part_sts['status']
+                if sts['status']:
+                    break
+            host_s = time.perf_counter() - start
+            # Trailing zeros are holes, the size comes from the sectors done.
+            out.truncate(sts['sectors'] * SECTOR)
+        print(file=sys.stderr)
+
+        print_result(args, sts, frames, count, host_s)
+        if sts['status']:
+            sys.exit(1)
+
+    if args.exit:
+        send_cmd(dev, tag, OP_EXIT)
+
+    usb.util.dispose_resources(dev)
+
+
+if __name__ == '__main__':
+    main()
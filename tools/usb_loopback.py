@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+# Host side of the ums-loader USB loopback gadget (build with USB_LOOPBACK=1).
+# Needs pyusb (libusb backend): pip install pyusb
+#
+# Measures host and device side throughput of the bulk endpoints for a range of
+# TRB sizes, so USB limits can be told apart from storage limits.
+
+import argparse
+import struct
+import sys
+import time
+
+import usb.core
+import usb.util
+
+VID = 0x11EC
+PID = 0xA7E1
+
+EP_OUT = 0x01
+EP_IN  = 0x81
+
+CMD_SIG = 0x4D43424C # LBCM.
+STS_SIG = 0x5453424C # LBST.
+
+OP_SINK   = 0
+OP_SOURCE = 1
+OP_LOOP   = 2
+OP_EXIT   = 3
+
+OP_NAMES = {OP_SINK: 'sink', OP_SOURCE: 'source', OP_LOOP: 'loop'}
+
+STATUS_NAMES = {0: 'ok', 1: 'bad command', 2: 'transfer error'}
+
+CHIP_NAMES = {1: 'T210', 2: 'T210B01'}
+
+TIMEOUT_MS = 10000
+
+
+def send_cmd(dev, tag, op, trb_size=0, trb_cnt=0, total=0):
+    cmd = struct.pack('<IIB3xIII8x', CMD_SIG, tag, op, trb_size, trb_cnt, total)
+    dev.write(EP_OUT, cmd, TIMEOUT_MS)
+
+
+def read_status(dev, tag):
+    sts = bytes(dev.read(EP_IN, 32, TIMEOUT_MS))
+    sig, sts_tag, status, nbytes, time_us, bursts, burst_max_us, chip = struct.unpack('<8I', sts)
+    if sig != STS_SIG or sts_tag != tag:
+        raise RuntimeError('bad status block')
+    return status, nbytes, time_us, bursts, burst_max_us, chip
+
+
+def run(dev, tag, op, trb_size, trb_cnt, total):
+    burst = trb_size * trb_cnt
+    data = bytes(burst)
+
+    send_cmd(dev, tag, op, trb_size, trb_cnt, total)
+
+    start = time.perf_counter()
+    remaining = total
+    while remaining:
+        n = min(remaining, burst)
+        if op in (OP_SINK, OP_LOOP):
+            dev.write(EP_OUT, data[:n], TIMEOUT_MS)
+        if op in (OP_SOURCE, OP_LOOP):
+            got = len(dev.read(EP_IN, n, TIMEOUT_MS))
+            if got != n:
+                raise RuntimeError('short read: %d of %d' % (got, n))
+        remaining -= n
+    host_s = time.perf_counter() - start
+
+    return host_s, read_status(dev, tag)
+
+
+def mbps(nbytes, seconds):
+    return nbytes / seconds / (1024 * 1024) if seconds else 0.0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ums-loader USB loopback benchmark')
+    parser.add_argument('-o', '--op', choices=['sink', 'source', 'loop', 'all'], default='all')
+    parser.add_argument('-s', '--trb-size', type=int, action='append',
+                        help='TRB size in KB, can be given multiple times (default 4 to 64)')
+    parser.add_argument('-n', '--trb-cnt', type=int, default=1, help='TRBs per burst, more than 1 queues a chained transfer (default 1)')
+    parser.add_argument('-t', '--total', type=int, default=64, help='MB per test (default 64)')
+    parser.add_argument('-x', '--exit', action='store_true', help='stop the gadget when done')
+    args = parser.parse_args()
+
+    dev = usb.core.find(idVendor=VID, idProduct=PID)
+    if dev is None:
+        sys.exit('Loopback gadget not found')
+
+    try:
+        if dev.is_kernel_driver_active(0):
+            dev.detach_kernel_driver(0)
+    except (NotImplementedError, usb.core.USBError):
+        pass
+    dev.set_configuration()
+
+    ops = [OP_SINK, OP_SOURCE, OP_LOOP] if args.op == 'all' else \
+          [{'sink': OP_SINK, 'source': OP_SOURCE, 'loop': OP_LOOP}[args.op]]
+    sizes = args.trb_size or [4, 8, 16, 32, 64]
+    total = args.total * 1024 * 1024
+
+    print('%-6s %5s %4s %10s %10s %9s %8s' % ('op', 'TRB', 'cnt', 'host MB/s', 'dev MB/s', 'max burst', 'chip'))
+
+    tag = 1
+    for op in ops:
+        for size in sizes:
+            host_s, (status, nbytes, time_us, bursts, burst_max_us, chip) = \
+                run(dev, tag, op, size * 1024, args.trb_cnt, total)
+            tag += 1
+
+            if status:
+                print('%-6s %4dK %4d  %s' % (OP_NAMES[op], size, args.trb_cnt, STATUS_NAMES.get(status, status)))
+                continue
+
+            moved = total * 2 if op == OP_LOOP else total
+            print('%-6s %4dK %4d %10.1f %10.1f %7dus %8s' % (
+                OP_NAMES[op], size, args.trb_cnt,
+                mbps(moved, host_s), mbps(nbytes, time_us / 1000000),
+                burst_max_us, CHIP_NAMES.get(chip, hex(chip))))
+
+    if args.exit:
+        send_cmd(dev, tag, OP_EXIT)
+
+    usb.util.dispose_resources(dev)
+
+
+if __name__ == '__main__':
+    main()
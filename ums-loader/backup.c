@@ -0,0 +1,328 @@
+#include "backup.h"
+#include "clone.h"
+
+#include <string.h>
+
+#include <gfx.h>
+#include <libs/fatfs/ff.h>
+#include <mem/heap.h>
+#include <storage/emmc.h>
+#include <storage/sd.h>
+#include <storage/sdmmc.h>
+#include <utils/btn.h>
+#include <utils/sprintf.h>
+#include <utils/types.h>
+#include <utils/util.h>
+
+#include <gfx_utils.h>
+#include <tui.h>
+
+// FAT32 files end at 4GB - 1. Parts of 4GB - 64KB stay chunk aligned.
+#define BACKUP_PART_SECTORS     (0xFFFF0000 >> 9)
+#define BACKUP_CLTBL_SZ         256 // DWORDs, 127 fragments per file.
+
+typedef struct backup_data_t{
+	tui_entry_t *menu;
+	u8 dev;
+	bool verify;
+}backup_data_t;
+
+static const char *backup_file_names[] = {
+	[CLONE_DEV_EMMC_GPP]   = "rawnand.bin",
+	[CLONE_DEV_EMMC_BOOT0] = "BOOT0",
+	[CLONE_DEV_EMMC_BOOT1] = "BOOT1",
+};
+
+static const char *backup_dev_strings[] = {
+	[CLONE_DEV_EMMC_GPP]   = "  eMMC GPP          ",
+	[CLONE_DEV_EMMC_BOOT0] = "  eMMC BOOT0        ",
+	[CLONE_DEV_EMMC_BOOT1] = "  eMMC BOOT1        ",
+};
+
+static const char *backup_verify_strings[] = {
+	"Verify Off          ",
+	"Verify SHA-256      "
+};
+
+static void _backup_set_text(void *label, const char *text){
+	u32 pos_x;
+	u32 pos_y;
+	gfx_con_getpos(&pos_x, &pos_y);
+	gfx_clear_partial_grey(0x0, pos_y, 8);
+	gfx_printf("%s", text);
+	gfx_con_setpos(pos_x, pos_y);
+}
+
+// The file name goes two lines above the status line.
+static void _backup_set_file(const char *path){
+	u32 pos_x;
+	u32 pos_y;
+	gfx_con_getpos(&pos_x, &pos_y);
+	gfx_con_setpos(0, pos_y - 2 * 8);
+	_backup_set_text(NULL, path);
+	gfx_con_setpos(pos_x, pos_y);
+}
+
+static bool _backup_open(){
+	if(!emmc_storage.initialized && !emmc_initialize(false)){
+		return false;
+	}
+
+	// Others end the card without sd_end(), so bring it up here and only mount.
+	if(!sd_storage.initialized && !sd_initialize(false)){
+		return false;
+	}
+
+	return sd_mount();
+}
+
+static void _backup_close(){
+	sd_end();
+	emmc_end();
+}
+
+static u32 _backup_volume_size(u8 dev){
+	// Boot partitions are boot_mult x 128KB.
+	return dev == CLONE_DEV_EMMC_GPP ? emmc_storage.sec_cnt : emmc_storage.ext_csd.boot_mult << 8;
+}
+
+// backup/<eMMC serial>/<name>, with .00, .01, ... when split.
+static void _backup_path(char *path, u8 dev, u32 part, bool split){
+	s_printf(path, "backup/%08X/%s", emmc_storage.cid.serial, backup_file_names[dev]);
+	if(split){
+		s_printf(path + strlen(path), ".%02d", part);
+	}
+}
+
+static u32 _backup_clst2sect(u32 clst){
+	return sd_fs.database + sd_fs.csize * (clst - 2);
+}
+
+// One extent through the clone engine, so SD and eMMC transfers overlap.
+static bool _backup_copy(u8 src, u32 src_lba, u8 dst, u32 dst_lba, u32 sectors, bool verify, u32 *time_ms){
+	clone_job_t job = {
+		.src       = src,
+		.dst       = dst,
+		.verify    = verify,
+		.src_lba   = src_lba,
+		.dst_lba   = dst_lba,
+		.sectors   = sectors,
+		.keep_open = true
+	};
+
+	u32 res = clone_run(&job, &_backup_set_text);
+	*time_ms += job.time_ms;
+
+	return res == CLONE_OK;
+}
+
+/*
+ * Files are allocated contiguously up front and the data is then written
+ * straight to their sectors, FatFs only writes the FAT and directory entries.
+ */
+static bool _backup_save(backup_data_t *data, u32 *time_ms){
+	u32 vol_size = _backup_volume_size(data->dev);
+	u32 part_size = sd_fs.fs_type == FS_EXFAT ? vol_size : MIN(vol_size, BACKUP_PART_SECTORS);
+	bool split = part_size < vol_size;
+	char path[40];
+	FIL fp;
+
+	s_printf(path, "backup/%08X", emmc_storage.cid.serial);
+	f_mkdir("backup");
+	f_mkdir(path);
+
+	u32 part = 0;
+	for(u32 pos = 0; pos < vol_size; pos += part_size, part++){
+		u32 cnt = MIN(part_size, vol_size - pos);
+
+		_backup_path(path, data->dev, part, split);
+		_backup_set_file(path);
+
+		if(f_open(&fp, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK){
+			_backup_set_text(NULL, "ERR: Create file");
+			return false;
+		}
+
+		FRESULT res = f_expand(&fp, (FSIZE_t)cnt << 9, 1);
+		u32 sector = _backup_clst2sect(fp.obj.sclust);
+		if(f_close(&fp) != FR_OK && res == FR_OK){
+			res = FR_DISK_ERR;
+		}
+
+		if(res != FR_OK){
+			f_unlink(path);
+			_backup_set_text(NULL, res == FR_DENIED ? "ERR: No contiguous space" : "ERR: Create file");
+			return false;
+		}
+
+		if(!_backup_copy(data->dev, pos, CLONE_DEV_SD, sector, cnt, data->verify, time_ms)){
+			f_unlink(path);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Restores a single file or the parts of a FAT32 backup, fragment by fragment.
+static bool _backup_restore(backup_data_t *data, u32 *time_ms){
+	u32 vol_size = _backup_volume_size(data->dev);
+	char path[40];
+	FILINFO fno;
+	FIL fp;
+
+	_backup_path(path, data->dev, 0, false);
+	bool split = f_stat(path, &fno) != FR_OK;
+
+	u32 parts = 0;
+	u64 size = 0;
+	do{
+		_backup_path(path, data->dev, parts, split);
+		if(f_stat(path, &fno) != FR_OK || (fno.fsize & 0x1FF)){
+			break;
+		}
+		size += fno.fsize;
+		parts++;
+	}while(split);
+
+	if(!parts){
+		_backup_set_text(NULL, "ERR: No backup found");
+		return false;
+	}
+	if(size != (u64)vol_size << 9){
+		_backup_set_text(NULL, "ERR: Size mismatch");
+		return false;
+	}
+
+	DWORD *tbl = (DWORD*)malloc(BACKUP_CLTBL_SZ * sizeof(DWORD));
+	bool ok = true;
+
+	u32 pos = 0;
+	for(u32 part = 0; ok && part < parts; part++){
+		_backup_path(path, data->dev, part, split);
+		_backup_set_file(path);
+
+		if(f_open(&fp, path, FA_READ) != FR_OK){
+			_backup_set_text(NULL, "ERR: Open file");
+			ok = false;
+			break;
+		}
+
+		// Fragments of the cluster chain as length, start cluster, ..., 0.
+		u32 left = f_size(&fp) >> 9;
+		tbl[0] = BACKUP_CLTBL_SZ;
+		fp.cltbl = tbl;
+		FRESULT res = f_lseek(&fp, CREATE_LINKMAP);
+		f_close(&fp);
+
+		if(res != FR_OK){
+			_backup_set_text(NULL, res == FR_NOT_ENOUGH_CORE ? "ERR: Too fragmented" : "ERR: Open file");
+			ok = false;
+			break;
+		}
+
+		for(DWORD *frag = &tbl[1]; ok && left && frag[0]; frag += 2){
+			u32 cnt = MIN(frag[0] * sd_fs.csize, left);
+			ok = _backup_copy(CLONE_DEV_SD, _backup_clst2sect(frag[1]), data->dev, pos, cnt, data->verify, time_ms);
+			pos += cnt;
+			left -= cnt;
+		}
+	}
+
+	free(tbl);
+
+	return ok;
+}
+
+static void _backup_start(backup_data_t *data, bool restore){
+	gfx_clear_color(0x0);
+	gfx_con_setpos(0, 0);
+	gfx_con_setcol(TUI_COL_FG, 1, TUI_COL_BG);
+
+	gfx_printf("%s %s\n\n", restore ? "Restore" : "Backup", clone_device_name(data->dev));
+
+	if(restore){
+		gfx_printf("Overwrites %s!\n\nPOWER to start,\n VOL to cancel.\n\n", clone_device_name(data->dev));
+		if(!(btn_wait() & BTN_POWER)){
+			return;
+		}
+	}
+
+	gfx_printf("To abort, hold\n VOL+ and VOL-.\n\nFile:\n\nStatus:\n");
+
+	u32 time_ms = 0;
+	bool ok = false;
+
+	if(!_backup_open()){
+		_backup_set_text(NULL, "ERR: Init fail");
+	}else{
+		ok = restore ? _backup_restore(data, &time_ms) : _backup_save(data, &time_ms);
+	}
+
+	gfx_printf("\n\n");
+
+	if(ok && time_ms){
+		u32 size = _backup_volume_size(data->dev);
+		u32 kbps = (u32)(((u64)size * 1000 / 2) / time_ms);
+		gfx_printf("%dMB in %ds\n%d.%d MB/s\n", size >> 11, time_ms / 1000, kbps >> 10, ((kbps & 0x3FF) * 10) >> 10);
+	}
+
+	_backup_close();
+
+	gfx_printf("\nPress any key...");
+	btn_wait();
+}
+
+static void _backup_menu_update(backup_data_t *data){
+	data->menu[0].action.title.text = backup_dev_strings[data->dev];
+	data->menu[1].action.title.text = backup_verify_strings[data->verify];
+}
+
+static void _backup_dev_cb(void *data){
+	backup_data_t *backup_data = (backup_data_t*)data;
+
+	backup_data->dev = backup_data->dev == CLONE_DEV_EMMC_BOOT1 ? CLONE_DEV_EMMC_GPP : backup_data->dev + 1;
+	_backup_menu_update(backup_data);
+}
+
+static void _backup_verify_cb(void *data){
+	backup_data_t *backup_data = (backup_data_t*)data;
+
+	backup_data->verify = !backup_data->verify;
+	_backup_menu_update(backup_data);
+}
+
+static void _backup_save_cb(void *data){
+	_backup_start((backup_data_t*)data, false);
+}
+
+static void _backup_restore_cb(void *data){
+	_backup_start((backup_data_t*)data, true);
+}
+
+void backup_menu(bool sd_available, bool emmc_available){
+	if(!sd_available || !emmc_available){
+		return;
+	}
+
+	backup_data_t data = {
+		.dev = CLONE_DEV_EMMC_GPP,
+		.verify = false
+	};
+
+	tui_entry_t backup_entries[] = {
+		[0] = TUI_ENTRY_ACTION_NO_BLANK(backup_dev_strings[data.dev], _backup_dev_cb, &data, false, &backup_entries[1]),
+		[1] = TUI_ENTRY_ACTION_NO_BLANK(backup_verify_strings[data.verify], _backup_verify_cb, &data, false, &backup_entries[2]),
+		[2] = TUI_ENTRY_TEXT("\n", &backup_entries[3]),
+		[3] = TUI_ENTRY_ACTION("Backup to SD", _backup_save_cb, &data, false, &backup_entries[4]),
+		[4] = TUI_ENTRY_ACTION("Restore from SD", _backup_restore_cb, &data, false, &backup_entries[5]),
+		[5] = TUI_ENTRY_TEXT("\n", &backup_entries[6]),
+		[6] = TUI_ENTRY_BACK(NULL)
+	};
+
+	data.menu = backup_entries;
+
+	tui_entry_menu_t backup_menu = {{"Backup"}, backup_entries};
+
+	tui_menu_start(&backup_menu);
+}
@@ -0,0 +1,8 @@
+#ifndef _BACKUP_H_
+#define _BACKUP_H_
+
+#include <utils/types.h>
+
+void backup_menu(bool sd_available, bool emmc_available);
+
+#endif
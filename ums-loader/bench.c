@@ -0,0 +1,371 @@
+/*
+ * Raw SD/eMMC throughput benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bench.h"
+
+#include <string.h>
+
+#include <gfx.h>
+#include <memory_map.h>
+#include <soc/timer.h>
+#include <storage/emmc.h>
+#include <storage/sd.h>
+#include <storage/sdmmc.h>
+#include <utils/btn.h>
+#include <utils/types.h>
+#include <utils/util.h>
+
+#include <gfx_utils.h>
+#include <tui.h>
+
+// Bulk IN and OUT buffers are contiguous, so 128K can be used while UMS is not running.
+#define BENCH_BUF               ((u8*)USB_EP_BULK_IN_BUF_ADDR)
+#define BENCH_TIME_MS           500
+#define BENCH_MAX_SECTORS       0x8000 // 16MB per test.
+
+typedef struct bench_cfg_t{
+	u8 device;
+	bool rw;
+	bool sd_available;
+	bool emmc_available;
+}bench_cfg_t;
+
+typedef struct bench_toggle_data_t{
+	tui_entry_t *entry;
+	bench_cfg_t *cfg;
+}bench_toggle_data_t;
+
+static const char *bench_device_strings[] = {
+	[BENCH_DEV_SD]         = "Device SD           ",
+	[BENCH_DEV_EMMC_GPP]   = "Device GPP          ",
+	[BENCH_DEV_EMMC_BOOT0] = "Device BOOT0        ",
+	[BENCH_DEV_EMMC_BOOT1] = "Device BOOT1        ",
+};
+
+static const char *bench_device_names[] = {
+	[BENCH_DEV_SD]         = "SD",
+	[BENCH_DEV_EMMC_GPP]   = "GPP",
+	[BENCH_DEV_EMMC_BOOT0] = "BOOT0",
+	[BENCH_DEV_EMMC_BOOT1] = "BOOT1",
+};
+
+#ifdef BDK_UMS_ACTMON_SUPPORT
+static const char *bench_test_names[] = {
+	[BENCH_SEQ_READ]  = "SeqRd",
+	[BENCH_RND_READ]  = "RndRd",
+	[BENCH_SEQ_WRITE] = "SeqWr",
+	[BENCH_RND_WRITE] = "RndWr",
+};
+#endif
+
+static const char *bench_mode_strings[] = {
+	"  Mode Read only    ",
+	"  Mode Read + Write "
+};
+
+static bench_result_t bench_results[BENCH_DEV_CNT];
+
+static u32 bench_rand_state;
+
+static u32 _bench_rand(){
+	// Xorshift32.
+	bench_rand_state ^= bench_rand_state << 13;
+	bench_rand_state ^= bench_rand_state >> 17;
+	bench_rand_state ^= bench_rand_state << 5;
+	return bench_rand_state;
+}
+
+// Returns KB/s, or 0 on error. Writes put back the data that was just read, only the write is timed.
+static u32 _bench_run_test(sdmmc_storage_t *storage, u32 span, u32 sectors, bool random, bool write){
+	u32 pos = 0;
+	u32 bytes = 0;
+	u32 time_us = 0;
+	u32 start = get_tmr_ms();
+
+	while(bytes < (BENCH_MAX_SECTORS << 9) && (get_tmr_ms() - start) < BENCH_TIME_MS){
+		u32 sector;
+		if(random){
+			sector = (_bench_rand() % (span / sectors)) * sectors;
+		}else{
+			if(pos + sectors > span){
+				pos = 0;
+			}
+			sector = pos;
+			pos += sectors;
+		}
+
+		u32 t = get_tmr_us();
+		if(!sdmmc_storage_read(storage, sector, sectors, BENCH_BUF)){
+			return 0;
+		}
+		if(write){
+			t = get_tmr_us();
+			if(!sdmmc_storage_write(storage, sector, sectors, BENCH_BUF)){
+				return 0;
+			}
+		}
+		time_us += get_tmr_us() - t;
+		bytes += sectors << 9;
+
+#ifdef BDK_UMS_ACTMON_SUPPORT
+		ums_actmon_poll();
+#endif
+	}
+
+	if(!time_us){
+		return 0;
+	}
+
+	return (u32)(((u64)bytes * 1000000 / 1024) / time_us);
+}
+
+static void _bench_print_mbps(u32 kbps){
+	u32 mbps10 = kbps * 10 / 1024;
+	gfx_printf(" %4d.%d", mbps10 / 10, mbps10 % 10);
+}
+
+static void _bench_print_table(const bench_result_t *res, u32 test){
+	gfx_printf("%s MB/s   Seq    Rnd\n", test == BENCH_SEQ_READ ? " Read" : "Write");
+	for(u32 i = 0; i < BENCH_SIZES_CNT; i++){
+		gfx_printf("%4dK", 4 << i);
+		_bench_print_mbps(res->kbps[i][test]);
+		_bench_print_mbps(res->kbps[i][test + 1]);
+		gfx_printf("\n");
+	}
+}
+
+#ifdef BDK_UMS_ACTMON_SUPPORT
+// Storage DMA alone, to compare with the samples taken while UMS runs.
+static void _bench_print_load(u8 device){
+	const bench_result_t *res = &bench_results[device];
+
+	gfx_clear_color(0x0);
+	gfx_con_setpos(0, 0);
+	gfx_con_setcol(TUI_COL_FG, 1, TUI_COL_BG);
+
+	gfx_printf("Bus load %% %s\n\n", bench_device_names[device]);
+
+	for(u32 test = BENCH_SEQ_READ; test < (res->rw ? BENCH_TESTS_CNT : BENCH_SEQ_WRITE); test++){
+		gfx_printf("%s  AHB   MC BPMP\n", bench_test_names[test]);
+		for(u32 i = 0; i < BENCH_SIZES_CNT; i++){
+			const ums_actmon_load_t *load = &res->load[i][test];
+			gfx_printf("%4dK %4d %4d %4d\n", 4 << i, load->ahb / 10, load->mc / 10, load->bpmp / 10);
+		}
+		gfx_printf("\n");
+	}
+
+	gfx_printf("Press any key...");
+	btn_wait();
+}
+#endif
+
+static void _bench_print_result(u8 device){
+	const bench_result_t *res = &bench_results[device];
+
+	gfx_clear_color(0x0);
+	gfx_con_setpos(0, 0);
+	gfx_con_setcol(TUI_COL_FG, 1, TUI_COL_BG);
+
+	gfx_printf("Benchmark %s\n\n", bench_device_names[device]);
+
+	if(!res->valid){
+		gfx_printf("No results.\n");
+	}else{
+		if(res->error){
+			gfx_printf("ERR: IO error\n\n");
+		}
+		_bench_print_table(res, BENCH_SEQ_READ);
+		if(res->rw){
+			gfx_printf("\n");
+			_bench_print_table(res, BENCH_SEQ_WRITE);
+		}
+	}
+
+	gfx_printf("\nPress any key...");
+	btn_wait();
+
+#ifdef BDK_UMS_ACTMON_SUPPORT
+	if(res->valid){
+		_bench_print_load(device);
+	}
+#endif
+}
+
+static void _bench_run(bench_cfg_t *cfg){
+	sdmmc_storage_t *storage;
+	u32 span;
+
+	gfx_clear_color(0x0);
+	gfx_con_setpos(0, 0);
+	gfx_con_setcol(TUI_COL_FG, 1, TUI_COL_BG);
+
+	gfx_printf("Benchmark %s\n\n", bench_device_names[cfg->device]);
+
+	switch(cfg->device){
+	case BENCH_DEV_SD:
+		storage = &sd_storage;
+		if(!sd_initialize(false)){
+			gfx_printf("ERR: SD init fail\n");
+			goto out;
+		}
+		span = storage->sec_cnt;
+		break;
+	case BENCH_DEV_EMMC_GPP:
+	case BENCH_DEV_EMMC_BOOT0:
+	case BENCH_DEV_EMMC_BOOT1:
+		storage = &emmc_storage;
+		if(!emmc_initialize(false)){
+			gfx_printf("ERR: MMC init fail\n");
+			goto out;
+		}
+		// A failed switch would leave it on the previous partition.
+		if(!emmc_set_partition(cfg->device - BENCH_DEV_EMMC_GPP)){ // GPP, BOOT0 or BOOT1.
+			gfx_printf("ERR: MMC part switch\n");
+			emmc_end();
+			goto out;
+		}
+		// Boot partitions are boot_mult x 128KB.
+		span = cfg->device == BENCH_DEV_EMMC_GPP ? storage->sec_cnt : storage->ext_csd.boot_mult << 8;
+		break;
+	default:
+		return;
+	}
+
+	bench_result_t *res = &bench_results[cfg->device];
+	memset(res, 0, sizeof(bench_result_t));
+	res->rw = cfg->rw;
+
+	bench_rand_state = get_tmr_us() | 1;
+
+	u32 seq_span = MIN(span, BENCH_MAX_SECTORS);
+
+	gfx_printf("Running, please wait\n");
+
+#ifdef BDK_UMS_ACTMON_SUPPORT
+	ums_actmon_start();
+#endif
+
+	for(u32 i = 0; i < BENCH_SIZES_CNT && !res->error; i++){
+		u32 sectors = (SZ_4K << i) >> 9;
+
+		for(u32 test = BENCH_SEQ_READ; test < BENCH_TESTS_CNT; test++){
+			bool write = test == BENCH_SEQ_WRITE || test == BENCH_RND_WRITE;
+			if(write && !cfg->rw){
+				continue;
+			}
+
+			u32 x, y;
+			gfx_con_getpos(&x, &y);
+			gfx_printf("%4dK %d/%d", 4 << i, test + 1, BENCH_TESTS_CNT);
+			gfx_con_setpos(x, y);
+
+			bool random = test == BENCH_RND_READ || test == BENCH_RND_WRITE;
+#ifdef BDK_UMS_ACTMON_SUPPORT
+			// The first sample still covers some of the previous test.
+			u32 first_sample = ums_actmon_total() + 1;
+#endif
+			res->kbps[i][test] = _bench_run_test(storage, random ? span : seq_span, sectors, random, write);
+#ifdef BDK_UMS_ACTMON_SUPPORT
+			ums_actmon_avg(first_sample, &res->load[i][test]);
+#endif
+			if(!res->kbps[i][test]){
+				res->error = true;
+				break;
+			}
+		}
+	}
+
+	res->valid = true;
+
+#ifdef BDK_UMS_ACTMON_SUPPORT
+	ums_actmon_end();
+#endif
+
+	sdmmc_storage_end(storage);
+
+	_bench_print_result(cfg->device);
+	return;
+
+out:
+	gfx_printf("\nPress any key...");
+	btn_wait();
+}
+
+static void _bench_device_toggle_cb(void *data){
+	bench_toggle_data_t *toggle_data = (bench_toggle_data_t*)data;
+	bench_cfg_t *cfg = toggle_data->cfg;
+
+	do{
+		cfg->device = (cfg->device + 1) % BENCH_DEV_CNT;
+	}while(cfg->device == BENCH_DEV_SD ? !cfg->sd_available : !cfg->emmc_available);
+
+	toggle_data->entry->title.text = bench_device_strings[cfg->device];
+}
+
+static void _bench_mode_toggle_cb(void *data){
+	bench_toggle_data_t *toggle_data = (bench_toggle_data_t*)data;
+
+	toggle_data->cfg->rw = !toggle_data->cfg->rw;
+	toggle_data->entry->title.text = bench_mode_strings[toggle_data->cfg->rw];
+}
+
+static void _bench_run_cb(void *data){
+	_bench_run((bench_cfg_t*)data);
+}
+
+static void _bench_result_cb(void *data){
+	_bench_print_result(((bench_cfg_t*)data)->device);
+}
+
+const bench_result_t *bench_get_result(u8 device){
+	if(device >= BENCH_DEV_CNT || !bench_results[device].valid){
+		return NULL;
+	}
+	return &bench_results[device];
+}
+
+void bench_menu(bool sd_available, bool emmc_available){
+	if(!sd_available && !emmc_available){
+		return;
+	}
+
+	bench_cfg_t cfg = {
+		.device = sd_available ? BENCH_DEV_SD : BENCH_DEV_EMMC_GPP,
+		.rw = false,
+		.sd_available = sd_available,
+		.emmc_available = emmc_available
+	};
+
+	bench_toggle_data_t dev_data  = {.cfg = &cfg};
+	bench_toggle_data_t mode_data = {.cfg = &cfg};
+
+	tui_entry_t bench_entries[] = {
+		[0] = TUI_ENTRY_ACTION_NO_BLANK(bench_device_strings[cfg.device], _bench_device_toggle_cb, &dev_data, false, &bench_entries[1]),
+		[1] = TUI_ENTRY_ACTION_NO_BLANK(bench_mode_strings[cfg.rw], _bench_mode_toggle_cb, &mode_data, false, &bench_entries[2]),
+		[2] = TUI_ENTRY_TEXT("\n", &bench_entries[3]),
+		[3] = TUI_ENTRY_ACTION("Run Benchmark", _bench_run_cb, &cfg, false, &bench_entries[4]),
+		[4] = TUI_ENTRY_ACTION("Last Results", _bench_result_cb, &cfg, false, &bench_entries[5]),
+		[5] = TUI_ENTRY_TEXT("\n", &bench_entries[6]),
+		[6] = TUI_ENTRY_BACK(NULL)
+	};
+
+	dev_data.entry  = &bench_entries[0];
+	mode_data.entry = &bench_entries[1];
+
+	tui_entry_menu_t bench_menu = {{"Benchmark"}, bench_entries};
+
+	tui_menu_start(&bench_menu);
+}
@@ -0,0 +1,51 @@
+/*
+ * Raw SD/eMMC throughput benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <usb/ums_actmon.h>
+#include <utils/types.h>
+
+// Same order as the MEMLOADER_* volumes.
+#define BENCH_DEV_SD            0
+#define BENCH_DEV_EMMC_GPP      1
+#define BENCH_DEV_EMMC_BOOT0    2
+#define BENCH_DEV_EMMC_BOOT1    3
+#define BENCH_DEV_CNT           4
+
+#define BENCH_SIZES_CNT         6 // 4K to 128K.
+
+#define BENCH_SEQ_READ          0
+#define BENCH_RND_READ          1
+#define BENCH_SEQ_WRITE         2
+#define BENCH_RND_WRITE         3
+#define BENCH_TESTS_CNT         4
+
+typedef struct bench_result_t{
+	bool valid;
+	bool rw;
+	bool error;
+	u32 kbps[BENCH_SIZES_CNT][BENCH_TESTS_CNT];
+#ifdef BDK_UMS_ACTMON_SUPPORT
+	ums_actmon_load_t load[BENCH_SIZES_CNT][BENCH_TESTS_CNT];
+#endif
+}bench_result_t;
+
+void bench_menu(bool sd_available, bool emmc_available);
+const bench_result_t *bench_get_result(u8 device);
+
+#endif
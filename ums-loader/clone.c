@@ -0,0 +1,570 @@
+#include "clone.h"
+
+#include <string.h>
+
+#include <gfx.h>
+#include <memory_map.h>
+#include <sec/se.h>
+#include <soc/timer.h>
+#include <storage/emmc.h>
+#include <storage/sd.h>
+#include <storage/sdmmc.h>
+#include <utils/btn.h>
+#include <utils/sprintf.h>
+#include <utils/types.h>
+#include <utils/util.h>
+
+#include <gfx_utils.h>
+#include <tui.h>
+
+#define CLONE_BUF               ((u8*)CLONE_BUF_ADDR)
+#define CLONE_CHUNK_SECTORS     (SZ_64K >> 9)
+#define CLONE_STATUS_MS         1000
+
+#define CLONE_ABORT_BTNS        (BTN_VOL_UP | BTN_VOL_DOWN)
+
+extern u32 ums_sub_storage_u32_selector(u8 y_pos, char *str, u32 initial, u32 max);
+
+typedef struct clone_toggle_data_t{
+	tui_entry_t *menu;
+	clone_job_t *job;
+	bool sd_available;
+	bool emmc_available;
+}clone_toggle_data_t;
+
+static const char *clone_device_names[] = {
+	[CLONE_DEV_SD]         = "SD",
+	[CLONE_DEV_EMMC_GPP]   = "GPP",
+	[CLONE_DEV_EMMC_BOOT0] = "BOOT0",
+	[CLONE_DEV_EMMC_BOOT1] = "BOOT1",
+};
+
+static const char *clone_src_strings[] = {
+	[CLONE_DEV_SD]         = "  From SD           ",
+	[CLONE_DEV_EMMC_GPP]   = "  From GPP          ",
+	[CLONE_DEV_EMMC_BOOT0] = "  From BOOT0        ",
+	[CLONE_DEV_EMMC_BOOT1] = "  From BOOT1        ",
+};
+
+static const char *clone_dst_strings[] = {
+	[CLONE_DEV_SD]         = "    To SD           ",
+	[CLONE_DEV_EMMC_GPP]   = "    To GPP          ",
+	[CLONE_DEV_EMMC_BOOT0] = "    To BOOT0        ",
+	[CLONE_DEV_EMMC_BOOT1] = "    To BOOT1        ",
+};
+
+static const char *clone_verify_strings[] = {
+	"Verify Off          ",
+	"Verify SHA-256      "
+};
+
+static const char *clone_status_strings[] = {
+	[CLONE_OK]         = "Done",
+	[CLONE_ERR_INIT]   = "ERR: Init fail",
+	[CLONE_ERR_RANGE]  = "ERR: Range too big",
+	[CLONE_ERR_READ]   = "ERR: Read",
+	[CLONE_ERR_WRITE]  = "ERR: Write",
+	[CLONE_ERR_VERIFY] = "ERR: Verify mismatch",
+	[CLONE_ERR_ABORT]  = "Aborted",
+};
+
+const char *clone_device_name(u8 dev){
+	return dev < CLONE_DEV_CNT ? clone_device_names[dev] : "?";
+}
+
+void clone_job_reset(clone_job_t *job){
+	job->status  = CLONE_OK;
+	job->total   = 0;
+	job->done    = 0;
+	job->err_lba = 0;
+	job->time_ms = 0;
+	memset(job->sha_left, 0, sizeof(job->sha_left));
+	memset(job->sha, 0, sizeof(job->sha));
+}
+
+static bool _clone_resumable(const clone_job_t *job){
+	return job->total && (job->status == CLONE_ERR_READ || job->status == CLONE_ERR_WRITE || job->status == CLONE_ERR_ABORT);
+}
+
+static sdmmc_storage_t *_clone_storage(u8 dev){
+	return dev == CLONE_DEV_SD ? &sd_storage : &emmc_storage;
+}
+
+// Returns the size of the volume in sectors, 0 if the card does not come up.
+static u32 _clone_open(u8 dev){
+	if(dev == CLONE_DEV_SD){
+		if(!sd_storage.initialized && !sd_initialize(false)){
+			return 0;
+		}
+		return sd_storage.sec_cnt;
+	}
+
+	if(!emmc_storage.initialized && !emmc_initialize(false)){
+		return 0;
+	}
+
+	// Boot partitions are boot_mult x 128KB.
+	return dev == CLONE_DEV_EMMC_GPP ? emmc_storage.sec_cnt : emmc_storage.ext_csd.boot_mult << 8;
+}
+
+static void _clone_close(){
+	if(sd_storage.initialized){
+		sd_end();
+	}
+	if(emmc_storage.initialized){
+		emmc_end();
+	}
+}
+
+static int _clone_select(u8 dev){
+	if(dev == CLONE_DEV_SD || emmc_storage.partition == (u32)(dev - CLONE_DEV_EMMC_GPP)){
+		return 1;
+	}
+	return emmc_set_partition(dev - CLONE_DEV_EMMC_GPP); // GPP, BOOT0 or BOOT1.
+}
+
+// Blocking access, retries and reinits the card at a lower speed on errors.
+static int _clone_io(u8 dev, u32 sector, u32 num_sectors, void *buf, bool write){
+	sdmmc_storage_t *storage = _clone_storage(dev);
+
+	if(!_clone_select(dev)){
+		return 0;
+	}
+
+	return write ? sdmmc_storage_write(storage, sector, num_sectors, buf) : sdmmc_storage_read(storage, sector, num_sectors, buf);
+}
+
+static int _clone_hash(u8 *sha, u32 *sha_left, const void *buf, u32 pos, u32 num_sectors, u32 total){
+	return se_calc_sha256(sha, sha_left, buf, num_sectors << 9, (u64)total << 9, pos ? SHA_CONTINUE : SHA_INIT_HASH, true);
+}
+
+static void _clone_progress(clone_job_t *job, void (*status)(void *, const char *), u32 start_ms, u32 start_done, u32 pos){
+	char text[32];
+	u32 elapsed = get_tmr_ms() - start_ms;
+	u32 kbps = elapsed ? (u32)(((u64)(pos - start_done) * 1000 / 2) / elapsed) : 0;
+	u32 eta = kbps ? ((job->total - pos) / 2) / kbps : 0;
+
+	s_printf(text, "%3d%% %d.%dMB/s %ds", (u32)(((u64)pos * 100) / job->total),
+		kbps >> 10, ((kbps & 0x3FF) * 10) >> 10, eta);
+	status(NULL, text);
+}
+
+static bool _clone_abort_requested(){
+	return (btn_read() & CLONE_ABORT_BTNS) == CLONE_ABORT_BTNS;
+}
+
+/*
+ * SD and eMMC sit on separate controllers, so the write of one chunk runs while
+ * the next one is read on the other controller and the SE hashes the current
+ * one. Between eMMC partitions, or within one card, reads and writes take turns
+ * with the whole buffer.
+ */
+static u32 _clone_copy(clone_job_t *job, void (*status)(void *, const char *)){
+	sdmmc_storage_t *src = _clone_storage(job->src);
+	sdmmc_storage_t *dst = _clone_storage(job->dst);
+	bool overlap = src != dst;
+	u32 chunk = overlap ? CLONE_CHUNK_SECTORS : CLONE_BUF_SZ >> 9;
+	u8 *bufs[2] = {CLONE_BUF, CLONE_BUF + SZ_64K};
+	u8 sha[SE_SHA_256_SIZE] __attribute__((aligned(4)));
+	u32 sha_left[2];
+	sdmmc_storage_xfer_t rd;
+	sdmmc_storage_xfer_t wr;
+
+	u32 start_ms = get_tmr_ms();
+	u32 last_ms = start_ms;
+	u32 start_done = job->done;
+	u32 pos = job->done;
+	u32 cnt = MIN(chunk, job->total - pos);
+	u32 cur = 0;
+
+	if(!_clone_io(job->src, job->src_lba + pos, cnt, bufs[cur], false)){
+		job->err_lba = job->src_lba + pos;
+		return CLONE_ERR_READ;
+	}
+
+	while(pos < job->total){
+		u32 next = pos + cnt;
+		u32 next_cnt = MIN(chunk, job->total - next);
+		bool wr_async = false;
+		bool rd_async = false;
+
+		if(overlap){
+			wr_async = _clone_select(job->dst) && sdmmc_storage_xfer_start(dst, &wr, job->dst_lba + pos, cnt, bufs[cur], 1);
+			rd_async = next_cnt && _clone_select(job->src) && sdmmc_storage_xfer_start(src, &rd, job->src_lba + next, next_cnt, bufs[cur ^ 1], 0);
+		}
+
+		// Only kept once the chunk is written, so a resumed job hashes it again.
+		bool hashed = true;
+		if(job->verify){
+			memcpy(sha, job->sha, sizeof(sha));
+			memcpy(sha_left, job->sha_left, sizeof(sha_left));
+			hashed = _clone_hash(sha, sha_left, bufs[cur], pos, cnt, job->total);
+		}
+
+		if(rd_async){
+			rd_async = sdmmc_storage_xfer_wait(src, &rd);
+		}
+		if(wr_async){
+			wr_async = sdmmc_storage_xfer_wait(dst, &wr);
+		}
+
+		if(!wr_async && !_clone_io(job->dst, job->dst_lba + pos, cnt, bufs[cur], true)){
+			job->err_lba = job->dst_lba + pos;
+			return CLONE_ERR_WRITE;
+		}
+
+		if(!hashed){
+			job->err_lba = job->src_lba + pos;
+			return CLONE_ERR_VERIFY;
+		}
+
+		job->done = next;
+		if(job->verify){
+			memcpy(job->sha, sha, sizeof(sha));
+			memcpy(job->sha_left, sha_left, sizeof(sha_left));
+		}
+
+		if(overlap){
+			cur ^= 1;
+		}
+
+		if(next_cnt && !rd_async && !_clone_io(job->src, job->src_lba + next, next_cnt, bufs[cur], false)){
+			job->err_lba = job->src_lba + next;
+			return CLONE_ERR_READ;
+		}
+
+		pos = next;
+		cnt = next_cnt;
+
+		if(get_tmr_ms() - last_ms >= CLONE_STATUS_MS || pos == job->total){
+			last_ms = get_tmr_ms();
+			_clone_progress(job, status, start_ms, start_done, pos);
+
+			if(pos < job->total && _clone_abort_requested()){
+				return CLONE_ERR_ABORT;
+			}
+		}
+	}
+
+	return CLONE_OK;
+}
+
+// Reads the destination back and compares its SHA-256 with the one of the source.
+static u32 _clone_verify(clone_job_t *job, void (*status)(void *, const char *)){
+	sdmmc_storage_t *dst = _clone_storage(job->dst);
+	u8 *bufs[2] = {CLONE_BUF, CLONE_BUF + SZ_64K};
+	u8 sha[SE_SHA_256_SIZE] __attribute__((aligned(4)));
+	u32 sha_left[2] = {0};
+	sdmmc_storage_xfer_t rd;
+
+	u32 start_ms = get_tmr_ms();
+	u32 last_ms = start_ms;
+	u32 pos = 0;
+	u32 cnt = MIN(CLONE_CHUNK_SECTORS, job->total);
+	u32 cur = 0;
+
+	if(!_clone_io(job->dst, job->dst_lba, cnt, bufs[cur], false)){
+		job->err_lba = job->dst_lba;
+		return CLONE_ERR_READ;
+	}
+
+	while(pos < job->total){
+		u32 next = pos + cnt;
+		u32 next_cnt = MIN(CLONE_CHUNK_SECTORS, job->total - next);
+
+		// The SE hashes this chunk while the next one is read.
+		bool rd_async = next_cnt && sdmmc_storage_xfer_start(dst, &rd, job->dst_lba + next, next_cnt, bufs[cur ^ 1], 0);
+
+		bool hashed = _clone_hash(sha, sha_left, bufs[cur], pos, cnt, job->total);
+
+		if(rd_async){
+			rd_async = sdmmc_storage_xfer_wait(dst, &rd);
+		}
+
+		if(!hashed){
+			job->err_lba = job->dst_lba + pos;
+			return CLONE_ERR_VERIFY;
+		}
+
+		cur ^= 1;
+
+		if(next_cnt && !rd_async && !_clone_io(job->dst, job->dst_lba + next, next_cnt, bufs[cur], false)){
+			job->err_lba = job->dst_lba + next;
+			return CLONE_ERR_READ;
+		}
+
+		pos = next;
+		cnt = next_cnt;
+
+		if(get_tmr_ms() - last_ms >= CLONE_STATUS_MS || pos == job->total){
+			last_ms = get_tmr_ms();
+			_clone_progress(job, status, start_ms, 0, pos);
+
+			if(pos < job->total && _clone_abort_requested()){
+				return CLONE_ERR_ABORT;
+			}
+		}
+	}
+
+	if(memcmp(sha, job->sha, sizeof(sha))){
+		return CLONE_ERR_VERIFY;
+	}
+
+	return CLONE_OK;
+}
+
+/*
+ * Runs a new job, or resumes a failed or aborted one from the last written
+ * chunk. Status gets progress lines and the result.
+ */
+u32 clone_run(clone_job_t *job, void (*status)(void *, const char *)){
+	u32 start_ms = get_tmr_ms();
+
+	if(!_clone_resumable(job)){
+		clone_job_reset(job);
+	}
+	job->status = CLONE_OK;
+
+	u32 src_size = _clone_open(job->src);
+	u32 dst_size = src_size ? _clone_open(job->dst) : 0;
+	if(!src_size || !dst_size){
+		job->status = CLONE_ERR_INIT;
+		goto out;
+	}
+
+	if(!job->total){
+		u32 total = job->sectors;
+		if(!total && job->src_lba < src_size){
+			total = src_size - job->src_lba;
+		}
+
+		bool same_volume = job->src == job->dst;
+		if(!total || job->src_lba >= src_size || total > src_size - job->src_lba ||
+			job->dst_lba >= dst_size || total > dst_size - job->dst_lba ||
+			(same_volume && job->src_lba < job->dst_lba + total && job->dst_lba < job->src_lba + total)){
+			job->status = CLONE_ERR_RANGE;
+			goto out;
+		}
+
+		job->total = total;
+	}
+
+	if(job->done < job->total){
+		status(NULL, "Copying");
+		job->status = _clone_copy(job, status);
+	}
+
+	if(job->status == CLONE_OK && job->verify){
+		status(NULL, "Verifying");
+		job->status = _clone_verify(job, status);
+	}
+
+	job->time_ms += get_tmr_ms() - start_ms;
+
+out:
+	if(!job->keep_open){
+		_clone_close();
+	}
+
+	status(NULL, clone_status_strings[job->status]);
+
+	return job->status;
+}
+
+static void _clone_set_text(void *label, const char *text){
+	u32 pos_x;
+	u32 pos_y;
+	gfx_con_getpos(&pos_x, &pos_y);
+	gfx_clear_partial_grey(0x0, pos_y, 8);
+	gfx_printf("%s", text);
+	gfx_con_setpos(pos_x, pos_y);
+}
+
+static void _clone_print_result(clone_job_t *job){
+	gfx_printf("\n\n");
+
+	if(job->status == CLONE_ERR_READ || job->status == CLONE_ERR_WRITE){
+		gfx_printf("LBA 0x%08x\nResume retries it.\n", job->err_lba);
+	}else if(job->status == CLONE_ERR_ABORT){
+		gfx_printf("Resume continues.\n");
+	}
+
+	if(job->status == CLONE_OK && job->time_ms){
+		u32 kbps = (u32)(((u64)job->total * 1000 / 2) / job->time_ms);
+		gfx_printf("%dMB in %ds\n%d.%d MB/s\n", job->total >> 11, job->time_ms / 1000,
+			kbps >> 10, ((kbps & 0x3FF) * 10) >> 10);
+
+		if(job->verify){
+			gfx_printf("\nSHA-256\n");
+			for(u32 i = 0; i < SE_SHA_256_SIZE; i++){
+				gfx_printf("%02x%s", job->sha[i], (i % 11) == 10 ? "\n" : "");
+			}
+			gfx_printf("\n");
+		}
+	}
+}
+
+static void _clone_start(clone_job_t *job, bool resume){
+	gfx_clear_color(0x0);
+	gfx_con_setpos(0, 0);
+	gfx_con_setcol(TUI_COL_FG, 1, TUI_COL_BG);
+
+	gfx_printf("Clone %s -> %s\n\n", clone_device_names[job->src], clone_device_names[job->dst]);
+	gfx_printf("From 0x%08x\n  To 0x%08x\n\n", job->src_lba, job->dst_lba);
+
+	if(!resume){
+		gfx_printf("Overwrites %s!\n\nPOWER to start,\n VOL to cancel.\n", clone_device_names[job->dst]);
+		if(!(btn_wait() & BTN_POWER)){
+			return;
+		}
+		clone_job_reset(job);
+
+		u32 x, y;
+		gfx_con_getpos(&x, &y);
+		gfx_clear_partial_grey(0x0, y - 4 * 8, 4 * 8);
+		gfx_con_setpos(0, y - 4 * 8);
+	}
+
+	gfx_printf("To abort, hold\n VOL+ and VOL-.\n\nStatus:\n");
+
+	clone_run(job, &_clone_set_text);
+
+	_clone_print_result(job);
+
+	gfx_printf("\nPress any key...");
+	btn_wait();
+}
+
+static void _clone_menu_update(clone_toggle_data_t *data){
+	clone_job_t *job = data->job;
+	tui_entry_t *menu = data->menu;
+
+	menu[0].action.title.text = clone_src_strings[job->src];
+	menu[1].action.title.text = clone_dst_strings[job->dst];
+	s_printf((char*)menu[2].action.title.text, "  From LBA 0x%08x", job->src_lba);
+	s_printf((char*)menu[3].action.title.text, "    To LBA 0x%08x", job->dst_lba);
+	if(job->sectors){
+		s_printf((char*)menu[4].action.title.text, "  Size 0x%08x    ", job->sectors);
+	}else{
+		s_printf((char*)menu[4].action.title.text, "  Size All          ");
+	}
+	menu[5].action.title.text = clone_verify_strings[job->verify];
+
+	// Resume only makes sense for the job as it was set up.
+	menu[8].disabled = !_clone_resumable(job);
+}
+
+static u8 _clone_next_device(clone_toggle_data_t *data, u8 dev){
+	do{
+		dev = (dev + 1) % CLONE_DEV_CNT;
+	}while(dev == CLONE_DEV_SD ? !data->sd_available : !data->emmc_available);
+
+	return dev;
+}
+
+static void _clone_src_cb(void *data){
+	clone_toggle_data_t *toggle_data = (clone_toggle_data_t*)data;
+
+	toggle_data->job->src = _clone_next_device(toggle_data, toggle_data->job->src);
+	clone_job_reset(toggle_data->job);
+	_clone_menu_update(toggle_data);
+}
+
+static void _clone_dst_cb(void *data){
+	clone_toggle_data_t *toggle_data = (clone_toggle_data_t*)data;
+
+	toggle_data->job->dst = _clone_next_device(toggle_data, toggle_data->job->dst);
+	clone_job_reset(toggle_data->job);
+	_clone_menu_update(toggle_data);
+}
+
+static void _clone_src_lba_cb(void *data){
+	clone_toggle_data_t *toggle_data = (clone_toggle_data_t*)data;
+
+	toggle_data->job->src_lba = ums_sub_storage_u32_selector(toggle_data->menu[2].action.y_pos, "  From LBA", toggle_data->job->src_lba, 0xFFFFFFFF);
+	clone_job_reset(toggle_data->job);
+	_clone_menu_update(toggle_data);
+}
+
+static void _clone_dst_lba_cb(void *data){
+	clone_toggle_data_t *toggle_data = (clone_toggle_data_t*)data;
+
+	toggle_data->job->dst_lba = ums_sub_storage_u32_selector(toggle_data->menu[3].action.y_pos, "    To LBA", toggle_data->job->dst_lba, 0xFFFFFFFF);
+	clone_job_reset(toggle_data->job);
+	_clone_menu_update(toggle_data);
+}
+
+static void _clone_size_cb(void *data){
+	clone_toggle_data_t *toggle_data = (clone_toggle_data_t*)data;
+
+	toggle_data->job->sectors = ums_sub_storage_u32_selector(toggle_data->menu[4].action.y_pos, "  Size", toggle_data->job->sectors, 0xFFFFFFFF);
+	clone_job_reset(toggle_data->job);
+	_clone_menu_update(toggle_data);
+}
+
+static void _clone_verify_cb(void *data){
+	clone_toggle_data_t *toggle_data = (clone_toggle_data_t*)data;
+
+	toggle_data->job->verify = !toggle_data->job->verify;
+	clone_job_reset(toggle_data->job);
+	_clone_menu_update(toggle_data);
+}
+
+static void _clone_start_cb(void *data){
+	clone_toggle_data_t *toggle_data = (clone_toggle_data_t*)data;
+
+	_clone_start(toggle_data->job, false);
+	_clone_menu_update(toggle_data);
+}
+
+static void _clone_resume_cb(void *data){
+	clone_toggle_data_t *toggle_data = (clone_toggle_data_t*)data;
+
+	_clone_start(toggle_data->job, true);
+	_clone_menu_update(toggle_data);
+}
+
+void clone_menu(clone_job_t *job, bool sd_available, bool emmc_available){
+	if(!sd_available && !emmc_available){
+		return;
+	}
+
+	clone_toggle_data_t data = {
+		.job = job,
+		.sd_available = sd_available,
+		.emmc_available = emmc_available
+	};
+
+	// Presets may name a card that is not there.
+	if(job->src == CLONE_DEV_SD ? !sd_available : !emmc_available){
+		job->src = _clone_next_device(&data, job->src);
+	}
+	if(job->dst == CLONE_DEV_SD ? !sd_available : !emmc_available){
+		job->dst = _clone_next_device(&data, job->dst);
+	}
+
+	char src_lba_str[25] = "";
+	char dst_lba_str[25] = "";
+	char size_str[25]    = "";
+
+	tui_entry_t clone_entries[] = {
+		[0] = TUI_ENTRY_ACTION_NO_BLANK(clone_src_strings[job->src], _clone_src_cb, &data, false, &clone_entries[1]),
+		[1] = TUI_ENTRY_ACTION_NO_BLANK(clone_dst_strings[job->dst], _clone_dst_cb, &data, false, &clone_entries[2]),
+		[2] = TUI_ENTRY_ACTION_NO_BLANK(src_lba_str, _clone_src_lba_cb, &data, false, &clone_entries[3]),
+		[3] = TUI_ENTRY_ACTION_NO_BLANK(dst_lba_str, _clone_dst_lba_cb, &data, false, &clone_entries[4]),
+		[4] = TUI_ENTRY_ACTION_NO_BLANK(size_str, _clone_size_cb, &data, false, &clone_entries[5]),
+		[5] = TUI_ENTRY_ACTION_NO_BLANK(clone_verify_strings[job->verify], _clone_verify_cb, &data, false, &clone_entries[6]),
+		[6] = TUI_ENTRY_TEXT("\n", &clone_entries[7]),
+		[7] = TUI_ENTRY_ACTION("Start Clone", _clone_start_cb, &data, false, &clone_entries[8]),
+		[8] = TUI_ENTRY_ACTION("Resume", _clone_resume_cb, &data, true, &clone_entries[9]),
+		[9] = TUI_ENTRY_TEXT("\n", &clone_entries[10]),
+		[10] = TUI_ENTRY_BACK(NULL)
+	};
+
+	data.menu = clone_entries;
+	_clone_menu_update(&data);
+
+	tui_entry_menu_t clone_menu = {{"Clone"}, clone_entries};
+
+	tui_menu_start(&clone_menu);
+}
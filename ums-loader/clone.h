@@ -0,0 +1,46 @@
+#ifndef _CLONE_H_
+#define _CLONE_H_
+
+#include <sec/se_t210.h>
+#include <utils/types.h>
+
+// Same order as the MEMLOADER_* volumes.
+#define CLONE_DEV_SD            0
+#define CLONE_DEV_EMMC_GPP      1
+#define CLONE_DEV_EMMC_BOOT0    2
+#define CLONE_DEV_EMMC_BOOT1    3
+#define CLONE_DEV_CNT           4
+
+#define CLONE_OK                0
+#define CLONE_ERR_INIT          1
+#define CLONE_ERR_RANGE         2
+#define CLONE_ERR_READ          3
+#define CLONE_ERR_WRITE         4
+#define CLONE_ERR_VERIFY        5
+#define CLONE_ERR_ABORT         6
+
+typedef struct clone_job_t{
+	u8 src;
+	u8 dst;
+	bool verify;
+	u32 src_lba;
+	u32 dst_lba;
+	u32 sectors; // 0: Up to the end of the source.
+	bool keep_open; // Leave the cards initialized, e.g. for FatFs on SD.
+
+	// Progress, a failed or aborted job resumes from done.
+	u32 status;
+	u32 total;
+	u32 done;
+	u32 err_lba;
+	u32 time_ms;
+	u32 sha_left[2];
+	u8 sha[SE_SHA_256_SIZE] __attribute__((aligned(4))); // Source, then the final digest.
+}clone_job_t;
+
+const char *clone_device_name(u8 dev);
+void clone_job_reset(clone_job_t *job);
+u32  clone_run(clone_job_t *job, void (*status)(void *, const char *));
+void clone_menu(clone_job_t *job, bool sd_available, bool emmc_available);
+
+#endif
@@ -9,16 +9,32 @@
 #include <storage/mbr_gpt.h>
 #include <string.h>
 #include <soc/timer.h>
+#include <usb/ums_trace.h>
 #include <usb/usbd.h>
 #include <utils/btn.h>
 #include <utils/types.h>
 #include <utils/util.h>
 #include <utils/sprintf.h>
+#include <utils/timeline.h>
 #include <soc/t210.h>
+#ifdef DEBUG_UART_PORT
+#include <soc/uart.h>
+#endif
+#ifdef BDK_UMS_RAMDISK_SUPPORT
+#include <mem/sdram.h>
+#include <soc/bpmp.h>
+#endif
 
 #include <display/di.h>
 #include <gfx_utils.h>
 #include <tui.h>
+#include "bench.h"
+#ifdef BDK_STORAGE_CLONE_SUPPORT
+#include "clone.h"
+#endif
+#ifdef BDK_FS_BACKUP_SUPPORT
+#include "backup.h"
+#endif
 
 // Offset: 0x94
 // +-----+---------+------------------------------------+
@@ -34,6 +50,16 @@
 // |     |         | 2: Reboot to RCM after UMS has     |
 // |     |         |    stopped                         |
 // +-----+---------+------------------------------------+
+// | 3   | 0       | 0: Normal autostart                |
+// |     |         | 1: Headless autostart, no display  |
+// |     |         |    init, status is sent over UART  |
+// |     |         |    (if built with DEBUG_UART_PORT) |
+// +-----+---------+------------------------------------+
+// | 5   | 0       | 0: Autostart runs UMS              |
+// |     |         | 1: Autostart runs the clone job in |
+// |     |         |    0x96 (if built with             |
+// |     |         |    STORAGE_CLONE=1)                |
+// +-----+---------+------------------------------------+
 
 // Offset: 0x95
 // +-----+---------+------------------------------------+
@@ -56,6 +82,19 @@
 // |     |         | 2: Mount SD EMMC-BOOT1 read/write  |
 // +-----+---------+------------------------------------+
 
+// Offset: 0x96, clone job, also the preset of the menu
+// +-----+---------+------------------------------------+
+// | Bit | Default | Function                           |
+// +-----+---------+------------------------------------+
+// | 0:1 | 1       | Source: 0: SD, 1: GPP, 2: BOOT0,   |
+// |     |         | 3: BOOT1                           |
+// | 2:3 | 0       | Destination, same values           |
+// | 4   | 0       | 1: Verify with SHA-256             |
+// +-----+---------+------------------------------------+
+// Offset 0x98: u32 source LBA
+// Offset 0x9C: u32 destination LBA
+// Offset 0xA0: u32 sectors, 0: up to the end of the source
+
 #define MEMLOADER_NO_MOUNT              0
 #define MEMLOADER_RO                    1
 #define MEMLOADER_RW                    2
@@ -64,6 +103,7 @@
 #define MEMLOADER_EMMC_GPP              1
 #define MEMLOADER_EMMC_BOOT0            2
 #define MEMLOADER_EMMC_BOOT1            3
+#define MEMLOADER_RAMDISK               4
 
 #define MEMLOADER_AUTOSTART_MASK        0x01
 #define MEMLOADER_AUTOSTART_YES         0x01
@@ -74,32 +114,59 @@
 #define MEMLOADER_STOP_ACTION_OFF       0x02
 #define MEMLOADER_STOP_ACTION_RCM       0x04 
 
+#define MEMLOADER_HEADLESS_MASK         0x08
+#define MEMLOADER_HEADLESS_YES          0x08
+#define MEMLOADER_HEADLESS_NO           0x00
+
+#define MEMLOADER_USB2_MASK             0x10
+#define MEMLOADER_USB2_YES              0x10
+#define MEMLOADER_USB2_NO               0x00
+
+#define MEMLOADER_CLONE_MASK            0x20
+#define MEMLOADER_CLONE_YES             0x20
+#define MEMLOADER_CLONE_NO              0x00
+
+#define MEMLOADER_CLONE_SRC_MASK        0x03
+#define MEMLOADER_CLONE_DST_SHIFT       2
+#define MEMLOADER_CLONE_VERIFY          0x10
+
 #define MEMLOADER_ERROR_SD              0x01
 #define MEMLOADER_ERROR_EMMC            0x02
+#define MEMLOADER_ERROR_RAMDISK         0x04
 
 typedef struct __attribute__((__packed__)) ums_loader_boot_cfg_t{
 	u8 magic;
 	u8 config;
+	u8 clone;
+	u8 reserved;
+	u32 clone_src_lba;
+	u32 clone_dst_lba;
+	u32 clone_sectors;
 }ums_loader_boot_cfg_t;
 
 typedef struct ums_loader_ums_cfg_t{
 	union{
-		u8 mount_modes[4];
+		u8 mount_modes[5];
 		struct{
 			u8 mount_mode_sd;
 			u8 mount_mode_emmc_gpp;
 			u8 mount_mode_emmc_boot0;
 			u8 mount_mode_emmc_boot1;
+			u8 mount_mode_ramdisk; // Not part of the boot config.
 		};
 	};
 	u32 storage_state;
 	u32 stop_action;
 	bool autostart;
+	bool headless;
+	bool clone;
+	u32 usb_backend;
 }ums_loader_ums_cfg_t;
 
 ums_loader_boot_cfg_t ums_loader_boot_cfg __attribute__((__section__("._ums_loader_cfg"))) = {
 	.magic = 0x0,
 	.config = 0x2,
+	.clone = 0x1,
 };
 
 typedef struct ums_toggle_cb_data_t{
@@ -109,6 +176,9 @@ typedef struct ums_toggle_cb_data_t{
 }ums_toggle_cb_data_t;
 
 static const char *toggle_menu_strings[][3] = {
+#ifdef BDK_UMS_RAMDISK_SUPPORT
+		[MEMLOADER_RAMDISK]    = {"   RAM - ", "   RAM RO", "   RAM RW"},
+#endif
 		[MEMLOADER_EMMC_BOOT1] = {" BOOT1 - ", " BOOT1 RO", " BOOT1 RW"},
 		[MEMLOADER_EMMC_BOOT0] = {" BOOT0 - ", " BOOT0 RO", " BOOT0 RW"},
 		[MEMLOADER_EMMC_GPP]   = {"   GPP - ", "   GPP RO", "   GPP RW"},
@@ -128,6 +198,41 @@ void reboot_rcm(){
 
 void system_maintenance(bool refresh){}
 
+#ifdef BDK_UMS_RAMDISK_SUPPORT
+#define RAMDISK_TEST_PATTERN 0x4D415244
+
+static bool ramdisk_ready = false;
+static u32  ramdisk_written = 0; // Sectors from the start that UMS sessions wrote or zeroed, see the commit menu.
+
+// DRAM is not initialized by hw_init, only bring it up when the RAM disk is actually used.
+bool ramdisk_init(){
+	if(ramdisk_ready){
+		return true;
+	}
+
+	sdram_init();
+
+	// Make sure DRAM holds data at both ends of the RAM disk.
+	vu32 *start = (vu32*)RAM_DISK_ADDR;
+	vu32 *end   = (vu32*)(RAM_DISK_ADDR + RAM_DISK_SZ - sizeof(u32));
+	*start = RAMDISK_TEST_PATTERN;
+	*end   = ~RAMDISK_TEST_PATTERN;
+	bpmp_mmu_maintenance(BPMP_MMU_MAINT_CLN_INV_WAY, false);
+	if(*start != RAMDISK_TEST_PATTERN || *end != ~RAMDISK_TEST_PATTERN){
+		return false;
+	}
+
+	// Clear the start, so the host does not pick up a stale partition table.
+	memset((void*)RAM_DISK_ADDR, 0, SZ_1M);
+
+	// Plenty of room for the command trace now.
+	ums_trace_set_buffer((void*)UMS_TRACE_DRAM_ADDR, UMS_TRACE_DRAM_SZ / sizeof(ums_trace_entry_t));
+
+	ramdisk_ready = true;
+	return true;
+}
+#endif
+
 void set_text(void *label, const char *text){
 	u32 pos_x;
 	u32 pos_y;
@@ -137,6 +242,73 @@ void set_text(void *label, const char *text){
 	gfx_con_setpos(pos_x, pos_y);
 }
 
+void set_text_headless(void *label, const char *text){
+#ifdef DEBUG_UART_PORT
+	uart_send(DEBUG_UART_PORT, (u8*)text, strlen(text));
+	uart_send(DEBUG_UART_PORT, (u8*)"\r\n", 2);
+#endif
+}
+
+// Throughput panel below the status line, a few lines per LUN.
+#define UMS_HUD_LUN_LINES 4
+
+static u32 ums_hud_y;
+
+static const char *sd_mode_strings[]   = {"-", "HS25x1", "HS25", "SDR82", "SDR104", "DDR208"};
+static const char *emmc_mode_strings[] = {"-", "HS52x1", "HS52", "HS200", "HS400"};
+
+void show_stats(void *label, const usb_ums_stats_t *stats){
+	const char *name = "RAM";
+	const char *mode = "DRAM";
+	u32 y = ums_hud_y + stats->lun * UMS_HUD_LUN_LINES * 8;
+	u32 pos_x;
+	u32 pos_y;
+
+	// Query the mode every time, it drops after SDMMC errors.
+	if(stats->type == MMC_SD){
+		name = "SD";
+		mode = sd_mode_strings[MIN(sd_get_mode(), ARRAY_SIZE(sd_mode_strings) - 1)];
+	}else if(stats->type == MMC_EMMC){
+		name = stats->partition == EMMC_GPP + 1 ? "GPP" : stats->partition == EMMC_BOOT0 + 1 ? "BOOT0" : "BOOT1";
+		mode = emmc_mode_strings[MIN(emmc_get_mode(), ARRAY_SIZE(emmc_mode_strings) - 1)];
+	}
+
+	gfx_con_getpos(&pos_x, &pos_y);
+	gfx_clear_partial_grey(0x0, y, UMS_HUD_LUN_LINES * 8);
+	gfx_con_setpos(0, y);
+
+	gfx_printf("%s %s\n", name, mode);
+	gfx_printf(" R%4d.%d W%4d.%d MB/s\n", stats->rd_kbps >> 10, ((stats->rd_kbps & 0x3FF) * 10) >> 10,
+		stats->wr_kbps >> 10, ((stats->wr_kbps & 0x3FF) * 10) >> 10);
+	gfx_printf(" %5d IOPS %6dus\n", MIN(stats->iops, 99999), MIN(stats->lat_us, 999999));
+	gfx_printf(" %dMB", (u32)(stats->bytes >> 20));
+	if(stats->type == MMC_EMMC){
+		gfx_printf(" %d switches", stats->part_switches);
+	}
+
+	gfx_con_setpos(pos_x, pos_y);
+}
+
+static bool display_ready = false;
+
+void display_start(){
+	if(display_ready){
+		return;
+	}
+
+	display_init();
+	u8 *fb = (u8*)display_init_window_a_pitch_small_palette();
+
+	gfx_init_ctxt(fb, 180, 320, 192);
+	gfx_con_init();
+	display_backlight_pwm_init();
+
+	display_backlight_brightness(128, 1000);
+
+	display_ready = true;
+	timeline_mark(TIMELINE_DISPLAY_INIT);
+}
+
 
 void ums_cfg_menu_toggle_cb(void *data){
 	ums_toggle_cb_data_t *ums_toggle_cb_data = (ums_toggle_cb_data_t*)data;
@@ -156,26 +328,61 @@ void ums_cfg_menu_toggle_cb(void *data){
 	ums_toggle_cb_data->entry->title.text = toggle_menu_strings[ums_toggle_cb_data->volume][ums_toggle_cb_data->config->mount_modes[ums_toggle_cb_data->volume]];
 }
 
+#ifdef BDK_USB2_SUPPORT
+static const char *usb_backend_strings[] = {
+	[USB_BACKEND_XUSB] = "USB XUSB",
+	[USB_BACKEND_USB2] = "USB USB2",
+};
+
+void ums_cfg_backend_toggle_cb(void *data){
+	ums_toggle_cb_data_t *ums_toggle_cb_data = (ums_toggle_cb_data_t*)data;
+
+	if(ums_toggle_cb_data->config->usb_backend == USB_BACKEND_XUSB){
+		ums_toggle_cb_data->config->usb_backend = USB_BACKEND_USB2;
+	}else{
+		ums_toggle_cb_data->config->usb_backend = USB_BACKEND_XUSB;
+	}
+
+	ums_toggle_cb_data->entry->title.text = usb_backend_strings[ums_toggle_cb_data->config->usb_backend];
+}
+#endif
+
+
 
+void ums_stop_action(ums_loader_ums_cfg_t *config);
 
 void ums_start(ums_loader_ums_cfg_t *config){
-	gfx_clear_color(0x0);
-	gfx_con_setpos(0, 0);
-	gfx_con_setcol(TUI_COL_FG, 1, TUI_COL_BG);
+	void (*status)(void *, const char *) = config->headless ? &set_text_headless : &set_text;
 
-	gfx_printf("Running UMS\n\n");
-	gfx_con_setcol(TUI_COL_DISABLED_FG, true, TUI_COL_DISABLED_BG);
-	gfx_printf("Volume Mount\n");
+	timeline_mark(TIMELINE_UMS_START);
 
-	for(u32 i = MEMLOADER_SD; i <= MEMLOADER_EMMC_BOOT1; i++){
-		gfx_printf("%s\n", toggle_menu_strings[i][config->mount_modes[i]]);
-	}
+	if(!config->headless){
+		gfx_clear_color(0x0);
+		gfx_con_setpos(0, 0);
+		gfx_con_setcol(TUI_COL_FG, 1, TUI_COL_BG);
 
-	gfx_con_setcol(TUI_COL_FG, 1, TUI_COL_BG);
+		gfx_printf("Running UMS\n\n");
+		gfx_con_setcol(TUI_COL_DISABLED_FG, true, TUI_COL_DISABLED_BG);
+		gfx_printf("Volume Mount\n");
 
-	gfx_printf("\nTo stop, hold\n VOL+ and VOL-, or\n eject all volumes\n safely.\n\nStatus:\n");
+		for(u32 i = MEMLOADER_SD; i <= MEMLOADER_EMMC_BOOT1; i++){
+			gfx_printf("%s\n", toggle_menu_strings[i][config->mount_modes[i]]);
+		}
+#ifdef BDK_UMS_RAMDISK_SUPPORT
+		gfx_printf("%s\n", toggle_menu_strings[MEMLOADER_RAMDISK][config->mount_mode_ramdisk]);
+#endif
 
-	usb_ctxt_vol_t volumes[4];
+		gfx_con_setcol(TUI_COL_FG, 1, TUI_COL_BG);
+
+		gfx_printf("\nTo stop, hold\n VOL+ and VOL-, or\n eject all volumes\n safely.\n\nStatus:\n");
+
+		// Leave the status line and one blank line.
+		u32 pos_x;
+		gfx_con_getpos(&pos_x, &ums_hud_y);
+		ums_hud_y += 2 * 8;
+	}
+
+	usb_ctxt_vol_t volumes[5] = {0};
 	u32 volumes_cnt = 0;
 
 	if(config->mount_mode_sd != MEMLOADER_NO_MOUNT){
@@ -227,19 +434,79 @@ void ums_start(ums_loader_ums_cfg_t *config){
 		}
 	}
 
+#ifdef BDK_UMS_RAMDISK_SUPPORT
+	if(config->mount_mode_ramdisk != MEMLOADER_NO_MOUNT){
+		if(ramdisk_init()){
+			volumes[volumes_cnt].offset = 0;
+			volumes[volumes_cnt].partition = 0;
+			volumes[volumes_cnt].sectors = RAM_DISK_SZ >> 9;
+			volumes[volumes_cnt].type = MMC_RAMDISK;
+			volumes[volumes_cnt].ro = config->mount_mode_ramdisk == MEMLOADER_RO;
+			volumes[volumes_cnt].written = ramdisk_written;
+
+			volumes_cnt++;
+		}else{
+			config->storage_state |= MEMLOADER_ERROR_RAMDISK;
+			status(NULL, "ERR: DRAM init fail");
+			if(!config->headless){
+				msleep(1000);
+			}
+		}
+	}
+#endif
+
+	void *boot_cache = NULL;
+#ifdef BDK_UMS_RAMDISK_SUPPORT
+	// Hosts probe all LUNs in turn. With BOOT0/1 next to another eMMC LUN, keep
+	// the boot partitions in DRAM, so reading them needs no partition switches.
+	u32 emmc_luns = 0;
+	bool boot_lun = false;
+	for(u32 i = 0; i < volumes_cnt; i++){
+		if(volumes[i].type == MMC_EMMC){
+			emmc_luns++;
+			boot_lun |= volumes[i].partition != EMMC_GPP + 1;
+		}
+	}
+
+	if(boot_lun && emmc_luns > 1 && ramdisk_init()){
+		boot_cache = (void*)UMS_BOOT_CACHE_DRAM_ADDR;
+	}
+#endif
+
 	usb_ctxt_t usbs;
 
 	usbs.label = NULL;
-	usbs.set_text = &set_text;
+	usbs.set_text = status;
+	usbs.show_stats = config->headless ? NULL : &show_stats;
 	usbs.system_maintenance = &system_maintenance;
 	usbs.volumes_cnt = volumes_cnt;
 	usbs.volumes = volumes;
+	// The framebuffer is not used when headless, so writes can use it as well.
+	usbs.bulk_out_max_xfer = config->headless ? USB_EP_BULK_OUT_EXT_MAX_XFER : 0;
+	usbs.read_io_max = 0;
+	usbs.boot_cache = boot_cache;
+	usbs.backend = config->usb_backend;
 
 
 	usb_device_gadget_ums(&usbs);
 
-	msleep(2000);
+#ifdef BDK_UMS_RAMDISK_SUPPORT
+	for(u32 i = 0; i < volumes_cnt; i++){
+		if(volumes[i].type == MMC_RAMDISK){
+			ramdisk_written = volumes[i].written;
+		}
+	}
+#endif
+
+	// Give the user time to read the status.
+	if(!config->headless){
+		msleep(2000);
+	}
 
+	ums_stop_action(config);
+}
+
+void ums_stop_action(ums_loader_ums_cfg_t *config){
 	switch(config->stop_action){
 		case MEMLOADER_STOP_ACTION_OFF:
 			power_set_state(POWER_OFF);
@@ -288,6 +555,7 @@ typedef struct sub_storage_cfg{
 	u32 offset;
 	u32 size;
 	bool ro;
+	bool xts;
 	u8 device;
 	u8 mode;
 	u8 part;
@@ -440,6 +708,14 @@ void ums_sub_storage_ro_update(tui_entry_t *entry){
 	s_printf((char*)entry->title.text, " Mount %s           ", data->sub_cfg->ro ? "RO" : "RW");
 }
 
+#ifdef BDK_UMS_XTS_SUPPORT
+void ums_sub_storage_xts_update(tui_entry_t *entry){
+	sub_storage_toggle_data_t *data = (sub_storage_toggle_data_t*)entry->action.data;
+
+	s_printf((char*)entry->title.text, "   XTS %s          ", data->sub_cfg->xts ? "On " : "Off");
+}
+#endif
+
 
 
 void ums_sub_storage_device_toggle_cb(void *data){
@@ -596,12 +872,17 @@ void ums_sub_storage_start_ums_cb(void *data){
 
 	gfx_con_setcol(TUI_COL_FG, 1, TUI_COL_BG);
 
+	if(sub_cfg->xts){
+		gfx_printf("Decrypted view, send\n the keys with\n tools/ums_xts.py\n");
+	}
+
 	gfx_printf("\nTo stop, hold\n VOL+ and VOL-, or\n eject all volumes\n safely.\n\nStatus:\n");
 
 	usb_ctxt_vol_t volume;
 	volume.offset = sub_cfg->offset;
 	volume.ro = sub_cfg->ro;
 	volume.sectors = sub_cfg->size;
+	volume.xts = sub_cfg->xts;
 	switch(sub_cfg->device){
 	case MEMLOADER_SD:
 		volume.partition = 0;
@@ -625,15 +906,110 @@ void ums_sub_storage_start_ums_cb(void *data){
 
 	usbs.label = NULL;
 	usbs.set_text = &set_text;
+	usbs.show_stats = NULL;
 	usbs.system_maintenance = &system_maintenance;
 	usbs.volumes_cnt = 1;
 	usbs.volumes = &volume;
+	usbs.bulk_out_max_xfer = 0;
+	usbs.read_io_max = 0;
+	usbs.boot_cache = NULL;
+	usbs.backend = sub_cfg->ums_cfg->usb_backend;
 
 	usb_device_gadget_ums(&usbs);
 
 	msleep(1000);
 }
 
+#ifdef BDK_UMS_RAMDISK_SUPPORT
+#define RAMDISK_COMMIT_CHUNK 0x8000 // 16MB.
+
+// Write the start of the RAM disk to the selected substorage in one sequential pass.
+void ums_sub_storage_commit_ramdisk_cb(void *data){
+	sub_storage_cfg_t *sub_cfg = (sub_storage_cfg_t*) data;
+	sdmmc_storage_t *storage;
+
+	gfx_clear_color(0x0);
+	gfx_con_setpos(0, 0);
+	gfx_con_setcol(TUI_COL_FG, 1, TUI_COL_BG);
+
+	gfx_printf("Commit RAM Disk\n\n");
+
+	if(sub_cfg->ro){
+		gfx_printf("Target is RO.\nSet it to RW first.\n");
+		goto out;
+	}
+
+	// Only up to the last sector UMS wrote. Below it DRAM holds host data or zeros, above it was never cleared.
+	if(!ramdisk_ready || !ramdisk_written){
+		gfx_printf("RAM disk is empty.\nWrite to it over\nUMS first.\n");
+		goto out;
+	}
+
+	u32 size = MIN(sub_cfg->size, ramdisk_written);
+
+	gfx_printf("Size   0x%08x\nOffset 0x%08x\n\n", size, sub_cfg->offset);
+
+	gfx_printf("Overwrites target!\n\nPOWER to start,\n VOL to cancel.\n\n");
+	if(!(btn_wait() & BTN_POWER)){
+		return;
+	}
+
+	switch(sub_cfg->device){
+	case MEMLOADER_SD:
+		storage = &sd_storage;
+		if(!sd_initialize(false)){
+			gfx_printf("ERR: SD init fail\n");
+			goto out;
+		}
+		break;
+	case MEMLOADER_EMMC_GPP:
+	case MEMLOADER_EMMC_BOOT0:
+	case MEMLOADER_EMMC_BOOT1:
+		storage = &emmc_storage;
+		if(!emmc_initialize(false)){
+			gfx_printf("ERR: MMC init fail\n");
+			goto out;
+		}
+		// A failed switch would leave it on the previous partition.
+		if(!emmc_set_partition(sub_cfg->device - MEMLOADER_EMMC_GPP)){ // GPP, BOOT0 or BOOT1.
+			gfx_printf("ERR: MMC part switch\n");
+			emmc_end();
+			goto out;
+		}
+		break;
+	default:
+		goto out;
+	}
+
+	u32 start = get_tmr_ms();
+	u32 done = 0;
+	while(done < size){
+		u32 amount = MIN(size - done, RAMDISK_COMMIT_CHUNK);
+
+		if(!sdmmc_storage_write(storage, sub_cfg->offset + done, amount, (u8*)(RAM_DISK_ADDR + (done << 9)))){
+			gfx_printf("\nERR: Write @ 0x%08x\n", sub_cfg->offset + done);
+			break;
+		}
+		done += amount;
+
+		u32 x, y;
+		gfx_con_getpos(&x, &y);
+		gfx_printf("%3d%%", (u32)(((u64)done * 100) / size));
+		gfx_con_setpos(x, y);
+	}
+
+	if(done == size){
+		gfx_printf("\nDone in %d ms\n", get_tmr_ms() - start);
+	}
+
+	sdmmc_storage_end(storage);
+
+out:
+	gfx_printf("\nPress any key...");
+	btn_wait();
+}
+#endif
+
 void ums_sub_storage_ro_cb(void *data){
 	sub_storage_toggle_data_t *toggle_data = (sub_storage_toggle_data_t*)data;
 
@@ -642,6 +1018,17 @@ void ums_sub_storage_ro_cb(void *data){
 	ums_sub_storage_ro_update(&toggle_data->menu[5]);
 }
 
+#ifdef BDK_UMS_XTS_SUPPORT
+// Decrypt BIS partitions (or an emuMMC copy of them) with keys sent by the host.
+void ums_sub_storage_xts_cb(void *data){
+	sub_storage_toggle_data_t *toggle_data = (sub_storage_toggle_data_t*)data;
+
+	toggle_data->sub_cfg->xts = !toggle_data->sub_cfg->xts;
+
+	ums_sub_storage_xts_update(toggle_data->entry);
+}
+#endif
+
 void ums_sub_storage_cb(void *data){
 	ums_loader_ums_cfg_t *ums_cfg = (ums_loader_ums_cfg_t*)data;
 	sub_storage_cfg_t sub_storage_cfg = {.ums_cfg = ums_cfg, .device = MEMLOADER_SD, .mode = MEMLOADER_SUBSTORAGE_BY_PART, .ro = false};
@@ -704,9 +1091,114 @@ void ums_sub_storage_cb(void *data){
 
 	tui_entry_menu_t sub_menu = {{"Substorage Mount"}, sub_storage_entries};
 
+#ifdef BDK_UMS_XTS_SUPPORT
+	char sub_storage_xts[25] = "";
+	sub_storage_toggle_data_t xts_data = {.sub_cfg = &sub_storage_cfg};
+	tui_entry_t xts_entry = TUI_ENTRY_ACTION_NO_BLANK(sub_storage_xts, ums_sub_storage_xts_cb, &xts_data, false, &sub_storage_entries[6]);
+	xts_data.entry = &xts_entry;
+	xts_data.menu  = sub_storage_entries;
+	sub_storage_entries[5].next = &xts_entry;
+	ums_sub_storage_xts_update(&xts_entry);
+#endif
+
+#ifdef BDK_UMS_RAMDISK_SUPPORT
+	tui_entry_t commit_entries[] = {
+		[0] = TUI_ENTRY_ACTION("Commit RAM Disk     ", ums_sub_storage_commit_ramdisk_cb, &sub_storage_cfg, false, &commit_entries[1]),
+		[1] = TUI_ENTRY_TEXT("\n", &sub_storage_entries[11]),
+	};
+	sub_storage_entries[10].next = &commit_entries[0];
+#endif
+
 	tui_menu_start(&sub_menu);
 }
 
+void bench_menu_cb(void *data){
+	ums_loader_ums_cfg_t *ums_cfg = (ums_loader_ums_cfg_t*)data;
+	bench_menu(!(ums_cfg->storage_state & MEMLOADER_ERROR_SD), !(ums_cfg->storage_state & MEMLOADER_ERROR_EMMC));
+}
+
+#ifdef BDK_STORAGE_CLONE_SUPPORT
+static clone_job_t clone_job;
+
+void clone_menu_cb(void *data){
+	ums_loader_ums_cfg_t *ums_cfg = (ums_loader_ums_cfg_t*)data;
+	clone_menu(&clone_job, !(ums_cfg->storage_state & MEMLOADER_ERROR_SD), !(ums_cfg->storage_state & MEMLOADER_ERROR_EMMC));
+}
+
+void clone_autostart(ums_loader_ums_cfg_t *config){
+	void (*status)(void *, const char *) = config->headless ? &set_text_headless : &set_text;
+
+	if(!config->headless){
+		gfx_clear_color(0x0);
+		gfx_con_setpos(0, 0);
+		gfx_con_setcol(TUI_COL_FG, 1, TUI_COL_BG);
+
+		gfx_printf("Clone %s -> %s\n\nTo abort, hold\n VOL+ and VOL-.\n\nStatus:\n", clone_device_name(clone_job.src), clone_device_name(clone_job.dst));
+	}
+
+	clone_run(&clone_job, status);
+
+	if(!config->headless){
+		msleep(2000);
+	}
+
+	ums_stop_action(config);
+}
+
+#endif
+#ifdef BDK_FS_BACKUP_SUPPORT
+void backup_menu_cb(void *data){
+	ums_loader_ums_cfg_t *ums_cfg = (ums_loader_ums_cfg_t*)data;
+	backup_menu(!(ums_cfg->storage_state & MEMLOADER_ERROR_SD), !(ums_cfg->storage_state & MEMLOADER_ERROR_EMMC));
+}
+
+#endif
+#ifdef BDK_USB_LOOPBACK_SUPPORT
+void usb_loopback_cb(void *data){
+	ums_loader_ums_cfg_t *ums_cfg = (ums_loader_ums_cfg_t*)data;
+
+	gfx_clear_color(0x0);
+	gfx_con_setpos(0, 0);
+	gfx_con_setcol(TUI_COL_FG, 1, TUI_COL_BG);
+
+	gfx_printf("USB Loopback\n\nRun\n tools/usb_loopback.py\n on the host.\n\nTo stop, hold\n VOL+ and VOL-.\n\nStatus:\n");
+
+	usb_ctxt_t usbs = {0};
+
+	usbs.label = NULL;
+	usbs.set_text = &set_text;
+	usbs.system_maintenance = &system_maintenance;
+	usbs.backend = ums_cfg->usb_backend;
+
+	usb_device_gadget_loopback(&usbs);
+
+	msleep(2000);
+}
+
+#endif
+#ifdef BDK_USB_IMAGE_SUPPORT
+void usb_image_cb(void *data){
+	ums_loader_ums_cfg_t *ums_cfg = (ums_loader_ums_cfg_t*)data;
+
+	gfx_clear_color(0x0);
+	gfx_con_setpos(0, 0);
+	gfx_con_setcol(TUI_COL_FG, 1, TUI_COL_BG);
+
+	gfx_printf("USB Image\n\nRun\n tools/usb_image.py\n on the host.\n\nTo stop, hold\n VOL+ and VOL-.\n\nStatus:\n");
+
+	usb_ctxt_t usbs = {0};
+
+	usbs.label = NULL;
+	usbs.set_text = &set_text;
+	usbs.system_maintenance = &system_maintenance;
+	usbs.backend = ums_cfg->usb_backend;
+
+	usb_device_gadget_image(&usbs);
+
+	msleep(2000);
+}
+
+#endif
 void menu_power_off_cb(void *data){
 	power_set_state(POWER_OFF);
 }
@@ -730,17 +1222,40 @@ int main(){
 
 	ums_cfg.autostart = (ums_loader_boot_cfg.magic & MEMLOADER_AUTOSTART_MASK) == MEMLOADER_AUTOSTART_YES;
 	ums_cfg.stop_action = (ums_loader_boot_cfg.magic & MEMLOADER_STOP_ACTION_MASK);
+	ums_cfg.headless = ums_cfg.autostart && (ums_loader_boot_cfg.magic & MEMLOADER_HEADLESS_MASK) == MEMLOADER_HEADLESS_YES;
+#ifdef BDK_USB2_SUPPORT
+	ums_cfg.usb_backend = (ums_loader_boot_cfg.magic & MEMLOADER_USB2_MASK) == MEMLOADER_USB2_YES ? USB_BACKEND_USB2 : USB_BACKEND_XUSB;
+#endif
+#ifdef BDK_STORAGE_CLONE_SUPPORT
+	ums_cfg.clone = (ums_loader_boot_cfg.magic & MEMLOADER_CLONE_MASK) == MEMLOADER_CLONE_YES;
+
+	clone_job.src     = ums_loader_boot_cfg.clone & MEMLOADER_CLONE_SRC_MASK;
+	clone_job.dst     = (ums_loader_boot_cfg.clone >> MEMLOADER_CLONE_DST_SHIFT) & MEMLOADER_CLONE_SRC_MASK;
+	clone_job.verify  = ums_loader_boot_cfg.clone & MEMLOADER_CLONE_VERIFY;
+	clone_job.src_lba = ums_loader_boot_cfg.clone_src_lba;
+	clone_job.dst_lba = ums_loader_boot_cfg.clone_dst_lba;
+	clone_job.sectors = ums_loader_boot_cfg.clone_sectors;
+#endif
 
 	if(!sd_initialize(false)){
 		ums_cfg.storage_state |= MEMLOADER_ERROR_SD;
 	}
 	sd_end();
+	timeline_mark(TIMELINE_SD_PROBE);
 	if(!sdmmc_storage_init_mmc(&emmc_storage, &emmc_sdmmc, SDMMC_BUS_WIDTH_8, SDHCI_TIMING_MMC_HS400)){
 		ums_cfg.storage_state |= MEMLOADER_ERROR_EMMC;
 	}
 	sdmmc_storage_end(&emmc_storage);
+	timeline_mark(TIMELINE_EMMC_PROBE);
 
-	if(ums_cfg.autostart){
+	if(ums_cfg.autostart && ums_cfg.headless){
+		if(ums_cfg.storage_state & MEMLOADER_ERROR_SD && ums_cfg.mount_mode_sd != MEMLOADER_NO_MOUNT){
+			set_text_headless(NULL, "ERR: SD not available");
+		}
+		if(ums_cfg.storage_state & MEMLOADER_ERROR_EMMC){
+			set_text_headless(NULL, "ERR: MMC not available");
+		}
+	}else if(ums_cfg.autostart && !ums_cfg.clone){
 		gfx_con_setpos(0, 0);
 		gfx_puts("UMS\n\n");
 		bool not_available = false;
@@ -782,10 +1297,19 @@ int main(){
 
 	if(ums_cfg.autostart){
 		ums_cfg.autostart = false;
+#ifdef BDK_STORAGE_CLONE_SUPPORT
+		if(ums_cfg.clone){
+			clone_autostart(&ums_cfg);
+		}else
+#endif
 		ums_start(&ums_cfg);
+
+		// Stop action is "menu", bring up the display now.
+		ums_cfg.headless = false;
+		display_start();
 	}
 
-	ums_toggle_cb_data_t ums_toggle_cb_data[4] = {
+	ums_toggle_cb_data_t ums_toggle_cb_data[5] = {
 		[MEMLOADER_SD] = {
 			.config = &ums_cfg,
 			.volume = MEMLOADER_SD
@@ -802,6 +1326,10 @@ int main(){
 			.config = &ums_cfg,
 			.volume = MEMLOADER_EMMC_BOOT1
 		},
+		[MEMLOADER_RAMDISK] = {
+			.config = &ums_cfg,
+			.volume = MEMLOADER_RAMDISK
+		},
 	};
 
 	bool is_t210 = hw_get_chip_id() == GP_HIDREV_MAJOR_T210;
@@ -816,10 +1344,11 @@ int main(){
 		[6] = TUI_ENTRY_ACTION("Start UMS", ums_menu_cb, &ums_cfg, false, &ums_menu_entries[7]),
 		[7] = TUI_ENTRY_TEXT("\n", &ums_menu_entries[8]),
 		[8] = TUI_ENTRY_ACTION("Mount Substorage", ums_sub_storage_cb, &ums_cfg, ums_cfg.storage_state & MEMLOADER_ERROR_EMMC && ums_cfg.storage_state & MEMLOADER_ERROR_SD, &ums_menu_entries[9]),
-		[9] = TUI_ENTRY_TEXT("\n", &ums_menu_entries[10]),
- 		[10] = TUI_ENTRY_ACTION("Reload", menu_reload_cb, NULL, false, &ums_menu_entries[11]),
-		[11] = TUI_ENTRY_ACTION("Reboot RCM", menu_reboot_rcm_cb, NULL, !is_t210, &ums_menu_entries[12]),
-		[12] = TUI_ENTRY_ACTION("Power Off", menu_power_off_cb, NULL, false, NULL),
+		[9] = TUI_ENTRY_ACTION("Benchmark", bench_menu_cb, &ums_cfg, ums_cfg.storage_state & MEMLOADER_ERROR_EMMC && ums_cfg.storage_state & MEMLOADER_ERROR_SD, &ums_menu_entries[10]),
+		[10] = TUI_ENTRY_TEXT("\n", &ums_menu_entries[11]),
+ 		[11] = TUI_ENTRY_ACTION("Reload", menu_reload_cb, NULL, false, &ums_menu_entries[12]),
+		[12] = TUI_ENTRY_ACTION("Reboot RCM", menu_reboot_rcm_cb, NULL, !is_t210, &ums_menu_entries[13]),
+		[13] = TUI_ENTRY_ACTION("Power Off", menu_power_off_cb, NULL, false, NULL),
 	};
 
 
@@ -828,6 +1357,41 @@ int main(){
 	ums_toggle_cb_data[MEMLOADER_EMMC_BOOT0].entry = &ums_menu_entries[3];
 	ums_toggle_cb_data[MEMLOADER_EMMC_BOOT1].entry = &ums_menu_entries[4];
 
+#ifdef BDK_UMS_RAMDISK_SUPPORT
+	tui_entry_t ramdisk_toggle_entry = TUI_ENTRY_ACTION_NO_BLANK(toggle_menu_strings[MEMLOADER_RAMDISK][ums_cfg.mount_mode_ramdisk], ums_cfg_menu_toggle_cb, &ums_toggle_cb_data[MEMLOADER_RAMDISK], false, &ums_menu_entries[5]);
+	ums_menu_entries[4].next = &ramdisk_toggle_entry;
+	ums_toggle_cb_data[MEMLOADER_RAMDISK].entry = &ramdisk_toggle_entry;
+#endif
+
+#ifdef BDK_USB2_SUPPORT
+	ums_toggle_cb_data_t usb_backend_cb_data = {
+		.config = &ums_cfg,
+	};
+	tui_entry_t usb_backend_entry = TUI_ENTRY_ACTION_NO_BLANK(usb_backend_strings[ums_cfg.usb_backend], ums_cfg_backend_toggle_cb, &usb_backend_cb_data, false, &ums_menu_entries[6]);
+	ums_menu_entries[5].next = &usb_backend_entry;
+	usb_backend_cb_data.entry = &usb_backend_entry;
+#endif
+
+#ifdef BDK_STORAGE_CLONE_SUPPORT
+	tui_entry_t clone_entry = TUI_ENTRY_ACTION("Clone", clone_menu_cb, &ums_cfg, ums_cfg.storage_state & MEMLOADER_ERROR_EMMC && ums_cfg.storage_state & MEMLOADER_ERROR_SD, ums_menu_entries[9].next);
+	ums_menu_entries[9].next = &clone_entry;
+#endif
+
+#ifdef BDK_FS_BACKUP_SUPPORT
+	tui_entry_t backup_entry = TUI_ENTRY_ACTION("Backup", backup_menu_cb, &ums_cfg, ums_cfg.storage_state & MEMLOADER_ERROR_EMMC || ums_cfg.storage_state & MEMLOADER_ERROR_SD, ums_menu_entries[9].next);
+	ums_menu_entries[9].next = &backup_entry;
+#endif
+
+#ifdef BDK_USB_LOOPBACK_SUPPORT
+	tui_entry_t loopback_entry = TUI_ENTRY_ACTION("USB Loopback", usb_loopback_cb, &ums_cfg, false, ums_menu_entries[9].next);
+	ums_menu_entries[9].next = &loopback_entry;
+#endif
+
+#ifdef BDK_USB_IMAGE_SUPPORT
+	tui_entry_t image_entry = TUI_ENTRY_ACTION("USB Image", usb_image_cb, &ums_cfg, ums_cfg.storage_state & MEMLOADER_ERROR_EMMC && ums_cfg.storage_state & MEMLOADER_ERROR_SD, ums_menu_entries[9].next);
+	ums_menu_entries[9].next = &image_entry;
+#endif
+
 	tui_entry_menu_t ums_menu;
 	ums_menu.title.text = "UMS";
 	ums_menu.entries = ums_menu_entries;
@@ -847,20 +1411,20 @@ void checkerboard_test(){
 }
 
 void ipl_main(){
+	timeline_mark(TIMELINE_IPL_START);
 	hw_init();
+	timeline_mark(TIMELINE_HW_INIT);
 	pivot_stack(IPL_STACK_TOP);
 	heap_init((void*)IPL_HEAP_START);
 
 	mc_enable_ahb_redirect(true);
 
-	display_init();
-	u8 *fb = (u8*)display_init_window_a_pitch_small_palette();
-
-	gfx_init_ctxt(fb, 180, 320, 192);
-	gfx_con_init();
-	display_backlight_pwm_init();
-
-	display_backlight_brightness(128, 1000);
+	// Headless autostart defers display init until the menu is needed.
+	bool headless = (ums_loader_boot_cfg.magic & MEMLOADER_AUTOSTART_MASK) == MEMLOADER_AUTOSTART_YES &&
+	                (ums_loader_boot_cfg.magic & MEMLOADER_HEADLESS_MASK) == MEMLOADER_HEADLESS_YES;
+	if(!headless){
+		display_start();
+	}
 	// checkerboard_test();
 	main();
 }
\ No newline at end of file
@@ -25,15 +25,27 @@
 #define USB_EP_BULK_IN_MAX_XFER   SZ_64K  
 #define USB_EP_BULK_OUT_BUF_ADDR  (USB_EP_BULK_IN_BUF_ADDR + SZ_64K) //64K
 #define USB_EP_BULK_OUT_MAX_XFER  SZ_64K
+#define USB_EP_BULK_OUT_EXT_MAX_XFER (USB_EP_BULK_OUT_MAX_XFER + IPL_SMALL_FB_SZ) // Bulk OUT + framebuffer. Only if display is off.
 
 #define IPL_SMALL_FB_SZ           (SZ_32K + SZ_16K + SZ_8K + SZ_4K)
 #define IPL_SMALL_FB_ADDR         (USB_EP_BULK_OUT_BUF_ADDR + SZ_64K) //60K
 
 #define XUSB_RING_ADDR            (IPL_SMALL_FB_ADDR + IPL_SMALL_FB_SZ) //1.5K
 
+// USB2 controller state. Only one controller is active, so it shares the XUSB rings.
+#define USBD_ADDR                 XUSB_RING_ADDR //1.25K
+#define USB_DESCRIPTOR_ADDR       (USBD_ADDR + SZ_1K + (SZ_1K / 4)) //256B
+
 #define USB_EP_CONTROL_BUF_ADDR   (XUSB_RING_ADDR + SZ_1K + (SZ_1K / 2)) //1K
 
-#define IPL_HEAP_START            (USB_EP_CONTROL_BUF_ADDR + SZ_1K)
+// SD/eMMC init scratch (ext_csd, SCR, SSR, switch status). A retried read/write reinits the card, so not a data buffer.
+#define SDMMC_INIT_BUF_ADDR       (USB_EP_CONTROL_BUF_ADDR + SZ_1K) //512B
+
+#define IPL_HEAP_START            (SDMMC_INIT_BUF_ADDR + 512)
+
+// Clone/backup ring of two 64K chunks while UMS is not running. Bulk IN and OUT are contiguous.
+#define CLONE_BUF_ADDR            USB_EP_BULK_IN_BUF_ADDR
+#define CLONE_BUF_SZ              (SZ_64K * 2)
 
 #define IPL_STACK_TOP             0x40040000
 
@@ -42,11 +54,30 @@
 #define SDMMC_UPPER_BUFFER        USB_EP_BULK_IN_BUF_ADDR
 #define SDMMC_UP_BUF_SZ           USB_EP_BULK_OUT_MAX_XFER
 
+#define SDRAM_PARAMS_ADDR         USB_EP_BULK_IN_BUF_ADDR // SDRAM extraction buffer during sdram init.
+
+// Virtual disk. Only valid after sdram_init().
+#define RAM_DISK_ADDR             0xA4000000
+#define RAM_DISK_SZ               0x41000000 // 1040MB.
+
+// SCSI command trace ring, moved here from IRAM once DRAM is up. 64K entries.
+#define UMS_TRACE_DRAM_ADDR       (RAM_DISK_ADDR - SZ_2M)
+#define UMS_TRACE_DRAM_SZ         SZ_2M
+
+// BOOT0/BOOT1 read cache of UMS, see USB_UMS_BOOT_CACHE_SZ.
+#define UMS_BOOT_CACHE_DRAM_ADDR  (UMS_TRACE_DRAM_ADDR - SZ_8M)
+#define UMS_BOOT_CACHE_DRAM_SZ    SZ_8M
+
 
 #if (IPL_HEAP_START + SZ_8K) > IPL_STACK_TOP
 #error payload too large
 #endif 
 
+// Chunks are written after a failed write reinits the card.
+#if (SDMMC_INIT_BUF_ADDR < CLONE_BUF_ADDR + CLONE_BUF_SZ) && (CLONE_BUF_ADDR < SDMMC_INIT_BUF_ADDR + 512)
+#error clone buffer overlaps sdmmc init scratch
+#endif
+
 /* --- XUSB EP context and TRB ring buffers --- */
 
 // #define SECMON_MIN_START  0x4002B000
@@ -69,8 +100,6 @@
 // /* --- Gap: 1040MB 0xA4000000 - 0xE4FFFFFF --- */
 
 // // Virtual disk / Chainloader buffers.
-// #define RAM_DISK_ADDR 0xA4000000
-// #define  RAM_DISK_SZ  0x41000000 // 1040MB.
 // #define  RAM_DISK2_SZ 0x21000000 //  528MB.
 
 // // NX BIS driver sector cache.
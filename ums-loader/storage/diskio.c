@@ -0,0 +1,98 @@
+/*-----------------------------------------------------------------------*/
+/* Low level disk I/O module skeleton for FatFs     (C)ChaN, 2016        */
+/*-----------------------------------------------------------------------*/
+/* If a working storage control module is available, it should be        */
+/* attached to the FatFs via a glue function rather than modifying it.   */
+/* This is an example of glue functions to attach various exsisting      */
+/* storage control modules to the FatFs module with a defined API.       */
+/*-----------------------------------------------------------------------*/
+
+#include <libs/fatfs/diskio.h>	/* FatFs lower layer API */
+#include <storage/sd.h>
+#include <storage/sdmmc.h>
+
+// Only the SD card is mounted. Bulk data of backups bypasses FatFs, see backup.c.
+
+/*-----------------------------------------------------------------------*/
+/* Get Drive Status                                                      */
+/*-----------------------------------------------------------------------*/
+DSTATUS disk_status (
+	BYTE pdrv		/* Physical drive number to identify the drive */
+)
+{
+	if (pdrv != DRIVE_SD)
+		return STA_NODISK;
+
+	return sd_storage.initialized ? 0 : STA_NOINIT;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Inidialize a Drive                                                    */
+/*-----------------------------------------------------------------------*/
+DSTATUS disk_initialize (
+	BYTE pdrv				/* Physical drive nmuber to identify the drive */
+)
+{
+	// sd_mount() brings the card up before mounting.
+	return disk_status(pdrv);
+}
+
+/*-----------------------------------------------------------------------*/
+/* Read Sector(s)                                                        */
+/*-----------------------------------------------------------------------*/
+DRESULT disk_read (
+	BYTE pdrv,		/* Physical drive number to identify the drive */
+	BYTE *buff,		/* Data buffer to store read data */
+	DWORD sector,	/* Start sector in LBA */
+	UINT count		/* Number of sectors to read */
+)
+{
+	if (pdrv != DRIVE_SD)
+		return RES_PARERR;
+
+	return sdmmc_storage_read(&sd_storage, sector, count, buff) ? RES_OK : RES_ERROR;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Write Sector(s)                                                       */
+/*-----------------------------------------------------------------------*/
+DRESULT disk_write (
+	BYTE pdrv,			/* Physical drive number to identify the drive */
+	const BYTE *buff,	/* Data to be written */
+	DWORD sector,		/* Start sector in LBA */
+	UINT count			/* Number of sectors to write */
+)
+{
+	if (pdrv != DRIVE_SD)
+		return RES_PARERR;
+
+	return sdmmc_storage_write(&sd_storage, sector, count, (void *)buff) ? RES_OK : RES_ERROR;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Miscellaneous Functions                                               */
+/*-----------------------------------------------------------------------*/
+DRESULT disk_ioctl (
+	BYTE pdrv,		/* Physical drive number (0..) */
+	BYTE cmd,		/* Control code */
+	void *buff		/* Buffer to send/receive control data */
+)
+{
+	DWORD *buf = (DWORD *)buff;
+
+	if (pdrv != DRIVE_SD)
+		return RES_PARERR;
+
+	switch (cmd)
+	{
+	case CTRL_SYNC: // Writes are not cached.
+		break;
+	case GET_SECTOR_COUNT:
+		*buf = sd_storage.sec_cnt;
+		break;
+	default:
+		return RES_PARERR;
+	}
+
+	return RES_OK;
+}